@@ -28,6 +28,8 @@
  * fpconv_* will around these issues with a translation buffer if required.
  */
 
+#define HEAP_TRACE_TAG HEAP_TAG_CJSON
+
 #include "c_stdio.h"
 #include "c_stdlib.h"
 // #include <assert.h>
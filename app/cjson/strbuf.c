@@ -22,6 +22,8 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#define HEAP_TRACE_TAG HEAP_TAG_CJSON
+
 #include "c_stdio.h"
 #include "c_stdlib.h"
 #include "c_stdarg.h"
@@ -45,6 +47,7 @@ int strbuf_init(strbuf_t *s, int len)
     s->dynamic = 0;
     s->reallocs = 0;
     s->debug = 0;
+    s->big = NULL;
 
     s->buf = (char *)c_malloc(size);
     if (!s->buf){
@@ -56,6 +59,26 @@ int strbuf_init(strbuf_t *s, int len)
 	return 0;
 }
 
+/* The memory of the string buffer is the block of a Lua buffer, which
+ * luaL_pushbigresult() turns into a string once the length is set:
+ *     luaL_addbigsize(big, strbuf_length(s) - big->n);
+ * Errors raised meanwhile leave the block to the Lua GC. */
+void strbuf_init_big(strbuf_t *s, luaL_BigBuffer *big)
+{
+    s->buf = NULL;
+    s->size = 0;
+    s->length = 0;
+    s->increment = STRBUF_DEFAULT_INCREMENT;
+    s->dynamic = 0;
+    s->reallocs = 0;
+    s->debug = 0;
+    s->big = big;
+
+    s->buf = luaL_prepbigbuffer(big, STRBUF_DEFAULT_SIZE - 1);
+    s->size = big->size + 1;
+    strbuf_ensure_null(s);
+}
+
 strbuf_t *strbuf_new(int len)
 {
     strbuf_t *s;
@@ -101,6 +124,8 @@ void strbuf_free(strbuf_t *s)
 {
     debug_stats(s);
 
+    if (s->big)
+        s->buf = NULL;      /* the Lua buffer frees it */
     if (s->buf) {
         c_free(s->buf);
         s->buf = NULL;
@@ -170,6 +195,17 @@ int strbuf_resize(strbuf_t *s, int len)
                 (long)s, s->size, newsize);
     }
 
+    if (s->big) {
+        /* The block has room for a NULL terminator after its size */
+        if (newsize <= s->size)
+            return 0;
+        s->big->n = s->length;
+        s->buf = luaL_prepbigbuffer(s->big, newsize - 1 - s->length) - s->length;
+        s->size = s->big->size + 1;
+        s->reallocs++;
+        return 0;
+    }
+
     s->buf = (char *)c_realloc(s->buf, newsize);
     if (!s->buf){
         NODE_ERR("not enough memory");
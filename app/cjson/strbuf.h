@@ -24,11 +24,13 @@
 
 #include "c_stdlib.h"
 #include "c_stdarg.h"
+#include "lauxlib.h"
 
 /* Size: Total bytes allocated to *buf
  * Length: String length, excluding optional NULL terminator.
  * Increment: Allocation increments when resizing the string buffer.
  * Dynamic: True if created via strbuf_new()
+ * Big: The Lua buffer holding *buf, when created via strbuf_init_big()
  */
 
 typedef struct {
@@ -39,6 +41,7 @@ typedef struct {
     int dynamic;
     int reallocs;
     int debug;
+    luaL_BigBuffer *big;
 } strbuf_t;
 
 #ifndef STRBUF_DEFAULT_SIZE
@@ -51,6 +54,7 @@ typedef struct {
 /* Initialise */
 extern strbuf_t *strbuf_new(int len);
 extern int strbuf_init(strbuf_t *s, int len);
+extern void strbuf_init_big(strbuf_t *s, luaL_BigBuffer *big);
 extern int strbuf_set_increment(strbuf_t *s, int increment);
 
 /* Release */
@@ -1,6 +1,7 @@
 #include "user_config.h"
 #include "c_stdio.h"
 #include "c_string.h"
+#include "c_stdlib.h"
 #include "coap.h"
 #include "uri.h"
 
@@ -421,6 +422,8 @@ int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint
     scratch->p[0] = ((uint16_t)content_type & 0xFF00) >> 8;
     scratch->p[1] = ((uint16_t)content_type & 0x00FF);
     pkt->opts[0].buf.len = 2;
+    scratch->p += 2;        // keep the option value when more options are added
+    scratch->len -= 2;
     pkt->payload.p = content;
     pkt->payload.len = content_len;
     return 0;
@@ -442,6 +445,50 @@ unsigned int coap_encode_var_bytes(unsigned char *buf, unsigned int val) {
   return n;
 }
 
+// adds option num with an uint value, keeping the options sorted
+int coap_add_option(coap_rw_buffer_t *scratch, coap_packet_t *pkt, uint8_t num, uint32_t value)
+{
+    int i, n;
+
+    if (pkt->numopts >= MAXOPT || scratch->len < sizeof(value))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    n = coap_encode_var_bytes(scratch->p, value);
+
+    for (i = pkt->numopts; i > 0 && pkt->opts[i - 1].num > num; i--)
+        pkt->opts[i] = pkt->opts[i - 1];
+    pkt->opts[i].num = num;
+    pkt->opts[i].buf.p = scratch->p;
+    pkt->opts[i].buf.len = n;
+    pkt->numopts++;
+
+    scratch->p += n;
+    scratch->len -= n;
+    return 0;
+}
+
+// 1 if pkt carries a valid Block1/Block2 option num
+int coap_get_block(const coap_packet_t *pkt, uint8_t num, coap_block_t *block)
+{
+    const coap_option_t *opt;
+    uint32_t value = 0;
+    uint8_t count;
+    size_t i;
+
+    if (NULL == (opt = coap_findOptions(pkt, num, &count)) || opt->buf.len > 3)
+        return 0;
+    for (i = 0; i < opt->buf.len; i++)
+        value = (value << 8) | opt->buf.p[i];
+    block->num = value >> 4;
+    block->m = (value >> 3) & 1;
+    block->szx = value & 7;
+    return block->szx < 7;      // 7 is reserved
+}
+
+int coap_add_block(coap_rw_buffer_t *scratch, coap_packet_t *pkt, uint8_t num, const coap_block_t *block)
+{
+    return coap_add_option(scratch, pkt, num, (block->num << 4) | (block->m ? 8 : 0) | block->szx);
+}
+
 static uint8_t _token_data[4] = {'n','o','d','e'};
 coap_buffer_t the_token = { _token_data, 4 };
 static unsigned short message_id;
@@ -467,8 +514,7 @@ int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, coap_msgtyp
     if (scratch->len < 2)   // TBD...
         return COAP_ERR_BUFFER_TOO_SMALL;
 
-    uint8_t *saved = scratch->p;
-
+    // options point into scratch, it is left past them so more can be added
     /* split arg into Uri-* options */
     // const char *addr = uri->host.s;
     // if(uri->host.length && (c_strlen(addr) != uri->host.length || c_memcmp(addr, uri->host.s, uri->host.length) != 0)){
@@ -501,45 +547,30 @@ int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, coap_msgtyp
 
     pkt->payload.p = payload;
     pkt->payload.len = payload_len;
-    scratch->p = saved;     // save back the pointer.
     return 0;
 }
 
-// FIXME, if this looked in the table at the path before the method then
-// it could more easily return 405 errors
 int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt)
 {
-    const coap_option_t *opt;
-    int i;
-    uint8_t count;
-    const coap_endpoint_t *ep = endpoints;
+    const coap_endpoint_t *ep;
+    coap_luser_entry *entry;
+    uint8_t methods;
 
-    while(NULL != ep->handler)
+    ep = endpoint_route(inpkt, &entry, &methods);
+    if (NULL != ep)
     {
-        if (ep->method != inpkt->hdr.code)
-            goto next;
-        if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
+        if (NULL != ep->user_entry)
         {
-            // if (count != ep->path->count)
-            if ((count != ep->path->count ) && (count != ep->path->count + 1)) // +1 for /f/[function], /v/[variable]
-                goto next;
-            for (i=0;i<ep->path->count;i++)
-            {
-                if (opt[i].buf.len != c_strlen(ep->path->elems[i]))
-                    goto next;
-                if (0 != c_memcmp(ep->path->elems[i], opt[i].buf.p, opt[i].buf.len))
-                    goto next;
-            }
-            // pre-path match!
-            if (count==ep->path->count+1 && ep->user_entry == NULL)
-                goto next;
-            return ep->handler(ep, scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
+            // /v1/v/[variable], /v1/f/[function]: hand over the matched one
+            coap_endpoint_t matched = *ep;
+            matched.user_entry = entry;
+            return ep->handler(&matched, scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
         }
-next:
-        ep++;
+        return ep->handler(ep, scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
     }
 
-    coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok,
+        methods ? COAP_RSPCODE_METHOD_NOT_ALLOWED : COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
 
     return 0;
 }
@@ -549,7 +580,7 @@ void coap_setup(void)
     message_id = (unsigned short)rand();      // calculate only once
 }
 
-inline int
+int
 check_token(coap_packet_t *pkt) {
   return pkt->tok.len == the_token.len && c_memcmp(pkt->tok.p, the_token.p, the_token.len) == 0;
 }
@@ -77,8 +77,12 @@ typedef enum
     COAP_OPTION_URI_QUERY = 15,
     COAP_OPTION_ACCEPT = 17,
     COAP_OPTION_LOCATION_QUERY = 20,
+    COAP_OPTION_BLOCK2 = 23,            /* http://tools.ietf.org/html/rfc7959#section-2.1 */
+    COAP_OPTION_BLOCK1 = 27,
+    COAP_OPTION_SIZE2 = 28,
     COAP_OPTION_PROXY_URI = 35,
-    COAP_OPTION_PROXY_SCHEME = 39
+    COAP_OPTION_PROXY_SCHEME = 39,
+    COAP_OPTION_SIZE1 = 60
 } coap_option_num_t;
 
 //http://tools.ietf.org/html/rfc7252#section-12.1.1
@@ -106,8 +110,13 @@ typedef enum
 {
     COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
     COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
+    COAP_RSPCODE_METHOD_NOT_ALLOWED = MAKE_RSPCODE(4, 5),
     COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
-    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4)
+    COAP_RSPCODE_BAD_OPTION = MAKE_RSPCODE(4, 2),
+    COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE = MAKE_RSPCODE(4, 8),
+    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE = MAKE_RSPCODE(4, 13),
+    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4),
+    COAP_RSPCODE_CONTINUE = MAKE_RSPCODE(2, 31)
 } coap_responsecode_t;
 
 //http://tools.ietf.org/html/rfc7252#section-12.3
@@ -136,6 +145,26 @@ typedef enum
     COAP_ERR_OPTION_DELTA_INVALID = 11,
 } coap_error_t;
 
+//http://tools.ietf.org/html/rfc7959#section-2.2
+typedef struct
+{
+    uint32_t num;               /* block number */
+    uint8_t m;                  /* more blocks follow */
+    uint8_t szx;                /* block size is 2^(szx + 4) */
+} coap_block_t;
+
+#define COAP_BLOCK_SIZE(szx) (1U << ((szx) + 4))
+#define COAP_BLOCK_OFFSET(b) ((b)->num << ((b)->szx + 4))
+
+/* largest block the server sends, has to fit MAX_PAYLOAD_SIZE */
+#ifndef COAP_BLOCK_SZX
+#define COAP_BLOCK_SZX 6
+#endif
+/* largest block the client sends, requests are built in MAX_REQUEST_SIZE */
+#ifndef COAP_BLOCK1_SZX
+#define COAP_BLOCK1_SZX 4
+#endif
+
 ///////////////////////
 typedef struct coap_endpoint_t coap_endpoint_t;
 
@@ -156,6 +185,8 @@ struct coap_luser_entry{
     // char name[MAX_SEGMENTS_SIZE+1];         // +1 for string '\0'
     const char *name;
     coap_luser_entry *next;
+    uint32_t block1_next;               /* offset of the next Block1 chunk of an upload */
+    int body_ref;                       /* response body still read in Block2 blocks */
 };
 
 struct coap_endpoint_t{
@@ -169,7 +200,8 @@ struct coap_endpoint_t{
                                          * provides a hint about the 
                                          * Content-Formats this resource returns." 
                                          * (Section 12.3. lists possible ct values.) */
-	coap_luser_entry *user_entry;
+	coap_luser_entry *user_entry;       /* head of the registered variables/functions, when
+	                                     * the handler runs: the one the request names */
 };
 
 
@@ -183,8 +215,15 @@ void coap_dump(const uint8_t *buf, size_t buflen, bool bare);
 int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type);
 int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt);
 void coap_option_nibble(uint32_t value, uint8_t *nibble);
+int coap_add_option(coap_rw_buffer_t *scratch, coap_packet_t *pkt, uint8_t num, uint32_t value);
+int coap_get_block(const coap_packet_t *pkt, uint8_t num, coap_block_t *block);
+int coap_add_block(coap_rw_buffer_t *scratch, coap_packet_t *pkt, uint8_t num, const coap_block_t *block);
 void coap_setup(void);
+int check_token(coap_packet_t *pkt);
 void endpoint_setup(void);
+const coap_endpoint_t *endpoint_route(const coap_packet_t *inpkt, coap_luser_entry **entry, uint8_t *methods);
+int endpoint_regist(coap_luser_entry *head, coap_luser_entry *h);
+void endpoint_invalidate(void);
 
 int coap_buildOptionHeader(uint32_t optDelta, size_t length, uint8_t *buf, size_t buflen);
 
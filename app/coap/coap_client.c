@@ -5,7 +5,7 @@
 #include "hash.h"
 #include "node.h"
 
-extern coap_queue_t *gQueue;
+extern coap_wheel_t gQueue;
 
 void coap_client_response_handler(char *data, unsigned short len, unsigned short size, const uint32_t ip, const uint32_t port)
 {
@@ -40,14 +40,9 @@ void coap_client_response_handler(char *data, unsigned short len, unsigned short
 
     coap_tid_t id = COAP_INVALID_TID;
     coap_transaction_id(ip, port, &pkt, &id);
-    /* transaction done, remove the node from queue */
-    // stop timer
-    coap_timer_stop();
-    // remove the node
+    /* transaction done, remove the node from queue, the wheel timer
+     * stops on its own once the queue is empty */
     coap_remove_node(&gQueue, id);
-    // calculate time elapsed
-    coap_timer_update(&gQueue);
-    coap_timer_start(&gQueue);
 
     if (COAP_RESPONSE_CLASS(pkt.hdr.code) == 2)
     {
@@ -63,7 +58,7 @@ void coap_client_response_handler(char *data, unsigned short len, unsigned short
   }
 
 end:
-  if(!gQueue){ // if there is no node pending in the queue, disconnect from host.
+  if(gQueue.count == 0){ // if there is no node pending in the queue, disconnect from host.
 
   }
 }
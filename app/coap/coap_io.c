@@ -1,10 +1,13 @@
+#define HEAP_TRACE_TAG HEAP_TAG_COAP
+
 #include "c_string.h"
+#include "c_stdlib.h"
 #include "coap_io.h"
 #include "node.h"
 #include "espconn.h"
 #include "coap_timer.h"
 
-extern coap_queue_t *gQueue;
+extern coap_wheel_t gQueue;
 
 /* releases space allocated by PDU if free_pdu is set */
 coap_tid_t coap_send(struct espconn *pesp_conn, coap_pdu_t *pdu) {
@@ -28,7 +31,6 @@ coap_tid_t coap_send(struct espconn *pesp_conn, coap_pdu_t *pdu) {
 
 coap_tid_t coap_send_confirmed(struct espconn *pesp_conn, coap_pdu_t *pdu) {
   coap_queue_t *node;
-  coap_tick_t diff;
   uint32_t r;
 
   node = coap_new_node();
@@ -54,17 +56,11 @@ coap_tid_t coap_send_confirmed(struct espconn *pesp_conn, coap_pdu_t *pdu) {
   node->pconn = pesp_conn;
   node->pdu = pdu;
 
-  /* Set timer for pdu retransmission. If this is the first element in
-   * the retransmission queue, the base time is set to the current
-   * time and the retransmission time is node->timeout. If there is
-   * already an entry in the sendqueue, we must check if this node is
-   * to be retransmitted earlier. Therefore, node->timeout is first
-   * normalized to the timeout and then inserted into the queue with
-   * an adjusted relative time.
+  /* Set timer for pdu retransmission. The node goes into the wheel
+   * slot node->timeout from now, the wheel timer only needs starting
+   * when this is the first outstanding node.
    */
-  coap_timer_stop();
-  coap_timer_update(&gQueue);
-  node->t = node->timeout;  
+  node->t = node->timeout + coap_timer_lag();
   coap_insert_node(&gQueue, node);
   coap_timer_start(&gQueue);
   return node->id;
@@ -1,3 +1,5 @@
+#define HEAP_TRACE_TAG HEAP_TAG_COAP
+
 #include "user_config.h"
 #include "c_types.h"
 #include "c_stdlib.h"
@@ -11,7 +13,7 @@ size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned
   coap_packet_t pkt;
   pkt.content.p = NULL;
   pkt.content.len = 0;
-  uint8_t scratch_raw[4];
+  uint8_t scratch_raw[16];    // Content-Format, Block2 and Block1 values
   coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
   int rc;
 
@@ -1,9 +1,12 @@
 #include "node.h"
 #include "coap_timer.h"
+#include "coap_io.h"
 #include "os_type.h"
+#include "user_interface.h"
 
 static os_timer_t coap_timer;
 static coap_tick_t basetime = 0;
+static bool coap_timer_armed = false;
 
 void coap_timer_elapsed(coap_tick_t *diff){
   coap_tick_t now = system_get_time() / 1000;   // coap_tick_t is in ms. also sys_timer
@@ -15,14 +18,7 @@ void coap_timer_elapsed(coap_tick_t *diff){
   basetime = now;
 }
 
-void coap_timer_tick(void *arg){
-  if( !arg )
-    return;
-  coap_queue_t **queue = (coap_queue_t **)arg;
-  if( !(*queue) )
-    return;
-
-  coap_queue_t *node = coap_pop_next( queue );
+static void coap_timer_expire(coap_wheel_t *wheel, coap_queue_t *node){
   /* re-initialize timeout when maximum number of retransmissions are not reached yet */
   if (node->retransmit_cnt < COAP_DEFAULT_MAX_RETRANSMIT) {
     node->retransmit_cnt++;
@@ -30,49 +26,75 @@ void coap_timer_tick(void *arg){
 
     NODE_DBG("** retransmission #%d of transaction %d\n", 
         node->retransmit_cnt, (((uint16_t)(node->pdu->pkt->hdr.id[0]))<<8)+node->pdu->pkt->hdr.id[1]);
-    node->id = coap_send(node->pconn, node->pdu);
-    if (COAP_INVALID_TID == node->id) {
-      NODE_DBG("retransmission: error sending pdu\n");
-      coap_delete_node(node);
-    } else {
-      coap_insert_node(queue, node);    
+    if (COAP_INVALID_TID != coap_send(node->pconn, node->pdu)) {
+      coap_insert_node(wheel, node);
+      return;
     }
-  } else {
-    /* And finally delete the node */
-    coap_delete_node( node );
+    NODE_DBG("retransmission: error sending pdu\n");
   }
+  /* And finally give up on the node */
+  if (wheel->expired)
+    wheel->expired(node);
+  coap_delete_node( node );
+}
 
-  coap_timer_start(queue);
+void coap_timer_tick(void *arg){
+  coap_wheel_t *wheel = (coap_wheel_t *)arg;
+  coap_queue_t *node, *next, *expired;
+  coap_tick_t now, diff;
+  unsigned int ticks;
+  if( !wheel )
+    return;
+
+  // basetime is the time of the last tick the wheel took. It takes one for
+  // every COAP_WHEEL_TICK that has passed since: more when the os timer
+  // fired late, none when it fired early, so no slot goes before its time.
+  now = basetime;
+  coap_timer_elapsed(&diff);
+  ticks = diff / COAP_WHEEL_TICK;
+  basetime = now + ticks * COAP_WHEEL_TICK;
+  if (basetime >= SYS_TIME_MAX)
+    basetime -= SYS_TIME_MAX;
+
+  // the wheel is brought up to now before anything expired goes back in,
+  // a node put in behind the cursor would be early by the ticks still due
+  expired = NULL;
+  while (ticks-- && wheel->count) {
+    for (node = coap_wheel_advance(wheel); node; node = next) {
+      next = node->next;
+      node->next = expired;
+      expired = node;
+    }
+  }
+  for (node = expired; node; node = next) {
+    next = node->next;
+    node->next = NULL;
+    coap_timer_expire(wheel, node);
+  }
+
+  if (wheel->count == 0)
+    coap_timer_stop();
 }
 
-void coap_timer_setup(coap_queue_t ** queue, coap_tick_t t){
-  os_timer_disarm(&coap_timer);
-  os_timer_setfn(&coap_timer, (os_timer_func_t *)coap_timer_tick, queue);
-  os_timer_arm(&coap_timer, t, 0);   // no repeat
+coap_tick_t coap_timer_lag(void){
+  coap_tick_t now = system_get_time() / 1000;
+  if (!coap_timer_armed)
+    return 0;
+  return now >= basetime ? now - basetime : now + SYS_TIME_MAX - basetime;
 }
 
 void coap_timer_stop(void){
   os_timer_disarm(&coap_timer);
+  coap_timer_armed = false;
 }
 
-void coap_timer_update(coap_queue_t ** queue){
-  if (!queue)
+void coap_timer_start(coap_wheel_t *wheel){
+  coap_tick_t diff;
+  if (!wheel || wheel->count == 0 || coap_timer_armed)
     return;
-  coap_tick_t diff = 0;
-  coap_queue_t *first = *queue;
-  coap_timer_elapsed(&diff); // update: basetime = now, diff = now - oldbase, means time elapsed
-  if (first) {
-    // diff ms time is elapsed, re-calculate the first node->t
-    if (first->t >= diff){
-      first->t -= diff;
-    } else {
-      first->t = 0;  // when timer enabled, time out almost immediately
-    }
-  }
-}
-
-void coap_timer_start(coap_queue_t ** queue){
-  if(*queue){ // if there is node in the queue, set timeout to its ->t.
-    coap_timer_setup(queue, (*queue)->t);
-  }
+  coap_timer_elapsed(&diff);    // basetime = now
+  os_timer_disarm(&coap_timer);
+  os_timer_setfn(&coap_timer, (os_timer_func_t *)coap_timer_tick, wheel);
+  os_timer_arm(&coap_timer, COAP_WHEEL_TICK, 1);
+  coap_timer_armed = true;
 }
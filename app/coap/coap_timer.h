@@ -16,13 +16,14 @@ extern "C" {
 
 void coap_timer_elapsed(coap_tick_t *diff);
 
-void coap_timer_setup(coap_queue_t ** queue, coap_tick_t t);
-
 void coap_timer_stop(void);
 
-void coap_timer_update(coap_queue_t ** queue);
+/** ms since the wheel's last tick. A node put in while the os timer is late
+ * has to wait that much longer, the ticks the wheel is behind go at once. */
+coap_tick_t coap_timer_lag(void);
 
-void coap_timer_start(coap_queue_t ** queue);
+/** Starts ticking the wheel if it has nodes and is not ticking yet. */
+void coap_timer_start(coap_wheel_t *wheel);
 
 #ifdef __cplusplus
 }
@@ -1,3 +1,5 @@
+#define HEAP_TRACE_TAG HEAP_TAG_COAP
+
 #include "c_stdio.h"
 #include "c_string.h"
 #include "c_stdlib.h"
@@ -8,25 +10,148 @@
 #include "lualib.h"
 
 #include "os_type.h"
+#include "user_interface.h"
 
-void build_well_known_rsp(char *rsp, uint16_t rsplen);
+size_t build_well_known_rsp(char *rsp, size_t rsplen);
 
-void endpoint_setup(void)
+/* /.well-known/core payload, built on the first request after a change
+ * and sent in blocks when it is larger than one */
+static char *wkc_rsp = NULL;
+static size_t wkc_len = 0;
+
+void endpoint_invalidate(void)
 {
-    coap_setup();
+    if (wkc_rsp) {
+        c_free(wkc_rsp);
+        wkc_rsp = NULL;
+        wkc_len = 0;
+    }
+}
+
+/* the Block2 the request asks for, in blocks no larger than we send.
+ * 0 if the request has none, b is then the first block. */
+static int block2_requested(const coap_packet_t *inpkt, coap_block_t *b)
+{
+    if (!coap_get_block(inpkt, COAP_OPTION_BLOCK2, b)) {
+        b->num = 0;
+        b->m = 0;
+        b->szx = COAP_BLOCK_SZX;
+        return 0;
+    }
+    if (b->szx > COAP_BLOCK_SZX) {      // same offset in smaller blocks
+        b->num <<= b->szx - COAP_BLOCK_SZX;
+        b->szx = COAP_BLOCK_SZX;
+    }
+    b->m = 0;
+    return 1;
+}
+
+/* the part of a len bytes body block b covers, sets b->m if more follows.
+ * NULL if b starts past the end of the body. */
+static const uint8_t *block_slice(const uint8_t *body, size_t len, coap_block_t *b, size_t *n)
+{
+    size_t off = COAP_BLOCK_OFFSET(b), size = COAP_BLOCK_SIZE(b->szx);
+
+    if (off > len || (off == len && off > 0))
+        return NULL;
+    *n = len - off < size ? len - off : size;
+    b->m = off + *n < len;
+    return body + off;
+}
+
+/* responds with chunk, as block b2 if blockwise is set. copy chunk to
+ * outpkt->content when it may go away before the response is built. */
+static int block_respond(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
+    const uint8_t *chunk, size_t n, int copy, coap_content_type_t ct, const coap_block_t *b2, int blockwise, const coap_block_t *b1)
+{
+    int rc;
+
+    if (copy && n > 0) {
+        outpkt->content.p = (uint8_t *)c_zalloc(n);
+        if (NULL == outpkt->content.p) {
+            NODE_DBG("not enough memory\n");
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        c_memcpy(outpkt->content.p, chunk, n);
+        outpkt->content.len = n;
+        chunk = outpkt->content.p;
+    }
+    rc = coap_make_response(scratch, outpkt, chunk, n, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, ct);
+    if (0 == rc && blockwise)
+        rc = coap_add_block(scratch, outpkt, COAP_OPTION_BLOCK2, b2);
+    if (0 == rc && b1)
+        rc = coap_add_block(scratch, outpkt, COAP_OPTION_BLOCK1, b1);
+    return rc;
+}
+
+/* Responds with the block of the body at idx the request asks for. A
+ * string body is sliced, a function is a reader called as f(offset, size)
+ * that returns the next chunk and optionally whether more follows. *more
+ * is set if the client has blocks left to ask for. */
+static int body_respond(lua_State *L, int idx, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt,
+    uint8_t id_hi, uint8_t id_lo, const coap_block_t *b1, int *more)
+{
+    coap_block_t b2;
+    int asked = block2_requested(inpkt, &b2);
+    const uint8_t *chunk;
+    size_t len = 0, n = 0;
+    int rc;
+
+    if (lua_type(L, idx) == LUA_TFUNCTION) {
+        size_t size = COAP_BLOCK_SIZE(b2.szx);
+        lua_pushvalue(L, idx);
+        lua_pushinteger(L, COAP_BLOCK_OFFSET(&b2));
+        lua_pushinteger(L, size);
+        lua_call(L, 2, 2);
+        chunk = (const uint8_t *)lua_tolstring(L, -2, &n);
+        b2.m = lua_isboolean(L, -1) ? lua_toboolean(L, -1) : n >= size;
+        if (n > size)
+            n = size;
+    } else {
+        const uint8_t *body = (const uint8_t *)lua_tolstring(L, idx, &len);
+        if (NULL == (chunk = block_slice(body, len, &b2, &n)))
+            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_OPTION, COAP_CONTENTTYPE_NONE);
+    }
+    *more = b2.m;
+    rc = block_respond(scratch, inpkt, outpkt, id_hi, id_lo, chunk, n, 1, COAP_CONTENTTYPE_TEXT_PLAIN, &b2, asked || b2.m, b1);
+    lua_settop(L, idx);
+    return rc;
+}
+
+/* drops a function response that was not read to the end */
+static void body_release(coap_luser_entry *h)
+{
+    if (LUA_NOREF != h->body_ref) {
+        luaL_unref(h->L, LUA_REGISTRYINDEX, h->body_ref);
+        h->body_ref = LUA_NOREF;
+    }
 }
 
 static const coap_endpoint_path_t path_well_known_core = {2, {".well-known", "core"}};
 static int handle_get_well_known_core(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
-    outpkt->content.p = (uint8_t *)c_zalloc(MAX_PAYLOAD_SIZE);      // this should be free-ed when outpkt is built in coap_server_respond()
-    if(outpkt->content.p == NULL){
-        NODE_DBG("not enough memory\n");
-        return COAP_ERR_BUFFER_TOO_SMALL;
+    coap_block_t b2;
+    const uint8_t *chunk;
+    size_t n;
+    int asked;
+
+#ifdef COAP_NO_TRIE
+    endpoint_invalidate();      // built for each request, as before
+#endif
+    if (NULL == wkc_rsp) {
+        size_t len = build_well_known_rsp(NULL, 0);     // measured first
+        wkc_rsp = (char *)c_zalloc(len + 1);
+        if(wkc_rsp == NULL){
+            NODE_DBG("not enough memory\n");
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        wkc_len = build_well_known_rsp(wkc_rsp, len + 1);
     }
-    outpkt->content.len = MAX_PAYLOAD_SIZE;
-    build_well_known_rsp(outpkt->content.p, outpkt->content.len);
-    return coap_make_response(scratch, outpkt, (const uint8_t *)outpkt->content.p, c_strlen(outpkt->content.p), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
+    asked = block2_requested(inpkt, &b2);
+    if (NULL == (chunk = block_slice((const uint8_t *)wkc_rsp, wkc_len, &b2, &n)))
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_OPTION, COAP_CONTENTTYPE_NONE);
+    // outpkt->content stays NULL, the cached payload is not free-ed in coap_server_respond()
+    return block_respond(scratch, inpkt, outpkt, id_hi, id_lo, chunk, n, 0, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT, &b2, asked || b2.m, NULL);
 }
 
 static const coap_endpoint_path_t path_variable = {2, {"v1", "v"}};
@@ -34,7 +159,7 @@ static int handle_get_variable(const coap_endpoint_t *ep, coap_rw_buffer_t *scra
 {
     const coap_option_t *opt;
     uint8_t count;
-    int n;
+    int n, rc, more;
     if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
     {
         if ((count != ep->path->count ) && (count != ep->path->count + 1)) // +1 for /f/[function], /v/[variable]
@@ -44,36 +169,26 @@ static int handle_get_variable(const coap_endpoint_t *ep, coap_rw_buffer_t *scra
         }
         if (count == ep->path->count + 1)
         {
-            coap_luser_entry *h = ep->user_entry->next;     // ->next: skip the first entry(head)
-            while(NULL != h){
-                if (opt[count-1].buf.len != c_strlen(h->name))
+            coap_luser_entry *h = ep->user_entry;     // the variable coap_handle_req matched, if any
+            if(NULL != h){
+                NODE_DBG("/v1/v/");
+                NODE_DBG((char *)h->name);
+                NODE_DBG(" match.\n");
+                if(h->L == NULL)
+                    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+                if(c_strlen(h->name))
                 {
-                    h = h->next;
-                    continue;
-                }
-                if (0 == c_memcmp(h->name, opt[count-1].buf.p, opt[count-1].buf.len))
-                {
-                    NODE_DBG("/v1/v/");
-                    NODE_DBG((char *)h->name);
-                    NODE_DBG(" match.\n");
-                    if(h->L == NULL)
+                    n = lua_gettop(h->L);
+                    lua_getglobal(h->L, h->name);
+                    if (!lua_isstring(h->L, -1) && lua_type(h->L, -1) != LUA_TFUNCTION) {
+                        NODE_DBG ("should be a number, string or function.\n");
+                        lua_settop(h->L, n);
                         return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-                    if(c_strlen(h->name))
-                    {
-                        n = lua_gettop(h->L);
-                        lua_getglobal(h->L, h->name);
-                        if (!lua_isnumber(h->L, -1)) {
-                            NODE_DBG ("should be a number.\n");
-                            lua_settop(h->L, n);
-                            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-                        } else {
-                            const char *res = lua_tostring(h->L,-1);
-                            lua_settop(h->L, n);
-                            return coap_make_response(scratch, outpkt, (const uint8_t *)res, c_strlen(res), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
-                        }
                     }
-                } else {
-                    h = h->next;
+                    // re-read for every block, a large string needs no state between requests
+                    rc = body_respond(h->L, n + 1, scratch, inpkt, outpkt, id_hi, id_lo, NULL, &more);
+                    lua_settop(h->L, n);
+                    return rc;
                 }
             }
         }else{
@@ -91,7 +206,7 @@ static int handle_post_function(const coap_endpoint_t *ep, coap_rw_buffer_t *scr
 {
     const coap_option_t *opt;
     uint8_t count;
-    int n;
+    int n, rc, more;
     if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
     {
         if ((count != ep->path->count ) && (count != ep->path->count + 1)) // +1 for /f/[function], /v/[variable]
@@ -101,57 +216,78 @@ static int handle_post_function(const coap_endpoint_t *ep, coap_rw_buffer_t *scr
         }
         if (count == ep->path->count + 1)
         {
-            coap_luser_entry *h = ep->user_entry->next;     // ->next: skip the first entry(head)
-            while(NULL != h){
-                if (opt[count-1].buf.len != c_strlen(h->name))
+            coap_luser_entry *h = ep->user_entry;     // the function coap_handle_req matched, if any
+            if(NULL != h){
+                coap_block_t b1, b2;
+                int blockwise;
+                uint32_t offset = 0;
+
+                NODE_DBG("/v1/f/");
+                NODE_DBG((char *)h->name);
+                NODE_DBG(" match.\n");
+
+                if(h->L == NULL)
+                    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+
+                n = lua_gettop(h->L);
+                blockwise = coap_get_block(inpkt, COAP_OPTION_BLOCK1, &b1);
+                if (!blockwise && block2_requested(inpkt, &b2) && b2.num > 0)
                 {
-                    h = h->next;
-                    continue;
+                    // the client reads on in a response that did not fit one block
+                    if (LUA_NOREF == h->body_ref)
+                        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE, COAP_CONTENTTYPE_NONE);
+                    lua_rawgeti(h->L, LUA_REGISTRYINDEX, h->body_ref);
+                    rc = body_respond(h->L, n + 1, scratch, inpkt, outpkt, id_hi, id_lo, NULL, &more);
+                    lua_settop(h->L, n);
+                    if (!more)
+                        body_release(h);
+                    return rc;
                 }
-                if (0 == c_memcmp(h->name, opt[count-1].buf.p, opt[count-1].buf.len))
+                body_release(h);
+
+                if (blockwise)
                 {
-                    NODE_DBG("/v1/f/");
-                    NODE_DBG((char *)h->name);
-                    NODE_DBG(" match.\n");
+                    // chunks of an upload are passed on as they come in, in order
+                    offset = COAP_BLOCK_OFFSET(&b1);
+                    if (offset != 0 && offset != h->block1_next)
+                        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE, COAP_CONTENTTYPE_NONE);
+                    if (b1.m && inpkt->payload.len != COAP_BLOCK_SIZE(b1.szx))
+                        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_NONE);
+                    h->block1_next = b1.m ? offset + inpkt->payload.len : 0;
+                }
 
-                    if(h->L == NULL)
-                        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+                lua_getglobal(h->L, h->name);
+                if (lua_type(h->L, -1) != LUA_TFUNCTION) {
+                    NODE_DBG ("should be a function\n");
+                    lua_settop(h->L, n);
+                    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+                }
+                lua_pushlstring(h->L, inpkt->payload.p, inpkt->payload.len);     // make sure payload.p is filled with '\0' after payload.len, or use lua_pushlstring
+                lua_pushinteger(h->L, offset);
+                lua_pushboolean(h->L, blockwise && b1.m);
+                lua_call(h->L, 3, 1);
 
-                    if(c_strlen(h->name))
-                    {
-                        n = lua_gettop(h->L);
-                        lua_getglobal(h->L, h->name);
-                        if (lua_type(h->L, -1) != LUA_TFUNCTION) {
-                            NODE_DBG ("should be a function\n");
-                            lua_settop(h->L, n);
-                            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-                        } else {
-                            lua_pushlstring(h->L, inpkt->payload.p, inpkt->payload.len);     // make sure payload.p is filled with '\0' after payload.len, or use lua_pushlstring
-                            lua_call(h->L, 1, 1);
-                            if (!lua_isnil(h->L, -1)){  /* get return? */
-                                if( lua_isstring(h->L, -1) )   // deal with the return string
-                                {
-                                    size_t len = 0;
-                                    const char *ret = luaL_checklstring( h->L, -1, &len );
-                                    if(len > MAX_PAYLOAD_SIZE){
-                                        lua_settop(h->L, n);
-                                        luaL_error( h->L, "return string:<MAX_PAYLOAD_SIZE" );
-                                        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-                                    }
-                                    NODE_DBG((char *)ret);
-                                    NODE_DBG("\n");
-                                    lua_settop(h->L, n);
-                                    return coap_make_response(scratch, outpkt, ret, len, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
-                                } 
-                            } else {
-                                lua_settop(h->L, n);
-                                return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
-                            }
-                        }
+                if (blockwise && b1.m) {
+                    lua_settop(h->L, n);
+                    rc = coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTINUE, COAP_CONTENTTYPE_NONE);
+                    if (0 == rc)
+                        rc = coap_add_block(scratch, outpkt, COAP_OPTION_BLOCK1, &b1);
+                    return rc;
+                }
+                if (lua_isnil(h->L, -1)) {
+                    lua_settop(h->L, n);
+                    return block_respond(scratch, inpkt, outpkt, id_hi, id_lo, NULL, 0, 0, COAP_CONTENTTYPE_TEXT_PLAIN, NULL, 0, blockwise ? &b1 : NULL);
+                }
+                if (lua_isstring(h->L, -1) || lua_type(h->L, -1) == LUA_TFUNCTION) {
+                    rc = body_respond(h->L, n + 1, scratch, inpkt, outpkt, id_hi, id_lo, blockwise ? &b1 : NULL, &more);
+                    if (more) {     // keep it for the client to read the rest
+                        lua_pushvalue(h->L, n + 1);
+                        h->body_ref = luaL_ref(h->L, LUA_REGISTRYINDEX);
                     }
-                } else {
-                    h = h->next;
+                    lua_settop(h->L, n);
+                    return rc;
                 }
+                lua_settop(h->L, n);
             }
         }else{
             NODE_DBG("/v1/f match.\n");
@@ -169,27 +305,24 @@ extern void dojob(lua_Load *load);
 static const coap_endpoint_path_t path_command = {2, {"v1", "c"}};
 static int handle_post_command(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
+    lua_Load *load = &gLoad;
     if (inpkt->payload.len == 0)
         return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
-    if (inpkt->payload.len > 0)
-    {
-        lua_Load *load = &gLoad;
-        if(load->line_position == 0){
-            coap_buffer_to_string(load->line, load->len,&inpkt->payload);
-            load->line_position = c_strlen(load->line)+1;
-            // load->line[load->line_position-1] = '\n';
-            // load->line[load->line_position] = 0;
-            // load->line_position++;
-            load->done = 1;
-            NODE_DBG("Get command:\n");
-            NODE_DBG(load->line); // buggy here
-            NODE_DBG("\nResult(if any):\n");
-            os_timer_disarm(&lua_timer);
-            os_timer_setfn(&lua_timer, (os_timer_func_t *)dojob, load);
-            os_timer_arm(&lua_timer, READLINE_INTERVAL, 0);   // no repeat
-        }
-        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
+    if(load->line_position == 0){
+        coap_buffer_to_string(load->line, load->len,&inpkt->payload);
+        load->line_position = c_strlen(load->line)+1;
+        // load->line[load->line_position-1] = '\n';
+        // load->line[load->line_position] = 0;
+        // load->line_position++;
+        load->done = 1;
+        NODE_DBG("Get command:\n");
+        NODE_DBG(load->line); // buggy here
+        NODE_DBG("\nResult(if any):\n");
+        os_timer_disarm(&lua_timer);
+        os_timer_setfn(&lua_timer, (os_timer_func_t *)dojob, load);
+        os_timer_arm(&lua_timer, READLINE_INTERVAL, 0);   // no repeat
     }
+    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
 static uint32_t id = 0;
@@ -200,10 +333,10 @@ static int handle_get_id(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, c
     return coap_make_response(scratch, outpkt, (const uint8_t *)(&id), sizeof(uint32_t), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
-coap_luser_entry var_head = {NULL,NULL,NULL};
+coap_luser_entry var_head = {NULL,NULL,NULL,0,LUA_NOREF};
 coap_luser_entry *variable_entry = &var_head;
 
-coap_luser_entry func_head = {NULL,NULL,NULL};
+coap_luser_entry func_head = {NULL,NULL,NULL,0,LUA_NOREF};
 coap_luser_entry *function_entry = &func_head;
 
 const coap_endpoint_t endpoints[] =
@@ -216,15 +349,54 @@ const coap_endpoint_t endpoints[] =
     {(coap_method_t)0, NULL, NULL, NULL, NULL}
 };
 
-void build_well_known_rsp(char *rsp, uint16_t rsplen)
+/* appends s to rsp, 0 if it doesn't fit. With rsp NULL only counts it. */
+static int wkc_put(char *rsp, size_t *pos, size_t rsplen, const char *s)
 {
-    const coap_endpoint_t *ep = endpoints;
+    size_t l = c_strlen(s);
+    if (NULL == rsp) {
+        *pos += l;
+        return 1;
+    }
+    if (*pos + l >= rsplen)     // keep room for the '\0'
+        return 0;
+    c_memcpy(rsp + *pos, s, l);
+    *pos += l;
+    return 1;
+}
+
+/* appends the link <path[/name]>;attr to rsp, only if it fits as a whole */
+static int wkc_link(char *rsp, size_t *pos, size_t rsplen, const coap_endpoint_t *ep, const char *name)
+{
+    size_t start = *pos;
     int i;
-    uint16_t len = rsplen;
 
-    c_memset(rsp, 0, len);
+    if ((start > 0 && !wkc_put(rsp, pos, rsplen, ",")) || !wkc_put(rsp, pos, rsplen, "<"))
+        goto full;
+    for (i = 0; i < ep->path->count; i++) {
+        if (!wkc_put(rsp, pos, rsplen, "/") || !wkc_put(rsp, pos, rsplen, ep->path->elems[i]))
+            goto full;
+    }
+    if (name && (!wkc_put(rsp, pos, rsplen, "/") || !wkc_put(rsp, pos, rsplen, name)))
+        goto full;
+    if (!wkc_put(rsp, pos, rsplen, ">;") || !wkc_put(rsp, pos, rsplen, ep->core_attr))
+        goto full;
+    return 1;
+full:
+    *pos = start;
+    rsp[start] = 0;
+    return 0;
+}
+
+/* the links of the endpoints and of the names registered from Lua, as many
+ * as fit in rsplen. Returns the length of the payload; with rsp NULL, that
+ * of the whole list, to size rsp by. */
+size_t build_well_known_rsp(char *rsp, size_t rsplen)
+{
+    const coap_endpoint_t *ep = endpoints;
+    size_t pos = 0;
 
-    len--; // Null-terminated string
+    if (rsp)
+        c_memset(rsp, 0, rsplen);
 
     while(NULL != ep->handler)
     {
@@ -233,62 +405,230 @@ void build_well_known_rsp(char *rsp, uint16_t rsplen)
             continue;
         }
         if (NULL == ep->user_entry){
-            if (0 < c_strlen(rsp)) {
-                c_strncat(rsp, ",", len);
-                len--;
+            if (!wkc_link(rsp, &pos, rsplen, ep, NULL))
+                return pos;
+        } else {
+            coap_luser_entry *h = ep->user_entry->next;     // ->next: skip the first entry(head)
+            while(NULL != h){
+                if (!wkc_link(rsp, &pos, rsplen, ep, h->name))
+                    return pos;
+                h = h->next;
             }
-        
-            c_strncat(rsp, "<", len);
-            len--;
+        }
+        ep++;
+    }
+    return pos;
+}
 
-            for (i = 0; i < ep->path->count; i++) {
-                c_strncat(rsp, "/", len);
-                len--;
+#ifdef COAP_NO_TRIE
+/* The walk of the endpoints and of the names registered from Lua that the
+ * trie below replaced, for the host build to compare. A name nobody
+ * registered still goes to the handler of its endpoint. */
+static int path_match(const coap_endpoint_t *ep, const coap_option_t *opt, uint8_t count, coap_luser_entry **entry)
+{
+    coap_luser_entry *h;
+    int i;
 
-                c_strncat(rsp, ep->path->elems[i], len);
-                len -= c_strlen(ep->path->elems[i]);
-            }
+    if ((count != ep->path->count) && (count != ep->path->count + 1))
+        return 0;
+    for (i = 0; i < ep->path->count; i++)
+        if (opt[i].buf.len != c_strlen(ep->path->elems[i]) ||
+            0 != c_memcmp(ep->path->elems[i], opt[i].buf.p, opt[i].buf.len))
+            return 0;
+    *entry = NULL;
+    if (count == ep->path->count)
+        return 1;
+    if (NULL == ep->user_entry)
+        return 0;
+    for (h = ep->user_entry->next; NULL != h; h = h->next)
+        if (opt[i].buf.len == c_strlen(h->name) && 0 == c_memcmp(h->name, opt[i].buf.p, opt[i].buf.len)) {
+            *entry = h;
+            break;
+        }
+    return 1;
+}
 
-            c_strncat(rsp, ">;", len);
-            len -= 2;
+const coap_endpoint_t *endpoint_route(const coap_packet_t *inpkt, coap_luser_entry **entry, uint8_t *methods)
+{
+    const coap_endpoint_t *ep;
+    const coap_option_t *opt;
+    coap_luser_entry *e;
+    uint8_t count;
 
-            c_strncat(rsp, ep->core_attr, len);
-            len -= c_strlen(ep->core_attr);
-        } else {
-            coap_luser_entry *h = ep->user_entry->next;     // ->next: skip the first entry(head)
-            while(NULL != h){
-                if (0 < c_strlen(rsp)) {
-                    c_strncat(rsp, ",", len);
-                    len--;
-                }
-            
-                c_strncat(rsp, "<", len);
-                len--;
+    *entry = NULL;
+    *methods = 0;
+    if (NULL == (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
+        return NULL;
+    for (ep = endpoints; NULL != ep->handler; ep++) {
+        if (!path_match(ep, opt, count, &e))
+            continue;
+        *methods |= 1 << (ep->method - 1);
+        if (ep->method == inpkt->hdr.code) {
+            *entry = e;
+            return ep;
+        }
+    }
+    return NULL;
+}
 
-                for (i = 0; i < ep->path->count; i++) {
-                    c_strncat(rsp, "/", len);
-                    len--;
+int endpoint_regist(coap_luser_entry *head, coap_luser_entry *h)
+{
+    endpoint_invalidate();
+    return 1;
+}
 
-                    c_strncat(rsp, ep->path->elems[i], len);
-                    len -= c_strlen(ep->path->elems[i]);
-                }
+void endpoint_setup(void)
+{
+}
+#else
+/* Requests are routed through a trie of path segments built from the
+ * endpoints above and the names registered from Lua. Children are kept
+ * sorted by length, then bytes, and binary searched, so /v1/v/<name>
+ * stays cheap with hundreds of registered variables. COAP_NO_TRIE walks
+ * them instead, and builds /.well-known/core for each request. */
+typedef struct coap_route_t coap_route_t;
+struct coap_route_t {
+    const char *seg;
+    uint16_t len;
+    uint16_t nchild;
+    uint16_t size;                      /* slots allocated in child */
+    uint8_t methods;                    /* bit (method - 1) set if ep[method - 1] handles this path */
+    coap_route_t **child;
+    const coap_endpoint_t *ep[COAP_METHOD_DELETE];
+    coap_luser_entry *entry;            /* variable/function registered at this path */
+};
 
-                c_strncat(rsp, "/", len);
-                len--;
+static coap_route_t route_root;
 
-                c_strncat(rsp, h->name, len);
-                len -= c_strlen(h->name);
+static int route_cmp(const coap_route_t *r, const uint8_t *seg, size_t len)
+{
+    if (r->len != len)
+        return r->len < len ? -1 : 1;
+    return c_memcmp(r->seg, seg, len);
+}
 
-                c_strncat(rsp, ">;", len);
-                len -= 2;
+/* index of the child named seg, or -(index to insert it at) - 1 */
+static int route_search(const coap_route_t *node, const uint8_t *seg, size_t len)
+{
+    int lo = 0, hi = node->nchild - 1, mid, c;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        c = route_cmp(node->child[mid], seg, len);
+        if (c == 0)
+            return mid;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -lo - 1;
+}
 
-                c_strncat(rsp, ep->core_attr, len);
-                len -= c_strlen(ep->core_attr);  
+static coap_route_t *route_child(coap_route_t *node, const char *seg)
+{
+    size_t len = c_strlen(seg);
+    int i = route_search(node, (const uint8_t *)seg, len);
+    coap_route_t *r, **child;
 
-                h = h->next;
-            }
+    if (i >= 0)
+        return node->child[i];
+    i = -i - 1;
+
+    r = (coap_route_t *)c_zalloc(sizeof(coap_route_t));
+    if (NULL == r)
+        return NULL;
+    if (node->nchild == node->size) {
+        child = (coap_route_t **)c_zalloc(sizeof(coap_route_t *) * (node->size ? node->size * 2 : 4));
+        if (NULL == child) {
+            c_free(r);
+            return NULL;
         }
-        ep++;
+        if (node->child) {
+            c_memcpy(child, node->child, sizeof(coap_route_t *) * node->nchild);
+            c_free(node->child);
+        }
+        node->child = child;
+        node->size = node->size ? node->size * 2 : 4;
+    }
+    c_memmove(node->child + i + 1, node->child + i, sizeof(coap_route_t *) * (node->nchild - i));
+    node->child[i] = r;
+    node->nchild++;
+    r->seg = seg;
+    r->len = len;
+    return r;
+}
+
+static int route_add(const coap_endpoint_t *ep, coap_luser_entry *entry)
+{
+    coap_route_t *r = &route_root;
+    int i;
+
+    for (i = 0; r && i < ep->path->count; i++)
+        r = route_child(r, ep->path->elems[i]);
+    if (r && entry)
+        r = route_child(r, entry->name);
+    if (NULL == r)
+        return 0;
+    r->ep[ep->method - 1] = ep;
+    r->methods |= 1 << (ep->method - 1);
+    r->entry = entry;
+    return 1;
+}
+
+const coap_endpoint_t *endpoint_route(const coap_packet_t *inpkt, coap_luser_entry **entry, uint8_t *methods)
+{
+    const coap_option_t *opt;
+    const coap_route_t *r = &route_root;
+    uint8_t count;
+    int i, m = inpkt->hdr.code - 1;
+
+    *entry = NULL;
+    *methods = 0;
+    if (NULL == (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
+        return NULL;
+    for (i = 0; i < count; i++) {
+        int c = route_search(r, opt[i].buf.p, opt[i].buf.len);
+        if (c < 0)
+            break;
+        r = r->child[c];
+    }
+    if (m < 0 || m >= COAP_METHOD_DELETE)
+        return NULL;
+    if (i == count) {
+        *methods = r->methods;
+        *entry = r->entry;
+        return r->ep[m];
     }
+    // /v1/v/[variable], /v1/f/[function] with a name nobody registered
+    if (i == count - 1 && r->ep[m] && r->ep[m]->user_entry) {
+        *methods = r->methods;
+        return r->ep[m];
+    }
+    return NULL;
+}
+
+int endpoint_regist(coap_luser_entry *head, coap_luser_entry *h)
+{
+    const coap_endpoint_t *ep = endpoints;
+
+    while(NULL != ep->handler && ep->user_entry != head)
+        ep++;
+    if (NULL == ep->handler)
+        return 0;
+    endpoint_invalidate();
+    return route_add(ep, h);
 }
 
+void endpoint_setup(void)
+{
+    const coap_endpoint_t *ep = endpoints;
+
+    if (route_root.nchild > 0)      // already set up by an earlier server
+        return;
+    while(NULL != ep->handler)
+    {
+        route_add(ep, NULL);
+        ep++;
+    }
+}
+#endif
@@ -1,7 +1,11 @@
+#define HEAP_TRACE_TAG HEAP_TAG_COAP
+
 #include "c_string.h"
 #include "c_stdlib.h"
 #include "node.h"
 
+#define COAP_TID_HASH(id) (((unsigned int)(id) ^ ((unsigned int)(id) >> 5)) & (COAP_TID_BUCKETS - 1))
+
 static inline coap_queue_t *
 coap_malloc_node(void) {
   return (coap_queue_t *)c_zalloc(sizeof(coap_queue_t));
@@ -11,40 +15,50 @@ void coap_free_node(coap_queue_t *node) {
   c_free(node);
 }
 
-int coap_insert_node(coap_queue_t **queue, coap_queue_t *node) {
-  coap_queue_t *p, *q;
-  if ( !queue || !node )
+int coap_insert_node(coap_wheel_t *wheel, coap_queue_t *node) {
+  unsigned int ticks, slot;
+  if ( !wheel || !node )
     return 0;
 
-  /* set queue head if empty */
-  if ( !*queue ) {
-    *queue = node;
-    return 1;
-  }
+  /* slot[cursor] goes on the next tick, which may come anywhere from now
+   * to COAP_WHEEL_TICK from now; only the ticks after it are whole. So the
+   * node waits for the next one and ceil(t / COAP_WHEEL_TICK) more, and
+   * never fires early. */
+  ticks = (node->t + COAP_WHEEL_TICK - 1) / COAP_WHEEL_TICK + 1;
+  slot = (wheel->cursor + ticks - 1) & (COAP_WHEEL_SLOTS - 1);
+  node->rounds = (ticks - 1) / COAP_WHEEL_SLOTS;
+
+  node->next = wheel->slot[slot];
+  if (node->next)
+    node->next->pprev = &node->next;
+  node->pprev = &wheel->slot[slot];
+  wheel->slot[slot] = node;
+
+  slot = COAP_TID_HASH(node->id);
+  node->hnext = wheel->tid[slot];
+  wheel->tid[slot] = node;
+
+  wheel->count++;
+  return 1;
+}
 
-  /* replace queue head if PDU's time is less than head's time */
-  q = *queue;
-  if (node->t < q->t) {
-    node->next = q;
-    *queue = node;
-    q->t -= node->t;		/* make q->t relative to node->t */
-    return 1;
-  }
+/* takes node out of its slot and tid bucket, does not free it */
+static void coap_unlink_node(coap_wheel_t *wheel, coap_queue_t *node) {
+  coap_queue_t **pp = &wheel->tid[COAP_TID_HASH(node->id)];
 
-  /* search for right place to insert */
-  do {
-    node->t -= q->t;		/* make node-> relative to q->t */
-    p = q;
-    q = q->next;
-  } while (q && q->t <= node->t);
+  while (*pp && *pp != node)
+    pp = &(*pp)->hnext;
+  if (*pp)
+    *pp = node->hnext;
+  node->hnext = NULL;
 
-  /* insert new item */
-  if (q) {
-    q->t -= node->t;		/* make q->t relative to node->t */
-  }
-  node->next = q;
-  p->next = node;
-  return 1;
+  *node->pprev = node->next;
+  if (node->next)
+    node->next->pprev = node->pprev;
+  node->next = NULL;
+  node->pprev = NULL;
+
+  wheel->count--;
 }
 
 int coap_delete_node(coap_queue_t *node) {
@@ -58,11 +72,26 @@ int coap_delete_node(coap_queue_t *node) {
 }
 
 void coap_delete_all(coap_queue_t *queue) {
-  if ( !queue )
+  coap_queue_t *next;
+
+  while (queue) {
+    next = queue->next;
+    coap_delete_node( queue );
+    queue = next;
+  }
+}
+
+void coap_wheel_clear(coap_wheel_t *wheel) {
+  unsigned int i;
+  if ( !wheel )
     return;
 
-  coap_delete_all( queue->next );
-  coap_delete_node( queue );
+  for (i = 0; i < COAP_WHEEL_SLOTS; i++) {
+    coap_delete_all(wheel->slot[i]);
+    wheel->slot[i] = NULL;
+  }
+  c_memset(wheel->tid, 0, sizeof(wheel->tid));
+  wheel->count = 0;
 }
 
 coap_queue_t * coap_new_node(void) {
@@ -77,65 +106,54 @@ coap_queue_t * coap_new_node(void) {
   return node;
 }
 
-coap_queue_t * coap_peek_next( coap_queue_t *queue ) {
-  if ( !queue )
-    return NULL;
-
-  return queue;
-}
+coap_queue_t * coap_wheel_advance( coap_wheel_t *wheel ) {		// this function is called inside timeout callback only.
+  coap_queue_t *node, *next, *expired = NULL;
 
-coap_queue_t * coap_pop_next( coap_queue_t **queue ) {		// this function is called inside timeout callback only.
-  coap_queue_t *next;
-
-  if ( !(*queue) )
+  if ( !wheel )
     return NULL;
 
-  next = *queue;
-  *queue = (*queue)->next;
-  // if (queue) {
-  //   queue->t += next->t;
-  // }
-  next->next = NULL;
-  return next;
+  for (node = wheel->slot[wheel->cursor]; node; node = next) {
+    next = node->next;
+    if (node->rounds > 0) {
+      node->rounds--;
+      continue;
+    }
+    coap_unlink_node(wheel, node);
+    node->next = expired;
+    expired = node;
+  }
+  wheel->cursor = (wheel->cursor + 1) & (COAP_WHEEL_SLOTS - 1);
+  return expired;
 }
 
-int coap_remove_node( coap_queue_t **queue, const coap_tid_t id){
-  coap_queue_t *p, *q, *node;
-  if ( !queue ) 
-    return 0;
-  if ( !*queue )  // if empty
-    return 0;
+void coap_remove_conn( coap_wheel_t *wheel, struct espconn *pconn){
+  coap_queue_t *node, *next;
+  unsigned int i;
+  if ( !wheel )
+    return;
 
-  q = *queue;
-  if (q->id == id) {
-    node = q;
-    *queue = q->next;
-    node->next = NULL;
-    if(*queue){
-      (*queue)->t += node->t;
+  for (i = 0; i < COAP_WHEEL_SLOTS; i++) {
+    for (node = wheel->slot[i]; node; node = next) {
+      next = node->next;
+      if (node->pconn == pconn) {
+        coap_unlink_node(wheel, node);
+        coap_delete_node(node);
+      }
     }
-    coap_delete_node(node);
-    return 1;
   }
+}
 
-  /* search for right node to remove */
-  while (q && q->id != id) {
-    p = q;
-    q = q->next;
-  }
+int coap_remove_node( coap_wheel_t *wheel, const coap_tid_t id){
+  coap_queue_t *node;
+  if ( !wheel )
+    return 0;
 
-  /* find the node */
-  if (q) {
-    node = q; /* save the node */
-    p->next = q->next;  /* remove the node */
-    q = q->next;
-    node->next = NULL;
-    if (q)   // add node->t to the node after.
-    {
-      q->t += node->t;
+  for (node = wheel->tid[COAP_TID_HASH(id)]; node; node = node->hnext) {
+    if (node->id == id) {
+      coap_unlink_node(wheel, node);
+      coap_delete_node(node);
+      return 1;
     }
-    coap_delete_node(node);
-    return 1;
   }
   return 0;
 }
@@ -12,17 +12,31 @@ struct coap_queue_t;
 typedef uint32_t coap_tick_t;
 
 /*
-1. queue(first)->t store when to send PDU for the next time, it's a base(absolute) time
-2. queue->next->t store the delta between time and base-time.  queue->next->t = timeout + now - basetime
-3. node->next->t store the delta between time and previous->t.  node->next->t = timeout + now - node->t - basetime
-4. time to fire:   10,   15,    18,    25
-		node->t:   10,   5,     3,     7
+Outstanding confirmable messages are kept in a hashed timing wheel. Every
+COAP_WHEEL_TICK ms the wheel advances one slot and the nodes in it whose
+rounds count is down to zero expire. A second hash on the transaction id
+finds a node again when its ACK comes in.
+1. insert:  n = ceil(t / COAP_WHEEL_TICK), as the next tick may come at
+            any time within the current one,
+            slot = (cursor + n) % COAP_WHEEL_SLOTS,
+            rounds = n / COAP_WHEEL_SLOTS
+2. tick:    nodes in slot[cursor] with rounds == 0 expire, the others
+            count down one round, then cursor moves on
 */
 
+#define COAP_WHEEL_SLOTS  64    /* power of two */
+#define COAP_TID_BUCKETS  32    /* power of two */
+#ifndef COAP_WHEEL_TICK
+#define COAP_WHEEL_TICK   100   /* ms per slot */
+#endif
+
 typedef struct coap_queue_t {
-  struct coap_queue_t *next;
+  struct coap_queue_t *next;    /**< next node in the same slot */
+  struct coap_queue_t **pprev;  /**< link pointing to this node */
+  struct coap_queue_t *hnext;   /**< next node with the same tid hash */
 
-  coap_tick_t t;	        /**< when to send PDU for the next time */
+  coap_tick_t t;	        /**< ms until the PDU is sent again, when inserted */
+  unsigned short rounds;        /**< wheel turns left before it expires */
   unsigned char retransmit_cnt;	/**< retransmission counter, will be removed when zero */
   unsigned int timeout;		/**< the randomized timeout value */
 
@@ -33,23 +47,38 @@ typedef struct coap_queue_t {
   struct espconn *pconn;
 } coap_queue_t;
 
+typedef struct coap_wheel_t {
+  coap_queue_t *slot[COAP_WHEEL_SLOTS];
+  coap_queue_t *tid[COAP_TID_BUCKETS];
+  unsigned int cursor;          /**< slot that expires on the next tick */
+  unsigned int count;           /**< nodes in the wheel */
+  void (*expired)(coap_queue_t *node);  /**< called for a node given up on, before it is freed */
+} coap_wheel_t;
+
 void coap_free_node(coap_queue_t *node);
 
-/** Adds node to given queue, ordered by node->t. */
-int coap_insert_node(coap_queue_t **queue, coap_queue_t *node);
+/** Adds node to the wheel, to expire node->t ms from now. */
+int coap_insert_node(coap_wheel_t *wheel, coap_queue_t *node);
 
 /** Destroys specified node. */
 int coap_delete_node(coap_queue_t *node);
 
-/** Removes all items from given queue and frees the allocated storage. */
+/** Destroys a list of nodes linked by next. */
 void coap_delete_all(coap_queue_t *queue);
 
+/** Removes all nodes from the wheel and frees the allocated storage. */
+void coap_wheel_clear(coap_wheel_t *wheel);
+
 /** Creates a new node suitable for adding to the CoAP sendqueue. */
 coap_queue_t *coap_new_node(void);
 
-coap_queue_t *coap_pop_next( coap_queue_t **queue );
+/** Advances the wheel by one tick, returns the expired nodes linked by next. */
+coap_queue_t *coap_wheel_advance(coap_wheel_t *wheel);
+
+int coap_remove_node( coap_wheel_t *wheel, const coap_tid_t id);
 
-int coap_remove_node( coap_queue_t **queue, const coap_tid_t id);
+/** Removes and frees the nodes sent on pconn, for a connection that goes away. */
+void coap_remove_conn( coap_wheel_t *wheel, struct espconn *pconn);
 
 #ifdef __cplusplus
 }
@@ -1,3 +1,5 @@
+#define HEAP_TRACE_TAG HEAP_TAG_COAP
+
 #include "c_stdlib.h"
 #include "pdu.h"
 
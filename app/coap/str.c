@@ -6,6 +6,8 @@
  * README for terms of use. 
  */
 
+#define HEAP_TRACE_TAG HEAP_TAG_COAP
+
 #include "c_stdlib.h"
 #include "c_types.h"
  
@@ -1,6 +1,8 @@
 /* uri.c -- helper functions for URI treatment
  */
 
+#define HEAP_TRACE_TAG HEAP_TAG_COAP
+
 #include "c_stdio.h"
 #include "c_stdlib.h"
 #include "c_string.h"
@@ -12,7 +14,7 @@
 #ifndef assert
 // #warning "assertions are disabled"
 #  define assert(x) do { \
-        if(!x) NODE_ERR("uri.c assert!\n");  \
+        if(!(x)) NODE_ERR("uri.c assert!\n");  \
     } while (0)
 #endif
 
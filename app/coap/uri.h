@@ -163,4 +163,8 @@ int coap_split_query(coap_rw_buffer_t *scratch, coap_packet_t *pkt,
 #endif
 /** @} */
 
+/** Builds a request for @p uri into @p pkt (coap.c). */
+int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, coap_msgtype_t t,
+    coap_method_t m, coap_uri_t *uri, const uint8_t *payload, size_t payload_len);
+
 #endif /* _COAP_URI_H_ */
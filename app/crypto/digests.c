@@ -42,10 +42,9 @@
 #include "sha2.h"
 #endif
 
-typedef char ensure_int_and_size_t_same[(sizeof(int)==sizeof(size_t)) ? 0 : -1];
-
 /* None of the functions match the prototype fully due to the void *, and in
-   some cases also the int vs size_t len, so wrap declarations in a macro. */
+   some cases also the unsigned int vs size_t len, so wrap declarations in a
+   macro. */
 #define MECH(pfx, u, ds, bs) \
   { #pfx, \
     (create_ctx_fn)pfx ## u ## Init, \
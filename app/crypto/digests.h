@@ -4,7 +4,7 @@
 #include <c_types.h>
 
 typedef void (*create_ctx_fn)(void *ctx);
-typedef void (*update_ctx_fn)(void *ctx, const uint8_t *msg, int len);
+typedef void (*update_ctx_fn)(void *ctx, const uint8_t *msg, size_t len);
 typedef void (*finalize_ctx_fn)(uint8_t *digest, void *ctx);
 
 /**
@@ -80,6 +80,6 @@ void crypto_encode_asciihex (const char *bin, size_t bin_len, char *outbuf);
 
 
 /** Text string "0123456789abcdef" */
-const char crypto_hexbytes[17];
+extern const char crypto_hexbytes[17];
 
 #endif
@@ -0,0 +1,84 @@
+/*
+ * The ciphers of the crypto module: AES from the SSL library, in CBC and in
+ * counter mode. Each operation is done in place, in the buffer the result
+ * string is made of.
+ */
+#include "mech.h"
+#include "user_config.h"
+#include "lwip/mem.h"
+#include "ssl/ssl_crypto.h"
+#include <string.h>
+#include <c_errno.h>
+
+static int ICACHE_FLASH_ATTR do_aes (crypto_op_t *co, int ctr)
+{
+  AES_CTX *ctx = (AES_CTX *)os_malloc (sizeof (AES_CTX));
+  uint8_t iv[AES_IV_SIZE] = { 0 };
+
+  if (!ctx)
+    return ENOMEM;
+
+  os_memcpy (iv, co->iv, co->iv_len);
+  AES_set_key (ctx, co->key, iv, co->key_len == 32 ? AES_MODE_256 : AES_MODE_128);
+
+  if (ctr)
+    AES_ctr_crypt (ctx, co->data, co->data, co->data_len);
+  else if (co->op == OP_ENCRYPT)
+    AES_cbc_encrypt (ctx, co->data, co->data, co->data_len);
+  else
+  {
+    AES_convert_key (ctx);
+    AES_cbc_decrypt (ctx, co->data, co->data, co->data_len);
+  }
+
+  os_free (ctx);
+  return 0;
+}
+
+static int ICACHE_FLASH_ATTR do_aes_cbc (crypto_op_t *co)
+{
+  return do_aes (co, 0);
+}
+
+static int ICACHE_FLASH_ATTR do_aes_ctr (crypto_op_t *co)
+{
+  return do_aes (co, 1);
+}
+
+static const crypto_mech_t mechs[] ICACHE_RODATA_ATTR =
+{
+   { "AES-CBC", do_aes_cbc, AES_BLOCKSIZE }
+  ,{ "AES-CTR", do_aes_ctr, 1 }
+};
+
+const crypto_mech_t *ICACHE_FLASH_ATTR crypto_encryption_mech (const char *mech)
+{
+  if (!mech)
+    return 0;
+
+  size_t i;
+  for (i = 0; i < (sizeof (mechs) / sizeof (crypto_mech_t)); ++i)
+  {
+    const crypto_mech_t *m = mechs + i;
+    if (strcasecmp (mech, m->name) == 0)
+      return m;
+  }
+  return 0;
+}
+
+size_t ICACHE_FLASH_ATTR crypto_output_len (const crypto_mech_t *mech, size_t data_len)
+{
+  size_t bs = mech->block_size;
+  return (data_len + bs - 1) / bs * bs;
+}
+
+int ICACHE_FLASH_ATTR crypto_check_op (const crypto_mech_t *mech, const crypto_op_t *op)
+{
+  if (op->key_len != 16 && op->key_len != 32)
+    return EINVAL;
+  if (op->iv_len > AES_IV_SIZE)
+    return EINVAL;
+  if (op->op == OP_DECRYPT && op->data_len % mech->block_size)
+    return EINVAL;
+  return 0;
+}
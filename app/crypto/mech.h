@@ -0,0 +1,63 @@
+#ifndef _CRYPTO_MECH_H_
+#define _CRYPTO_MECH_H_
+
+#include <c_types.h>
+
+typedef enum { OP_ENCRYPT, OP_DECRYPT } crypto_op_dir_t;
+
+/**
+ * One encryption or decryption, done in place on @c data.
+ */
+typedef struct
+{
+  const uint8_t *key;
+  size_t         key_len;
+  const uint8_t *iv;
+  size_t         iv_len;
+  uint8_t       *data;
+  size_t         data_len;
+  crypto_op_dir_t op;
+} crypto_op_t;
+
+typedef int (*crypto_op_fn) (crypto_op_t *op);
+
+/**
+ * Description of a cipher mechanism.
+ *
+ * Typical usage:
+ *   const crypto_mech_t *mech = crypto_encryption_mech (chosen_algorithm);
+ *   size_t len = crypto_output_len (mech, data_len);
+ *   ... a buffer of len bytes, with the data and zeros after it ...
+ *   crypto_op_t op = { key, key_len, iv, iv_len, buf, len, OP_ENCRYPT };
+ *   mech->run (&op);
+ */
+typedef struct
+{
+  /* Note: All entries are 32bit to enable placement using ICACHE_RODATA_ATTR.*/
+  const char *  name;
+  crypto_op_fn  run;
+  uint32_t      block_size; /* what the data is padded to, 1 for a stream */
+} crypto_mech_t;
+
+
+/**
+ * Looks up the mech data for a specified cipher.
+ * @param mech The name of the cipher, e.g. "AES-CBC", "AES-CTR"
+ * @returns The mech data, or null if the mech is unknown.
+ */
+const crypto_mech_t *crypto_encryption_mech (const char *mech);
+
+/**
+ * The length of the output for @c data_len bytes of input: the input padded
+ * with zeros to a whole number of blocks.
+ */
+size_t crypto_output_len (const crypto_mech_t *mech, size_t data_len);
+
+/**
+ * Checks the key and iv lengths of an operation, and the length of the data
+ * to decrypt, before anything is allocated for it.
+ * @return 0 if they suit the mech, EINVAL if not.
+ */
+int crypto_check_op (const crypto_mech_t *mech, const crypto_op_t *op);
+
+#endif
@@ -0,0 +1,243 @@
+// bigint-host: the RSA arithmetic of app/ssl (crypto/ssl_bigint.c) on keys of
+// 1024 and 2048 bits. Each key is first checked against what OpenSSL worked
+// out with it, then timed: the public operation, with the exponent 65537, of
+// a key exchange or a certificate check; the private one of a server, with
+// CRT as RSA_private does; and the set up of a modulus, for every key loaded.
+//
+//   bigint-host [rounds]
+//
+// make modexp runs it as built, then bigint-host-nomont, built without
+// CONFIG_BIGINT_MONT_POWER: the Barrett exponentiation of before.
+
+#include "c_stdio.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+#include <time.h>
+
+#include "ssl/ssl_os_port.h"
+#include "ssl/ssl_crypto.h"
+#include "ssl/ssl_bigint.h"
+
+#define PROGNAME  "bigint-host"
+
+// a key of openssl genrsa, m a random block, c = m^65537 mod n by openssl
+// pkeyutl -encrypt -pkeyopt rsa_padding_mode:none
+typedef struct
+{
+  int bits;
+  const char *n, *d, *p, *q, *dP, *dQ, *qInv, *m, *c;
+} rsa_vector;
+
+static const rsa_vector vectors[] =
+{
+  { 1024,
+    // n
+    "B1E961B89DC0746D80D50D8CD80FB0A19CD15BBDDF79040CCCB2B27418A41135"
+    "3C585C61A5DA9DE36A0584A3C4B273C61DBA4FAE20CB564AA37A7C3ACD8C8867"
+    "28B155DC83E63A597B184B6021C8E49C871341ED36B08E87F8EF5FCC599FFCD4"
+    "F91F642D3CA6B6C2D6381A28C443BFD86EAE50DD7C3D63415140C37D596B87C1",
+    // d
+    "25E7AE6D5216EDF762AA81DF8F2D1099EE3A60CC7C6F6120850051AB1090EC25"
+    "A67CC0FA010729FA88DD321C5E4D130393D3DD242152914907B991FC494CF6C6"
+    "80D47E47C1A1A0FC1DDC8F9830CA14941C76F226453FD16AF9CC1E5EA91E3940"
+    "DBCAE5D9ECC1229F8140D6322A62CE68149E1B84A111C1512D9FF314AFCCB96D",
+    // p
+    "DCB01CECEA18C5F8DFAB30997B95DA5F83D155006405B5E80EFBFFD987BEBF4B"
+    "25FFA6BB93170F457029B7ACB4A0148D7191BFBC942F6BD3FEC7984A4F84B1D7",
+    // q
+    "CE610D96E22462494542F22B9BC323CAEB1C417F23FF019192962DDD15BC9A16"
+    "771BF83EB359B9FEE07798A4C9F8525FD0DE27A82A49F2E65428601E52C11027",
+    // dP
+    "2D40374E24DA1B8DE25EF9C21EE32539BC8FA9BC40C622FC884607BA14E979D3"
+    "F0E0B0D179619B1203E3A9F3D1BD99393F7641386BB2258BFC8BF4A01819FF55",
+    // dQ
+    "B0C7FDE6032C7B6C9C01AE83A05755AF9A1988192A72639B98DF3FC623BA7C9B"
+    "45C815AB4FE24A2A8388AE9E69CB667460EC0B384791349A0BF8D1ECE7A22CFD",
+    // qInv
+    "AF7214553ED795ADF962FB56CD1C844EE49F78CC61D2CD40F741EB3126F546C5"
+    "C6A4CCC3119499B0BD965F5EF0B4CC56F04DECA5793E9E4490E56616C72173ED",
+    // m
+    "2EDC8F34BE5D51605984F6D62885C22BA32457204399F75E7071C16FCB6806C0"
+    "684A1BC6F5CC60F35C90A975FA92D9F38F9BD5D91C3DD5FF89349AAFA519316D"
+    "17A2EB87C98CB73ADA52A2FCD2E8953ADD18633961E161A6E0A9247F19348D39"
+    "8551C5FE74A8B4FE6C8758D3843271C9FC91FB6CCD57F3D558C25ECBF981A",
+    // c
+    "8CEC86DE521F08E83C6ED94CCDCB2A396C6308BF3831105E5CE65A325F8698D9"
+    "B56F130E454771E32FB4EAF4CD53AD5023D52EF197768B53BABB66EE51F3351D"
+    "0B2DE1F20E0A5D29EBBCB0E2912818C09E5EF3B1F5ACAC03F310EAA8011077DD"
+    "6D1BAD33193376872C68F6BD20DDBCC33FB04A5FD259F44049557E4F1F5F8A55",
+  },
+  { 2048,
+    // n
+    "D2BC16796AA44187248F5F90162BE862A8C63E4B2FE3584AAEF05D23A2E4E485"
+    "F530833E4AA82879AC4DDD007285F9B3B2E0FC374E08EDD1EA43C3FE28510360"
+    "BAF079FFD68B25BD5DF5609BBD8B33E73DBB0437DABF936AE6BE63D42460D010"
+    "67F88D43C2DF933B5141CD80310C6A95004AC78183B7BA85F91F2BB5F48F7C80"
+    "AF8554C8E49E6A9AA403539C503D56CF318BF1AEA6EBD7F95527A7CA1388D76B"
+    "00736E42E066C2AE913C9927B43D0D945B0700D0FC1E614D5608726FB4EF4919"
+    "2CD9255CA1102A14F45028B2BAECDFEDEBF05764DE87D3031293B42E29910F6D"
+    "DF74BDFCAC4ABF995BEE81F4C9DD692EE5C893B3CA574C1E5B32FBF02D529EC5",
+    // d
+    "21D70A54DD071B6EB43441C845872F7E08542D54AD8FF871A5BDFB76E985901C"
+    "E2CEB384A140779F7247DEA15FC29BE27B6B1D9553F6A319FE607B6CA8D4B992"
+    "22F2D2E47E7341D032F2605D2206E482D1AAE27685AE15E228C3920C52FB28EE"
+    "3983F44B5953C5B4D4CB9850698FF0DD947A6DA7229BB25C29311437D7D9E2C8"
+    "0CCB4DFCB2CEA79C4103C7AEE4729236347AB00409CB71E21C9EBDC61F387934"
+    "DB2CF35AF6689236B188D9EEA5C0A2532243541936D6DB35AB8D68D3DBEBD92E"
+    "DB25C123C9909B130F403BC6533EDC51332AB1961DB6320342E0AD0558EBEE75"
+    "194D8BDC0A40F749CBCF1BB8FF42D614837673F1AFBD1732B1E1E20DB280AA51",
+    // p
+    "ECBD12226EDB35251863F66A297C13E3C841547DE00898F15629E5B45F0DD1F5"
+    "9C08E7DF4DB32F64ADA2AEF79685242E0836E1AE7FE090355904EF326D9B9CB5"
+    "975FB5E0CE7D4A35B041217F43C62DF4680E6482FDFF7EF1143381D4369CE3DF"
+    "BE7D350FAAF9C8C1D015682D6CA4FD89A05F470E39C4A30719D0FE27B75509EB",
+    // q
+    "E3E164CD8E4C5851D21162629AB3DDCDF5F7B380E8C2DA49525B98841E2F1DA7"
+    "7E411C3C386AC75CDE749064152C612EF1D743B4F3245F0B2CB6BB8BC85B0A9B"
+    "B80062B31F0B06B41AD1F250F8BA4FE4B4893109C9A8BC895C5ED64148D6FEAC"
+    "9706C86CCECAD86AB01E95D5E3038D9E9DFB124333634CF39DE7010113A89E0F",
+    // dP
+    "B26FAC1C81FBFDA9B1219F58D35DEF4BEFE3B6008E7D4C721324CF3B4DAE0804"
+    "1D10E55C7D9F42689B2B94BF8F175976CCC03908A2E02B31DAA00A7EB2F8E87C"
+    "42D5642C46D74EB8FAD98C9AF5058A1BBED6A251CD8AE72E64B091F9D71417F9"
+    "CC05699A1E9FD8FEA48D8E1136E3812A5BD394A6174AAC2AACFDC6A33EDEFCF3",
+    // dQ
+    "A0CA0EB8436976FFF47B33B26379FA4D32FA9DFB9D40AF8900C5846DE4665644"
+    "327F7A8EBB380C8768A752A26B962ED452EC12E8008F6F48913A3646C10E0C04"
+    "27E68DBDD96F8C41549342A90377629BFB0EBA3D2FBF1198D24650632C2416FA"
+    "6C6DEAC96B78110FE6490E6C268C0147242D5D8B711CE5D5175B418822F8DCDD",
+    // qInv
+    "AE61879331A6BCC8CCEF7B653201AF925B01B01568892474EEEA345DD9F74B9B"
+    "03C59D969C3D4CF34C56F4A60B00F28FA306365F4783BCD0DE03E9733DB067CE"
+    "A729FA20EEB1AD2174726E48A5F963EFD727053424D5B407389A20E20DC392CA"
+    "60BC803C37C829FED785E98310548F150DDCB32CC476CF52C1F9FA3067299BC0",
+    // m
+    "2F3632B74FA090FA26B65062AD03AB004FA39CFBEF30F8AF2FD72C0185905FAC"
+    "A617E320A1444788D33C2EF76F44C38181B8F88A72CB18C8FD13E411A6C2BE70"
+    "472C458A9E56BD12BE69EB1D06A12B2F6D5E6A4BF3E8C4C6D694DC6DD8F9D8D0"
+    "ED4491C07A22456F890BBD66F402BF4AA155790B18B1E3DE490F679CD74FEB84"
+    "602576107CAF525C0DF6735CCAF082DA874BF6DF5156CB4477B99B1FE8BB98F2"
+    "E87894D44E7FF173AE110DEE48061C705AD759B6A4BAF52695ACF4E47F6EF582"
+    "A640B6CE4D2AB7BC28EE3428A48B1176338E544FDDB26815F1D9F77FE1F4891C"
+    "67202DC0A43C9DA1D40C4FC91A3790B69CF1547345D9126A0D7C8182FBD83",
+    // c
+    "22483EF9B40B9ECE129E86DF5504DFB02931C51C4C3A41035FA14C618E1EE14B"
+    "1735F7B2AE09E3D53DB7C7B5CDD0616886BF86507F4F5A0D0CC32A102EB1F0C1"
+    "E572CC329812B3F2EB962FC5986A96B8FFD725161FB838A81AEF63D409B6578C"
+    "241F3C360E7A4C09DE1FF6D0ED62A8A846C80DDB3E48E706D128AF626B265B5D"
+    "F6AD2DD811EFF53232D3EF6EF083F3BF65A9E64BA5CCC12ED8DDA98E0128F1CA"
+    "040BA95E24B811F0B3AA246C9368A1051E820BE96236CA7A316F3FDA8BD5BFA3"
+    "32D6E3D311D2E874553BDB7367680A00494D1A3FCDA9390D0883F6CA12223D7A"
+    "062A1D490BD25CE3A361A570A78B39DFE9DFD7C7432FA6C23010ED4E84AB81D0",
+  },
+};
+
+static double cpu_ms( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static bigint *import( BI_CTX *ctx, const char *hex )
+{
+  bigint *bi = bi_str_import( ctx, hex );
+  bi_permanent( bi );
+  return bi;
+}
+
+static void release( BI_CTX *ctx, bigint *bi )
+{
+  bi_depermanent( bi );
+  bi_free( ctx, bi );
+}
+
+// the result of one operation against what it should be
+static int matches( BI_CTX *ctx, bigint *bi, bigint *expected, const char *what, int bits )
+{
+  int ok = bi_compare( bi, expected ) == 0;
+  if( !ok )
+    fprintf( stderr, "%s: %d bits, %s: wrong result\n", PROGNAME, bits, what );
+  bi_free( ctx, bi );
+  return ok;
+}
+
+static int run( const rsa_vector *v, int rounds )
+{
+  BI_CTX *ctx = bi_initialize();
+  bigint *n = bi_str_import( ctx, v->n ), *d = import( ctx, v->d );
+  bigint *p = bi_str_import( ctx, v->p ), *q = bi_str_import( ctx, v->q );
+  bigint *dP = import( ctx, v->dP ), *dQ = import( ctx, v->dQ );
+  bigint *qInv = import( ctx, v->qInv );
+  bigint *m = import( ctx, v->m ), *c = import( ctx, v->c );
+  bigint *e = int_to_bi( ctx, 65537 );
+  double t0, t_set, t_pub, t_priv;
+  int i, ok;
+
+  // as RSA_priv_key_new and RSA_pub_key_new, which keep the moduli
+  bi_permanent( e );
+  bi_set_mod( ctx, n, BIGINT_M_OFFSET );
+  bi_set_mod( ctx, p, BIGINT_P_OFFSET );
+  bi_set_mod( ctx, q, BIGINT_Q_OFFSET );
+
+  ctx->mod_offset = BIGINT_M_OFFSET;
+  ok = matches( ctx, bi_mod_power( ctx, bi_copy( m ), e ), c, "m^e", v->bits );
+  ok &= matches( ctx, bi_mod_power( ctx, bi_copy( c ), d ), m, "c^d", v->bits );
+  ok &= matches( ctx, bi_crt( ctx, bi_copy( c ), dP, dQ, p, q, qInv ), m,
+                 "c^d by CRT", v->bits );
+
+  t0 = cpu_ms();
+  for( i = 0; i < rounds * 10; i++ )
+  {
+    BI_CTX *tmp = bi_initialize();
+    bi_set_mod( tmp, bi_clone( tmp, n ), BIGINT_M_OFFSET );
+    bi_free_mod( tmp, BIGINT_M_OFFSET );
+    bi_terminate( tmp );
+  }
+  t_set = ( cpu_ms() - t0 ) / ( rounds * 10 );
+
+  t0 = cpu_ms();
+  for( i = 0; i < rounds * 10; i++ )
+  {
+    ctx->mod_offset = BIGINT_M_OFFSET;
+    bi_free( ctx, bi_mod_power( ctx, bi_copy( m ), e ) );
+  }
+  t_pub = ( cpu_ms() - t0 ) / ( rounds * 10 );
+
+  t0 = cpu_ms();
+  for( i = 0; i < rounds; i++ )
+    bi_free( ctx, bi_crt( ctx, bi_copy( c ), dP, dQ, p, q, qInv ) );
+  t_priv = ( cpu_ms() - t0 ) / rounds;
+
+  printf( "%d bits: %s, public %.3f ms, private %.3f ms, modulus set up %.3f ms\n",
+          v->bits, ok ? "ok" : "FAILED", t_pub, t_priv, t_set );
+
+  bi_free_mod( ctx, BIGINT_M_OFFSET );
+  bi_free_mod( ctx, BIGINT_P_OFFSET );
+  bi_free_mod( ctx, BIGINT_Q_OFFSET );
+  release( ctx, d );
+  release( ctx, dP );
+  release( ctx, dQ );
+  release( ctx, qInv );
+  release( ctx, m );
+  release( ctx, c );
+  release( ctx, e );
+  bi_terminate( ctx );
+  return ok;
+}
+
+int main( int argc, char **argv )
+{
+  int rounds = argc > 1 ? atoi( argv[ 1 ] ) : 20;
+  int i, ok = 1;
+
+  if( rounds <= 0 )
+  {
+    fprintf( stderr, "usage: %s [rounds]\n", PROGNAME );
+    return EXIT_FAILURE;
+  }
+  for( i = 0; i < sizeof( vectors ) / sizeof( vectors[ 0 ] ); i++ )
+    ok &= run( &vectors[ i ], rounds );
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,299 @@
+// cipher-host: the record ciphers of app/ssl (crypto/ssl_aes.c). AES-GCM is
+// first checked against the test cases of its specification (McGrew and
+// Viega, "The Galois/Counter Mode of Operation"), then a record of each size
+// is sealed the way ssl_tls1.c does it, with AES128-GCM-SHA256 in one pass
+// and with AES128-SHA in two, HMAC-SHA1 then CBC, and the rate of each timed.
+// AES itself is checked against FIPS-197 and the counter mode against SP
+// 800-38A, and AES-128 is timed in CBC each way and in counter mode, the
+// modes of crypto.encrypt.
+//
+//   cipher-host [rounds]
+//
+// make aead runs it; make aes the AES checks and timings, here and in
+// cipher-host-nottable, which has the AES of before CONFIG_AES_TTABLE.
+
+#include "c_stdio.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+#include <time.h>
+
+#include "ssl/ssl_os_port.h"
+#include "ssl/ssl_crypto.h"
+
+#define PROGNAME  "cipher-host"
+
+typedef struct
+{
+  int tc;
+  const char *k, *iv, *a, *p, *c, *t;
+} gcm_vector;
+
+#define GCM_K    "feffe9928665731c6d6a8f9467308308"
+#define GCM_IV   "cafebabefacedbaddecaf888"
+#define GCM_A    "feedfacedeadbeeffeedfacedeadbeefabaddad2"
+#define GCM_P60  "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72" \
+                 "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39"
+#define GCM_Z96  "000000000000000000000000"
+#define GCM_Z128 "00000000000000000000000000000000"
+
+static const gcm_vector vectors[] =
+{
+  { 1, GCM_Z128, GCM_Z96, "", "", "", "58e2fccefa7e3061367f1d57a4e7455a" },
+  { 2, GCM_Z128, GCM_Z96, "", GCM_Z128, "0388dace60b6a392f328c2b971b2fe78",
+    "ab6e47d42cec13bdf53a67b21257bddf" },
+  { 3, GCM_K, GCM_IV, "", GCM_P60 "1aafd255",
+    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+    "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+    "4d5c2af327cd64a62cf35abd2ba6fab4" },
+  { 4, GCM_K, GCM_IV, GCM_A, GCM_P60,
+    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+    "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+    "5bc94fbc3221a5db94fae95ae7121a47" },
+  { 14, GCM_Z128 GCM_Z128, GCM_Z96, "", GCM_Z128, "cea7403d4d606b6e074ec5d3baf39d18",
+    "d0d1c8a799996bf0265b98b5d48ab919" },
+  { 15, GCM_K GCM_K, GCM_IV, "", GCM_P60 "1aafd255",
+    "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+    "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad",
+    "b094dac5d93471bdec1a502270e3cc6c" },
+  { 16, GCM_K GCM_K, GCM_IV, GCM_A, GCM_P60,
+    "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+    "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+    "76fc6ece0f4e1768cddf8853bb2d551b" },
+};
+
+// FIPS-197 appendix C.1 and C.3
+#define FIPS_P    "00112233445566778899aabbccddeeff"
+#define FIPS_K    "000102030405060708090a0b0c0d0e0f"
+#define FIPS_C128 "69c4e0d86a7b0430d8cdb78070b4c55a"
+#define FIPS_C256 "8ea2b7ca516745bfeafc49904b496089"
+
+// SP 800-38A F.5.1, CTR-AES128.Encrypt
+#define CTR_K     "2b7e151628aed2a6abf7158809cf4f3c"
+#define CTR_IV    "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"
+#define CTR_P     "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51" \
+                  "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710"
+#define CTR_C     "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff" \
+                  "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee"
+
+static double cpu_ms( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// the bytes of a string of hex digits, and how many
+static int unhex( const char *hex, uint8_t *out )
+{
+  int n = 0;
+  for( ; hex[ 0 ] && hex[ 1 ]; hex += 2 )
+  {
+    unsigned b;
+    sscanf( hex, "%2x", &b );
+    out[ n++ ] = b;
+  }
+  return n;
+}
+
+// both ways, in place and not, and a tag or a ciphertext with a bit flipped
+static int check( const gcm_vector *v )
+{
+  AES_GCM_CTX ctx;
+  uint8_t k[ 32 ], iv[ 12 ], a[ 64 ], p[ 64 ], c[ 64 ], t[ 16 ];
+  uint8_t out[ 64 ], tag[ 16 ];
+  int klen = unhex( v->k, k ), alen = unhex( v->a, a ), len = unhex( v->p, p );
+  int ok = 1;
+
+  unhex( v->iv, iv );
+  unhex( v->c, c );
+  unhex( v->t, t );
+  AES_gcm_set_key( &ctx, k, klen == 32 ? AES_MODE_256 : AES_MODE_128 );
+
+  AES_gcm_encrypt( &ctx, iv, a, alen, p, out, len, tag );
+  ok &= os_memcmp( out, c, len ) == 0 && os_memcmp( tag, t, 16 ) == 0;
+  os_memcpy( out, p, len );
+  AES_gcm_encrypt( &ctx, iv, a, alen, out, out, len, tag );
+  ok &= os_memcmp( out, c, len ) == 0 && os_memcmp( tag, t, 16 ) == 0;
+
+  ok &= AES_gcm_decrypt( &ctx, iv, a, alen, c, out, len, t ) == 0 &&
+        os_memcmp( out, p, len ) == 0;
+  os_memcpy( out, c, len );
+  ok &= AES_gcm_decrypt( &ctx, iv, a, alen, out, out, len, t ) == 0 &&
+        os_memcmp( out, p, len ) == 0;
+
+  t[ 15 ] ^= 1;
+  ok &= AES_gcm_decrypt( &ctx, iv, a, alen, c, out, len, t ) == -1;
+  t[ 15 ] ^= 1;
+  if( len )
+  {
+    c[ 0 ] ^= 0x80;
+    ok &= AES_gcm_decrypt( &ctx, iv, a, alen, c, out, len, t ) == -1;
+  }
+
+  if( !ok )
+    fprintf( stderr, "%s: AES-GCM test case %d: wrong result\n", PROGNAME, v->tc );
+  return ok;
+}
+
+// one block each way through CBC with a zero iv, which is the block cipher
+// itself
+static int check_block( const char *hk, const char *hc )
+{
+  AES_CTX ctx;
+  uint8_t k[ 32 ], p[ 16 ], c[ 16 ], iv[ 16 ] = { 0 }, out[ 16 ];
+  int klen = unhex( hk, k ), ok;
+
+  unhex( FIPS_P, p );
+  unhex( hc, c );
+  AES_set_key( &ctx, k, iv, klen == 32 ? AES_MODE_256 : AES_MODE_128 );
+  AES_cbc_encrypt( &ctx, p, out, 16 );
+  ok = os_memcmp( out, c, 16 ) == 0;
+  os_memset( ctx.iv, 0, sizeof( ctx.iv ) );
+  AES_convert_key( &ctx );
+  AES_cbc_decrypt( &ctx, c, out, 16 );
+  ok &= os_memcmp( out, p, 16 ) == 0;
+  if( !ok )
+    fprintf( stderr, "%s: AES-%d FIPS-197 example: wrong result\n", PROGNAME, klen * 8 );
+  return ok;
+}
+
+// the four blocks in one go, then in two calls of whole blocks, the second
+// going on from the counter the first left; a length that ends inside a
+// block; and back
+static int check_ctr( void )
+{
+  AES_CTX ctx;
+  uint8_t k[ 16 ], iv[ 16 ], p[ 64 ], c[ 64 ], out[ 64 ];
+  int ok;
+
+  unhex( CTR_K, k );
+  unhex( CTR_IV, iv );
+  unhex( CTR_P, p );
+  unhex( CTR_C, c );
+  AES_set_key( &ctx, k, iv, AES_MODE_128 );
+  AES_ctr_crypt( &ctx, p, out, 64 );
+  ok = os_memcmp( out, c, 64 ) == 0;
+
+  // the low byte of the counter carries into the next after the first block
+  os_memcpy( ctx.iv, iv, 16 );
+  os_memset( out, 0, sizeof( out ) );
+  AES_ctr_crypt( &ctx, p, out, 16 );
+  AES_ctr_crypt( &ctx, &p[ 16 ], &out[ 16 ], 48 );
+  ok &= os_memcmp( out, c, 64 ) == 0;
+
+  os_memcpy( ctx.iv, iv, 16 );
+  os_memset( out, 0, sizeof( out ) );
+  AES_ctr_crypt( &ctx, p, out, 37 );
+  ok &= os_memcmp( out, c, 37 ) == 0 && out[ 37 ] == 0;
+
+  os_memcpy( ctx.iv, iv, 16 );
+  os_memcpy( out, c, 64 );
+  AES_ctr_crypt( &ctx, out, out, 64 );
+  ok &= os_memcmp( out, p, 64 ) == 0;
+  if( !ok )
+    fprintf( stderr, "%s: CTR-AES128 SP 800-38A example: wrong result\n", PROGNAME );
+  return ok;
+}
+
+// MB/s of AES-128 in CBC each way and in counter mode, over 4096 bytes
+static void bench_aes( int rounds )
+{
+  static uint8_t buf[ 4096 ];
+  static const uint8_t key[ 16 ] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+  AES_CTX enc, dec, ctr;
+  double t0, t_enc, t_dec, t_ctr;
+  int i, n = rounds * 16;
+
+  AES_set_key( &enc, key, key, AES_MODE_128 );
+  AES_set_key( &ctr, key, key, AES_MODE_128 );
+  AES_set_key( &dec, key, key, AES_MODE_128 );
+  AES_convert_key( &dec );
+  os_memset( buf, 0x5a, sizeof( buf ) );
+
+  t0 = cpu_ms();
+  for( i = 0; i < n; i++ )
+    AES_cbc_encrypt( &enc, buf, buf, sizeof( buf ) );
+  t_enc = cpu_ms() - t0;
+
+  t0 = cpu_ms();
+  for( i = 0; i < n; i++ )
+    AES_cbc_decrypt( &dec, buf, buf, sizeof( buf ) );
+  t_dec = cpu_ms() - t0;
+
+  t0 = cpu_ms();
+  for( i = 0; i < n; i++ )
+    AES_ctr_crypt( &ctr, buf, buf, sizeof( buf ) );
+  t_ctr = cpu_ms() - t0;
+
+#define MBS( t ) ( n * ( double )sizeof( buf ) / ( ( t ) * 1e3 ) )
+  printf( "AES-128: CBC encrypt %6.2f MB/s, CBC decrypt %6.2f MB/s, CTR %6.2f MB/s\n",
+          MBS( t_enc ), MBS( t_dec ), MBS( t_ctr ) );
+#undef MBS
+}
+
+// MB/s of sealing records of len bytes, as send_packet does with each suite;
+// the buffer has the room for the MAC, the padding and the explicit IV
+static void bench( int len, int rounds )
+{
+  static uint8_t buf[ 4096 + 64 ], mac_buf[ 4096 + 64 ];
+  static const uint8_t key[ 32 ] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+  uint8_t seq[ 8 ] = { 0 }, aad[ 13 ], nonce[ 12 ] = { 0 };
+  AES_GCM_CTX gcm;
+  AES_CTX cbc;
+  double t0, t_gcm, t_cbc;
+  int i, n = rounds * ( 65536 / len );
+
+  AES_gcm_set_key( &gcm, key, AES_MODE_128 );
+  AES_set_key( &cbc, key, key + 16, AES_MODE_128 );
+  os_memset( buf, 0x5a, sizeof( buf ) );
+
+  t0 = cpu_ms();
+  for( i = 0; i < n; i++ )
+  {
+    seq[ 7 ] = i;
+    os_memcpy( aad, seq, 8 );
+    os_memcpy( &nonce[ 4 ], seq, 8 );
+    AES_gcm_encrypt( &gcm, nonce, aad, sizeof( aad ), buf, buf, len, &buf[ len ] );
+  }
+  t_gcm = cpu_ms() - t0;
+
+  t0 = cpu_ms();
+  for( i = 0; i < n; i++ )
+  {
+    int total = len + SHA1_SIZE, pad = 16 - total % 16;
+    seq[ 7 ] = i;
+    os_memcpy( mac_buf, seq, 8 );
+    os_memcpy( &mac_buf[ 13 ], buf, len );
+    ssl_hmac_sha1( mac_buf, len + 13, key, SHA1_SIZE, &buf[ len ] );
+    os_memset( &buf[ total ], pad - 1, pad );
+    AES_cbc_encrypt( &cbc, buf, buf, total + pad );
+  }
+  t_cbc = cpu_ms() - t0;
+
+  printf( "%5d byte records: AES128-GCM %6.2f MB/s, AES128-CBC+HMAC-SHA1 %6.2f MB/s\n",
+          len, n * ( double )len / ( t_gcm * 1e3 ), n * ( double )len / ( t_cbc * 1e3 ) );
+}
+
+int main( int argc, char **argv )
+{
+  static const int sizes[] = { 64, 512, 1024, 4096 };
+  int rounds = argc > 1 ? atoi( argv[ 1 ] ) : 200;
+  int i, ok = 1;
+
+  if( rounds <= 0 )
+  {
+    fprintf( stderr, "usage: %s [rounds]\n", PROGNAME );
+    return EXIT_FAILURE;
+  }
+  for( i = 0; i < sizeof( vectors ) / sizeof( vectors[ 0 ] ); i++ )
+    ok &= check( &vectors[ i ] );
+  printf( "AES-GCM test cases: %s\n", ok ? "ok" : "FAILED" );
+  ok &= check_block( FIPS_K, FIPS_C128 ) & check_block( FIPS_K "101112131415161718191a1b1c1d1e1f", FIPS_C256 ) &
+        check_ctr();
+  printf( "AES and CTR examples: %s\n", ok ? "ok" : "FAILED" );
+  bench_aes( rounds );
+  for( i = 0; i < sizeof( sizes ) / sizeof( sizes[ 0 ] ); i++ )
+    bench( sizes[ i ], rounds );
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
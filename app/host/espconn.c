@@ -0,0 +1,325 @@
+// The SDK's connections for the host build, in process: nothing goes on the
+// wire. A UDP datagram goes to the connection created on the port it is sent
+// to, whatever the address, and is lost if there is none. A TCP client
+// connects at once to a peer the test plays, which reads what the client
+// sent with host_tcp_sent(), answers with host_tcp_receive() and hangs up
+// with host_tcp_close(). As the SDK does, a TCP send is refused until the
+// sent callback of the one before has run. The SDK calls its callbacks from
+// its own task, never from within the call that caused them, so they are
+// queued here and run by host_net_run().
+
+#include "host.h"
+#include "espconn.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+#include <arpa/inet.h>
+
+enum { EV_CONNECT, EV_SENT, EV_DISCON, EV_RECV };
+
+typedef struct host_event
+{
+  struct host_event *next;
+  struct espconn *conn;
+  int type;
+  int port;                   // EV_RECV: the port it came from
+  uint16 len;
+  uint8 data[ 1 ];
+} host_event;
+
+static host_event *events, **events_tail = &events;
+
+#define UDP_CONNS  16
+
+// the UDP connections created and not deleted
+static struct espconn *udp_conns[ UDP_CONNS ];
+
+// the TCP connection the last client opened, and what it sent since the
+// peer last looked
+static struct espconn *tcp_conn;
+static uint8 *tcp_out;
+static size_t tcp_outlen, tcp_outsize;
+static int tcp_sending;       // a send whose sent callback has not run
+
+static uint32 next_port = 1024;
+
+static host_event *post_data( struct espconn *conn, int type, const uint8 *data, uint16 len )
+{
+  host_event *ev = ( host_event* )malloc( sizeof( host_event ) + len );
+  if( ev == NULL )
+    return NULL;
+  ev->next = NULL;
+  ev->conn = conn;
+  ev->type = type;
+  ev->port = 0;
+  ev->len = len;
+  if( len )
+    memcpy( ev->data, data, len );
+  *events_tail = ev;
+  events_tail = &ev->next;
+  return ev;
+}
+
+static sint8 post( struct espconn *conn, int type )
+{
+  return post_data( conn, type, NULL, 0 ) ? ESPCONN_OK : ESPCONN_MEM;
+}
+
+static struct espconn **udp_find( struct espconn *conn )
+{
+  int i;
+  for( i = 0; i < UDP_CONNS; i++ )
+    if( udp_conns[ i ] == conn )
+      return &udp_conns[ i ];
+  return NULL;
+}
+
+static struct espconn *udp_bound( int port )
+{
+  int i;
+  for( i = 0; i < UDP_CONNS; i++ )
+    if( udp_conns[ i ] && udp_conns[ i ]->proto.udp->local_port == port )
+      return udp_conns[ i ];
+  return NULL;
+}
+
+// a datagram comes from 127.0.0.1
+static void udp_deliver( struct espconn *conn, host_event *ev )
+{
+  esp_udp *udp = conn->proto.udp;
+  udp->remote_ip[ 0 ] = 127;
+  udp->remote_ip[ 1 ] = udp->remote_ip[ 2 ] = 0;
+  udp->remote_ip[ 3 ] = 1;
+  udp->remote_port = ev->port;
+  if( conn->recv_callback )
+    conn->recv_callback( conn, ( char* )ev->data, ev->len );
+}
+
+// drops what is queued for a connection that goes away
+static void cancel( struct espconn *conn )
+{
+  host_event **pp = &events, *ev;
+  while( ( ev = *pp ) != NULL )
+    if( ev->conn == conn )
+    {
+      *pp = ev->next;
+      free( ev );
+    }
+    else
+      pp = &ev->next;
+  for( events_tail = &events; *events_tail; events_tail = &( *events_tail )->next );
+}
+
+// Runs the queued callbacks, and those they queue, in order. Returns how
+// many ran.
+int host_net_run( void )
+{
+  host_event *ev;
+  int n = 0;
+  while( ( ev = events ) != NULL )
+  {
+    struct espconn *conn = ev->conn;
+    events = ev->next;
+    if( events == NULL )
+      events_tail = &events;
+    n++;
+    switch( ev->type )
+    {
+      case EV_CONNECT:
+        if( conn->proto.tcp->connect_callback )
+          conn->proto.tcp->connect_callback( conn );
+        break;
+      case EV_SENT:
+        if( conn == tcp_conn )
+          tcp_sending = 0;
+        if( conn->sent_callback )
+          conn->sent_callback( conn );
+        break;
+      case EV_DISCON:
+        if( conn->proto.tcp->disconnect_callback )
+          conn->proto.tcp->disconnect_callback( conn );
+        break;
+      case EV_RECV:
+        udp_deliver( conn, ev );
+        break;
+    }
+    free( ev );
+  }
+  return n;
+}
+
+int host_net_pending( void )
+{
+  return events != NULL;
+}
+
+int host_tcp_receive( const uint8 *data, size_t len )
+{
+  uint8 *copy;
+  if( tcp_conn == NULL )
+    return 0;
+  if( tcp_conn->recv_callback && len > 0 )
+  {
+    // the callback may keep pointers into it until it returns, as on the
+    // device, but no longer
+    if( ( copy = ( uint8* )malloc( len ) ) == NULL )
+      return 0;
+    memcpy( copy, data, len );
+    tcp_conn->recv_callback( tcp_conn, ( char* )copy, ( unsigned short )len );
+    free( copy );
+  }
+  return 1;
+}
+
+const uint8 *host_tcp_sent( size_t *len )
+{
+  *len = tcp_outlen;
+  tcp_outlen = 0;
+  return tcp_out;
+}
+
+// the peer closes the connection, the client is called back as if it had
+// been reset
+int host_tcp_close( void )
+{
+  struct espconn *conn = tcp_conn;
+  if( conn == NULL )
+    return 0;
+  tcp_conn = NULL;
+  tcp_sending = 0;
+  cancel( conn );
+  return post( conn, EV_DISCON ) == ESPCONN_OK;
+}
+
+// ****************************************************************************
+// The SDK's functions
+
+sint8 espconn_create( struct espconn *espconn )
+{
+  struct espconn **slot;
+  if( espconn->type != ESPCONN_UDP || espconn->proto.udp == NULL )
+    return ESPCONN_ARG;
+  if( udp_find( espconn ) )
+    return ESPCONN_ISCONN;
+  if( ( slot = udp_find( NULL ) ) == NULL )
+    return ESPCONN_MEM;
+  *slot = espconn;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_delete( struct espconn *espconn )
+{
+  struct espconn **slot = udp_find( espconn );
+  if( slot == NULL )
+    return ESPCONN_ARG;
+  *slot = NULL;
+  cancel( espconn );
+  return ESPCONN_OK;
+}
+
+sint8 espconn_connect( struct espconn *espconn )
+{
+  if( espconn->type != ESPCONN_TCP || espconn->proto.tcp == NULL )
+    return ESPCONN_ARG;
+  if( tcp_conn == espconn )
+    return ESPCONN_ISCONN;
+  tcp_conn = espconn;
+  tcp_outlen = 0;
+  tcp_sending = 0;
+  return post( espconn, EV_CONNECT );
+}
+
+sint8 espconn_disconnect( struct espconn *espconn )
+{
+  if( espconn != tcp_conn )
+    return ESPCONN_ARG;
+  tcp_conn = NULL;
+  tcp_sending = 0;
+  cancel( espconn );
+  return post( espconn, EV_DISCON );
+}
+
+sint8 espconn_sent( struct espconn *espconn, uint8 *psent, uint16 length )
+{
+  if( espconn->type == ESPCONN_UDP )
+  {
+    struct espconn *to;
+    host_event *ev;
+    if( !udp_find( espconn ) )
+      return ESPCONN_ARG;
+    to = udp_bound( espconn->proto.udp->remote_port );
+    if( to && to != espconn )
+    {
+      if( ( ev = post_data( to, EV_RECV, psent, length ) ) == NULL )
+        return ESPCONN_MEM;
+      ev->port = espconn->proto.udp->local_port;
+    }
+    return post( espconn, EV_SENT );
+  }
+  if( espconn != tcp_conn )
+    return ESPCONN_CONN;
+  if( tcp_sending )
+    return ESPCONN_INPROGRESS;
+  if( tcp_outlen + length > tcp_outsize )
+  {
+    size_t size = ( tcp_outlen + length ) * 2;
+    uint8 *p = ( uint8* )realloc( tcp_out, size );
+    if( p == NULL )
+      return ESPCONN_MEM;
+    tcp_out = p;
+    tcp_outsize = size;
+  }
+  memcpy( tcp_out + tcp_outlen, psent, length );
+  tcp_outlen += length;
+  tcp_sending = 1;
+  return post( espconn, EV_SENT );
+}
+
+sint8 espconn_regist_recvcb( struct espconn *espconn, espconn_recv_callback recv_cb )
+{
+  espconn->recv_callback = recv_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_sentcb( struct espconn *espconn, espconn_sent_callback sent_cb )
+{
+  espconn->sent_callback = sent_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_connectcb( struct espconn *espconn, espconn_connect_callback connect_cb )
+{
+  espconn->proto.tcp->connect_callback = connect_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_reconcb( struct espconn *espconn, espconn_reconnect_callback recon_cb )
+{
+  espconn->proto.tcp->reconnect_callback = recon_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_disconcb( struct espconn *espconn, espconn_connect_callback discon_cb )
+{
+  espconn->proto.tcp->disconnect_callback = discon_cb;
+  return ESPCONN_OK;
+}
+
+// only localhost has a name
+sint8 espconn_gethostbyname( struct espconn *pespconn, const char *hostname, ip_addr_t *addr, dns_found_callback found )
+{
+  if( strcmp( hostname, "localhost" ) != 0 )
+    return ESPCONN_ARG;
+  addr->addr = htonl( INADDR_LOOPBACK );
+  return ESPCONN_OK;
+}
+
+uint32 espconn_port( void )
+{
+  return next_port++;
+}
+
+uint32 ipaddr_addr( const char *cp )
+{
+  return inet_addr( cp );
+}
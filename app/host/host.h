@@ -0,0 +1,45 @@
+// What the host build adds to the platform, for its main program
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#include "c_types.h"
+
+void host_heap_init( size_t limit );
+size_t host_heap_used( void );
+size_t host_heap_peak( void );
+
+// the heap of -H, how it is cut up and what finding blocks in it cost
+typedef struct
+{
+  size_t free;              // bytes in free blocks
+  size_t largest;           // largest free block
+  size_t fragments;         // free blocks
+  unsigned long allocs;     // allocations
+  unsigned long steps;      // free blocks passed over to find them
+  unsigned long maxsteps;   // most passed over for one
+} host_heap_stats;
+
+int host_heap_arena( host_heap_stats *st );  // 0 without -H
+
+// the SDK's timers, on the clock of system_get_time(), which runs in real
+// time and jumps ahead by what host_clock_advance() is given
+int host_timers_run( void );
+void host_clock_advance( uint32_t ms );
+
+// the SDK's connections, in process (espconn.c): the queued callbacks, and
+// the peer of the last TCP connection a client opened
+int host_net_run( void );
+int host_net_pending( void );
+int host_tcp_receive( const uint8_t *data, size_t len );
+const uint8_t *host_tcp_sent( size_t *len );
+int host_tcp_close( void );
+
+// the host table for test scripts (lhost.c)
+struct lua_State;
+int luaopen_host( struct lua_State *L );
+
+void host_flash_init( void );
+uint8_t *host_flash( void );
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _C_CTYPE_H_
+#define _C_CTYPE_H_
+
+#include <ctype.h>
+
+#endif /* _C_CTYPE_H_ */
@@ -0,0 +1,6 @@
+#ifndef __c_stdarg_h
+#define __c_stdarg_h
+
+#include <stdarg.h>
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef __c_stddef_h
+#define __c_stddef_h
+
+#include <stddef.h>
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * c_stdio.h for the host build: the firmware's console is stdout.
+ */
+
+#ifndef _C_STDIO_H_
+#define _C_STDIO_H_
+
+#include <stdio.h>
+#include "osapi.h"
+
+#define c_stdin stdin
+#define c_stdout stdout
+#define c_stderr stderr
+
+#define c_puts(s) fputs((s), stdout)
+#define c_printf printf
+#define c_sprintf sprintf
+#define c_fprintf fprintf
+#define c_fputs fputs
+#define c_fflush fflush
+#define c_getc getc
+#define c_ungetc ungetc
+
+#endif /* _C_STDIO_H_ */
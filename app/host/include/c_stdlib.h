@@ -0,0 +1,26 @@
+/*
+ * c_stdlib.h for the host build.
+ */
+
+#ifndef _C_STDLIB_H_
+#define _C_STDLIB_H_
+
+#include <stdlib.h>
+#include "mem.h"
+
+#define c_free os_free
+#define c_malloc os_malloc
+#define c_zalloc os_zalloc
+#define c_realloc os_realloc
+
+#define c_abs	abs
+#define c_atoi	atoi
+#define c_strtod	strtod
+#define c_strtol	strtol
+#define c_strtoul	strtoul
+#define c_getenv	getenv
+#define c_exit	exit
+
+#include "c_heaptrace.h"
+
+#endif /* _C_STDLIB_H_ */
@@ -0,0 +1,102 @@
+/*
+ * espconn.h for the host build: the SDK's connections, as far as the
+ * modules built for the host use them, and the lwIP addresses that come
+ * with them on the device. espconn.c runs them in process.
+ */
+
+#ifndef __ESPCONN_H__
+#define __ESPCONN_H__
+
+#include "c_types.h"
+
+typedef void (* espconn_connect_callback)(void *arg);
+typedef void (* espconn_reconnect_callback)(void *arg, sint8 err);
+
+#define ESPCONN_OK          0
+#define ESPCONN_MEM        -1
+#define ESPCONN_INPROGRESS -5
+#define ESPCONN_CONN       -11
+#define ESPCONN_ARG        -12
+#define ESPCONN_ISCONN     -15
+
+typedef struct ip_addr {
+  uint32 addr;
+} ip_addr_t;
+
+#define IPADDR_NONE     ((uint32)0xffffffffUL)
+#define IPSTR           "%d.%d.%d.%d"
+#define IP2STR(ipaddr)  ((uint8 *)(ipaddr))[0], ((uint8 *)(ipaddr))[1], \
+                        ((uint8 *)(ipaddr))[2], ((uint8 *)(ipaddr))[3]
+
+typedef void (* dns_found_callback)(const char *name, ip_addr_t *ipaddr, void *arg);
+
+enum espconn_type {
+  ESPCONN_INVALID    = 0,
+  ESPCONN_TCP        = 0x10,
+  ESPCONN_UDP        = 0x20,
+};
+
+enum espconn_state {
+  ESPCONN_NONE,
+  ESPCONN_WAIT,
+  ESPCONN_LISTEN,
+  ESPCONN_CONNECT,
+  ESPCONN_WRITE,
+  ESPCONN_READ,
+  ESPCONN_CLOSE
+};
+
+typedef struct _esp_tcp {
+  int remote_port;
+  int local_port;
+  uint8 local_ip[4];
+  uint8 remote_ip[4];
+  espconn_connect_callback connect_callback;
+  espconn_reconnect_callback reconnect_callback;
+  espconn_connect_callback disconnect_callback;
+  espconn_connect_callback write_finish_fn;
+} esp_tcp;
+
+typedef struct _esp_udp {
+  int remote_port;
+  int local_port;
+  uint8 local_ip[4];
+  uint8 remote_ip[4];
+} esp_udp;
+
+typedef void (* espconn_recv_callback)(void *arg, char *pdata, unsigned short len);
+typedef void (* espconn_sent_callback)(void *arg);
+
+struct espconn {
+  enum espconn_type type;
+  enum espconn_state state;
+  union {
+    esp_tcp *tcp;
+    esp_udp *udp;
+  } proto;
+  espconn_recv_callback recv_callback;
+  espconn_sent_callback sent_callback;
+  uint8 link_cnt;
+  void *reverse;
+};
+
+sint8 espconn_create(struct espconn *espconn);
+sint8 espconn_delete(struct espconn *espconn);
+sint8 espconn_connect(struct espconn *espconn);
+sint8 espconn_disconnect(struct espconn *espconn);
+sint8 espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length);
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb);
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb);
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb);
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb);
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb);
+sint8 espconn_gethostbyname(struct espconn *pespconn, const char *hostname, ip_addr_t *addr, dns_found_callback found);
+uint32 espconn_port(void);
+uint32 ipaddr_addr(const char *cp);
+
+// there is no TLS on the host, a secure connection is a plain one
+#define espconn_secure_connect     espconn_connect
+#define espconn_secure_disconnect  espconn_disconnect
+#define espconn_secure_sent        espconn_sent
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * flash_api.h for the host build: constants live in RAM, no alignment games.
+ */
+
+#ifndef __FLASH_API_H__
+#define __FLASH_API_H__
+
+#include "c_types.h"
+
+#define byte_of_aligned_array(aligned_array, index) \
+  ((uint8_t)(aligned_array)[(index)])
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * lwip/app/espconn.h for the host build: the TLS code only passes these
+ * around.
+ */
+
+#ifndef __ESPCONN_H__
+#define __ESPCONN_H__
+
+#include "lwip/tcp.h"
+
+struct espconn;
+typedef struct _espconn_msg espconn_msg;
+
+#endif
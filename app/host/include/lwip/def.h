@@ -0,0 +1,11 @@
+/*
+ * lwip/def.h for the host build.
+ */
+
+#ifndef __LWIP_DEF_H__
+#define __LWIP_DEF_H__
+
+#include <arpa/inet.h>
+#include "lwip/opt.h"
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef __LWIP_MEM_H__
+#define __LWIP_MEM_H__
+
+#include "../mem.h"
+#include "../osapi.h"
+
+#endif
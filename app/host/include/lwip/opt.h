@@ -0,0 +1,22 @@
+/*
+ * lwip/opt.h for the host build: the types lwIP's headers bring along.
+ */
+
+#ifndef __LWIP_OPT_H__
+#define __LWIP_OPT_H__
+
+#include "c_types.h"
+
+typedef uint8_t   u8_t;
+typedef int8_t    s8_t;
+typedef uint16_t  u16_t;
+typedef int16_t   s16_t;
+typedef uint32_t  u32_t;
+typedef int32_t   s32_t;
+
+typedef s8_t err_t;
+
+#define ERR_OK    0
+#define ERR_MEM  -1
+
+#endif
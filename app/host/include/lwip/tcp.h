@@ -0,0 +1,23 @@
+/*
+ * lwip/tcp.h for the host build: what the TLS code uses of a TCP PCB, a
+ * socket behind it (see tls.c).
+ */
+
+#ifndef __LWIP_TCP_H__
+#define __LWIP_TCP_H__
+
+#include "lwip/opt.h"
+#include "lwip/mem.h"
+#include "lwip/pbuf.h"
+
+struct tcp_pcb {
+  u16_t mss;
+  int fd;             /* the socket */
+};
+
+#define tcp_sndbuf(pcb)   0xffff
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags);
+err_t tcp_output(struct tcp_pcb *pcb);
+
+#endif
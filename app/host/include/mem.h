@@ -0,0 +1,21 @@
+/*
+ * mem.h for the host build: the heap is the C library's, capped at the size
+ * of the device's (see host_heap in platform.c).
+ */
+
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include <stddef.h>
+
+void *host_malloc(size_t size);
+void *host_zalloc(size_t size);
+void *host_realloc(void *ptr, size_t size);
+void host_free(void *ptr);
+
+#define os_malloc   host_malloc
+#define os_free     host_free
+#define os_zalloc   host_zalloc
+#define os_realloc  host_realloc
+
+#endif
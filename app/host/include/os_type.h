@@ -0,0 +1,28 @@
+/*
+ * os_type.h for the host build: the SDK's software timers, run by
+ * host_timers_run() (see platform.c).
+ */
+
+#ifndef _OS_TYPES_H_
+#define _OS_TYPES_H_
+
+#include "c_types.h"
+
+typedef void ETSTimerFunc(void *timer_arg);
+
+typedef struct _ETSTIMER_ {
+  struct _ETSTIMER_ *timer_next;
+  uint32_t timer_expire;      /* system_get_time() it fires at */
+  uint32_t timer_period;      /* us, 0 for once */
+  ETSTimerFunc *timer_func;
+  void *timer_arg;
+} ETSTimer;
+
+#define os_timer_func_t ETSTimerFunc
+#define os_timer_t      ETSTimer
+
+void os_timer_setfn(os_timer_t *ptimer, os_timer_func_t *pfunction, void *parg);
+void os_timer_arm(os_timer_t *ptimer, uint32_t milliseconds, bool repeat_flag);
+void os_timer_disarm(os_timer_t *ptimer);
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * osapi.h for the host build.
+ */
+
+#ifndef _OSAPI_H_
+#define _OSAPI_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "user_config.h"
+#include "os_type.h"
+
+#define os_memcmp memcmp
+#define os_memcpy memcpy
+#define os_memmove memmove
+#define os_memset memset
+#define os_bzero bzero
+#define os_strcat strcat
+#define os_strchr strchr
+#define os_strcmp strcmp
+#define os_strcpy strcpy
+#define os_strlen strlen
+#define os_strncmp strncmp
+#define os_strncpy strncpy
+#define os_strstr strstr
+#define os_sprintf sprintf
+#define os_printf printf
+#define os_putc putchar
+
+#endif
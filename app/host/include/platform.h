@@ -0,0 +1,40 @@
+/*
+ * platform.h for the host build: the flash is an array in RAM, the rest of
+ * the platform interface is not there.
+ */
+
+#ifndef __PLATFORM_H__
+#define __PLATFORM_H__
+
+#include "c_types.h"
+#include "user_config.h"
+
+enum
+{
+  PLATFORM_ERR,
+  PLATFORM_OK,
+  PLATFORM_UNDERFLOW = -1
+};
+
+#ifndef HOST_FLASH_SIZE
+#define HOST_FLASH_SIZE                 ( 4 * 1024 * 1024 )
+#endif
+// where the firmware would end, SPIFFS comes behind it
+#ifndef HOST_FIRMWARE_SIZE
+#define HOST_FIRMWARE_SIZE              0x60000
+#endif
+
+#define INTERNAL_FLASH_SECTOR_SIZE      4096
+#define INTERNAL_FLASH_WRITE_UNIT_SIZE  4
+#define INTERNAL_FLASH_READ_UNIT_SIZE   4
+#define INTERNAL_FLASH_SIZE             ( HOST_FLASH_SIZE - 4 * INTERNAL_FLASH_SECTOR_SIZE )
+#define INTERNAL_FLASH_START_ADDRESS    0x40200000
+
+uint32_t platform_flash_get_first_free_block_address( uint32_t *psect );
+uint32_t platform_flash_get_sector_of_address( uint32_t addr );
+uint32_t platform_flash_write( const void *from, uint32_t toaddr, uint32_t size );
+uint32_t platform_flash_read( void *to, uint32_t fromaddr, uint32_t size );
+uint32_t platform_flash_get_num_sectors(void);
+int platform_flash_erase_sector( uint32_t sector_id );
+
+#endif
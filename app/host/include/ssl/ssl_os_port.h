@@ -0,0 +1,24 @@
+/*
+ * ssl_os_port.h for the host build: the C library has struct timeval and
+ * time_t already.
+ */
+
+#ifndef HEADER_OS_PORT_H
+#define HEADER_OS_PORT_H
+
+#include <sys/time.h>
+#include "c_types.h"
+#include "osapi.h"
+#include <stdio.h>
+
+#define ssl_printf(fmt, args...)
+
+#define STDCALL
+#define EXP_FUNC
+
+#define SSL_CTX_MUTEX_INIT(A)
+#define SSL_CTX_MUTEX_DESTROY(A)
+#define SSL_CTX_LOCK(A)
+#define SSL_CTX_UNLOCK(A)
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * user_interface.h for the host build: what the modules built for the host
+ * use of the SDK.
+ */
+
+#ifndef __USER_INTERFACE_H__
+#define __USER_INTERFACE_H__
+
+#include "c_types.h"
+
+uint32 system_get_free_heap_size(void);
+uint32 system_get_time(void);
+uint32 system_get_chip_id(void);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __USER_MODULES_H__
+#define __USER_MODULES_H__
+
+// the modules the host build has, those that need no hardware; the network
+// is in process (espconn.c)
+#define LUA_USE_BUILTIN_STRING
+#define LUA_USE_BUILTIN_TABLE
+#define LUA_USE_BUILTIN_COROUTINE
+#define LUA_USE_BUILTIN_MATH
+#define LUA_USE_BUILTIN_DEBUG_MINIMAL
+
+#define LUA_USE_MODULES
+
+#ifdef LUA_USE_MODULES
+#define LUA_USE_MODULES_FILE
+#define LUA_USE_MODULES_BIT
+#define LUA_USE_MODULES_CJSON
+#define LUA_USE_MODULES_COAP
+#define LUA_USE_MODULES_CRYPTO
+#define LUA_USE_MODULES_MQTT
+#endif /* LUA_USE_MODULES */
+
+#endif	/* __USER_MODULES_H__ */
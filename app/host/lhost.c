@@ -0,0 +1,101 @@
+// The host table of nodemcu-host: what a test script needs to stand in for
+// the SDK's task loop and for the other end of a connection.
+//
+//   host.run([ms])       runs the callbacks that are due, those of the
+//                        connections and of the timers, until none is left;
+//                        with ms the clock goes on that far, to each timer
+//                        in turn, as if the script had waited
+//   host.receive(data)   the peer of the last TCP connection a client opened
+//                        sends data; false if there is none
+//   host.sent()          what the client sent on it since the last call
+//   host.close()         the peer hangs up; false if there is no connection
+//   host.clock()         the CPU time of the process so far, in seconds, for
+//                        benchmarks to time their parts
+//   host.rotables()      the names of the read-only tables of lua_rotable[]
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lrotable.h"
+#include "host.h"
+
+#include <time.h>
+
+extern const luaR_table lua_rotable[];
+
+static int host_run( lua_State *L )
+{
+  uint32_t left = luaL_optinteger( L, 1, 0 );
+  uint32_t step;
+  int wait;
+  for( ;; )
+  {
+    host_net_run();
+    wait = host_timers_run();
+    if( host_net_pending() )
+      continue;
+    if( left == 0 )
+      break;
+    step = wait < 0 || ( uint32_t )wait > left ? left : ( uint32_t )wait;
+    host_clock_advance( step );
+    left -= step;
+  }
+  return 0;
+}
+
+static int host_receive( lua_State *L )
+{
+  size_t len;
+  const char *data = luaL_checklstring( L, 1, &len );
+  lua_pushboolean( L, host_tcp_receive( ( const uint8_t* )data, len ) );
+  return 1;
+}
+
+static int host_sent( lua_State *L )
+{
+  size_t len;
+  const uint8_t *data = host_tcp_sent( &len );
+  lua_pushlstring( L, ( const char* )data, len );
+  return 1;
+}
+
+static int host_close( lua_State *L )
+{
+  lua_pushboolean( L, host_tcp_close() );
+  return 1;
+}
+
+static int host_clock( lua_State *L )
+{
+  lua_pushnumber( L, ( lua_Number )clock() / CLOCKS_PER_SEC );
+  return 1;
+}
+
+static int host_rotables( lua_State *L )
+{
+  int i, n = 0;
+  lua_newtable( L );
+  for( i = 0; lua_rotable[ i ].name; i++ )
+    if( *lua_rotable[ i ].name )      // the unnamed are metatables
+    {
+      lua_pushstring( L, lua_rotable[ i ].name );
+      lua_rawseti( L, -2, ++n );
+    }
+  return 1;
+}
+
+static const luaL_Reg host_funcs[] =
+{
+  { "run", host_run },
+  { "receive", host_receive },
+  { "sent", host_sent },
+  { "close", host_close },
+  { "clock", host_clock },
+  { "rotables", host_rotables },
+  { NULL, NULL }
+};
+
+int luaopen_host( lua_State *L )
+{
+  luaL_register_light( L, "host", host_funcs );   // no heap for the functions, the scripts measure it
+  return 1;
+}
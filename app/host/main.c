@@ -0,0 +1,514 @@
+/*
+** nodemcu-host: the firmware's Lua with the modules that need no hardware,
+** on SPIFFS in an emulated flash, for running scripts off the device.
+** See Copyright Notice in lua.h
+*/
+
+#include "c_stdio.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "legc.h"
+#include "lgc.h"
+#include "lprofile.h"
+#include "lstate.h"
+#include "ltm.h"
+#include "flash_fs.h"
+#include "platform.h"
+#include "os_type.h"
+#include "host.h"
+
+#define PROGNAME	"nodemcu-host"
+
+static const char *progname = PROGNAME;
+static const char *flashfile = NULL;	/* -F: flash contents kept here */
+static int stats = 0;			/* -s: report CPU time and heap */
+static int egcmode = EGC_ALWAYS;	/* emergency GC set as on the device */
+static unsigned egclimit = 4096;
+static const char *profile = NULL;	/* -p: folded stacks go here */
+static int pool = 1;			/* -m: small objects from the heap */
+
+static void usage (const char *message) {
+  if (*message == '-')
+    fprintf(stderr, "%s: unrecognized option " LUA_QS "\n", progname, message);
+  else
+    fprintf(stderr, "%s: %s\n", progname, message);
+  fprintf(stderr,
+  "usage: %s [options] [script [args]].\n"
+  "Available options are:\n"
+  "  -e stat  execute string " LUA_QL("stat") "\n"
+  "  -i       enter interactive mode after running the script\n"
+  "  -u file  upload " LUA_QL("file") " to SPIFFS under its name, without directory\n"
+  "  -F image keep the flash in " LUA_QL("image") ": read it if it exists, write it on exit\n"
+  "  -H bytes give the heap the size of the device's\n"
+  "  -g       run the standard collector, not the emergency GC of the device\n"
+  "  -E mode[:limit]  set the emergency GC as node.egc_setmode does, mode\n"
+  "           none, failure, limit, always or adaptive\n"
+  "  -m       allocate small objects from the heap, not from the pool\n"
+  "  -s       report CPU time and heap use by subsystem and size on exit\n"
+  "  -p file  profile the VM, write the sampled stacks to " LUA_QL("file") "\n"
+  "           for flamegraph.pl, and with -s the instruction counts to stderr\n"
+  "  --       stop handling options\n"
+  "  -        run stdin\n",
+  progname);
+  exit(EXIT_FAILURE);
+}
+
+static void fatal (const char *message) {
+  fprintf(stderr, "%s: %s\n", progname, message);
+  exit(EXIT_FAILURE);
+}
+
+static int report (lua_State *L, int status) {
+  if (status && !lua_isnil(L, -1)) {
+    const char *msg = lua_tostring(L, -1);
+    if (msg == NULL) msg = "(error object is not a string)";
+    fprintf(stderr, "%s: %s\n", progname, msg);
+    fflush(stderr);
+    lua_pop(L, 1);
+  }
+  return status;
+}
+
+static int traceback (lua_State *L) {
+  if (!lua_isstring(L, 1))  /* 'message' not a string? */
+    return 1;  /* keep it intact */
+  lua_getfield(L, LUA_GLOBALSINDEX, "debug");
+  if (!lua_istable(L, -1) && !lua_isrotable(L, -1)) {
+    lua_pop(L, 1);
+    return 1;
+  }
+  lua_getfield(L, -1, "traceback");
+  if (!lua_isfunction(L, -1) && !lua_islightfunction(L, -1)) {
+    lua_pop(L, 2);
+    return 1;
+  }
+  lua_pushvalue(L, 1);  /* pass error message */
+  lua_pushinteger(L, 2);  /* skip this function and traceback */
+  lua_call(L, 2, 1);  /* call debug.traceback */
+  return 1;
+}
+
+static int docall (lua_State *L, int narg, int clear) {
+  int status;
+  int base = lua_gettop(L) - narg;  /* function index */
+  lua_pushcfunction(L, traceback);  /* push traceback function */
+  lua_insert(L, base);  /* put it under chunk and args */
+  status = lua_pcall(L, narg, (clear ? 0 : LUA_MULTRET), base);
+  lua_remove(L, base);  /* remove traceback function */
+  if (status != 0) lua_gc(L, LUA_GCCOLLECT, 0);
+  return status;
+}
+
+/* read a host file, NULL for stdin, into a new buffer */
+static char *readfile (const char *name, size_t *size) {
+  FILE *f = name ? fopen(name, "rb") : stdin;
+  char *b = NULL;
+  size_t n = 0, m = 0;
+  if (f == NULL) return NULL;
+  for (;;) {
+    if (n == m) {
+      char *nb = realloc(b, m = m ? 2*m : 4096);
+      if (nb == NULL) fatal("not enough memory to read a file");
+      b = nb;
+    }
+    n += fread(b + n, 1, m - n, f);
+    if (n < m) break;
+  }
+  if (ferror(f)) {
+    free(b);
+    b = NULL;
+  }
+  if (f != stdin) fclose(f);
+  *size = n;
+  return b;
+}
+
+static int loadhostfile (lua_State *L, const char *name) {
+  size_t size;
+  char *b = readfile(name, &size);
+  int status;
+  if (b == NULL) {
+    lua_pushfstring(L, "cannot read %s", name ? name : "stdin");
+    return LUA_ERRFILE;
+  }
+  lua_pushfstring(L, "@%s", name ? name : "stdin");
+  status = luaL_loadbuffer(L, b, size, lua_tostring(L, -1));
+  lua_remove(L, -2);
+  free(b);
+  return status;
+}
+
+/* copy a host file into SPIFFS, under its name without directory */
+static void upload (const char *name) {
+  const char *base = strrchr(name, '/');
+  size_t size;
+  char *b = readfile(name, &size);
+  int fd;
+  base = base ? base + 1 : name;
+  if (b == NULL)
+    fatal("cannot read the file to upload");
+  if (strlen(base) > FS_NAME_MAX_LENGTH)
+    fatal("name of the file to upload too long");
+  fd = fs_open(base, FS_WRONLY | FS_CREAT | FS_TRUNC);
+  if (fd < FS_OPEN_OK)
+    fatal("cannot create the uploaded file in SPIFFS");
+  if (size > 0 && fs_write(fd, b, size) != size)
+    fatal("SPIFFS is full");
+  fs_close(fd);
+  free(b);
+}
+
+static void loadflash (void) {
+  FILE *f;
+  host_flash_init();
+  if (flashfile == NULL || (f = fopen(flashfile, "rb")) == NULL)
+    return;  /* a new, erased flash */
+  if (fread(host_flash(), 1, HOST_FLASH_SIZE, f) != HOST_FLASH_SIZE)
+    fatal("flash image has the wrong size");
+  fclose(f);
+}
+
+static void saveflash (void) {
+  FILE *f;
+  if (flashfile == NULL)
+    return;
+  if ((f = fopen(flashfile, "wb")) == NULL ||
+      fwrite(host_flash(), 1, HOST_FLASH_SIZE, f) != HOST_FLASH_SIZE ||
+      fclose(f) != 0)
+    fatal("cannot write the flash image");
+}
+
+static const char *get_prompt (lua_State *L, int firstline) {
+  const char *p;
+  lua_getfield(L, LUA_GLOBALSINDEX, firstline ? "_PROMPT" : "_PROMPT2");
+  p = lua_tostring(L, -1);
+  if (p == NULL) p = (firstline ? LUA_PROMPT : LUA_PROMPT2);
+  lua_pop(L, 1);  /* remove global */
+  return p;
+}
+
+static int incomplete (lua_State *L, int status) {
+  if (status == LUA_ERRSYNTAX) {
+    size_t lmsg;
+    const char *msg = lua_tolstring(L, -1, &lmsg);
+    const char *tp = msg + lmsg - (sizeof(LUA_QL("<eof>")) - 1);
+    if (strstr(msg, LUA_QL("<eof>")) == tp) {
+      lua_pop(L, 1);
+      return 1;
+    }
+  }
+  return 0;  /* else... */
+}
+
+static int pushline (lua_State *L, int firstline) {
+  char buffer[LUA_MAXINPUT];
+  size_t l;
+  fputs(get_prompt(L, firstline), stdout);
+  fflush(stdout);
+  if (fgets(buffer, sizeof(buffer), stdin) == NULL)
+    return 0;  /* no input */
+  l = strlen(buffer);
+  if (l > 0 && buffer[l-1] == '\n')  /* line ends with newline? */
+    buffer[l-1] = '\0';  /* remove it */
+  if (firstline && buffer[0] == '=')  /* first line starts with `=' ? */
+    lua_pushfstring(L, "return %s", buffer+1);  /* change it to `return' */
+  else
+    lua_pushstring(L, buffer);
+  return 1;
+}
+
+static int loadline (lua_State *L) {
+  int status;
+  lua_settop(L, 0);
+  if (!pushline(L, 1))
+    return -1;  /* no input */
+  for (;;) {  /* repeat until gets a complete line */
+    status = luaL_loadbuffer(L, lua_tostring(L, 1), lua_strlen(L, 1), "=stdin");
+    if (!incomplete(L, status)) break;  /* cannot try to add lines? */
+    if (!pushline(L, 0))  /* no more input? */
+      return -1;
+    lua_pushliteral(L, "\n");  /* add a new line... */
+    lua_insert(L, -2);  /* ...between the two lines */
+    lua_concat(L, 3);  /* join them */
+  }
+  lua_remove(L, 1);  /* remove line */
+  return status;
+}
+
+static void dotty (lua_State *L) {
+  int status;
+  while ((status = loadline(L)) != -1) {
+    if (status == 0) status = docall(L, 0, 0);
+    report(L, status);
+    if (status == 0 && lua_gettop(L) > 0) {  /* any result to print? */
+      lua_getglobal(L, "print");
+      lua_insert(L, 1);
+      if (lua_pcall(L, lua_gettop(L)-1, 0, 0) != 0)
+        fprintf(stderr, "%s: %s\n", progname, lua_pushfstring(L,
+                "error calling " LUA_QL("print") " (%s)", lua_tostring(L, -1)));
+    }
+  }
+  lua_settop(L, 0);  /* clear stack */
+  fputs("\n", stdout);
+  fflush(stdout);
+}
+
+/* the line the CoAP server's /v1/c endpoint takes, run from lua_timer as on
+** the device, but whole: there is no console to go on with it */
+static char coap_line[LUA_MAXINPUT];
+lua_Load gLoad;
+os_timer_t lua_timer;
+
+void dojob (lua_Load *load) {
+  lua_State *L = load->L;
+  int top = lua_gettop(L);
+  int status = luaL_loadbuffer(L, load->line, strlen(load->line), "=stdin");
+  if (status == 0) status = docall(L, 0, 0);
+  report(L, status);
+  lua_settop(L, top);
+  load->line_position = 0;
+  load->done = 0;
+}
+
+/* the script's arguments go to `arg', as with the stand-alone lua */
+static int getargs (lua_State *L, char **argv, int n) {
+  int narg;
+  int i;
+  int argc = 0;
+  while (argv[argc]) argc++;  /* count total number of arguments */
+  narg = argc - (n + 1);  /* number of arguments to the script */
+  luaL_checkstack(L, narg + 3, "too many arguments to script");
+  for (i=n+1; i < argc; i++)
+    lua_pushstring(L, argv[i]);
+  lua_createtable(L, narg, n + 1);
+  for (i=0; i < argc; i++) {
+    lua_pushstring(L, argv[i]);
+    lua_rawseti(L, -2, i - n);
+  }
+  return narg;
+}
+
+/* -E mode[:limit] */
+static void setegc (const char *arg) {
+  static const char *const modes[] = { "none", "failure", "limit", "always",
+                                       "adaptive", NULL };
+  static const int mode[] = { EGC_NOT_ACTIVE, EGC_ON_ALLOC_FAILURE,
+                              EGC_ON_MEM_LIMIT, EGC_ALWAYS, EGC_ADAPTIVE };
+  size_t l = strcspn(arg, ":");
+  int i;
+  for (i = 0; modes[i]; i++)
+    if (strlen(modes[i]) == l && strncmp(arg, modes[i], l) == 0)
+      break;
+  if (modes[i] == NULL)
+    usage("unknown mode of the emergency GC");
+  egcmode = mode[i];
+  egclimit = arg[l] ? strtoul(arg + l + 1, NULL, 0) : 0;
+  if (egcmode == EGC_ON_MEM_LIMIT && egclimit == 0)
+    usage("the limit mode needs a limit");
+}
+
+static int writeprofile (lua_State *L, const void *p, size_t size, void *f) {
+  (void)L;
+  return fwrite(p, 1, size, (FILE *)f) != size;
+}
+
+/* print the counts in table at -1, one `name count' to a line */
+static void printcounts (lua_State *L, const char *what) {
+  fprintf(stderr, "%s: %s\n", progname, what);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    fprintf(stderr, "%s %.14g\n", lua_tostring(L, -2), lua_tonumber(L, -1));
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+}
+
+static void saveprofile (lua_State *L) {
+  FILE *f = fopen(profile, "w");
+  lprofile_stop(L);
+  if (f == NULL || lprofile_dumpstacks(L, writeprofile, f) != 0 || fclose(f) != 0)
+    fatal("cannot write the profile");
+  if (stats) {
+    lprofile_pushopcodes(L);
+    printcounts(L, "instructions by opcode");
+    lprofile_pushfunctions(L);
+    printcounts(L, "instructions by function");
+  }
+}
+
+/* the Lua objects by type, and what the tracer counted of the heap */
+static void printheap (lua_State *L) {
+  lu_mem count[LUA_TUPVAL + 1], bytes[LUA_TUPVAL + 1];
+  host_heap_stats h;
+  int i;
+  if (host_heap_arena(&h))
+    fprintf(stderr, "%s: heap %u bytes free in %u pieces, the largest %u; "
+            "%lu allocations passed over %.1f free blocks, %lu at most\n",
+            progname, (unsigned)h.free, (unsigned)h.fragments,
+            (unsigned)h.largest, h.allocs,
+            h.allocs ? (double)h.steps / h.allocs : 0.0, h.maxsteps);
+#ifdef LUA_POOL
+  fprintf(stderr, "%s: pool %d slabs of %d bytes, %u bytes in use, "
+          "%u blocks from the heap\n", progname, G(L)->pool.nslab, POOL_SLAB,
+          (unsigned)G(L)->pool.used, (unsigned)G(L)->pool.missed);
+#endif
+  fprintf(stderr, "%s: GC %u cycles, %u steps ahead of pace, %u full "
+          "collections, %u allocations failed, %u failed first with the heap in pieces\n",
+          progname, (unsigned)G(L)->egc.cycles, (unsigned)G(L)->egc.steps,
+          (unsigned)G(L)->egc.fullgcs, (unsigned)G(L)->egc.failures,
+          (unsigned)G(L)->egc.fragmented);
+  luaC_census(L, count, bytes);
+  fprintf(stderr, "%s: Lua objects by type\n", progname);
+  for (i = LUA_TSTRING; i <= LUA_TUPVAL; i++)
+    fprintf(stderr, "%-8s %8lu objects %9lu bytes\n", luaT_typenames[i],
+            (unsigned long)count[i], (unsigned long)bytes[i]);
+  fprintf(stderr, "%s: heap by subsystem, %u bytes at most, %u failed\n",
+          progname, (unsigned)c_heap.peak, (unsigned)c_heap.failed);
+  for (i = 0; i < HEAP_TAGS; i++) {
+    const c_heap_tagstats *t = &c_heap.tag[i];
+    fprintf(stderr, "%-8s %9u bytes %9u at most %7u blocks %9u allocations\n",
+            c_heap_tagnames[i], (unsigned)t->bytes, (unsigned)t->peak,
+            (unsigned)t->blocks, (unsigned)t->allocs);
+  }
+  fprintf(stderr, "%s: blocks by size\n", progname);
+  for (i = 0; i < HEAP_CLASSES; i++) {
+    if (i < HEAP_CLASSES - 1)
+      fprintf(stderr, "<= %-5u", HEAP_CLASS_MIN << i);
+    else
+      fprintf(stderr, "larger  ");
+    fprintf(stderr, " %7u in use %9u allocations\n",
+            (unsigned)c_heap.live[i], (unsigned)c_heap.allocs[i]);
+  }
+}
+
+struct Smain {
+  int argc;
+  char **argv;
+  int status;
+};
+
+static int pmain (lua_State *L) {
+  struct Smain *s = (struct Smain *)lua_touserdata(L, 1);
+  char **argv = s->argv;
+  int interactive = 0, ran = 0;
+  int i;
+  lua_gc(L, LUA_GCSTOP, 0);  /* stop collector during initialization */
+  luaL_openlibs(L);  /* open libraries */
+  luaopen_host(L);
+  lua_pop(L, 1);
+  gLoad.L = L;
+  gLoad.line = coap_line;
+  gLoad.len = sizeof(coap_line);
+  gLoad.firstline = 1;
+  lua_gc(L, LUA_GCRESTART, 0);
+  if (egcmode != EGC_NOT_ACTIVE)
+    legc_set_mode(L, egcmode, egclimit);  /* as lua_main does by default */
+  if (profile)
+    lprofile_start(L, 0);
+  for (i = 1; argv[i] != NULL && s->status == 0; i++) {
+    if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)
+      break;  /* the script */
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    }
+    switch (argv[i][1]) {
+      case 'e':
+        i++;
+        s->status = luaL_loadbuffer(L, argv[i], strlen(argv[i]), "=(command line)");
+        if (s->status == 0) s->status = docall(L, 0, 1);
+        report(L, s->status);
+        ran = 1;
+        break;
+      case 'i':
+        interactive = 1;
+        break;
+      case 'u':
+        upload(argv[++i]);
+        break;
+      default:  /* taken by main */
+        if (strchr("EFHp", argv[i][1])) i++;
+        break;
+    }
+  }
+  if (s->status == 0 && argv[i] != NULL) {
+    const char *name = strcmp(argv[i], "-") == 0 ? NULL : argv[i];
+    int narg = getargs(L, argv, i);  /* collect arguments */
+    lua_setglobal(L, "arg");
+    s->status = loadhostfile(L, name);
+    lua_insert(L, -(narg+1));
+    if (s->status == 0)
+      s->status = docall(L, narg, 0);
+    else
+      lua_pop(L, narg);
+    report(L, s->status);
+    ran = 1;
+  }
+  if (s->status == 0 && (interactive || !ran))
+    dotty(L);
+  if (profile)
+    saveprofile(L);
+  return 0;
+}
+
+int main (int argc, char **argv) {
+  struct Smain s;
+  lua_State *L;
+  clock_t start = clock();
+  size_t heap = 0;
+  int i;
+  if (argv[0] && argv[0][0]) progname = argv[0];
+  for (i = 1; i < argc; i++) {  /* the options main takes care of */
+    if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0 || strcmp(argv[i], "--") == 0)
+      break;
+    if (strchr("euEFHp", argv[i][1]) && argv[i][2] == '\0' && i + 1 == argc)
+      usage(argv[i]);
+    if (strcmp(argv[i], "-F") == 0)
+      flashfile = argv[++i];
+    else if (strcmp(argv[i], "-H") == 0)
+      heap = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-p") == 0)
+      profile = argv[++i];
+    else if (strcmp(argv[i], "-s") == 0)
+      stats = 1;
+    else if (strcmp(argv[i], "-g") == 0)
+      egcmode = EGC_NOT_ACTIVE;
+    else if (strcmp(argv[i], "-E") == 0)
+      setegc(argv[++i]);
+    else if (strcmp(argv[i], "-m") == 0)
+      pool = 0;
+    else if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-u") == 0)
+      i++;
+    else if (strcmp(argv[i], "-i") != 0)
+      usage(argv[i]);
+  }
+  loadflash();
+  fs_mount();
+  host_heap_init(heap);
+  L = lua_open();
+  if (L == NULL) fatal("cannot create state: not enough memory");
+#ifdef LUA_POOL
+  G(L)->pool.on = pool;
+#endif
+  s.argc = argc;
+  s.argv = argv;
+  s.status = 0;
+  if (report(L, lua_cpcall(L, &pmain, &s)) != 0) s.status = 1;
+  fflush(stdout);
+  if (stats)
+    fprintf(stderr, "%s: %.3f s of CPU, heap %u bytes in use, %u at most\n",
+            progname, (double)(clock() - start) / CLOCKS_PER_SEC,
+            (unsigned)host_heap_used(), (unsigned)host_heap_peak());
+  if (stats)
+    printheap(L);
+  lua_close(L);
+  fs_unmount();
+  saveflash();
+  return s.status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,391 @@
+// Platform layer of the host build: the flash is an array in RAM that acts
+// like NOR flash (writes clear bits, erases set a sector to 0xff), and the
+// heap is the C library's, or an arena of the size given with -H. The SDK's
+// timers run on a clock that a test can move ahead rather than wait.
+
+#include "host.h"
+#include "platform.h"
+#include "user_interface.h"
+#include "os_type.h"
+#include "mem.h"
+#include "c_stdio.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+#include <time.h>
+
+// ****************************************************************************
+// Heap
+
+// every block carries its size in front, aligned for any type; in the arena
+// the size takes the header in and a free block links to the next one
+typedef union host_block {
+  struct {
+    size_t size;
+    union host_block *next;
+  } h;
+  long double align;
+} host_block;
+
+#define ARENA_ALIGN   sizeof( host_block )
+#define ARENA_MIN     ( 2 * sizeof( host_block ) )  // smallest block split off
+
+static size_t heap_limit;   // 0 for no limit
+static size_t heap_used;
+static size_t heap_peak;
+
+// With a limit the heap is an arena of that size, taken first fit from a
+// list of free blocks in address order which merge with their neighbours,
+// as the SDK's heap does, so that it fragments as on the device.
+static char *arena;
+static host_block *arena_free;
+static unsigned long arena_allocs, arena_steps, arena_maxsteps;
+
+void host_heap_init( size_t limit )
+{
+  heap_limit = limit;
+  if( limit == 0 )
+    return;
+  heap_limit = limit - limit % ARENA_ALIGN;
+  arena = ( char* )malloc( heap_limit );
+  if( arena == NULL )
+  {
+    fprintf( stderr, "cannot allocate a heap of %u bytes\n", ( unsigned )limit );
+    exit( EXIT_FAILURE );
+  }
+  arena_free = ( host_block* )arena;
+  arena_free->h.size = heap_limit;
+  arena_free->h.next = NULL;
+}
+
+size_t host_heap_used( void )
+{
+  return heap_used;
+}
+
+size_t host_heap_peak( void )
+{
+  return heap_peak;
+}
+
+int host_heap_arena( host_heap_stats *st )
+{
+  host_block *b;
+  if( arena == NULL )
+    return 0;
+  memset( st, 0, sizeof( *st ) );
+  for( b = arena_free; b; b = b->h.next )
+  {
+    st->free += b->h.size;
+    st->fragments ++;
+    if( b->h.size > st->largest )
+      st->largest = b->h.size;
+  }
+  st->allocs = arena_allocs;
+  st->steps = arena_steps;
+  st->maxsteps = arena_maxsteps;
+  return 1;
+}
+
+// put `b' back in the free list, merged with the free blocks next to it
+static void arena_release( host_block *b )
+{
+  host_block *prev = NULL, *next = arena_free;
+  while( next && next < b )
+  {
+    prev = next;
+    next = next->h.next;
+  }
+  if( next && ( char* )b + b->h.size == ( char* )next )
+  {
+    b->h.size += next->h.size;
+    next = next->h.next;
+  }
+  b->h.next = next;
+  if( prev && ( char* )prev + prev->h.size == ( char* )b )
+  {
+    prev->h.size += b->h.size;
+    prev->h.next = next;
+  }
+  else if( prev )
+    prev->h.next = b;
+  else
+    arena_free = b;
+}
+
+// cut what `b' does not need off as a free block
+static void arena_split( host_block *b, size_t size )
+{
+  host_block *rest;
+  if( b->h.size - size < ARENA_MIN )
+    return;
+  rest = ( host_block* )( ( char* )b + size );
+  rest->h.size = b->h.size - size;
+  b->h.size = size;
+  heap_used -= rest->h.size;
+  arena_release( rest );
+}
+
+static void *arena_alloc( size_t size )
+{
+  host_block **link = &arena_free, *b;
+  unsigned long steps = 0;
+  size = sizeof( host_block ) + ( size + ARENA_ALIGN - 1 ) / ARENA_ALIGN * ARENA_ALIGN;
+  for( b = arena_free; b && b->h.size < size; b = b->h.next )
+  {
+    link = &b->h.next;
+    steps ++;
+  }
+  arena_allocs ++;
+  arena_steps += steps;
+  if( steps > arena_maxsteps )
+    arena_maxsteps = steps;
+  if( b == NULL )
+    return NULL;
+  *link = b->h.next;
+  b->h.next = NULL;
+  heap_used += b->h.size;
+  arena_split( b, size );
+  if( heap_used > heap_peak )
+    heap_peak = heap_used;
+  return b + 1;
+}
+
+static void *arena_realloc( void *ptr, size_t size )
+{
+  host_block *b = ( host_block* )ptr - 1;
+  size_t need = sizeof( host_block ) + ( size + ARENA_ALIGN - 1 ) / ARENA_ALIGN * ARENA_ALIGN;
+  void *p;
+  if( need <= b->h.size )  // shrinks in place, never fails
+  {
+    arena_split( b, need );
+    return ptr;
+  }
+  if( ( p = arena_alloc( size ) ) == NULL )
+    return NULL;
+  memcpy( p, ptr, b->h.size - sizeof( host_block ) );
+  heap_used -= b->h.size;
+  arena_release( b );
+  return p;
+}
+
+void *host_realloc( void *ptr, size_t size )
+{
+  host_block *b = ptr ? ( host_block* )ptr - 1 : NULL;
+  size_t old = b ? b->h.size : 0;
+  if( size == 0 )
+  {
+    host_free( ptr );
+    return NULL;
+  }
+  if( arena )
+    return ptr ? arena_realloc( ptr, size ) : arena_alloc( size );
+  b = ( host_block* )realloc( b, sizeof( host_block ) + size );
+  if( b == NULL )
+    return NULL;
+  b->h.size = size;
+  heap_used = heap_used - old + size;
+  if( heap_used > heap_peak )
+    heap_peak = heap_used;
+  return b + 1;
+}
+
+void *host_malloc( size_t size )
+{
+  return host_realloc( NULL, size ? size : 1 );
+}
+
+void *host_zalloc( size_t size )
+{
+  void *p = host_malloc( size );
+  if( p )
+    memset( p, 0, size );
+  return p;
+}
+
+void host_free( void *ptr )
+{
+  host_block *b;
+  if( ptr == NULL )
+    return;
+  b = ( host_block* )ptr - 1;
+  heap_used -= b->h.size;
+  if( arena )
+    arena_release( b );
+  else
+    free( b );
+}
+
+uint32 system_get_free_heap_size( void )
+{
+  if( heap_limit == 0 )
+    return 0x7fffffff;
+  return heap_limit > heap_used ? heap_limit - heap_used : 0;
+}
+
+// the modules make names from it, mqtt the default client id
+uint32 system_get_chip_id( void )
+{
+  return 0x00c0ffee;
+}
+
+// ****************************************************************************
+// Time
+
+// the real clock, plus the time host_clock_advance() skipped
+static uint32 clock_skip;
+
+uint32 system_get_time( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ( uint32 )( ts.tv_sec * 1000000 + ts.tv_nsec / 1000 ) + clock_skip;
+}
+
+void host_clock_advance( uint32_t ms )
+{
+  clock_skip += ms * 1000;
+}
+
+// ****************************************************************************
+// Timers
+
+// the armed timers, in no order
+static os_timer_t *timers;
+
+void os_timer_setfn( os_timer_t *ptimer, os_timer_func_t *pfunction, void *parg )
+{
+  ptimer->timer_func = pfunction;
+  ptimer->timer_arg = parg;
+}
+
+void os_timer_disarm( os_timer_t *ptimer )
+{
+  os_timer_t **pp;
+  for( pp = &timers; *pp; pp = &( *pp )->timer_next )
+    if( *pp == ptimer )
+    {
+      *pp = ptimer->timer_next;
+      break;
+    }
+  ptimer->timer_next = NULL;
+}
+
+void os_timer_arm( os_timer_t *ptimer, uint32_t milliseconds, bool repeat_flag )
+{
+  os_timer_disarm( ptimer );
+  ptimer->timer_expire = system_get_time() + milliseconds * 1000;
+  ptimer->timer_period = repeat_flag ? milliseconds * 1000 : 0;
+  ptimer->timer_next = timers;
+  timers = ptimer;
+}
+
+// Fire the timers that are due, one at a time as a callback may arm or
+// disarm any of them. A periodic timer that fires late fires once, and
+// its period starts over, as on the device when a task held the CPU.
+// Returns the ms until the next one is due, -1 if none is armed.
+int host_timers_run( void )
+{
+  os_timer_t *t, *due;
+  int32_t wait;
+  for( ;; )
+  {
+    uint32 now = system_get_time();
+    due = NULL;
+    wait = -1;
+    for( t = timers; t; t = t->timer_next )
+    {
+      int32_t left = ( int32_t )( t->timer_expire - now );
+      if( left <= 0 )
+      {
+        due = t;
+        break;
+      }
+      if( wait < 0 || left < wait )
+        wait = left;
+    }
+    if( due == NULL )
+      return wait < 0 ? -1 : ( wait + 999 ) / 1000;
+    if( due->timer_period )
+      due->timer_expire = now + due->timer_period;
+    else
+      os_timer_disarm( due );
+    due->timer_func( due->timer_arg );
+  }
+}
+
+// ****************************************************************************
+// Flash
+
+static uint8_t flash[ HOST_FLASH_SIZE ];
+
+uint8_t *host_flash( void )
+{
+  return flash;
+}
+
+void host_flash_init( void )
+{
+  memset( flash, 0xff, sizeof( flash ) );
+}
+
+// the device reads its constant tables a word at a time from flash; the SSL
+// library, which has no flash_api.h, calls it as a function (the macro of
+// include/flash_api.h is kept out by the parentheses)
+uint8_t ( byte_of_aligned_array )( const uint8_t *aligned_array, uint32_t index )
+{
+  return aligned_array[ index ];
+}
+
+static int flash_range( uint32_t addr, uint32_t size )
+{
+  return addr >= INTERNAL_FLASH_START_ADDRESS &&
+         addr - INTERNAL_FLASH_START_ADDRESS <= INTERNAL_FLASH_SIZE &&
+         size <= INTERNAL_FLASH_SIZE - ( addr - INTERNAL_FLASH_START_ADDRESS );
+}
+
+uint32_t platform_flash_get_first_free_block_address( uint32_t *psect )
+{
+  if( psect )
+    *psect = HOST_FIRMWARE_SIZE / INTERNAL_FLASH_SECTOR_SIZE;
+  return INTERNAL_FLASH_START_ADDRESS + HOST_FIRMWARE_SIZE;
+}
+
+uint32_t platform_flash_get_sector_of_address( uint32_t addr )
+{
+  return ( addr - INTERNAL_FLASH_START_ADDRESS ) / INTERNAL_FLASH_SECTOR_SIZE;
+}
+
+uint32_t platform_flash_get_num_sectors( void )
+{
+  return INTERNAL_FLASH_SIZE / INTERNAL_FLASH_SECTOR_SIZE;
+}
+
+uint32_t platform_flash_write( const void *from, uint32_t toaddr, uint32_t size )
+{
+  const uint8_t *p = ( const uint8_t* )from;
+  uint8_t *to;
+  uint32_t i;
+  if( !flash_range( toaddr, size ) )
+    return 0;
+  to = flash + ( toaddr - INTERNAL_FLASH_START_ADDRESS );
+  for( i = 0; i < size; i ++ )
+    to[ i ] &= p[ i ];
+  return size;
+}
+
+uint32_t platform_flash_read( void *to, uint32_t fromaddr, uint32_t size )
+{
+  if( !flash_range( fromaddr, size ) )
+    return 0;
+  memcpy( to, flash + ( fromaddr - INTERNAL_FLASH_START_ADDRESS ), size );
+  return size;
+}
+
+int platform_flash_erase_sector( uint32_t sector_id )
+{
+  if( sector_id >= platform_flash_get_num_sectors() )
+    return PLATFORM_ERR;
+  memset( flash + sector_id * INTERNAL_FLASH_SECTOR_SIZE, 0xff, INTERNAL_FLASH_SECTOR_SIZE );
+  return PLATFORM_OK;
+}
@@ -0,0 +1,226 @@
+// The digest functions the device has in ROM (see rom.h), for the host build.
+// MD5 follows RFC 1321, SHA1 follows RFC 3174.
+
+#include "c_types.h"
+#include "c_string.h"
+#include "rom.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// ****************************************************************************
+// MD5
+
+#define F(x, y, z) (((x) & (y)) | (~(x) & (z)))
+#define G(x, y, z) (((x) & (z)) | ((y) & ~(z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define STEP(f, a, b, c, d, x, t, s) \
+  (a) += f((b), (c), (d)) + (x) + (t); \
+  (a) = ROL((a), (s)) + (b)
+
+static void md5_transform( uint32_t state[4], const uint8_t block[64] )
+{
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t x[16];
+  int i;
+  for( i = 0; i < 16; i ++ )
+    x[i] = ( uint32_t )block[4*i] | ( uint32_t )block[4*i+1] << 8 |
+           ( uint32_t )block[4*i+2] << 16 | ( uint32_t )block[4*i+3] << 24;
+
+  STEP(F, a, b, c, d, x[ 0], 0xd76aa478,  7);
+  STEP(F, d, a, b, c, x[ 1], 0xe8c7b756, 12);
+  STEP(F, c, d, a, b, x[ 2], 0x242070db, 17);
+  STEP(F, b, c, d, a, x[ 3], 0xc1bdceee, 22);
+  STEP(F, a, b, c, d, x[ 4], 0xf57c0faf,  7);
+  STEP(F, d, a, b, c, x[ 5], 0x4787c62a, 12);
+  STEP(F, c, d, a, b, x[ 6], 0xa8304613, 17);
+  STEP(F, b, c, d, a, x[ 7], 0xfd469501, 22);
+  STEP(F, a, b, c, d, x[ 8], 0x698098d8,  7);
+  STEP(F, d, a, b, c, x[ 9], 0x8b44f7af, 12);
+  STEP(F, c, d, a, b, x[10], 0xffff5bb1, 17);
+  STEP(F, b, c, d, a, x[11], 0x895cd7be, 22);
+  STEP(F, a, b, c, d, x[12], 0x6b901122,  7);
+  STEP(F, d, a, b, c, x[13], 0xfd987193, 12);
+  STEP(F, c, d, a, b, x[14], 0xa679438e, 17);
+  STEP(F, b, c, d, a, x[15], 0x49b40821, 22);
+
+  STEP(G, a, b, c, d, x[ 1], 0xf61e2562,  5);
+  STEP(G, d, a, b, c, x[ 6], 0xc040b340,  9);
+  STEP(G, c, d, a, b, x[11], 0x265e5a51, 14);
+  STEP(G, b, c, d, a, x[ 0], 0xe9b6c7aa, 20);
+  STEP(G, a, b, c, d, x[ 5], 0xd62f105d,  5);
+  STEP(G, d, a, b, c, x[10], 0x02441453,  9);
+  STEP(G, c, d, a, b, x[15], 0xd8a1e681, 14);
+  STEP(G, b, c, d, a, x[ 4], 0xe7d3fbc8, 20);
+  STEP(G, a, b, c, d, x[ 9], 0x21e1cde6,  5);
+  STEP(G, d, a, b, c, x[14], 0xc33707d6,  9);
+  STEP(G, c, d, a, b, x[ 3], 0xf4d50d87, 14);
+  STEP(G, b, c, d, a, x[ 8], 0x455a14ed, 20);
+  STEP(G, a, b, c, d, x[13], 0xa9e3e905,  5);
+  STEP(G, d, a, b, c, x[ 2], 0xfcefa3f8,  9);
+  STEP(G, c, d, a, b, x[ 7], 0x676f02d9, 14);
+  STEP(G, b, c, d, a, x[12], 0x8d2a4c8a, 20);
+
+  STEP(H, a, b, c, d, x[ 5], 0xfffa3942,  4);
+  STEP(H, d, a, b, c, x[ 8], 0x8771f681, 11);
+  STEP(H, c, d, a, b, x[11], 0x6d9d6122, 16);
+  STEP(H, b, c, d, a, x[14], 0xfde5380c, 23);
+  STEP(H, a, b, c, d, x[ 1], 0xa4beea44,  4);
+  STEP(H, d, a, b, c, x[ 4], 0x4bdecfa9, 11);
+  STEP(H, c, d, a, b, x[ 7], 0xf6bb4b60, 16);
+  STEP(H, b, c, d, a, x[10], 0xbebfbc70, 23);
+  STEP(H, a, b, c, d, x[13], 0x289b7ec6,  4);
+  STEP(H, d, a, b, c, x[ 0], 0xeaa127fa, 11);
+  STEP(H, c, d, a, b, x[ 3], 0xd4ef3085, 16);
+  STEP(H, b, c, d, a, x[ 6], 0x04881d05, 23);
+  STEP(H, a, b, c, d, x[ 9], 0xd9d4d039,  4);
+  STEP(H, d, a, b, c, x[12], 0xe6db99e5, 11);
+  STEP(H, c, d, a, b, x[15], 0x1fa27cf8, 16);
+  STEP(H, b, c, d, a, x[ 2], 0xc4ac5665, 23);
+
+  STEP(I, a, b, c, d, x[ 0], 0xf4292244,  6);
+  STEP(I, d, a, b, c, x[ 7], 0x432aff97, 10);
+  STEP(I, c, d, a, b, x[14], 0xab9423a7, 15);
+  STEP(I, b, c, d, a, x[ 5], 0xfc93a039, 21);
+  STEP(I, a, b, c, d, x[12], 0x655b59c3,  6);
+  STEP(I, d, a, b, c, x[ 3], 0x8f0ccc92, 10);
+  STEP(I, c, d, a, b, x[10], 0xffeff47d, 15);
+  STEP(I, b, c, d, a, x[ 1], 0x85845dd1, 21);
+  STEP(I, a, b, c, d, x[ 8], 0x6fa87e4f,  6);
+  STEP(I, d, a, b, c, x[15], 0xfe2ce6e0, 10);
+  STEP(I, c, d, a, b, x[ 6], 0xa3014314, 15);
+  STEP(I, b, c, d, a, x[13], 0x4e0811a1, 21);
+  STEP(I, a, b, c, d, x[ 4], 0xf7537e82,  6);
+  STEP(I, d, a, b, c, x[11], 0xbd3af235, 10);
+  STEP(I, c, d, a, b, x[ 2], 0x2ad7d2bb, 15);
+  STEP(I, b, c, d, a, x[ 9], 0xeb86d391, 21);
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+void MD5Init( MD5_CTX *ctx )
+{
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->count[0] = ctx->count[1] = 0;
+}
+
+void MD5Update( MD5_CTX *ctx, const unsigned char *input, unsigned int len )
+{
+  unsigned int index = ( ctx->count[0] >> 3 ) & 0x3f;
+  unsigned int i = 0;
+  if( ( ctx->count[0] += len << 3 ) < ( len << 3 ) )
+    ctx->count[1] ++;
+  ctx->count[1] += len >> 29;
+  if( index + len >= 64 )
+  {
+    i = 64 - index;
+    memcpy( ctx->buffer + index, input, i );
+    md5_transform( ctx->state, ctx->buffer );
+    for( ; i + 63 < len; i += 64 )
+      md5_transform( ctx->state, input + i );
+    index = 0;
+  }
+  memcpy( ctx->buffer + index, input + i, len - i );
+}
+
+void MD5Final( unsigned char digest[MD5_DIGEST_LENGTH], MD5_CTX *ctx )
+{
+  static const unsigned char pad[64] = { 0x80 };
+  unsigned char bits[8];
+  unsigned int index = ( ctx->count[0] >> 3 ) & 0x3f;
+  int i;
+  for( i = 0; i < 8; i ++ )
+    bits[i] = ( unsigned char )( ctx->count[i >> 2] >> ( 8 * ( i & 3 ) ) );
+  MD5Update( ctx, pad, index < 56 ? 56 - index : 120 - index );
+  MD5Update( ctx, bits, 8 );
+  for( i = 0; i < MD5_DIGEST_LENGTH; i ++ )
+    digest[i] = ( unsigned char )( ctx->state[i >> 2] >> ( 8 * ( i & 3 ) ) );
+}
+
+// ****************************************************************************
+// SHA1
+
+void SHA1Transform( uint32_t state[5], const uint8_t block[64] )
+{
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  uint32_t w[80], t;
+  int i;
+  for( i = 0; i < 16; i ++ )
+    w[i] = ( uint32_t )block[4*i] << 24 | ( uint32_t )block[4*i+1] << 16 |
+           ( uint32_t )block[4*i+2] << 8 | ( uint32_t )block[4*i+3];
+  for( ; i < 80; i ++ )
+    w[i] = ROL( w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1 );
+  for( i = 0; i < 80; i ++ )
+  {
+    if( i < 20 )
+      t = ( ( b & c ) | ( ~b & d ) ) + 0x5a827999;
+    else if( i < 40 )
+      t = ( b ^ c ^ d ) + 0x6ed9eba1;
+    else if( i < 60 )
+      t = ( ( b & c ) | ( b & d ) | ( c & d ) ) + 0x8f1bbcdc;
+    else
+      t = ( b ^ c ^ d ) + 0xca62c1d6;
+    t += ROL( a, 5 ) + e + w[i];
+    e = d;
+    d = c;
+    c = ROL( b, 30 );
+    b = a;
+    a = t;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+void SHA1Init( SHA1_CTX *ctx )
+{
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->state[4] = 0xc3d2e1f0;
+  ctx->count[0] = ctx->count[1] = 0;
+}
+
+// count[0] holds the high word of the bit count, as in the NetBSD code
+void SHA1Update( SHA1_CTX *ctx, const uint8_t *data, unsigned int len )
+{
+  unsigned int index = ( ctx->count[1] >> 3 ) & 0x3f;
+  unsigned int i = 0;
+  if( ( ctx->count[1] += len << 3 ) < ( len << 3 ) )
+    ctx->count[0] ++;
+  ctx->count[0] += len >> 29;
+  if( index + len >= 64 )
+  {
+    i = 64 - index;
+    memcpy( ctx->buffer + index, data, i );
+    SHA1Transform( ctx->state, ctx->buffer );
+    for( ; i + 63 < len; i += 64 )
+      SHA1Transform( ctx->state, data + i );
+    index = 0;
+  }
+  memcpy( ctx->buffer + index, data + i, len - i );
+}
+
+void SHA1Final( uint8_t digest[SHA1_DIGEST_LENGTH], SHA1_CTX *ctx )
+{
+  static const uint8_t pad[64] = { 0x80 };
+  uint8_t bits[8];
+  unsigned int index = ( ctx->count[1] >> 3 ) & 0x3f;
+  int i;
+  for( i = 0; i < 8; i ++ )
+    bits[i] = ( uint8_t )( ctx->count[i >> 2] >> ( 8 * ( 3 - ( i & 3 ) ) ) );
+  SHA1Update( ctx, pad, index < 56 ? 56 - index : 120 - index );
+  SHA1Update( ctx, bits, 8 );
+  for( i = 0; i < SHA1_DIGEST_LENGTH; i ++ )
+    digest[i] = ( uint8_t )( ctx->state[i >> 2] >> ( 8 * ( 3 - ( i & 3 ) ) ) );
+}
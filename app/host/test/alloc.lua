@@ -0,0 +1,67 @@
+-- Allocation stress test: churns objects of the sizes Lua makes most,
+-- with random lifetimes, and checks they all kept their contents.
+--
+--   nodemcu-host -s -H 80000 test/alloc.lua [rounds]       with the pool
+--   nodemcu-host -s -H 80000 -m test/alloc.lua [rounds]    without it
+--
+-- -s tells how the heap ended up cut, and how many free blocks the
+-- allocations passed over to find one: the cost of malloc on the device.
+
+local rounds = tonumber(arg and arg[1]) or 20000
+local SLOTS = 200
+
+math.randomseed(7)
+local random = math.random
+
+-- each maker returns an object and the check of it
+local makers = {
+  function(i)  -- short string
+    local s = "s" .. i
+    return s, s
+  end,
+  function(i)  -- small table
+    return { i, i + 1 }, i
+  end,
+  function(i)  -- closure with an upvalue
+    local n = i
+    return function() return n end, i
+  end,
+  function(i)  -- record
+    return { id = i, name = "n" .. (i % 97), ok = true }, i
+  end,
+  function(i)  -- longer string, from the heap
+    local s = string.rep("x", 80 + i % 120) .. i
+    return s, s
+  end,
+  function(i)  -- array, from the heap
+    local t = {}
+    for k = 1, 24 do t[k] = i end
+    return t, i
+  end,
+}
+local weights = { 1, 1, 1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 6 }
+
+local function check(kind, o, c)
+  if kind == 1 or kind == 5 then return o == c end
+  if kind == 2 then return o[1] == c and o[2] == c + 1 end
+  if kind == 3 then return o() == c end
+  if kind == 4 then return o.id == c and o.name == "n" .. (c % 97) end
+  return #o == 24 and o[24] == c
+end
+
+local obj, chk, kinds = {}, {}, {}
+for i = 1, rounds do
+  local k = random(SLOTS)
+  if kinds[k] and not check(kinds[k], obj[k], chk[k]) then
+    error("slot " .. k .. " lost its contents in round " .. i)
+  end
+  local kind = weights[random(#weights)]
+  obj[k], chk[k] = makers[kind](i)
+  kinds[k] = kind
+end
+for k = 1, SLOTS do
+  if kinds[k] and not check(kinds[k], obj[k], chk[k]) then
+    error("slot " .. k .. " lost its contents")
+  end
+end
+print("alloc: " .. rounds .. " rounds ok")
@@ -0,0 +1,49 @@
+-- Integer arithmetic benchmark: the loop counters, sums, index sums and
+-- bit twiddling of the usual GPIO and protocol code, on numbers that are
+-- all integers. Prints a checksum, the same with or without LUA_INTFAST.
+--
+--   nodemcu-host -s test/arith.lua [rounds]
+--
+-- make arith runs it on the VM with and without integers, make arith
+-- PERF="perf stat -e instructions:u" counts the instructions of each.
+
+local rounds = tonumber(arg and arg[1]) or 200
+
+local band, bxor, lshift, rshift = bit.band, bit.bxor, bit.lshift, bit.rshift
+
+local function crc16(buf, n)
+  local crc = 0xffff
+  for i = 1, n do
+    crc = bxor(crc, buf[i])
+    for _ = 1, 8 do
+      if band(crc, 1) == 1 then
+        crc = bxor(rshift(crc, 1), 0xa001)
+      else
+        crc = rshift(crc, 1)
+      end
+    end
+  end
+  return crc
+end
+
+local function sums(n)
+  local s, d = 0, 0
+  for i = 1, n do
+    s = s + i * 3 - (i % 7)
+    d = d + (i - s % 13)
+  end
+  for i = n, 1, -2 do
+    s = s - i
+  end
+  return s + d
+end
+
+local buf = {}
+for i = 1, 256 do buf[i] = (i * 37 + 11) % 256 end
+
+local check = 0
+for r = 1, rounds do
+  check = (check + crc16(buf, #buf) + sums(1000) + lshift(r, 4)) % 65521
+  buf[r % #buf + 1] = band(check, 0xff)
+end
+print(("arith: %d rounds, checksum %d"):format(rounds, check))
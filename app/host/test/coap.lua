@@ -0,0 +1,140 @@
+-- The CoAP server and client on the in-process loopback: responses and
+-- uploads larger than a block go block-wise both ways (RFC 7959), from a
+-- string variable, a reader variable, a function and a /.well-known/core
+-- of more than 2048 bytes, and have to arrive whole and in order. Then a
+-- request to a port nobody listens on: its retransmissions run out, and
+-- the transfer has to end with function(nil, "timeout") and let go of the
+-- client.
+--
+--   nodemcu-host -g test/coap.lua
+--
+-- -g, as the emergency GC's memory limit also caps the length of a
+-- concatenation, and the payloads are longer.
+--
+-- make coap runs it.
+
+local BASE = "coap://127.0.0.1:5683/v1/"
+
+local function text(n, seed)
+  local t = {}
+  for i = 1, n do t[i] = string.char(48 + (i * seed) % 75) end
+  return table.concat(t)
+end
+
+local cs = coap.Server()
+cs:listen(5683)
+
+big = text(9600, 7)
+cs:var("big")
+
+local reads = 0
+stream = function(offset, size)
+  reads = reads + 1
+  return big:sub(offset + 1, offset + size)
+end
+cs:var("stream")
+
+local upload, uploads = {}, 0
+store = function(payload, offset, more)
+  if offset ~= #table.concat(upload) then
+    error(("upload: block at %d, %d bytes in"):format(offset, #table.concat(upload)))
+  end
+  upload[#upload + 1] = payload
+  uploads = uploads + 1
+  if not more then return "stored " .. #table.concat(upload) end
+end
+cs:func("store")
+
+local reply = text(3600, 11)
+answer = function(payload) return reply end
+cs:func("answer")
+
+-- runs one request to its end and returns what the callback got
+local function request(method, url, payload)
+  local cc = coap.Client()
+  local parts, code, err, done = {}, nil, nil, false
+  local function cb(c, data, more)
+    if c == nil then err, done = data, true return end
+    code = c
+    parts[#parts + 1] = data
+    if not more then done = true end
+  end
+  if payload then cc[method](cc, coap.CON, url, payload, cb)
+  else cc[method](cc, coap.CON, url, cb) end
+  host.run(1000)
+  if not done then error(url .. ": no end") end
+  return code, table.concat(parts), err, #parts
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    error(("%s: got %s, want %s"):format(what, tostring(got):sub(1, 40),
+          tostring(want):sub(1, 40)))
+  end
+end
+
+local code, data, err, blocks = request("get", BASE .. "v/big")
+expect("get big", code, 205)
+expect("get big", data, big)
+print(("string variable: %d bytes in %d blocks"):format(#data, blocks))
+
+code, data, err, blocks = request("get", BASE .. "v/stream")
+expect("get stream", code, 205)
+expect("get stream", data, big)
+expect("stream reads", reads, blocks)
+print(("reader variable: %d bytes in %d blocks"):format(#data, blocks))
+
+local sent = text(6000, 13)
+code, data = request("post", BASE .. "f/store", sent)
+expect("post store", code, 205)
+expect("post store", data, "stored " .. #sent)
+expect("stored", table.concat(upload), sent)
+print(("upload: %d bytes in %d blocks"):format(#sent, uploads))
+
+code, data, err, blocks = request("post", BASE .. "f/answer", "x")
+expect("post answer", code, 205)
+expect("post answer", data, reply)
+print(("function response: %d bytes in %d blocks"):format(#data, blocks))
+
+code, data = request("get", "coap://127.0.0.1:5683/.well-known/core")
+expect("well-known", code, 205)
+if not data:find("</v1/v/big>", 1, true) or not data:find("</v1/v/stream>", 1, true) then
+  error("well-known: " .. data)
+end
+print(("well-known/core: %d bytes"):format(#data))
+
+-- enough variables that the list outgrows two blocks' worth, 2048 bytes
+for i = 1, 80 do
+  _G["listed_variable_" .. i] = i
+  cs:var("listed_variable_" .. i)
+end
+code, data, err, blocks = request("get", "coap://127.0.0.1:5683/.well-known/core")
+expect("long well-known", code, 205)
+if #data <= 2048 then error(("long well-known: %d bytes"):format(#data)) end
+for i = 1, 80 do
+  if not data:find("</v1/v/listed_variable_" .. i .. ">;ct=0", 1, true) then
+    error("long well-known: no listed_variable_" .. i)
+  end
+end
+expect("long well-known ends", data:sub(-#",</v1/id>;ct=0"), ",</v1/id>;ct=0")
+print(("long well-known/core: %d bytes in %d blocks"):format(#data, blocks))
+
+-- nobody on 5684: about 93 s of retransmissions at most
+local clients = setmetatable({}, { __mode = "k" })
+local result
+do
+  local cc = coap.Client()
+  clients[cc] = true
+  cc:get(coap.CON, "coap://127.0.0.1:5684/v1/v/big", function(c, d) result = { c, d } end)
+end
+host.run(100000)
+if not result then error("unanswered request: no end") end
+expect("unanswered request", result[1], nil)
+expect("unanswered request", result[2], "timeout")
+collectgarbage()
+collectgarbage()
+if next(clients) then error("unanswered request: client not freed") end
+print("unanswered request: timeout, client freed")
+
+cs:close()
+print("ok")
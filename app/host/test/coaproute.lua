@@ -0,0 +1,80 @@
+-- CoAP routing benchmark: a server with 200 variables and 200 functions
+-- registered, asked on the loopback for the last of each, for one nobody
+-- registered and for /.well-known/core. Prints requests per second for
+-- each, and a checksum of the responses, the same with or without the
+-- route trie and the cached /.well-known/core. First /.well-known/core is
+-- read whole, block by block, and has to list every variable (functions
+-- carry no link attributes and are not listed).
+--
+--   nodemcu-host -g test/coaproute.lua [requests]
+--
+-- -g, as the emergency GC would collect in full at each allocation and
+-- leave little of the time to the routing.
+--
+-- make coaproute runs it with and without them (nodemcu-host-nocoaptrie).
+
+local requests = tonumber(arg and arg[1]) or 2000
+local NAMES = 200
+local clock = host.clock
+
+local cs = coap.Server()
+cs:listen(5683)
+for i = 1, NAMES do
+  _G["var" .. i] = "value " .. i
+  cs:var("var" .. i)
+  _G["fun" .. i] = function(payload) return "fun " .. i .. " " .. payload end
+  cs:func("fun" .. i)
+end
+
+local check = 0
+local cc = coap.Client()
+
+do
+  local parts, done = {}, false
+  cc:get(coap.CON, "coap://127.0.0.1:5683/.well-known/core", function(c, d, more)
+    parts[#parts + 1] = d
+    if not more then done = true end
+  end)
+  host.run(1000)
+  if not done then error("well-known/core: no end") end
+  local links, seen = 0, {}
+  for link in table.concat(parts):gmatch("<([^>]*)>") do
+    links = links + 1
+    seen[link] = true
+  end
+  for i = 1, NAMES do
+    if not seen["/v1/v/var" .. i] then error("well-known/core: no var" .. i) end
+  end
+  if links ~= NAMES + 2 then                  -- and itself, /v1/id
+    error(("well-known/core: %d links, want %d"):format(links, NAMES + 2))
+  end
+  print(("well-known/core: %d links in %d blocks"):format(links, #parts))
+end
+
+local function bench(name, method, url, payload)
+  local code, data
+  local function cb(c, d, more)
+    code, data = c, d
+  end
+  local t0 = clock()
+  for _ = 1, requests do
+    if payload then cc[method](cc, coap.CON, url, payload, cb)
+    else cc[method](cc, coap.CON, url, cb) end
+    host.run()
+  end
+  local dt = clock() - t0
+  if not code then error(name .. ": no response") end
+  check = (check + code + #data) % 65521
+  print(("%-16s %4d %5d bytes %8.0f requests/s"):format(name, code, #data, requests / dt))
+end
+
+local base = "coap://127.0.0.1:5683/v1/"
+bench("GET var1", "get", base .. "v/var1")
+bench("GET var" .. NAMES, "get", base .. "v/var" .. NAMES)
+bench("GET unknown", "get", base .. "v/nobody")
+bench("POST fun" .. NAMES, "post", base .. "f/fun" .. NAMES, "x")
+bench("GET id", "get", base .. "id")
+bench("well-known/core", "get", "coap://127.0.0.1:5683/.well-known/core")
+
+cs:close()
+print(("checksum %d"):format(check))
@@ -0,0 +1,35 @@
+-- Emergency GC benchmark: a live set that swells and shrinks under a churn
+-- of garbage, each round in a pcall. Counts the rounds that ran out of
+-- memory; -s adds the CPU time and what the collector did.
+--
+--   nodemcu-host -s -H 60000 -E adaptive test/egc.lua [rounds]
+
+local rounds = tonumber(arg and arg[1]) or 4000
+
+math.randomseed(11)
+local random = math.random
+local live, oom = {}, 0
+
+local function round(i)
+  local g = {}
+  for k = 1, 8 do
+    g[k] = { k, "g" .. i .. "." .. k }
+  end
+  local phase = i % 600
+  local want = 10 + (phase < 300 and phase or 600 - phase)
+  while #live > want do
+    live[#live] = nil
+  end
+  while #live < want do
+    live[#live + 1] = string.rep("l", random(16, 160)) .. i
+  end
+end
+
+for i = 1, rounds do
+  local ok, err = pcall(round, i)
+  if not ok then
+    if not tostring(err):find("not enough memory") then error(err) end
+    oom = oom + 1
+  end
+end
+print(("egc: %d rounds, %d out of memory"):format(rounds, oom))
@@ -0,0 +1,68 @@
+-- File reading benchmark: a log of lines of every length read back with
+-- file.read(), file.read(n), file.read("\n") and file.readline(), then with
+-- file.readblock() and file.copy(). Prints bytes per second for each and a
+-- checksum, the same with or without the block reads.
+--
+--   nodemcu-host test/fileread.lua [kbytes]
+--
+-- make fileread runs it with and without them (nodemcu-host-noblockread,
+-- which reads a byte at a time).
+
+local kbytes = tonumber(arg and arg[1]) or 256
+local clock = host.clock
+
+local lines, size = {}, 0
+while size < kbytes * 1024 do
+  local n = #lines + 1
+  local line = ("%05d "):format(n) .. string.rep(string.char(97 + n % 26), n * 7 % 120)
+  lines[n] = line
+  size = size + #line + 1
+end
+file.remove("log.txt")
+file.open("log.txt", "w")
+for i = 1, #lines do file.writeline(lines[i]) end
+file.close()
+-- the emergency GC collects in full at each allocation, as on the device:
+-- what is left of the log should not be what the reads are timed on
+local nlines = #lines
+lines = nil
+collectgarbage()
+
+local check = 0
+local function sum(s)
+  check = (check + #s + s:byte(1) + s:byte(-1)) % 65521
+end
+
+-- runs read on the open log, or on fname, until it returns nil, and prints
+-- the rate
+local function bench(name, read, fname)
+  local got = 0
+  file.open(fname or "log.txt", "r")
+  local t0 = clock()
+  for s in read do
+    got = got + #s
+    sum(s)
+  end
+  local dt = clock() - t0
+  file.close()
+  if got ~= size then error(("%s: %d bytes of %d"):format(name, got, size)) end
+  print(("%-16s %8.0f KB/s"):format(name, got / dt / 1024))
+end
+
+bench("read()", function() return file.read() end)
+bench("read(100)", function() return file.read(100) end)
+bench("read(\"\\n\")", function() return file.read("\n") end)
+bench("readline()", function() return file.readline() end)
+bench("readblock(4096)", function() return file.readblock(4096) end)
+
+file.remove("copy.txt")
+local t0 = clock()
+local n = file.copy("log.txt", "copy.txt")
+local dt = clock() - t0
+if n ~= size then error(("copy: %s bytes of %d"):format(tostring(n), size)) end
+print(("%-16s %8.0f KB/s"):format("copy()", n / dt / 1024))
+bench("read() of copy", function() return file.read() end, "copy.txt")
+
+file.remove("log.txt")
+file.remove("copy.txt")
+print(("%d bytes in %d lines, checksum %d"):format(size, nlines, check))
@@ -0,0 +1,63 @@
+-- File objects: a log appended to while a page is read, both open at once;
+-- the module level functions on the file opened last, closed only by
+-- file.close(); and more files opened and dropped than SPIFFS has
+-- descriptors, which file.open() has to get back from the GC.
+--
+--   nodemcu-host test/files.lua
+--
+-- make files runs it.
+
+local function expect(what, got, want)
+  if got ~= want then
+    error(("%s: got %s, want %s"):format(what, tostring(got), tostring(want)))
+  end
+end
+
+file.remove("page.txt")
+file.remove("log.txt")
+file.open("page.txt", "w")
+file.write(string.rep("<p>page</p>\n", 20))
+file.close()
+
+local log = file.open("log.txt", "a+")
+local page = file.open("page.txt", "r")
+local served = 0
+while true do
+  local s = page:read(64)
+  if not s then break end
+  served = served + #s
+  log:writeline("sent " .. #s)
+end
+expect("page", served, 240)
+page:close()
+log:close()
+local n = 0
+file.open("log.txt", "r")
+while file.readline() do n = n + 1 end
+file.close()
+expect("log lines", n, 4)
+print("log and page open at once: ok")
+
+-- the default file: the last opened, whose object the script may drop
+local first = file.open("log.txt", "r")
+file.open("page.txt", "r")
+expect("default", file.read(3), "<p>")
+expect("first still open", first:read(4), "sent")
+file.close()
+expect("default closed", pcall(file.read), false)
+expect("first after file.close()", first:read(2), " 6")
+first:close()
+expect("closed object", pcall(first.read, first), false)
+print("default file: ok")
+
+for i = 1, 40 do
+  local f = file.open(("drop%d.txt"):format(i), "w")
+  if not f then error(("open %d: no descriptor"):format(i)) end
+  f:write(i)
+end
+for i = 1, 40 do file.remove(("drop%d.txt"):format(i)) end
+print("40 files opened and dropped: ok")
+
+file.remove("page.txt")
+file.remove("log.txt")
+print("ok")
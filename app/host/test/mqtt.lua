@@ -0,0 +1,84 @@
+-- The MQTT client's receive path against a broker the script plays: the
+-- same stream of PUBLISH packets, from empty to over MQTT_RECV_MAX_SIZE,
+-- with a PINGRESP among them, is cut into segments of every size from one
+-- byte up and sent whole, so packets are split across segments and several
+-- share one. The client has to deliver the same messages each time; the
+-- packet too large to reassemble may only be missing, and only when it was
+-- split.
+--
+--   nodemcu-host -g test/mqtt.lua
+--
+-- -g, as the emergency GC's memory limit also caps the length of a
+-- concatenation, and the stream is longer.
+--
+-- make mqtt runs it.
+
+local RECV_MAX = 4096
+
+local function remaining(n)
+  local s = ""
+  repeat
+    local b = n % 128
+    n = (n - b) / 128
+    if n > 0 then b = b + 128 end
+    s = s .. string.char(b)
+  until n == 0
+  return s
+end
+
+local function publish(topic, payload)
+  local body = string.char(#topic / 256, #topic % 256) .. topic .. payload
+  return "\48" .. remaining(#body) .. body
+end
+
+local sizes = { 0, 1, 10, 121, 122, 200, 1000, 3000, RECV_MAX + 900, 5, 16381, 2 }
+local packets, expected, length = {}, {}, {}
+for i, n in ipairs(sizes) do
+  local topic, payload = "t/" .. i, string.rep(string.char(64 + i), n)
+  packets[#packets + 1] = publish(topic, payload)
+  expected[#expected + 1] = topic .. " " .. payload
+  length[#expected] = #packets[#packets]
+  if i == 4 then packets[#packets + 1] = "\208\0" end   -- PINGRESP
+end
+local stream = table.concat(packets)
+
+local got = {}
+local client = mqtt.Client("host", 60)
+client:on("message", function(c, topic, data)
+  got[#got + 1] = topic .. " " .. (data or "")
+end)
+local connected = false
+client:connect("127.0.0.1", 1883, 0, function() connected = true end)
+host.run()
+local sent = host.sent()
+if sent:byte(1) ~= 0x10 then error("no CONNECT sent") end
+host.receive("\32\2\0\0")                                -- CONNACK
+host.run()
+if not connected then error("not connected") end
+
+local function check(cut)
+  local j = 1
+  for i = 1, #expected do
+    if got[j] == expected[i] then
+      j = j + 1
+    elseif length[i] <= RECV_MAX or cut >= length[i] then
+      error(("segments of %d: message %d is %s"):format(cut, i,
+            got[j] and ("%q"):format(got[j]:sub(1, 20)) or "missing"))
+    end
+  end
+  if got[j] then error(("segments of %d: extra message %d"):format(cut, j)) end
+end
+
+local cuts = { 1, 2, 3, 4, 5, 7, 13, 64, 127, 128, 129, 536, 1024, 1460, 4096, #stream }
+for _, cut in ipairs(cuts) do
+  got = {}
+  for i = 1, #stream, cut do
+    host.receive(stream:sub(i, i + cut - 1))
+  end
+  host.run()
+  check(cut)
+end
+
+client:close()
+host.run()
+print(("%d messages in %d bytes, cut %d ways: ok"):format(#expected, #stream, #cuts))
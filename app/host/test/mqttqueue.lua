@@ -0,0 +1,255 @@
+-- The MQTT client's send path against a broker the script plays. QoS 1
+-- publishes made before the first connection and during an outage are
+-- queued, spilling to a file once the queue is full, and go out when the
+-- broker accepts the connection, in order, with the window of them in
+-- flight at once and those left unanswered sent again as duplicates, also
+-- after MQTT_SEND_TIMEOUT on the same connection. A QoS
+-- 2 publish goes through PUBREC and PUBREL. Incoming QoS 1 publishes are
+-- acked while the queue is full, every one of them: those the client has
+-- no room to ack it does not deliver, and gets again.
+--
+--   nodemcu-host -g test/mqttqueue.lua
+--
+-- make mqttqueue runs it.
+
+local function expect(what, got, want)
+  if got ~= want then
+    error(("%s: got %s, want %s"):format(what, tostring(got), tostring(want)))
+  end
+end
+
+local function hi(n) return (n - n % 256) / 256 end
+
+-- the packets in what the client sent: type, flags and body of each
+local function packets(s)
+  local t, i = {}, 1
+  while i <= #s do
+    local n, mul, j, b = 0, 1, i + 1
+    repeat
+      b = s:byte(j)
+      j = j + 1
+      n = n + b % 128 * mul
+      mul = mul * 128
+    until b < 128
+    local h = s:byte(i)
+    t[#t + 1] = { type = (h - h % 16) / 16, flags = h % 16, body = s:sub(j, j + n - 1) }
+    i = j + n
+  end
+  return t
+end
+
+local function topic_id(p)
+  local tl = p.body:byte(1) * 256 + p.body:byte(2)
+  return p.body:sub(3, 2 + tl), p.body:byte(3 + tl) * 256 + p.body:byte(4 + tl)
+end
+
+local function ack(h, id) return string.char(h, 2, hi(id), id % 256) end
+local PUBACK, PUBREC, PUBREL, PUBCOMP = 0x40, 0x50, 0x62, 0x70
+local CONNACK = "\32\2\0\0"
+
+local function incoming(topic, id)
+  local body = string.char(0, #topic) .. topic .. string.char(hi(id), id % 256) .. "in"
+  return "\50" .. string.char(#body) .. body          -- PUBLISH, QoS 1
+end
+
+local seen, order, acked, offline = {}, {}, 0, 0
+local function on_puback() acked = acked + 1 end
+
+-- what the client sent, publishes noted in the order first seen
+local function take()
+  local p = packets(host.sent())
+  for _, pk in ipairs(p) do
+    if pk.type == 3 then
+      local topic = topic_id(pk)
+      if not seen[topic] then
+        seen[topic] = true
+        order[#order + 1] = topic
+      end
+    end
+  end
+  return p
+end
+
+-- the broker acks each publish it gets until the client sends no more
+local function drain()
+  for _ = 1, 200 do
+    local p = take()
+    if #p == 0 then return end
+    local acks = {}
+    for _, pk in ipairs(p) do
+      if pk.type == 3 then
+        local _, id = topic_id(pk)
+        acks[#acks + 1] = ack(PUBACK, id)
+      end
+    end
+    host.receive(table.concat(acks))
+    host.run()
+  end
+  error("the client kept sending")
+end
+
+local client = mqtt.Client("queue", 60)
+client:on("offline", function() offline = offline + 1 end)
+file.remove("mqtt.spl")
+client:spill("mqtt.spl")
+expect("default window", client:window(4), 1)
+expect("window", client:window(), 4)
+expect("window 0", pcall(client.window, client, 0), false)
+
+-- before there is a connection
+local payload = string.rep("x", 100)
+for i = 1, 30 do
+  expect("publish " .. i, client:publish("s/" .. i, payload, 1, 0, on_puback), true)
+end
+local n, spilled = client:queued()
+expect("queued before the connection", n + spilled, 30)
+if spilled == 0 then error("nothing spilled") end
+expect("qos 0 without a connection", client:publish("q0", "x", 0, 0), false)
+
+local connects = 0
+client:connect("127.0.0.1", 1883, 0, 0, function() connects = connects + 1 end)
+host.run()
+local p = take()
+expect("sent before CONNACK", #p, 1)
+expect("CONNECT", p[1].type, 1)
+host.receive(CONNACK)
+host.run()
+expect("connected", connects, 1)
+p = take()
+expect("in flight after CONNACK", #p, 4)
+for i = 1, 4 do expect("in flight " .. i, topic_id(p[i]), "s/" .. i) end
+
+-- answers out of order: each frees its own place in the window
+local _, id2 = topic_id(p[2])
+host.receive(ack(PUBACK, id2))
+host.run()
+p = take()
+expect("after one PUBACK", #p, 1)
+expect("next in flight", topic_id(p[1]), "s/5")
+expect("acked", acked, 1)
+print("queued before connecting, window of 4: ok")
+
+-- the broker goes away with s/1, s/3, s/4 and s/5 unanswered
+host.close()
+host.run()
+expect("offline", offline, 1)
+for i = 31, 40 do
+  expect("publish offline " .. i, client:publish("s/" .. i, payload, 1, 0, on_puback), true)
+end
+expect("qos 0 offline", client:publish("q0", "x", 0, 0), false)
+
+client:connect("127.0.0.1", 1883, 0, 0, function() connects = connects + 1 end)
+host.run()
+p = take()
+expect("sent before the second CONNACK", #p, 1)
+host.receive(CONNACK)
+host.run()
+p = take()
+expect("sent again", #p, 4)
+local again = { "s/1", "s/3", "s/4", "s/5" }
+for i = 1, 4 do
+  expect("sent again " .. i, topic_id(p[i]), again[i])
+  expect("DUP of " .. again[i], p[i].flags, 8 + 2)
+end
+local acks = {}
+for i = 1, 4 do acks[i] = ack(PUBACK, select(2, topic_id(p[i]))) end
+host.receive(table.concat(acks))
+host.run()
+drain()
+expect("published", #order, 40)
+for i = 1, 40 do expect("order " .. i, order[i], "s/" .. i) end
+expect("acked", acked, 40)
+n, spilled = client:queued()
+expect("left queued", n + spilled, 0)
+expect("spill file", file.open("mqtt.spl", "r"), nil)
+print("queued through an outage, spilled and sent in order: ok")
+
+-- QoS 2: the PUBREL takes the publish's place until the PUBCOMP
+client:publish("q2", "two", 2, 0, on_puback)
+host.run()
+p = take()
+expect("QoS 2 publish", #p, 1)
+expect("QoS 2 flags", p[1].flags, 4)
+local _, id = topic_id(p[1])
+host.receive(ack(PUBREC, id))
+host.run()
+p = take()
+expect("PUBREL", #p, 1)
+expect("PUBREL packet", p[1].type * 16 + p[1].flags, PUBREL)
+expect("PUBREL id", p[1].body:byte(1) * 256 + p[1].body:byte(2), id)
+host.receive(ack(PUBCOMP, id))
+host.run()
+expect("QoS 2 acked", acked, 41)
+expect("QoS 2 left queued", (client:queued()), 0)
+print("QoS 2: ok")
+
+-- acks while the queue is full of publishes the broker does not answer
+client:window(1)
+for i = 41, 70 do client:publish("s/" .. i, payload, 1, 0, on_puback) end
+host.run()
+p = take()
+expect("in flight with a window of 1", #p, 1)
+local _, id41 = topic_id(p[1])
+n, spilled = client:queued()
+if spilled == 0 then error("queue not full") end
+local got = {}
+client:on("message", function(c, topic) got[#got + 1] = topic end)
+local burst = {}
+for i = 1, 12 do burst[i] = incoming("in/" .. i, 100 + i) end
+host.receive(table.concat(burst))
+host.run()
+local delivered = #got
+local acked_ids = {}
+for _, pk in ipairs(take()) do
+  if pk.type * 16 + pk.flags == PUBACK then
+    acked_ids[#acked_ids + 1] = pk.body:byte(1) * 256 + pk.body:byte(2)
+  end
+end
+expect("acks sent for the burst", #acked_ids, delivered)
+if delivered == 12 then error("the whole burst fitted, no ack held back") end
+-- the broker sends those it got no ack for again
+local redo = {}
+for i = delivered + 1, 12 do redo[#redo + 1] = burst[i] end
+host.receive(table.concat(redo))
+host.run()
+for _, pk in ipairs(take()) do
+  if pk.type * 16 + pk.flags == PUBACK then
+    acked_ids[#acked_ids + 1] = pk.body:byte(1) * 256 + pk.body:byte(2)
+  end
+end
+expect("delivered", #got, 12)
+expect("acks", #acked_ids, 12)
+for i = 1, 12 do
+  expect("message " .. i, got[i], "in/" .. i)
+  expect("ack " .. i, acked_ids[i], 100 + i)
+end
+print(("acks with the queue full: %d of 12 at first, all once sent again: ok"):format(delivered))
+
+-- the broker answers what is left
+host.receive(ack(PUBACK, id41))
+host.run()
+drain()
+expect("published", #order, 71)                    -- q2 among them
+for i = 41, 70 do expect("order " .. i, order[i + 1], "s/" .. i) end
+expect("acked", acked, 71)
+n, spilled = client:queued()
+expect("left queued", n + spilled, 0)
+
+-- a publish the broker leaves unanswered goes again after MQTT_SEND_TIMEOUT
+client:publish("late", "x", 1, 0, on_puback)
+host.run()
+p = take()
+expect("late", topic_id(p[1]), "late")
+host.run(6000)
+p = take()
+expect("sent again unanswered", #p, 1)
+expect("late again", topic_id(p[1]), "late")
+expect("DUP of late", p[1].flags, 8 + 2)
+host.receive(ack(PUBACK, select(2, topic_id(p[1]))))
+host.run()
+expect("late acked", acked, 72)
+print("sent again when unanswered: ok")
+
+client:close()
+host.run()
+print("ok")
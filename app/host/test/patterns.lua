@@ -0,0 +1,61 @@
+-- Pattern matching benchmark: an HTTP request taken apart as a server on the
+-- device does it, with string.find, match, gmatch and gsub. Prints a
+-- checksum, the same with or without the pattern cache. A malformed pattern
+-- has to be an error even where nothing matches its beginning.
+--
+--   nodemcu-host -s test/patterns.lua [rounds]
+--
+-- make patterns runs it with and without the cache (nodemcu-host-nopatcache).
+
+local rounds = tonumber(arg and arg[1]) or 2000
+
+local body = string.rep("field=value&", 50)
+local request = table.concat({
+  "POST /config.html?ssid=home%20net&pwd=secret&mode=1 HTTP/1.1",
+  "Host: 192.168.4.1",
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:38.0) Gecko/20100101",
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+  "Accept-Language: en-US,en;q=0.5",
+  "Accept-Encoding: gzip, deflate",
+  "Connection: keep-alive",
+  "Content-Length: " .. #body,
+  "", body}, "\r\n")
+
+local function unescape(s)
+  return (s:gsub("%%(%x%x)", function(h) return string.char(tonumber(h, 16)) end))
+end
+
+local function parse(req)
+  local n = 0
+  local e = req:find("\r\n\r\n", 1, true) or req:find("\r\n\r\n")
+  local method, path, query = req:match("^(%u+) ([^ ?]*)%??([^ ]*) HTTP")
+  n = n + #method + #path + (e or 0)
+  for k, v in query:gmatch("([^&=]+)=([^&]*)") do
+    n = n + #k + #unescape(v)
+  end
+  for k, v in req:gmatch("\r\n([%w%-]+): ([^\r]*)") do
+    n = n + #k + #v
+  end
+  local len = req:match("Content%-Length: (%d+)")
+  n = n + tonumber(len)
+  if req:find("keep-alive") then n = n + 1 end
+  local text = req:gsub("\r\n", "\n")
+  return n + #text + select(2, req:gsub("Accept", "accept"))
+end
+
+for _, c in ipairs{ {"a%", "ends with"}, {"a[b", "missing"},
+                    {"a%f", "after"}, {"a%bx", "unbalanced"} } do
+  for _, f in ipairs{ string.find, string.match, string.gmatch("xyz", c[1]),
+                      function(s, p) return s:gsub(p, "") end } do
+    local ok, err = pcall(f, "xyz", c[1])
+    if ok or not err:find(c[2], 1, true) then
+      error(("%q: %s"):format(c[1], tostring(err)))
+    end
+  end
+end
+
+local check = 0
+for i = 1, rounds do
+  check = (check + parse(request)) % 65521
+end
+print(("patterns: %d rounds, checksum %d"):format(rounds, check))
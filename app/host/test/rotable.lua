@@ -0,0 +1,42 @@
+-- Read-only table benchmark: every key of every rotable in lua_rotable[]
+-- looked up in turn, as a script calling into the modules does, then the
+-- tables walked with pairs(). Prints lookups per second for each table and
+-- a checksum.
+--
+--   nodemcu-host test/rotable.lua [lookups]
+--
+-- make rotable runs it.
+
+local lookups = tonumber(arg and arg[1]) or 200000
+local clock = host.clock
+
+local check, total, spent = 0, 0, 0
+for _, name in ipairs(host.rotables()) do
+  local t = _G[name]
+  local keys = {}
+  for k in pairs(t) do
+    if type(k) == "string" then keys[#keys + 1] = k end
+  end
+  local n = #keys
+  local rounds = math.ceil(lookups / n)
+  local t0 = clock()
+  for _ = 1, rounds do
+    for i = 1, n do
+      if t[keys[i]] ~= nil then check = check + 1 end
+    end
+  end
+  local dt = clock() - t0
+  total, spent = total + rounds * n, spent + dt
+  print(("%-10s %3d keys %10.0f lookups/s"):format(name, n, rounds * n / dt))
+end
+print(("all        %14.0f lookups/s"):format(total / spent))
+
+local walks, steps = math.ceil(lookups / 100), 0
+local t0 = clock()
+for _ = 1, walks do
+  for _, name in ipairs(host.rotables()) do
+    for _ in pairs(_G[name]) do steps = steps + 1 end
+  end
+end
+print(("pairs()    %14.0f keys/s"):format(steps / (clock() - t0)))
+print(("checksum %d"):format((check + steps) % 65521))
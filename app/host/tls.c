@@ -0,0 +1,245 @@
+// tls-host: the firmware's TLS client (app/ssl) over a socket in place of the
+// lwIP PCB, for loopback tests against a local TLS server. It connects, does
+// the handshake as espconn_ssl.c does, sends a request and prints what came
+// back, with the CPU time the handshake took.
+//
+//   tls-host [-s session] [-f length] [-r request] host port
+//
+// With -s the session is offered from the file, if there is one, and kept in
+// it after the handshake: the RTC memory of a device in deep sleep between two
+// runs. A second run prints "resumed" if the server took the session back.
+// With -f the client asks for a maximum fragment length of 512 to 4096 bytes;
+// the heap the connection holds, and held at its peak, is printed at the end.
+
+#include "c_stdio.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+#include "host.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "ssl/ssl_os_port.h"
+#include "ssl/ssl_ssl.h"
+#include "ssl/ssl_crypto_misc.h"
+
+#define PROGNAME  "tls-host"
+
+// what net.c takes from the firmware for a server certificate
+unsigned char *default_certificate;
+unsigned int default_certificate_len = 0;
+unsigned char *default_private_key;
+unsigned int default_private_key_len = 0;
+
+// the server side, which the client never runs into
+int do_svr_handshake( SSL *ssl, int handshake_type, uint8_t *buf, int hs_len )
+{
+  return SSL_ERROR_NOT_SUPPORTED;
+}
+
+// ****************************************************************************
+// lwIP
+
+err_t tcp_write( struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags )
+{
+  const char *p = dataptr;
+  while( len > 0 )
+  {
+    ssize_t n = send( pcb->fd, p, len, 0 );
+    if( n <= 0 )
+      return ERR_MEM;
+    p += n;
+    len -= n;
+  }
+  return ERR_OK;
+}
+
+err_t tcp_output( struct tcp_pcb *pcb )
+{
+  return ERR_OK;
+}
+
+u16_t pbuf_copy_partial( struct pbuf *p, void *dataptr, u16_t len, u16_t offset )
+{
+  if( offset >= p->len )
+    return 0;
+  if( len > p->len - offset )
+    len = p->len - offset;
+  os_memcpy( dataptr, ( char * )p->payload + offset, len );
+  return len;
+}
+
+u8_t pbuf_free( struct pbuf *p )
+{
+  return 1;
+}
+
+// ****************************************************************************
+
+static double cpu_ms( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int connect_to( const char *host, const char *port )
+{
+  struct addrinfo hints, *res, *ai;
+  int fd = -1;
+  os_memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if( getaddrinfo( host, port, &hints, &res ) != 0 )
+    return -1;
+  for( ai = res; ai; ai = ai->ai_next )
+  {
+    fd = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+    if( fd < 0 )
+      continue;
+    if( connect( fd, ai->ai_addr, ai->ai_addrlen ) == 0 )
+      break;
+    close( fd );
+    fd = -1;
+  }
+  freeaddrinfo( res );
+  if( fd >= 0 )
+  {
+    // a server that keeps the connection open has answered by then
+    struct timeval tv = { 1, 0 };
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+  }
+  return fd;
+}
+
+// feed one read of the socket to the TLS client, as espconn_ssl_crecv does
+// with a pbuf, or the rest of the last one after a record of data; -1 when
+// the connection is gone or has been quiet for a while
+static int receive( SSL *ssl, int fd, uint8_t **data )
+{
+  static uint8_t buf[ 2048 ];
+  static struct pbuf p;
+  ssize_t n;
+  if( ssl->pbuf_offset == 0 )
+  {
+    if( ( n = recv( fd, buf, sizeof( buf ), 0 ) ) <= 0 )
+      return -1;
+    os_memset( &p, 0, sizeof( p ) );
+    p.payload = buf;
+    p.len = p.tot_len = n;
+  }
+  ssl->ssl_pbuf = &p;
+  n = ssl_read( ssl, data );
+  ssl->ssl_pbuf = NULL;
+  return n;
+}
+
+static int load_session( const char *name, SSL_CLIENT_SESSION *sess )
+{
+  FILE *f = fopen( name, "rb" );
+  int ok;
+  if( f == NULL )
+    return 0;
+  ok = fread( sess, sizeof( *sess ), 1, f ) == 1;
+  fclose( f );
+  return ok;
+}
+
+static void save_session( const char *name, const SSL_CLIENT_SESSION *sess )
+{
+  FILE *f = fopen( name, "wb" );
+  if( f == NULL || fwrite( sess, sizeof( *sess ), 1, f ) != 1 )
+    fprintf( stderr, "%s: cannot write %s\n", PROGNAME, name );
+  if( f )
+    fclose( f );
+}
+
+static void usage( void )
+{
+  fprintf( stderr, "usage: %s [-s session] [-f length] [-r request] host port\n", PROGNAME );
+  exit( EXIT_FAILURE );
+}
+
+int main( int argc, char **argv )
+{
+  const char *request = "GET / HTTP/1.0\r\n\r\n";
+  const char *session = NULL;
+  SSL_CLIENT_SESSION sess;
+  int offered = 0, resumed, fragment = 0;
+  size_t held = 0;
+  struct tcp_pcb pcb;
+  SSL_CTX *ssl_ctx;
+  SSL *ssl;
+  double t0;
+  int i, ret, total = 0;
+
+  for( i = 1; i < argc && argv[ i ][ 0 ] == '-'; i++ )
+  {
+    if( argv[ i ][ 1 ] == 'r' && i + 1 < argc )
+      request = argv[ ++i ];
+    else if( argv[ i ][ 1 ] == 's' && i + 1 < argc )
+      session = argv[ ++i ];
+    else if( argv[ i ][ 1 ] == 'f' && i + 1 < argc )
+      fragment = atoi( argv[ ++i ] );
+    else
+      usage();
+  }
+  if( argc - i != 2 )
+    usage();
+
+  os_memset( &pcb, 0, sizeof( pcb ) );
+  pcb.mss = 1460;
+  if( ( pcb.fd = connect_to( argv[ i ], argv[ i + 1 ] ) ) < 0 )
+  {
+    fprintf( stderr, "%s: cannot connect to %s:%s\n", PROGNAME, argv[ i ], argv[ i + 1 ] );
+    return EXIT_FAILURE;
+  }
+
+  // the options of espconn_ssl_connect
+  ssl_ctx = ssl_ctx_new( SSL_SERVER_VERIFY_LATER | SSL_NO_DEFAULT_KEY, SSL_DEFAULT_CLNT_SESS );
+  if( ssl_ctx_set_max_fragment( ssl_ctx, fragment ) != SSL_OK )
+    usage();
+  if( session )
+    offered = load_session( session, &sess );
+  t0 = cpu_ms();
+  ssl = SSLClient_resume( ssl_ctx, &pcb, offered ? &sess : NULL );
+  ret = SSL_OK;
+  while( ssl_handshake_status( ssl ) != SSL_OK && ret >= SSL_OK )
+    if( ( ret = receive( ssl, pcb.fd, NULL ) ) < 0 && ret != SSL_CLOSE_NOTIFY )
+      break;
+  if( ssl_handshake_status( ssl ) != SSL_OK )
+  {
+    fprintf( stderr, "%s: handshake failed (%d)\n", PROGNAME, ret );
+    return EXIT_FAILURE;
+  }
+  // the server takes a session back by answering with its id
+  resumed = offered && ssl_get_session_id_size( ssl ) == sess.sess_id_size &&
+            os_memcmp( ssl_get_session_id( ssl ), sess.session_id, sess.sess_id_size ) == 0;
+  printf( "handshake: %s, TLS 1.%d, cipher 0x%02x, fragment %d, %.1f ms of CPU\n",
+          resumed ? "resumed" : "full", ( ssl->version & 0x0f ) - 1,
+          ssl_get_cipher_id( ssl ), ssl->max_plain_length, cpu_ms() - t0 );
+  if( session && ssl_get_client_session( ssl, &sess ) == SSL_OK )
+    save_session( session, &sess );
+
+  ssl_write( ssl, ( const uint8_t * )request, os_strlen( request ) );
+  for( ;; )
+  {
+    uint8_t *data = NULL;
+    if( ( ret = receive( ssl, pcb.fd, &data ) ) < 0 )
+      break;
+    if( ret > 0 && data )
+      total += ret;
+    if( host_heap_used() > held )
+      held = host_heap_used();
+  }
+  printf( "received %d bytes\n", total );
+  printf( "heap: %u bytes held by the connection, %u at the peak\n",
+          ( unsigned )held, ( unsigned )host_heap_peak() );
+
+  ssl_free( ssl );
+  ssl_ctx_free( ssl_ctx );
+  close( pcb.fd );
+  return EXIT_SUCCESS;
+}
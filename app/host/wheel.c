@@ -0,0 +1,195 @@
+// wheel-host: the retransmission wheel of app/coap (node.c, coap_timer.c) on
+// a clock that jumps ahead by 1 to 250 ms at a time, so the wheel's os timer
+// fires late, sometimes by more than a tick. Confirmable messages go out at
+// random points within a tick and some are acknowledged; the others have to
+// go out again after their timeout, then twice that, and so on, and never
+// before. The clock starts a minute before system_get_time() wraps, so the
+// wheel goes through that too. The most any went late is printed.
+//
+//   wheel-host [steps] [seed]
+//
+// make wheel runs it.
+
+#include "c_stdio.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+#include "user_interface.h"
+#include "espconn.h"
+
+#include "host.h"
+#include "node.h"
+#include "coap_io.h"
+#include "coap_timer.h"
+
+#define PROGNAME  "wheel-host"
+
+#define MESSAGES  4096        // message ids, one per confirmable sent
+#define STEP_MAX  250         // most ms the clock jumps at a time
+
+coap_wheel_t gQueue;
+
+typedef struct
+{
+  coap_tid_t tid;
+  uint32_t timeout;           // of its node, in ms
+  uint32_t last;              // ms when it last went out
+  int sends;
+  int acked;
+} message;
+
+static message messages[ MESSAGES ];
+static int sent, early;
+static uint32_t latest;
+
+// system_get_time() counts us in 32 bits and wraps every 71 minutes: the ms
+// are counted from its steps
+static uint32_t now_ms( void )
+{
+  static uint32_t last;
+  static uint64_t us;
+  uint32_t t = system_get_time();
+  us += ( uint32_t )( t - last );
+  last = t;
+  return ( uint32_t )( us / 1000 );
+}
+
+sint8 espconn_sent( struct espconn *espconn, uint8 *psent, uint16 length )
+{
+  message *m = &messages[ ( psent[ 0 ] << 8 ) | psent[ 1 ] ];
+  uint32_t now = now_ms();
+
+  if( m->sends > 0 )
+  {
+    uint32_t due = m->timeout << ( m->sends - 1 );
+    uint32_t gap = now - m->last;
+    if( gap < due )
+    {
+      printf( "message %d: retransmission %d after %u ms, due after %u\n",
+              ( int )( m - messages ), m->sends, gap, due );
+      early++;
+    }
+    else if( gap - due > latest )
+      latest = gap - due;
+  }
+  m->last = now;
+  m->sends++;
+  return ESPCONN_OK;
+}
+
+// the node of a message, found by its PDU as tids can collide
+static coap_queue_t *find_node( coap_pdu_t *pdu )
+{
+  coap_queue_t *node;
+  int i;
+  for( i = 0; i < COAP_TID_BUCKETS; i++ )
+    for( node = gQueue.tid[ i ]; node; node = node->hnext )
+      if( node->pdu == pdu )
+        return node;
+  return NULL;
+}
+
+static int send_one( struct espconn *conn )
+{
+  coap_pdu_t *pdu = coap_new_pdu();
+  message *m = &messages[ sent ];
+  coap_queue_t *node;
+
+  if( !pdu )
+    return 0;
+  pdu->pkt->hdr.id[ 0 ] = pdu->msg.p[ 0 ] = sent >> 8;
+  pdu->pkt->hdr.id[ 1 ] = pdu->msg.p[ 1 ] = sent & 0xff;
+  pdu->msg.len = 2;
+  m->tid = coap_send_confirmed( conn, pdu );
+  node = find_node( pdu );
+  if( m->tid == COAP_INVALID_TID || !node )
+    return 0;
+  m->timeout = node->timeout;
+  sent++;
+  return 1;
+}
+
+// acknowledges a message still in the wheel, unless another has its tid
+static void ack_one( void )
+{
+  int i, j, n = rand() % sent;
+  for( i = 0; i < sent; i++ )
+  {
+    message *m = &messages[ ( n + i ) % sent ];
+    if( m->acked || m->sends > COAP_DEFAULT_MAX_RETRANSMIT )
+      continue;
+    for( j = 0; j < sent; j++ )
+      if( &messages[ j ] != m && messages[ j ].tid == m->tid && !messages[ j ].acked )
+        break;
+    if( j < sent )
+      continue;
+    if( coap_remove_node( &gQueue, m->tid ) )
+      m->acked = 1;
+    return;
+  }
+}
+
+int main( int argc, char **argv )
+{
+  int steps = argc > 1 ? atoi( argv[ 1 ] ) : 20000;
+  unsigned seed = argc > 2 ? atoi( argv[ 2 ] ) : 1;
+  unsigned char ip[ 4 ] = { 127, 0, 0, 1 };
+  struct espconn conn;
+  esp_udp udp;
+  int i, lost = 0;
+  uint32_t left;
+
+  if( steps <= 0 )
+  {
+    fprintf( stderr, "usage: %s [steps] [seed]\n", PROGNAME );
+    return EXIT_FAILURE;
+  }
+  srand( seed );
+  now_ms();
+  left = ( 0xffffffffu - system_get_time() ) / 1000;
+  if( left > 60000 )
+    host_clock_advance( left - 60000 );
+  memset( &conn, 0, sizeof( conn ) );
+  memset( &udp, 0, sizeof( udp ) );
+  memcpy( udp.remote_ip, ip, sizeof( ip ) );
+  udp.remote_port = 5683;
+  conn.type = ESPCONN_UDP;
+  conn.proto.udp = &udp;
+
+  for( i = 0; i < steps; i++ )
+  {
+    host_clock_advance( 1 + rand() % STEP_MAX );
+    host_timers_run();
+    switch( rand() % 8 )
+    {
+      case 0:
+        if( sent < MESSAGES && !send_one( &conn ) )
+        {
+          fprintf( stderr, "%s: could not send\n", PROGNAME );
+          return EXIT_FAILURE;
+        }
+        break;
+      case 1:
+        if( sent )
+          ack_one();
+        break;
+    }
+  }
+  // let the rest run out
+  while( gQueue.count )
+  {
+    host_clock_advance( 1 + rand() % STEP_MAX );
+    host_timers_run();
+  }
+
+  for( i = 0; i < sent; i++ )
+    if( !messages[ i ].acked && messages[ i ].sends != COAP_DEFAULT_MAX_RETRANSMIT + 1 )
+    {
+      printf( "message %d: sent %d times\n", i, messages[ i ].sends );
+      lost++;
+    }
+  printf( "%d messages, %d retransmissions early, %d not sent %d times, "
+          "at most %u ms late\n", sent, early, lost,
+          COAP_DEFAULT_MAX_RETRANSMIT + 1, latest );
+  return early || lost ? EXIT_FAILURE : EXIT_SUCCESS;
+}
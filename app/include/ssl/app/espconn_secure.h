@@ -41,6 +41,15 @@ extern sint8 espconn_secure_sent(struct espconn *espconn, uint8 *psent, uint16 l
 
 extern sint8 espconn_secure_accept(struct espconn *espconn);
 
+/******************************************************************************
+ * FunctionName : espconn_secure_set_size
+ * Description  : Set the maximum fragment length client connections ask for
+ * Parameters   : size -- 512, 1024, 2048 or 4096, or 0 not to ask
+ * Returns      : ESPCONN_OK, or ESPCONN_ARG for any other size
+*******************************************************************************/
+
+extern sint8 espconn_secure_set_size(uint16 size);
+
 #endif
 
 
@@ -55,5 +55,14 @@ extern void espconn_ssl_sent(void *arg, uint8 *psent, uint16 length);
 
 extern void espconn_ssl_disconnect(espconn_msg *pdis);
 
+/******************************************************************************
+ * FunctionName : espconn_ssl_set_size
+ * Description  : Set the maximum fragment length client connections ask for
+ * Parameters   : size -- 512, 1024, 2048 or 4096, or 0 not to ask
+ * Returns      : true if the size is one of those
+*******************************************************************************/
+
+extern bool espconn_ssl_set_size(uint16 size);
+
 #endif
 
@@ -105,9 +105,11 @@ typedef struct /**< A big integer "session" context. */
 #if defined(CONFIG_BIGINT_MONTGOMERY)
     bigint *bi_RR_mod_m[BIGINT_NUM_MODS];   /**< R^2 mod m */
     bigint *bi_R_mod_m[BIGINT_NUM_MODS];    /**< R mod m */
-    comp N0_dash[BIGINT_NUM_MODS];
 #elif defined(CONFIG_BIGINT_BARRETT)
     bigint *bi_mu[BIGINT_NUM_MODS];         /**< Storage for mu */
+#endif
+#if defined(CONFIG_BIGINT_MONTGOMERY) || defined(CONFIG_BIGINT_MONT_POWER)
+    comp N0_dash[BIGINT_NUM_MODS];          /**< -m^-1 mod radix, or 0 */
 #endif
     bigint *bi_normalised_mod[BIGINT_NUM_MODS]; /**< Normalised mod storage. */
     bigint **g;                 /**< Used by sliding-window. */
@@ -120,8 +120,33 @@
 #define MUL_KARATSUBA_THRESH 
 #define SQU_KARATSUBA_THRESH 
 #define CONFIG_BIGINT_SLIDING_WINDOW 1
+#define CONFIG_BIGINT_MAX_WINDOW 5
+#define CONFIG_BIGINT_MONT_POWER 1
 #define CONFIG_BIGINT_SQUARE 1
 #define CONFIG_BIGINT_CHECK_ON 1
 #define CONFIG_INTEGER_32BIT 1
 #undef CONFIG_INTEGER_16BIT
 #undef CONFIG_INTEGER_8BIT
+
+/* CONFIG_BIGINT_MONT_POWER does bi_mod_power() in Montgomery form on the
+   components, whatever the reduction of the other operations; the window of
+   its odd powers is at most CONFIG_BIGINT_MAX_WINDOW bits, a table of 2^(w-1)
+   residues. BIGINT_NO_MONT_POWER lets the host build it without, to compare */
+#if defined(CONFIG_BIGINT_MONT_POWER) && (defined(CONFIG_BIGINT_MONTGOMERY) || \
+    defined(BIGINT_NO_MONT_POWER))
+#undef CONFIG_BIGINT_MONT_POWER
+#endif
+
+/*
+ * AES Options
+ */
+#define CONFIG_AES_TTABLE 1
+#undef CONFIG_AES_TTABLE_RAM
+
+/* CONFIG_AES_TTABLE does the rounds of AES with a table of 256 words each
+   way, 2 KB of flash, or of RAM with CONFIG_AES_TTABLE_RAM; without it each
+   byte is worked out on its own. AES_NO_TTABLE lets the host build it
+   without, to compare */
+#if defined(CONFIG_AES_TTABLE) && defined(AES_NO_TTABLE)
+#undef CONFIG_AES_TTABLE
+#endif
@@ -86,8 +86,31 @@ void AES_set_key(AES_CTX *ctx, const uint8_t *key,
 void AES_cbc_encrypt(AES_CTX *ctx, const uint8_t *msg, 
         uint8_t *out, int length);
 void AES_cbc_decrypt(AES_CTX *ks, const uint8_t *in, uint8_t *out, int length);
+void AES_ctr_crypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length);
 void AES_convert_key(AES_CTX *ctx);
 
+/*
+ * AES-GCM (NIST SP 800-38D): a 96 bit IV, a 128 bit tag. The key schedule is
+ * the encrypting one both ways, and the table of multiples of the hash key
+ * lets GHASH go 4 bits at a time on 32 bit words.
+ */
+#define AES_GCM_IV_SIZE         12
+#define AES_GCM_TAG_SIZE        16
+
+typedef struct
+{
+    AES_CTX aes;
+    uint32_t hh[16][4];     /* i*H, for i of 4 bits */
+} AES_GCM_CTX;
+
+void AES_gcm_set_key(AES_GCM_CTX *ctx, const uint8_t *key, AES_MODE mode);
+void AES_gcm_encrypt(const AES_GCM_CTX *ctx, const uint8_t *iv,
+        const uint8_t *aad, int aad_len, const uint8_t *msg, uint8_t *out,
+        int length, uint8_t *tag);
+int AES_gcm_decrypt(const AES_GCM_CTX *ctx, const uint8_t *iv,
+        const uint8_t *aad, int aad_len, const uint8_t *msg, uint8_t *out,
+        int length, const uint8_t *tag);
+
 /**************************************************************************
  * RC4 declarations 
  **************************************************************************/
@@ -123,6 +146,14 @@ void SHA1_Init(SHA1_CTX *);
 void SHA1_Update(SHA1_CTX *, const uint8_t * msg, int len);
 void SHA1_Final(uint8_t *digest, SHA1_CTX *);
 
+/**************************************************************************
+ * SHA256 declarations - those of app/crypto, which SHA2_ENABLE builds
+ **************************************************************************/
+
+#include "../../crypto/sha2.h"
+
+#define SHA256_SIZE SHA256_DIGEST_LENGTH
+
 /**************************************************************************
  * MD2 declarations 
  **************************************************************************/
@@ -165,6 +196,8 @@ void ssl_hmac_md5(const uint8_t *msg, int length, const uint8_t *key,
         int key_len, uint8_t *digest);// fix hmac_md5 to ssl_hmac_md5, discriminate ieee80211
 void ssl_hmac_sha1(const uint8_t *msg, int length, const uint8_t *key, 
         int key_len, uint8_t *digest);// fix hmac_md5 to ssl_hmac_sha1, discriminate ieee80211
+void ssl_hmac_sha256(const uint8_t *msg, int length, const uint8_t *key, 
+        int key_len, uint8_t *digest);
 
 /**************************************************************************
  * RSA declarations 
@@ -128,6 +128,7 @@ typedef long     time_t;
 #define SSL_AES256_SHA                          0x35
 #define SSL_RC4_128_SHA                         0x05
 #define SSL_RC4_128_MD5                         0x04
+#define SSL_AES128_GCM_SHA256                   0x9c    /* TLS 1.2 only */
 
 /* build mode ids' */
 #define SSL_BUILD_SKELETON_MODE                 0x01
@@ -216,6 +217,19 @@ EXP_FUNC SSL_CTX * STDCALL ssl_ctx_new(uint32_t options, int num_sessions);
  */
 EXP_FUNC void STDCALL ssl_ctx_free(SSL_CTX *ssl_ctx);
 
+/**
+ * @brief (client only) Ask the server for a smaller maximum fragment length
+ * (RFC 6066), for the connections made from this context.
+ *
+ * The record buffer of each connection is sized to the fragment length, so
+ * a small one saves most of its memory. If the server does not take the
+ * extension, the connection goes on with the default size.
+ * @param ssl_ctx [in] The client context.
+ * @param length [in] 512, 1024, 2048 or 4096, or 0 not to ask.
+ * @return SSL_OK, or SSL_NOT_OK for any other length.
+ */
+EXP_FUNC int STDCALL ssl_ctx_set_max_fragment(SSL_CTX *ssl_ctx, int length);
+
 /**
  * @brief (server only) Establish a new SSL connection to an SSL client.
  *
@@ -250,6 +264,30 @@ EXP_FUNC SSL *STDCALL sslserver_new(SSL_CTX *ssl_ctx, struct tcp_pcb* client_pcb
 
 EXP_FUNC SSL *STDCALL SSLClient_new(SSL_CTX *ssl_ctx, struct tcp_pcb *SslClient_pcb, const
                                         uint8_t *session_id, uint8_t sess_id_size);
+
+/**
+ * @brief (client only) Establish a new SSL connection, offering the server
+ * a session kept from an earlier connection with ssl_get_client_session().
+ *
+ * If the server still has the session, the handshake is an abbreviated one,
+ * without the certificate and the RSA key exchange. If not, it goes on as a
+ * full handshake.
+ * @param ssl_ctx [in] The client context, which must have room for a session.
+ * @param SslClient_pcb [in] The connection.
+ * @param sess [in] The session to offer, or null for none.
+ * @return An SSL object reference.
+ */
+EXP_FUNC SSL *STDCALL SSLClient_resume(SSL_CTX *ssl_ctx, struct tcp_pcb *SslClient_pcb,
+                                        const SSL_CLIENT_SESSION *sess);
+
+/**
+ * @brief (client only) Get the session of a connection, to resume it on a
+ * later one with SSLClient_resume().
+ * @param ssl [in] An SSL object reference, once the handshake is complete.
+ * @param sess [out] The session id and the master secret.
+ * @return SSL_OK, or SSL_ERROR_INVALID_SESSION if there is no session to keep.
+ */
+EXP_FUNC int STDCALL ssl_get_client_session(const SSL *ssl, SSL_CLIENT_SESSION *sess);
 /**
  * @brief Free any used resources on this connection. 
  
@@ -329,6 +367,7 @@ EXP_FUNC uint8_t STDCALL ssl_get_session_id_size(const SSL *ssl);
  * - SSL_AES256_SHA (0x35)
  * - SSL_RC4_128_SHA (0x05)
  * - SSL_RC4_128_MD5 (0x04)
+ * - SSL_AES128_GCM_SHA256 (0x9c)
  */
 EXP_FUNC uint8_t STDCALL ssl_get_cipher_id(const SSL *ssl);
 
@@ -49,9 +49,11 @@ extern "C" {
 #include "lwip/tcp.h"
 
 #define SSL_PROTOCOL_MIN_VERSION    0x31   /* TLS v1.0 */
-#define SSL_PROTOCOL_MINOR_VERSION  0x02   /* TLS v1.1 */
-#define SSL_PROTOCOL_VERSION_MAX    0x32   /* TLS v1.1 */
+#define SSL_PROTOCOL_MINOR_VERSION  0x03   /* TLS v1.2 */
+#define SSL_PROTOCOL_VERSION_MAX    0x33   /* TLS v1.2 */
 #define SSL_PROTOCOL_VERSION1_1     0x32   /* TLS v1.1 */
+#define SSL_PROTOCOL_VERSION1_2     0x33   /* TLS v1.2 */
+#define SSL_PROTOCOL_SVR_VERSION_MAX 0x32  /* the server stops at TLS v1.1 */
 #define SSL_RANDOM_SIZE             32
 #define SSL_SECRET_SIZE             48
 #define SSL_FINISHED_HASH_SIZE      12
@@ -78,15 +80,28 @@ extern "C" {
 
 #define MAX_KEY_BYTE_SIZE           512     /* for a 4096 bit key */
 #define RT_MAX_PLAIN_LENGTH         4096
+#define RT_MIN_PLAIN_LENGTH         512
 #define RT_EXTRA                    1024
+#define RT_MFL_EXTRA                320     /* IV, MAC and the most padding */
 #define BM_RECORD_OFFSET            5
 
+/* the record buffer for fragments of up to A bytes: the slack of the default
+ * size is more than a negotiated smaller fragment needs */
+#define BM_BUFFER_SIZE(A)           ((A) + ((A) < RT_MAX_PLAIN_LENGTH ? \
+                                        RT_MFL_EXTRA : RT_EXTRA))
+
+/* RFC 6066 extensions */
+#define SSL_EXT_MAX_FRAGMENT_LENGTH 1
+
 #ifdef CONFIG_SSL_SKELETON_MODE
 #define NUM_PROTOCOLS               1
 #else
-#define NUM_PROTOCOLS               4
+#define NUM_PROTOCOLS               5
 #endif
 
+/* the suites that encrypt and authenticate in one (TLS 1.2 and up) */
+#define IS_AEAD_CIPHER(A)           ((A) == SSL_AES128_GCM_SHA256)
+
 #define PARANOIA_CHECK(A, B)        if (A < B) { \
     ret = SSL_ERROR_INVALID_HANDSHAKE; goto error; }
 
@@ -142,6 +157,14 @@ typedef struct
     uint8_t master_secret[SSL_SECRET_SIZE];
 } SSL_SESSION;
 
+/* what a client keeps of a session to resume it on a later connection */
+typedef struct
+{
+    uint8_t sess_id_size;
+    uint8_t session_id[SSL_SESSION_ID_SIZE];
+    uint8_t master_secret[SSL_SECRET_SIZE];
+} SSL_CLIENT_SESSION;
+
 typedef struct
 {
     uint8_t *buf;
@@ -152,12 +175,16 @@ typedef struct
 {
     MD5_CTX md5_ctx;
     SHA1_CTX sha1_ctx;
+    SHA256_CTX sha256_ctx;      /* the handshake hash of TLS 1.2 */
     uint8_t final_finish_mac[SSL_FINISHED_HASH_SIZE];
     uint8_t *key_block;
     uint8_t master_secret[SSL_SECRET_SIZE];
     uint8_t client_random[SSL_RANDOM_SIZE]; /* client's random sequence */
     uint8_t server_random[SSL_RANDOM_SIZE]; /* server's random sequence */
     uint16_t bm_proc_index;
+    uint8_t *hs_buf;            /* a handshake message split over records */
+    uint16_t hs_got;
+    uint8_t hs_hdr[SSL_HS_HDR_SIZE];
 } DISPOSABLE_CTX;
 
 struct _SSL
@@ -176,11 +203,14 @@ struct _SSL
     //int client_fd;
 	struct tcp_pcb *SslClient_pcb;//add by ives 12.12.2013
     struct pbuf *ssl_pbuf;//add by ives 12.12.2013
+    uint16_t pbuf_offset;               /* of the records not yet read */
     const cipher_info_t *cipher_info;
     void *encrypt_ctx;
     void *decrypt_ctx;
-    uint8_t bm_all_data[RT_MAX_PLAIN_LENGTH+RT_EXTRA];
+    uint8_t *bm_all_data;
     uint8_t *bm_data;
+    uint16_t bm_size;                   /* of bm_all_data */
+    uint16_t max_plain_length;          /* of a fragment, either way */
     uint16_t bm_index;
     uint16_t bm_read_index;
     struct _SSL *next;                  /* doubly linked list */
@@ -208,6 +238,7 @@ struct _SSL_CTX
 {
     uint32_t options;
     uint8_t chain_length;
+    uint16_t max_plain_length;  /* fragment length to ask for, or 0 */
     RSA_CTX *rsa_ctx;
 #ifdef CONFIG_SSL_CERT_VERIFICATION
     CA_CERT_CTX *ca_cert_ctx;
@@ -287,7 +318,7 @@ void DISPLAY_BYTES(SSL *ssl, const char *format,/* win32 has no variadic macros
 #endif
 
 #ifdef CONFIG_SSL_CERT_VERIFICATION
-int process_certificate(SSL *ssl, X509_CTX **x509_ctx);
+int process_certificate(SSL *ssl, X509_CTX **x509_ctx, uint8_t *buf, int hs_len);
 #endif
 
 SSL_SESSION *ssl_session_update(int max_sessions, 
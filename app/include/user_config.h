@@ -40,15 +40,41 @@
 #define ICACHE_RAM_ATTR __attribute__((section(".iram0.text")))
 
 #define CLIENT_SSL_ENABLE
+// Keep the TLS session of the last client connection in RTC memory, which
+// deep sleep keeps, and offer it when connecting to that server again: if the
+// server still has it, the handshake skips the certificate and the RSA.
+#define CLIENT_SSL_SESSION_RTC
 #define GPIO_INTERRUPT_ENABLE
 //#define MD2_ENABLE
+// SHA256 is also the handshake hash and PRF of TLS 1.2 in the SSL client
 #define SHA2_ENABLE
 
 // #define BUILD_WOFS		1
 #define BUILD_SPIFFS	1
 
+// Flash reserved between the firmware and SPIFFS for a Lua image loaded with
+// node.flashreload(). Enabling it moves SPIFFS, which then has to be formatted.
+// #define LUA_FLASH_IMAGE_SIZE	0x10000
+
 // #define LUA_NUMBER_INTEGRAL
 
+// Keep the numbers that are integers and fit 32 bits as ints, tagged apart
+// from the doubles, so that their arithmetic, loops and the bit module need no
+// software floating point. Scripts see one number type either way.
+#define LUA_INTFAST
+
+// Build in the VM profiler behind node.profile(), which costs a test on every
+// instruction the VM executes even when the profiler is stopped.
+// #define LUA_PROFILE
+
+// Account for the heap by subsystem (Lua, net, mqtt, coap, cjson) with size
+// histograms, for node.memstat(). Traced C blocks take 8 more bytes.
+// #define HEAP_TRACE
+
+// Take the Lua objects of up to 64 bytes from slabs of 512 bytes rather than
+// one by one from the heap, which they would otherwise cut into pieces.
+#define LUA_POOL
+
 #define LUA_OPTRAM
 #ifdef LUA_OPTRAM
 #define LUA_OPTIMIZE_MEMORY			2
@@ -0,0 +1,127 @@
+/*
+ * c_heaptrace.c
+ *
+ * Accounting of the heap by subsystem, see c_heaptrace.h.
+ */
+
+#include "c_types.h"
+#include "osapi.h"
+#include "lwip/mem.h"
+#include "c_heaptrace.h"
+
+#ifdef HEAP_TRACE
+
+// in front of every traced block, keeps the block 8 byte aligned
+typedef struct
+{
+  uint32_t size;
+  uint16_t tag;
+  uint16_t magic;
+} heap_block;
+
+#define HEAP_MAGIC  0x7ea5
+
+c_heap_stats c_heap;
+
+const char *const c_heap_tagnames[ HEAP_TAGS ] =
+{
+  "lua", "net", "mqtt", "coap", "cjson"
+};
+
+static int heap_class( size_t size )
+{
+  int c = 0;
+  size_t limit = HEAP_CLASS_MIN;
+  while( size > limit && c < HEAP_CLASSES - 1 )
+  {
+    limit <<= 1;
+    c ++;
+  }
+  return c;
+}
+
+void c_heap_account( int tag, size_t osize, size_t nsize )
+{
+  c_heap_tagstats *t = &c_heap.tag[ tag ];
+  if( osize )
+  {
+    t->bytes -= osize;
+    t->blocks --;
+    c_heap.bytes -= osize;
+    c_heap.live[ heap_class( osize ) ] --;
+  }
+  if( nsize )
+  {
+    t->bytes += nsize;
+    t->blocks ++;
+    t->allocs ++;
+    if( t->bytes > t->peak )
+      t->peak = t->bytes;
+    c_heap.bytes += nsize;
+    if( c_heap.bytes > c_heap.peak )
+      c_heap.peak = c_heap.bytes;
+    c_heap.live[ heap_class( nsize ) ] ++;
+    c_heap.allocs[ heap_class( nsize ) ] ++;
+  }
+}
+
+void *c_heap_realloc( void *ptr, size_t size, int tag )
+{
+  heap_block *b = NULL;
+  size_t osize = 0;
+  if( ptr )
+  {
+    b = ( heap_block* )ptr - 1;
+    if( b->magic != HEAP_MAGIC )  // not traced, leave it be
+      return ( void* )os_realloc( ptr, size );
+    osize = b->size;
+    tag = b->tag;
+  }
+  if( size == 0 )
+  {
+    c_heap_free( ptr );
+    return NULL;
+  }
+  b = ( heap_block* )os_realloc( b, sizeof( heap_block ) + size );
+  if( b == NULL )
+  {
+    c_heap.failed ++;
+    return NULL;
+  }
+  b->size = size;
+  b->tag = tag;
+  b->magic = HEAP_MAGIC;
+  c_heap_account( tag, osize, size );
+  return b + 1;
+}
+
+void *c_heap_malloc( size_t size, int tag )
+{
+  return c_heap_realloc( NULL, size, tag );
+}
+
+void *c_heap_zalloc( size_t size, int tag )
+{
+  void *p = c_heap_realloc( NULL, size, tag );
+  if( p )
+    os_memset( p, 0, size );
+  return p;
+}
+
+void c_heap_free( void *ptr )
+{
+  heap_block *b;
+  if( ptr == NULL )
+    return;
+  b = ( heap_block* )ptr - 1;
+  if( b->magic != HEAP_MAGIC )  // not traced
+  {
+    os_free( ptr );
+    return;
+  }
+  c_heap_account( b->tag, b->size, 0 );
+  b->magic = 0;
+  os_free( b );
+}
+
+#endif // #ifdef HEAP_TRACE
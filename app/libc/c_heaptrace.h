@@ -0,0 +1,83 @@
+/*
+ * c_heaptrace.h
+ *
+ * Accounting of the heap by subsystem, built in with HEAP_TRACE in
+ * user_config.h.
+ *
+ * A source file joins a subsystem by defining HEAP_TRACE_TAG before its
+ * first #include; its c_malloc, c_zalloc, c_realloc and c_free (and the os_
+ * ones) then go through the tracer, which puts the size and the tag in front
+ * of every block. A block so allocated must be freed by a file that is
+ * traced as well. Lua is accounted for in luaM_realloc_, which knows the
+ * sizes, and its blocks carry nothing extra.
+ */
+
+#ifndef _C_HEAPTRACE_H_
+#define _C_HEAPTRACE_H_
+
+#include "user_config.h"
+
+#ifdef HEAP_TRACE
+
+#include "c_types.h"
+
+#define HEAP_TAG_LUA	0
+#define HEAP_TAG_NET	1
+#define HEAP_TAG_MQTT	2
+#define HEAP_TAG_COAP	3
+#define HEAP_TAG_CJSON	4
+#define HEAP_TAGS	5
+
+// size classes of blocks: up to 8, 16, ... 2048 bytes, and larger
+#define HEAP_CLASSES	10
+#define HEAP_CLASS_MIN	8
+
+typedef struct
+{
+  uint32_t bytes;       // in use
+  uint32_t peak;        // most in use at one time
+  uint32_t blocks;      // in use
+  uint32_t allocs;      // allocations, reallocations included
+} c_heap_tagstats;
+
+typedef struct
+{
+  c_heap_tagstats tag[ HEAP_TAGS ];
+  uint32_t bytes;       // in use by all tags
+  uint32_t peak;        // most in use by all tags at one time
+  uint32_t failed;      // allocations that failed
+  uint32_t live[ HEAP_CLASSES ];    // blocks in use by size class
+  uint32_t allocs[ HEAP_CLASSES ];  // allocations by size class
+} c_heap_stats;
+
+extern c_heap_stats c_heap;
+extern const char *const c_heap_tagnames[ HEAP_TAGS ];
+
+void c_heap_account( int tag, size_t osize, size_t nsize );
+void *c_heap_malloc( size_t size, int tag );
+void *c_heap_zalloc( size_t size, int tag );
+void *c_heap_realloc( void *ptr, size_t size, int tag );
+void c_heap_free( void *ptr );
+
+#ifdef HEAP_TRACE_TAG
+#undef c_malloc
+#undef c_zalloc
+#undef c_realloc
+#undef c_free
+#undef os_malloc
+#undef os_zalloc
+#undef os_realloc
+#undef os_free
+#define c_malloc(s)     c_heap_malloc( (s), HEAP_TRACE_TAG )
+#define c_zalloc(s)     c_heap_zalloc( (s), HEAP_TRACE_TAG )
+#define c_realloc(p, s) c_heap_realloc( (p), (s), HEAP_TRACE_TAG )
+#define c_free(p)       c_heap_free( p )
+#define os_malloc(s)    c_heap_malloc( (s), HEAP_TRACE_TAG )
+#define os_zalloc(s)    c_heap_zalloc( (s), HEAP_TRACE_TAG )
+#define os_realloc(p, s) c_heap_realloc( (p), (s), HEAP_TRACE_TAG )
+#define os_free(p)      c_heap_free( p )
+#endif
+
+#endif /* HEAP_TRACE */
+
+#endif /* _C_HEAPTRACE_H_ */
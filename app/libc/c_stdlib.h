@@ -60,4 +60,7 @@ double	c_strtod(const char *__n, char **__end_PTR);
 // unsigned long c_strtoul(const char *__n, char **__end_PTR, int __base);
 // // long long c_strtoll(const char *__n, char **__end_PTR, int __base);
 
+// files traced with HEAP_TRACE_TAG get the tracer's allocation functions
+#include "c_heaptrace.h"
+
 #endif /* _C_STDLIB_H_ */
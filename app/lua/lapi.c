@@ -326,6 +326,8 @@ LUA_API lua_Number lua_tonumber (lua_State *L, int idx) {
 LUA_API lua_Integer lua_tointeger (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
+  if (ttisint(o))
+    return ivalue(o);
   if (tonumber(o, &n)) {
     lua_Integer res;
     lua_Number num = nvalue(o);
@@ -443,7 +445,12 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setnvalue(L->top, cast_num(n));
+  if (n == cast(l_int32, n)) {
+    setivalue(L->top, n);
+  }
+  else {
+    setnvalue(L->top, cast_num(n));
+  }
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -1094,6 +1101,38 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
 }
 
 
+/*
+** Room for up to `nsize' chars, in a block that lua_pushstrblock can make a
+** string of without a copy; `s' is NULL for a new block, and the block is
+** freed for a `nsize' of 0. Raises an error when out of memory, with `s'
+** left as it was.
+*/
+LUA_API char *lua_resizestrblock (lua_State *L, char *s, size_t osize,
+                                                         size_t nsize) {
+  char *b;
+  lua_lock(L);
+  if (nsize+1 > MAX_SIZET - sizeof(TString))
+    luaM_toobig(L);
+  b = cast(char *, luaM_realloc_(L, s ? s - sizeof(TString) : NULL,
+                                 s ? sizestrblock(osize) : 0,
+                                 nsize ? sizestrblock(nsize) : 0));
+  lua_unlock(L);
+  return b ? b + sizeof(TString) : NULL;
+}
+
+
+/* pushes the first `len' chars of block `s' as a string, which takes it */
+LUA_API void lua_pushstrblock (lua_State *L, char *s, size_t size,
+                                                      size_t len) {
+  lua_lock(L);
+  api_check(L, len <= size);
+  luaC_checkGC(L);
+  setsvalue2s(L, L->top, luaS_newblock(L, s - sizeof(TString), size, len));
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
   Udata *u;
   lua_lock(L);
@@ -531,6 +531,82 @@ LUALIB_API void luaL_buffinit (lua_State *L, luaL_Buffer *B) {
   B->lvl = 0;
 }
 
+
+#define BIGBUFFER	"luaL_BigBuffer"
+
+/* the block and its room, as the userdata in the slot of the buffer has it */
+typedef struct BigBox {
+  char *b;
+  size_t size;
+} BigBox;
+
+
+static int bigbuffer_gc (lua_State *L) {
+  BigBox *box = (BigBox *)lua_touserdata(L, 1);
+  if (box->b != NULL) {  /* not made a string: an error came first */
+    lua_resizestrblock(L, box->b, box->size, 0);
+    box->b = NULL;
+  }
+  return 0;
+}
+
+
+/* room for `size' chars now; 0 to leave it to the first add */
+LUALIB_API void luaL_bigbuffinit (lua_State *L, luaL_BigBuffer *B,
+                                  size_t size) {
+  BigBox *box = (BigBox *)lua_newuserdata(L, sizeof(BigBox));
+  box->b = NULL;
+  box->size = 0;
+  if (luaL_newmetatable(L, BIGBUFFER)) {
+    lua_pushcfunction(L, bigbuffer_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  B->L = L;
+  B->b = NULL;
+  B->n = B->size = 0;
+  B->box = box;
+  B->slot = lua_gettop(L);
+  if (size > 0)
+    luaL_prepbigbuffer(B, size);
+}
+
+
+/* makes room for `n' more chars, and returns where they go */
+LUALIB_API char *luaL_prepbigbuffer (luaL_BigBuffer *B, size_t n) {
+  if (B->size - B->n < n) {
+    BigBox *box = (BigBox *)B->box;
+    size_t size = B->size + B->size/2;
+    if (size < B->n + n)
+      size = B->n + n;
+    B->b = lua_resizestrblock(B->L, B->b, B->size, size);
+    box->b = B->b;
+    box->size = B->size = size;
+  }
+  return B->b + B->n;
+}
+
+
+LUALIB_API void luaL_addbiglstring (luaL_BigBuffer *B, const char *s,
+                                    size_t l) {
+  c_memcpy(luaL_prepbigbuffer(B, l), s, l);
+  B->n += l;
+}
+
+
+LUALIB_API void luaL_pushbigresult (luaL_BigBuffer *B) {
+  BigBox *box = (BigBox *)B->box;
+  if (B->b == NULL)
+    lua_pushlstring(B->L, "", 0);
+  else {
+    lua_pushstrblock(B->L, B->b, B->size, B->n);  /* the block is the string's */
+    box->b = NULL;
+  }
+  lua_replace(B->L, B->slot);  /* in the place of the buffer */
+  B->b = NULL;
+  B->n = B->size = 0;
+}
+
 /* }====================================================== */
 
 
@@ -713,7 +789,7 @@ LUALIB_API int luaL_loadfsfile (lua_State *L, const char *filename) {
     lf.f = fs_open(filename, FS_RDONLY);  /* reopen in binary mode */
     if (lf.f < FS_OPEN_OK) return errfsfile(L, "reopen", fnameindex);
     /* skip eventual `#!...' */
-   while ((c = fs_getc(lf.f)) != EOF && c != LUA_SIGNATURE[0]) ;
+    while ((c = fs_getc(lf.f)) != EOF && c != LUA_SIGNATURE[0]) ;
     lf.extraline = 0;
   }
   fs_ungetc(c, lf.f);
@@ -789,20 +865,31 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
     c_free(ptr);
     return NULL;
   }
-  if (L != NULL && (mode & EGC_ALWAYS)) /* always collect memory if requested */
+  if (L != NULL && (mode & EGC_ALWAYS)) { /* always collect memory if requested */
     luaC_fullgc(L);
+    G(L)->egc.fullgcs++;
+  }
   if(nsize > osize && L != NULL) {
 #if defined(LUA_STRESS_EMERGENCY_GC)
     luaC_fullgc(L);
 #endif
-    if(G(L)->memlimit > 0 && (mode & EGC_ON_MEM_LIMIT) && l_check_memlimit(L, nsize - osize))
+    if(G(L)->memlimit > 0 && (mode & EGC_ON_MEM_LIMIT) && l_check_memlimit(L, nsize - osize)) {
+      G(L)->egc.failures++;
       return NULL;
+    }
+    if (mode & EGC_ADAPTIVE)
+      legc_adapt(L, nsize - osize);
   }
   nptr = (void *)c_realloc(ptr, nsize);
-  if (nptr == NULL && L != NULL && (mode & EGC_ON_ALLOC_FAILURE)) {
-    luaC_fullgc(L); /* emergency full collection. */
+  if (nptr == NULL && L != NULL && (mode & (EGC_ON_ALLOC_FAILURE | EGC_ADAPTIVE))) {
+    if (mode & EGC_ADAPTIVE)
+      legc_failed(L, nsize);
+    luaC_fullgc(L); /* emergency full collection, which trims the pool too */
+    G(L)->egc.fullgcs++;
     nptr = (void *)c_realloc(ptr, nsize); /* try allocation again */
   }
+  if (nptr == NULL && L != NULL)
+    G(L)->egc.failures++;
   return nptr;
 }
 
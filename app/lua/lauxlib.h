@@ -167,6 +167,36 @@ LUALIB_API void (luaL_addvalue) (luaL_Buffer *B);
 LUALIB_API void (luaL_pushresult) (luaL_Buffer *B);
 
 
+/*
+** A buffer of any size in one block of the heap, grown by half again as it
+** fills, that luaL_pushbigresult makes the result string of without a copy.
+** It takes the slot above the top of the stack when it is made, where the
+** string is left in the end; the values pushed above it meanwhile are the
+** caller's. The block is freed by the GC if an error comes first.
+*/
+typedef struct luaL_BigBuffer {
+  char *b;  /* the chars, NULL while there is no room */
+  size_t n;  /* number of chars in it */
+  size_t size;  /* room for chars in the block */
+  void *box;  /* the block as the userdata in the slot knows it */
+  int slot;
+  lua_State *L;
+} luaL_BigBuffer;
+
+#define luaL_addbigchar(B,c) \
+  ((void)((B)->n < (B)->size || luaL_prepbigbuffer(B, 1)), \
+   ((B)->b[(B)->n++] = (char)(c)))
+
+#define luaL_addbigsize(B,s)	((B)->n += (s))
+
+LUALIB_API void (luaL_bigbuffinit) (lua_State *L, luaL_BigBuffer *B,
+                                    size_t size);
+LUALIB_API char *(luaL_prepbigbuffer) (luaL_BigBuffer *B, size_t n);
+LUALIB_API void (luaL_addbiglstring) (luaL_BigBuffer *B, const char *s,
+                                      size_t l);
+LUALIB_API void (luaL_pushbigresult) (luaL_BigBuffer *B);
+
+
 /* }====================================================== */
 
 
@@ -21,6 +21,7 @@
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lparser.h"
+#include "lprofile.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -141,11 +142,21 @@ static void correctstack (lua_State *L, TValue *oldstack) {
 }
 
 
+/*
+** The allocation may run the emergency GC, and the finalizers it calls may
+** grow or shrink the stack themselves: so the new stack is taken first and
+** what the old one holds is copied over once it is done, rather than the
+** stack being reallocated from where it was before the allocation.
+*/
 void luaD_reallocstack (lua_State *L, int newsize) {
-  TValue *oldstack = L->stack;
   int realsize = newsize + 1 + EXTRA_STACK;
+  TValue *newstack = luaM_newvector(L, realsize, TValue);
+  TValue *oldstack = L->stack;
+  int n = L->stacksize < realsize ? L->stacksize : realsize;
   lua_assert(L->stack_last - L->stack == L->stacksize - EXTRA_STACK - 1);
-  luaM_reallocvector(L, L->stack, L->stacksize, realsize, TValue);
+  c_memcpy(newstack, oldstack, n * sizeof(TValue));
+  luaM_freearray(L, oldstack, L->stacksize, TValue);
+  L->stack = newstack;
   L->stacksize = realsize;
   L->stack_last = L->stack+newsize;
   correctstack(L, oldstack);
@@ -153,8 +164,12 @@ void luaD_reallocstack (lua_State *L, int newsize) {
 
 
 void luaD_reallocCI (lua_State *L, int newsize) {
+  CallInfo *newci = luaM_newvector(L, newsize, CallInfo);  /* as above */
   CallInfo *oldci = L->base_ci;
-  luaM_reallocvector(L, L->base_ci, L->size_ci, newsize, CallInfo);
+  int n = L->size_ci < newsize ? L->size_ci : newsize;
+  c_memcpy(newci, oldci, n * sizeof(CallInfo));
+  luaM_freearray(L, oldci, L->size_ci, CallInfo);
+  L->base_ci = newci;
   L->size_ci = newsize;
   L->ci = (L->ci - oldci) + L->base_ci;
   L->end_ci = L->base_ci + L->size_ci - 1;
@@ -334,6 +349,9 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
     else
       n = ((lua_CFunction)fvalue(ci->func))(L);  /* do the actual call */
     lua_lock(L);
+#ifdef LUA_PROFILE
+    lprofile_creturn(L);  /* charge the time spent in C to the C function */
+#endif
     if (n < 0)  /* yielding? */
       return PCRYIELD;
     else {
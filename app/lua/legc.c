@@ -1,13 +1,127 @@
 // Lua EGC (Emergeny Garbage Collector) interface
 
 #include "legc.h"
+#include "lgc.h"
 #include "lstate.h"
 #include "c_types.h"
 
+#ifndef LUA_CROSS_COMPILER
+#include "user_interface.h"
+#endif
+
+// GC steps run ahead of the collector's pace before one allocation
+#define EGC_MAXSTEPS  8
+
+// allocations preceded by a full collection, when the mode is set and
+// after the heap is found cut up
+#define EGC_COMPACT   2048
+
 void legc_set_mode(lua_State *L, int mode, unsigned limit) {
    global_State *g = G(L); 
    
    g->egcmode = mode;
    g->memlimit = limit;
+   if (mode & EGC_ADAPTIVE) {
+      g->memlimit = 0;  // the limit is the free heap to keep
+      g->egc.base = limit ? limit : EGC_HEADROOM;
+      g->egc.compact = EGC_COMPACT;
+   }
+}
+
+/*
+** The adaptive mode looks at the free heap before Lua grows a block. Below
+** the target it runs GC steps ahead of the collector's pace; above it, it
+** brings the next cycle, or the next step of the running one, forward so
+** that the cycle can finish before the room left over the target is
+** allocated, going by what the last cycles allocated while they ran.
+**
+** The SDK does not tell the largest free block, so the heap is found to be
+** cut up when an allocation fails with enough heap free. Keeping more of it
+** free does not mend that; placing the blocks that stay while no garbage is
+** in the way does. For the first EGC_COMPACT allocations after the mode is
+** set, and again after such a failure, it runs a full collection before
+** each, as EGC_ALWAYS does. A collection or a failure that leaves less than
+** the target free ends that: a heap full of live blocks packed tighter only
+** leaves no room for what comes next.
+*/
+void legc_adapt(lua_State *L, size_t need) {
+#ifndef LUA_CROSS_COMPILER
+  global_State *g = G(L);
+  EGCState *e = &g->egc;
+  lu_mem avail, room;
+  int n;
+  if (is_block_gc(L))  // called from the collector
+    return;
+  if (e->compact > 0) {
+    e->compact--;
+    luaC_fullgc(L);
+    e->fullgcs++;
+    if (system_get_free_heap_size() < need + e->base)
+      e->compact = 0;
+    return;
+  }
+  if (g->gcstate != GCSpause && !e->running) {
+    e->running = 1;
+    e->mark = e->allocated;
+  }
+  avail = system_get_free_heap_size();
+  for (n = 0; avail < need + e->base && n < EGC_MAXSTEPS; n++) {
+    g->GCthreshold = g->totalbytes;
+    luaC_step(L);
+    e->steps++;
+    avail = system_get_free_heap_size();
+  }
+  room = avail > need + e->base ? avail - need - e->base : 0;
+  if (room <= e->rate)
+    g->GCthreshold = g->totalbytes;  // step at the next check
+  else if (g->GCthreshold > g->totalbytes + room - e->rate)
+    g->GCthreshold = g->totalbytes + room - e->rate;
+#endif
 }
 
+void legc_failed(lua_State *L, size_t need) {
+#ifndef LUA_CROSS_COMPILER
+  EGCState *e = &G(L)->egc;
+  if (system_get_free_heap_size() >= need + e->base) {
+    e->fragmented++;
+    e->compact = EGC_COMPACT;
+  }
+  else
+    e->compact = 0;
+#endif
+}
+
+void legc_cycle(lua_State *L) {
+  EGCState *e = &G(L)->egc;
+  e->cycles++;
+  if (e->running) {
+    e->rate = (3 * e->rate + (e->allocated - e->mark)) / 4;
+    e->running = 0;
+  }
+}
+
+int legc_pushstats(lua_State *L) {
+  EGCState *e = &G(L)->egc;
+  lua_createtable(L, 0, 10);
+  lua_pushinteger(L, G(L)->egcmode);
+  lua_setfield(L, -2, "mode");
+  lua_pushinteger(L, e->base);
+  lua_setfield(L, -2, "target");
+  lua_pushinteger(L, e->compact);
+  lua_setfield(L, -2, "compact");
+  lua_pushinteger(L, e->rate);
+  lua_setfield(L, -2, "rate");
+  lua_pushnumber(L, (lua_Number)e->allocated);
+  lua_setfield(L, -2, "allocated");
+  lua_pushinteger(L, e->cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushinteger(L, e->steps);
+  lua_setfield(L, -2, "steps");
+  lua_pushinteger(L, e->fullgcs);
+  lua_setfield(L, -2, "fullgcs");
+  lua_pushinteger(L, e->failures);
+  lua_setfield(L, -2, "failures");
+  lua_pushinteger(L, e->fragmented);
+  lua_setfield(L, -2, "fragmented");
+  return 1;
+}
@@ -10,8 +10,20 @@
 #define EGC_ON_ALLOC_FAILURE  1   // run EGC on allocation failure
 #define EGC_ON_MEM_LIMIT      2   // run EGC when an upper memory limit is hit
 #define EGC_ALWAYS            4   // always run EGC before an allocation
+#define EGC_ADAPTIVE          8   // run GC steps to keep some heap free, EGC on failure
 
+#define EGC_HEADROOM       4096   // free heap EGC_ADAPTIVE keeps by default
+
+// the limit is the memory limit of EGC_ON_MEM_LIMIT, or the free heap
+// EGC_ADAPTIVE keeps (EGC_HEADROOM if 0)
 void legc_set_mode(lua_State *L, int mode, unsigned limit);
 
+// hooks of the allocator and the collector
+void legc_adapt(lua_State *L, size_t need);
+void legc_failed(lua_State *L, size_t need);
+void legc_cycle(lua_State *L);
+
+int legc_pushstats(lua_State *L);
+
 #endif
 
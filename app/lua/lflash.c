@@ -0,0 +1,234 @@
+/*
+** Lua images: Protos and strings executed in place from flash
+** See Copyright Notice in lua.h
+*/
+
+#define lflash_c
+#define LUA_CORE
+#define LUAC_CROSS_FILE
+
+#include "lua.h"
+#include C_HEADER_STRING
+
+#include "ldo.h"
+#include "lflash.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+
+#if !defined(LUA_CROSS_COMPILER) && defined(LUA_FLASH_IMAGE_SIZE) && defined(BUILD_SPIFFS)
+#define LUA_FLASH_PARTITION
+#include "platform.h"
+#include "flash_fs.h"
+#include "user_interface.h"
+
+/* only the first MB of flash is mapped into the address space */
+#define FLASH_MAPPED_END	(INTERNAL_FLASH_START_ADDRESS + 0x100000)
+
+/* a pending node.flashreload() is kept in user RTC memory over the restart */
+#ifndef LUA_FLASH_RTC_ADDR
+#define LUA_FLASH_RTC_ADDR	64
+#endif
+
+/* bytes relocated and written per step, one bitmap byte per 8 words */
+#define FLASH_CHUNK	(64*sizeof(void *))
+
+typedef struct {
+  lu_int32 magic;
+  char name[FS_NAME_MAX_LENGTH+4];
+} FlashReload;
+
+/* the partition sits right behind the firmware, SPIFFS follows it */
+static char *flash_base (void) {
+  return (char *)platform_flash_get_first_free_block_address(NULL);
+}
+
+static const char *flash_check (int fd, FlashHeader *h) {
+  if (fs_read(fd, h, sizeof(FlashHeader)) != sizeof(FlashHeader) ||
+      h->magic != FLASH_MAGIC || h->version != FLASH_VERSION)
+    return "not a Lua image";
+  if (h->config != FLASH_CONFIG_NATIVE)
+    return "image built for a different VM";
+  if (h->size > LUA_FLASH_IMAGE_SIZE ||
+      (uint32_t)flash_base() + h->size > FLASH_MAPPED_END)
+    return "image too big";
+  if (h->size % sizeof(void *) != 0 ||
+      fs_size(fd) != h->size + FLASH_BITMAPSIZE(h->size))
+    return "image truncated";
+  return NULL;
+}
+
+/*
+** Copy the image in fname to the partition, relocating it on the way. The
+** chunk holding the header goes last, an image cut short is never mounted.
+*/
+static void flash_load (const char *fname) {
+  lu_int32 buf[FLASH_CHUNK/sizeof(lu_int32)];
+  lu_byte bits[FLASH_CHUNK/sizeof(void *)/8];
+  FlashHeader h;
+  const char *err;
+  char *base = flash_base();
+  uint32_t o, n, s;
+  int fd = fs_open(fname, FS_RDONLY);
+  if (fd < FS_OPEN_OK) {
+    NODE_ERR("cannot open %s\n", fname);
+    return;
+  }
+  if ((err = flash_check(fd, &h)) != NULL) {
+    NODE_ERR("%s: %s\n", fname, err);
+    fs_close(fd);
+    return;
+  }
+  s = platform_flash_get_sector_of_address((uint32_t)base);
+  for (o = 0; o < h.size; o += INTERNAL_FLASH_SECTOR_SIZE)
+    platform_flash_erase_sector(s++);
+  o = FLASH_CHUNK;
+  do {
+    if (o >= h.size) o = 0;
+    n = h.size - o < FLASH_CHUNK ? h.size - o : FLASH_CHUNK;
+    if (fs_seek(fd, o, FS_SEEK_SET) < 0 || fs_read(fd, buf, n) != n ||
+        fs_seek(fd, h.size + o/sizeof(void *)/8, FS_SEEK_SET) < 0 ||
+        fs_read(fd, bits, FLASH_BITMAPSIZE(n)) != FLASH_BITMAPSIZE(n)) {
+      NODE_ERR("%s: read error\n", fname);
+      break;
+    }
+    luaN_relocate(buf, n, bits, base);
+    platform_flash_write(buf, (uint32_t)base + o, n);
+    o += FLASH_CHUNK;
+  } while (o != FLASH_CHUNK);
+  fs_close(fd);
+}
+
+/*
+** Check fname and have it loaded on the next restart. The image cannot be
+** replaced while the VM runs from it, its strings are interned and its code
+** may be on the call stack.
+*/
+const char *luaN_reload (const char *fname) {
+  FlashReload r;
+  FlashHeader h;
+  const char *err;
+  size_t l = c_strlen(fname);
+  int fd;
+  if (l > FS_NAME_MAX_LENGTH)
+    return "filename too long";
+  if ((fd = fs_open(fname, FS_RDONLY)) < FS_OPEN_OK)
+    return "cannot open image";
+  err = flash_check(fd, &h);
+  fs_close(fd);
+  if (err)
+    return err;
+  c_memset(&r, 0, sizeof(r));
+  r.magic = FLASH_MAGIC;
+  c_memcpy(r.name, fname, l);
+  if (!system_rtc_mem_write(LUA_FLASH_RTC_ADDR, &r, sizeof(r)))
+    return "cannot save request";
+  return NULL;
+}
+
+#elif defined(LUA_CROSS_COMPILER)
+
+static const FlashHeader *flash_image = NULL;
+
+/* image mounted by the states created after this call */
+void luaN_setimage (const void *image) {
+  flash_image = cast(const FlashHeader *, image);
+}
+
+#else
+
+const char *luaN_reload (const char *fname) {
+  UNUSED(fname);
+  return "no flash partition for Lua images";
+}
+
+#endif
+
+
+/*
+** Image for a new state, NULL if there is none. On the device this is where
+** a pending node.flashreload() is carried out, before any string exists.
+*/
+const FlashHeader *luaN_image (void) {
+  const FlashHeader *h;
+#if defined(LUA_FLASH_PARTITION)
+  FlashReload r;
+  if (system_rtc_mem_read(LUA_FLASH_RTC_ADDR, &r, sizeof(r)) &&
+      r.magic == FLASH_MAGIC) {
+    r.magic = 0;
+    system_rtc_mem_write(LUA_FLASH_RTC_ADDR, &r, sizeof(r.magic));
+    r.name[FS_NAME_MAX_LENGTH] = '\0';
+    flash_load(r.name);
+  }
+  h = cast(const FlashHeader *, flash_base());
+#elif defined(LUA_CROSS_COMPILER)
+  h = flash_image;
+#else
+  h = NULL;
+#endif
+  if (h == NULL || h->magic != FLASH_MAGIC || h->version != FLASH_VERSION ||
+      h->config != FLASH_CONFIG_NATIVE)
+    return NULL;
+  return h;
+}
+
+
+/*
+** Relocate n bytes of an image file to an image mapped at base. bits are the
+** relocation bits of these bytes, which start on a multiple of 8 words.
+*/
+void luaN_relocate (void *data, size_t n, const lu_byte *bits,
+                    const void *base) {
+  char **w = cast(char **, data);
+  size_t i;
+  for (i = 0; i < n/sizeof(char *); i++)
+    if (bits[i >> 3] & (1 << (i & 7)))
+      w[i] = cast(char *, base) + cast(size_t, w[i]);
+}
+
+
+static void pushproto (lua_State *L, Proto *p) {
+  Closure *cl = luaF_newLclosure(L, p->nups, hvalue(gt(L)));
+  int i;
+  cl->l.p = p;
+  for (i = 0; i < p->nups; i++)  /* initialize eventual upvalues */
+    cl->l.upvals[i] = luaF_newupval(L);
+  setclvalue(L, L->top, cl);
+  incr_top(L);
+}
+
+
+/* push the main function of the mounted image, or nil */
+int luaN_pushmain (lua_State *L) {
+  const FlashHeader *h = G(L)->flash;
+  if (h == NULL) {
+    setnilvalue(L->top);
+    incr_top(L);
+    return 0;
+  }
+  pushproto(L, h->main);
+  return 1;
+}
+
+
+/* push the main function of module `name' of the mounted image, or nil */
+int luaN_pushmodule (lua_State *L, const char *name, size_t len) {
+  const FlashHeader *h = G(L)->flash;
+  if (h != NULL && h->sizeindex > 0) {
+    TString *ts = luaS_newlstr(L, name, len);
+    if (luaN_isimage(G(L), ts)) {  /* else no module has this name */
+      lu_int32 i = lmod(ts->tsv.hash, h->sizeindex);
+      for (; h->index[i].name != NULL; i = lmod(i + 1, h->sizeindex)) {
+        if (h->index[i].name == ts) {
+          pushproto(L, h->index[i].main);
+          return 1;
+        }
+      }
+    }
+  }
+  setnilvalue(L->top);
+  incr_top(L);
+  return 0;
+}
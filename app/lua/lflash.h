@@ -0,0 +1,98 @@
+/*
+** Lua images: Protos and strings executed in place from flash
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lflash_h
+#define lflash_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+/*
+** An image is one block of memory holding a header, a string table and the
+** TStrings and Protos of a compiled chunk, laid out exactly as the VM keeps
+** them in RAM. Once an image is mounted its main function runs straight from
+** it: no Proto, constant or string is copied to the heap.
+**
+** Image strings are interned ahead of the RAM string table, so a string that
+** exists in the image is never created in RAM. That only works if the image
+** is there before the first string is made, so it is mounted when the state
+** is created (see luaN_image). Image objects carry no white bit, the GC never
+** marks, moves or frees them.
+**
+** In an image file every pointer is stored as an offset from the start of
+** the image, and the image is followed by a relocation bitmap with one bit
+** per pointer sized word (least significant bit first) set where the word
+** holds a pointer. Loading adds the address the image is mapped at to the
+** marked words.
+**
+** An image built from several modules carries an index of them, an open
+** addressed hash table keyed by the module name. Module names are image
+** strings, so `require' finds a module with one probe on the interned name
+** and a name that is not in the image is turned down without probing.
+*/
+
+#define FLASH_MAGIC	0x4c464c41	/* "ALFL" */
+#define FLASH_VERSION	2
+
+/* layout of the VM an image is built for, must match to mount it */
+#define FLASH_CONFIG(ptr,num,integral,tvalue) \
+	((ptr) | ((num) << 8) | ((integral) << 15) | ((tvalue) << 16))
+#define FLASH_CONFIG_NATIVE	FLASH_CONFIG(sizeof(void *), sizeof(lua_Number), \
+	(((lua_Number)0.5) == 0), sizeof(TValue))
+
+typedef struct FlashModule {
+  TString *name;  /* NULL in a free slot */
+  Proto *main;
+} FlashModule;
+
+typedef struct FlashHeader {
+  lu_int32 magic;
+  lu_int32 version;
+  lu_int32 config;
+  lu_int32 size;  /* bytes in the image, header included */
+  GCObject **strt;  /* string table of the image */
+  lu_int32 strtsize;  /* buckets in `strt', a power of 2 */
+  lu_int32 nuse;  /* strings in the image */
+  Proto *main;  /* main function of the chunk */
+  FlashModule *index;  /* modules in the image */
+  lu_int32 sizeindex;  /* slots in `index', 0 or a power of 2 */
+  lu_int32 nmodules;
+} FlashHeader;
+
+#define FLASH_BITMAPSIZE(size)	(((size)/sizeof(void *) + 7) / 8)
+
+#define luaN_isimage(g,p) ((g)->flash != NULL && \
+	cast(const char *, p) >= cast(const char *, (g)->flash) && \
+	cast(const char *, p) < cast(const char *, (g)->flash) + (g)->flash->size)
+
+LUAI_FUNC const FlashHeader *luaN_image (void);
+LUAI_FUNC void luaN_relocate (void *data, size_t n, const lu_byte *bits,
+                              const void *base);
+LUAI_FUNC int luaN_pushmain (lua_State *L);
+LUAI_FUNC int luaN_pushmodule (lua_State *L, const char *name, size_t len);
+
+#ifdef LUA_CROSS_COMPILER
+LUAI_FUNC void luaN_setimage (const void *image);
+#else
+LUAI_FUNC const char *luaN_reload (const char *fname);
+#endif
+
+#ifdef luac_c
+/* info about the machine an image is built for */
+typedef struct {
+ int sizeof_ptr;
+ int sizeof_lua_Number;
+ int lua_Number_integral;
+ int align_lua_Number;	/* alignment of lua_Number inside a struct */
+ int align_max;		/* alignment of L_Umaxalign */
+} FlashTargetInfo;
+
+/* write a chunk and the index of its modules as an image; from lflashimg.c */
+LUAI_FUNC int luaN_dump (lua_State* L, const Proto* f, const Proto* const* modules,
+                         const char* const* names, int nmodules, lua_Writer w,
+                         void* data, int strip, FlashTargetInfo target);
+#endif
+
+#endif
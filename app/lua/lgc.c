@@ -14,9 +14,12 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "legc.h"
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lpool.h"
+#include "lprofile.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -37,7 +40,9 @@
 #define white2gray(x)	reset2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
 #define black2gray(x)	resetbit((x)->gch.marked, BLACKBIT)
 
-#define stringmark(s)	reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT)
+/* image strings have no white bit and must not be written to */
+#define stringmark(s)	(iswhite(obj2gco(s)) ? \
+	reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT) : 0)
 
 
 #define isfinalized(u)		testbit((u)->marked, FINALIZEDBIT)
@@ -494,6 +499,70 @@ void luaC_freeall (lua_State *L) {
 }
 
 
+/* bytes taken by an object, counted as propagatemark counts them */
+static lu_mem objsize (GCObject *o) {
+  switch (o->gch.tt) {
+    case LUA_TSTRING: return sizestring(gco2ts(o));
+    case LUA_TUSERDATA: return sizeudata(gco2u(o));
+    case LUA_TUPVAL: return sizeof(UpVal);
+    case LUA_TTABLE: {
+      Table *h = gco2h(o);
+      return sizeof(Table) + sizeof(TValue) * h->sizearray +
+                             sizeof(Node) * sizenode(h);
+    }
+    case LUA_TFUNCTION: {
+      Closure *cl = gco2cl(o);
+      return (cl->c.isC) ? sizeCclosure(cl->c.nupvalues) :
+                           sizeLclosure(cl->l.nupvalues);
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      return sizeof(lua_State) + sizeof(TValue) * th->stacksize +
+                                 sizeof(CallInfo) * th->size_ci;
+    }
+    case LUA_TPROTO: {
+      Proto *p = gco2p(o);
+      return sizeof(Proto) + sizeof(Proto *) * p->sizep +
+                             sizeof(TValue) * p->sizek +
+                             sizeof(LocVar) * p->sizelocvars +
+                             sizeof(TString *) * p->sizeupvalues +
+                             (proto_is_readonly(p) ? 0 : sizeof(Instruction) * p->sizecode +
+                                                         sizeof(int) * p->sizelineinfo);
+    }
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+static void censuslist (GCObject *o, lu_mem *count, lu_mem *bytes) {
+  for (; o != NULL; o = o->gch.next) {
+    count[o->gch.tt]++;
+    bytes[o->gch.tt] += objsize(o);
+  }
+}
+
+
+/*
+** Count the objects of each type and the bytes they take, `count' and
+** `bytes' indexed by type up to LUA_TUPVAL. Objects in a flash image are
+** in no list and not counted.
+*/
+void luaC_census (lua_State *L, lu_mem *count, lu_mem *bytes) {
+  global_State *g = G(L);
+  UpVal *uv;
+  int i;
+  for (i = 0; i <= LUA_TUPVAL; i++)
+    count[i] = bytes[i] = 0;
+  censuslist(g->rootgc, count, bytes);  /* userdata included */
+  for (i = 0; i < g->strt.size; i++)
+    censuslist(g->strt.hash[i], count, bytes);
+  for (uv = g->uvhead.u.l.next; uv != &g->uvhead; uv = uv->u.l.next) {
+    count[LUA_TUPVAL]++;  /* open upvalues are in their thread's list */
+    bytes[LUA_TUPVAL] += sizeof(UpVal);
+  }
+}
+
+
 static void markmt (global_State *g) {
   int i;
   for (i=0; i<NUM_TAGS; i++)
@@ -502,6 +571,25 @@ static void markmt (global_State *g) {
 
 
 /* mark root set */
+#ifdef LUA_PROFILE
+/* functions the profiler counted, marked here as they may have run and
+   gone since the cycle started */
+static void markprofile (global_State *g) {
+  Profile *pr = g->profile;
+  int i, k;
+  if (pr == NULL)
+    return;
+  for (i = 0; i < PROFILE_FUNCS; i++)
+    if (pr->func[i].p)
+      markobject(g, pr->func[i].p);
+  for (i = 0; i < PROFILE_STACKS; i++)
+    for (k = 0; k < pr->stack[i].depth; k++)
+      if (!(pr->stack[i].isC & (1u << k)))
+        markobject(g, (const Proto *)pr->stack[i].frame[k]);
+}
+#endif
+
+
 static void markroot (lua_State *L) {
   global_State *g = G(L);
   g->gray = NULL;
@@ -539,6 +627,9 @@ static void atomic (lua_State *L) {
   lua_assert(!iswhite(obj2gco(g->mainthread)));
   markobject(g, L);  /* mark running thread */
   markmt(g);  /* mark basic metatables (again) */
+#ifdef LUA_PROFILE
+  markprofile(g);
+#endif
   propagateall(g);
   /* remark gray again */
   g->gray = g->grayagain;
@@ -607,6 +698,7 @@ static l_mem singlestep (lua_State *L) {
       else {
         g->gcstate = GCSpause;  /* end collection */
         g->gcdept = 0;
+        legc_cycle(L);
         return 0;
       }
     }
@@ -679,6 +771,9 @@ void luaC_fullgc (lua_State *L) {
     singlestep(L);
   }
   setthreshold(g);
+#ifdef LUA_POOL
+  lpool_trim(L);
+#endif
   unset_block_gc(L);
 }
 
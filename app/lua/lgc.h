@@ -123,6 +123,7 @@
 LUAI_FUNC size_t luaC_separateudata (lua_State *L, int all);
 LUAI_FUNC void luaC_callGCTM (lua_State *L);
 LUAI_FUNC void luaC_freeall (lua_State *L);
+LUAI_FUNC void luaC_census (lua_State *L, lu_mem *count, lu_mem *bytes);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_fullgc (lua_State *L);
 LUAI_FUNC int luaC_sweepstrgc (lua_State *L);
@@ -14,6 +14,8 @@
 
 typedef LUAI_UINT32 lu_int32;
 
+typedef LUAI_INT32 l_int32;
+
 typedef LUAI_UMEM lu_mem;
 
 typedef LUAI_MEM l_mem;
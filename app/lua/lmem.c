@@ -15,8 +15,13 @@
 #include "ldo.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lpool.h"
 #include "lstate.h"
 
+#ifdef HEAP_TRACE
+#include "c_heaptrace.h"
+#endif
+
 
 
 /*
@@ -75,11 +80,21 @@ void *luaM_toobig (lua_State *L) {
 void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
+#ifdef LUA_POOL
+  if (lpool_wants(&g->pool, block, osize, nsize))
+    block = lpool_realloc(L, block, osize, nsize);
+  else
+#endif
   block = (*g->frealloc)(g->ud, block, osize, nsize);
   if (block == NULL && nsize > 0)
     luaD_throw(L, LUA_ERRMEM);
   lua_assert((nsize == 0) == (block == NULL));
   g->totalbytes = (g->totalbytes - osize) + nsize;
+  if (nsize > osize)
+    g->egc.allocated += nsize - osize;
+#ifdef HEAP_TRACE
+  c_heap_account(HEAP_TAG_LUA, osize, nsize);
+#endif
   return block;
 }
 
@@ -25,6 +25,7 @@
 #include "lauxlib.h"
 #include "lualib.h"
 #include "lrotable.h"
+#include "lflash.h"
 
 /* prefix for open functions in C libraries */
 #define LUA_POF		"luaopen_"
@@ -387,6 +388,17 @@ static void loaderror (lua_State *L, const char *filename) {
 }
 
 
+static int loader_flash (lua_State *L) {
+  size_t l;
+  const char *name = luaL_checklstring(L, 1, &l);
+  if (!luaN_pushmodule(L, name, l)) {  /* not in the flash image? */
+    lua_pop(L, 1);
+    lua_pushfstring(L, "\n\tno module '%s' in flash", name);
+  }
+  return 1;
+}
+
+
 static int loader_Lua (lua_State *L) {
   const char *filename;
   const char *name = luaL_checkstring(L, 1);
@@ -643,7 +655,7 @@ static const luaL_Reg ll_funcs[] = {
 
 
 static const lua_CFunction loaders[] =
-  {loader_preload, loader_Lua, loader_C, loader_Croot, NULL};
+  {loader_preload, loader_flash, loader_Lua, loader_C, loader_Croot, NULL};
 
 #if LUA_OPTIMIZE_MEMORY > 0
 #define MIN_OPT_LEVEL 1
@@ -77,6 +77,8 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
     case LUA_TNIL:
       return 1;
     case LUA_TNUMBER:
+      if (ttisint(t1) && ttisint(t2))
+        return ivalue(t1) == ivalue(t2);
       return luai_numeq(nvalue(t1), nvalue(t2));
     case LUA_TBOOLEAN:
       return bvalue(t1) == bvalue(t2);  /* boolean true must be 1 !! */
@@ -104,6 +106,24 @@ int luaO_str2d (const char *s, lua_Number *result) {
 }
 
 
+/*
+** sets a number, tagged as an integer if it is one that fits an l_int32;
+** -0 stays a double, as an integer would lose its sign
+*/
+void luaO_setnumber (TValue *o, lua_Number n) {
+#ifdef LUA_INTFAST
+  if (n >= -2147483648.0 && n < 2147483648.0) {
+    l_int32 i = cast(l_int32, n);
+    if (luai_numeq(cast_num(i), n) && (i != 0 || 1/n > 0)) {
+      setivalue(o, i);
+      return;
+    }
+  }
+#endif
+  setnvalue(o, n);
+}
+
+
 
 static void pushstr (lua_State *L, const char *str) {
   setsvalue2s(L, L->top, luaS_new(L, str));
@@ -135,7 +155,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
         break;
       }
       case 'd': {
-        setnvalue(L->top, cast_num(va_arg(argp, int)));
+        setivalue(L->top, va_arg(argp, int));
         incr_top(L);
         break;
       }
@@ -34,6 +34,14 @@
 #define LUA_TUPVAL	(LAST_TAG+2)
 #define LUA_TDEADKEY	(LAST_TAG+3)
 
+/*
+** A number that is an integer and fits an int is kept as one with LUA_INTFAST,
+** tagged LUA_TNUMINT. The bit is masked off by ttype(), so to everything
+** but the arithmetic it is a LUA_TNUMBER, and nvalue() reads it as a double.
+*/
+#define LUA_TINTBIT	16
+#define LUA_TNUMINT	(LUA_TNUMBER | LUA_TINTBIT)
+
 
 /*
 ** Union of all collectable objects
@@ -76,6 +84,10 @@ typedef union {
     int _pad2;
     int b;
   };
+  struct {
+    int _pad3;
+    l_int32 i;
+  };
 } Value;
 #else // #if defined( LUA_PACK_VALUE ) && defined( ELUA_ENDIAN_BIG )
 typedef union {
@@ -83,6 +95,7 @@ typedef union {
   void *p;
   lua_Number n;
   int b;
+  l_int32 i;
 } Value;
 #endif // #if defined( LUA_PACK_VALUE ) && defined( ELUA_ENDIAN_BIG )
 
@@ -135,17 +148,22 @@ typedef TValuefields TValue;
 
 /* Macros to test type */
 #ifndef LUA_PACK_VALUE
-#define ttisnil(o)	(ttype(o) == LUA_TNIL)
+#define ttisnil(o)	((o)->tt == LUA_TNIL)
 #define ttisnumber(o)	(ttype(o) == LUA_TNUMBER)
-#define ttisstring(o)	(ttype(o) == LUA_TSTRING)
-#define ttistable(o)	(ttype(o) == LUA_TTABLE)
-#define ttisfunction(o)	(ttype(o) == LUA_TFUNCTION)
-#define ttisboolean(o)	(ttype(o) == LUA_TBOOLEAN)
-#define ttisuserdata(o)	(ttype(o) == LUA_TUSERDATA)
-#define ttisthread(o)	(ttype(o) == LUA_TTHREAD)
-#define ttislightuserdata(o)	(ttype(o) == LUA_TLIGHTUSERDATA)
-#define ttisrotable(o) (ttype(o) == LUA_TROTABLE)
-#define ttislightfunction(o)  (ttype(o) == LUA_TLIGHTFUNCTION)
+#define ttisstring(o)	((o)->tt == LUA_TSTRING)
+#define ttistable(o)	((o)->tt == LUA_TTABLE)
+#define ttisfunction(o)	((o)->tt == LUA_TFUNCTION)
+#define ttisboolean(o)	((o)->tt == LUA_TBOOLEAN)
+#define ttisuserdata(o)	((o)->tt == LUA_TUSERDATA)
+#define ttisthread(o)	((o)->tt == LUA_TTHREAD)
+#define ttislightuserdata(o)	((o)->tt == LUA_TLIGHTUSERDATA)
+#define ttisrotable(o) ((o)->tt == LUA_TROTABLE)
+#define ttislightfunction(o)  ((o)->tt == LUA_TLIGHTFUNCTION)
+#ifdef LUA_INTFAST
+#define ttisint(o)	((o)->tt == LUA_TNUMINT)
+#else
+#define ttisint(o)	0
+#endif
 #else // #ifndef LUA_PACK_VALUE
 #define ttisnil(o) (ttype_sig(o) == add_sig(LUA_TNIL))
 #define ttisnumber(o)  ((o)->_t.sig != LUA_NOTNUMBER_SIG)
@@ -158,11 +176,16 @@ typedef TValuefields TValue;
 #define ttislightuserdata(o) (ttype_sig(o) == add_sig(LUA_TLIGHTUSERDATA))
 #define ttisrotable(o) (ttype_sig(o) == add_sig(LUA_TROTABLE))
 #define ttislightfunction(o)  (ttype_sig(o) == add_sig(LUA_TLIGHTFUNCTION))
+#define ttisint(o)	0
 #endif // #ifndef LUA_PACK_VALUE
 
 /* Macros to access values */
 #ifndef LUA_PACK_VALUE
+#ifdef LUA_INTFAST
+#define ttype(o)	((o)->tt & ~LUA_TINTBIT)
+#else
 #define ttype(o)	((o)->tt)
+#endif
 #else // #ifndef LUA_PACK_VALUE
 #define ttype(o)	((o)->_t.sig == LUA_NOTNUMBER_SIG ? (o)->_t.tt : LUA_TNUMBER)
 #define ttype_sig(o)	((o)->_ts.tt_sig)
@@ -171,7 +194,9 @@ typedef TValuefields TValue;
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
 #define rvalue(o)	check_exp(ttisrotable(o), (o)->value.p)
 #define fvalue(o) check_exp(ttislightfunction(o), (o)->value.p)
-#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+	ttisint(o) ? cast_num((o)->value.i) : (o)->value.n)
+#define ivalue(o)	check_exp(ttisint(o), (o)->value.i)
 #define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
 #define tsvalue(o)	(&rawtsvalue(o)->tsv)
 #define rawuvalue(o)	check_exp(ttisuserdata(o), &(o)->value.gc->u)
@@ -209,6 +234,13 @@ typedef TValuefields TValue;
 #define setnvalue(obj,x) \
   { lua_Number i_x = (x); TValue *i_o=(obj); i_o->value.n=i_x; i_o->tt=LUA_TNUMBER; }
 
+#ifdef LUA_INTFAST
+#define setivalue(obj,x) \
+  { l_int32 i_x = (x); TValue *i_o=(obj); i_o->value.i=i_x; i_o->tt=LUA_TNUMINT; }
+#else
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+#endif
+
 #define setpvalue(obj,x) \
   { void *i_x = (x); TValue *i_o=(obj); i_o->value.p=i_x; i_o->tt=LUA_TLIGHTUSERDATA; }
   
@@ -270,6 +302,8 @@ typedef TValuefields TValue;
 #define setnvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.n=(x); }
 
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+
 #define setpvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.p=(x); i_o->_ts.tt_sig=add_sig(LUA_TLIGHTUSERDATA);}
 
@@ -341,7 +375,7 @@ typedef TValuefields TValue;
 #define setsvalue2n	setsvalue
 
 #ifndef LUA_PACK_VALUE
-#define setttype(obj, tt) (ttype(obj) = (tt))
+#define setttype(obj, _tt) ((obj)->tt = (_tt))
 #else // #ifndef LUA_PACK_VALUE
 /* considering it used only in lgc to set LUA_TDEADKEY */
 /* we could define it this way */
@@ -543,6 +577,7 @@ LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
+LUAI_FUNC void luaO_setnumber (TValue *o, lua_Number n);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
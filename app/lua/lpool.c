@@ -0,0 +1,239 @@
+/*
+** Pool of small blocks for the objects of the Lua core
+** See Copyright Notice in lua.h
+*/
+
+#define lpool_c
+#define LUA_CORE
+#define LUAC_CROSS_FILE
+
+#include "lua.h"
+#include C_HEADER_STRING
+
+#include "lpool.h"
+#include "lstate.h"
+
+#ifdef LUA_POOL
+
+#define classof(n)	cast(int, ((n) - 1) / POOL_GRAIN)
+#define blocksize(c)	(((c) + 1) * POOL_GRAIN)
+#define nblocks(c)	((POOL_SLAB - sizeof(PoolSlab)) / blocksize(c))
+#define firstblock(s)	(cast(char *, s) + sizeof(PoolSlab))
+
+#define nextfree(b)	(*cast(void **, b))
+#define addr(p)		cast(size_t, p)
+
+#define frealloc(g,b,os,ns)	((*(g)->frealloc)((g)->ud, (b), (os), (ns)))
+
+
+/*
+** The allocator of the state may run a full collection, which frees
+** blocks and slabs, and whose finalizers and shrinking buffers may take
+** new ones: the pool is read again after every call to it.
+*/
+
+void lpool_init (Pool *p) {
+  c_memset(p, 0, sizeof(Pool));
+  p->on = 1;
+}
+
+
+/* index of the first slab after `b' */
+static int search (Pool *p, const void *b) {
+  int lo = 0, hi = p->nslab;
+  while (lo < hi) {
+    int m = (lo + hi) / 2;
+    if (addr(p->slab[m]) > addr(b)) hi = m;
+    else lo = m + 1;
+  }
+  return lo;
+}
+
+
+static PoolSlab *findslab (Pool *p, const void *b) {
+  int i = search(p, b);
+  if (i > 0 && addr(b) < addr(p->slab[i - 1]) + POOL_SLAB)
+    return p->slab[i - 1];
+  return NULL;  /* a block of the heap */
+}
+
+
+static void linkroom (Pool *p, PoolSlab *s) {
+  PoolSlab **head = &p->room[s->s.cls];
+  s->s.prev = NULL;
+  s->s.next = *head;
+  if (*head) (*head)->s.prev = s;
+  *head = s;
+}
+
+
+static void unlinkroom (Pool *p, PoolSlab *s) {
+  if (s->s.prev) s->s.prev->s.next = s->s.next;
+  else p->room[s->s.cls] = s->s.next;
+  if (s->s.next) s->s.next->s.prev = s->s.prev;
+}
+
+
+static void freeslab (global_State *g, PoolSlab *s) {
+  Pool *p = &g->pool;
+  int i = search(p, s) - 1;
+  lua_assert(i >= 0 && p->slab[i] == s && s->s.used == 0);
+  unlinkroom(p, s);
+  c_memmove(p->slab + i, p->slab + i + 1, (p->nslab - i - 1) * sizeof(PoolSlab *));
+  p->nslab--;
+  frealloc(g, s, POOL_SLAB, 0);
+}
+
+
+/* make room in the index for one more slab */
+static int growindex (global_State *g) {
+  Pool *p = &g->pool;
+  int size = p->sizeslab ? 2 * p->sizeslab : POOL_MINSLABS;
+  PoolSlab **a;
+  if (p->nslab < p->sizeslab)
+    return 1;
+  /* not a realloc of the index, which may change while this allocates */
+  a = cast(PoolSlab **, frealloc(g, NULL, 0, size * sizeof(PoolSlab *)));
+  if (a == NULL)
+    return 0;
+  if (p->sizeslab >= size) {  /* grown meanwhile */
+    frealloc(g, a, size * sizeof(PoolSlab *), 0);
+    return 1;
+  }
+  if (p->nslab > 0)
+    c_memcpy(a, p->slab, p->nslab * sizeof(PoolSlab *));
+  frealloc(g, p->slab, p->sizeslab * sizeof(PoolSlab *), 0);
+  p->slab = a;
+  p->sizeslab = size;
+  return 1;
+}
+
+
+static PoolSlab *newslab (lua_State *L, int c) {
+  global_State *g = G(L);
+  Pool *p = &g->pool;
+  PoolSlab *s;
+  char *b;
+  int i, n = nblocks(c);
+  if (!growindex(g))
+    return NULL;
+  if (p->room[c])  /* a block was freed meanwhile */
+    return p->room[c];
+  s = cast(PoolSlab *, frealloc(g, NULL, 0, POOL_SLAB));
+  if (s == NULL)
+    return NULL;
+  if (!growindex(g)) {  /* filled meanwhile */
+    frealloc(g, s, POOL_SLAB, 0);
+    return NULL;
+  }
+  s->s.free = NULL;
+  for (i = n - 1, b = firstblock(s) + i * blocksize(c); i >= 0; i--, b -= blocksize(c)) {
+    nextfree(b) = s->s.free;
+    s->s.free = b;
+  }
+  s->s.used = 0;
+  s->s.cls = cast_byte(c);
+  i = search(p, s);
+  c_memmove(p->slab + i + 1, p->slab + i, (p->nslab - i) * sizeof(PoolSlab *));
+  p->slab[i] = s;
+  p->nslab++;
+  linkroom(p, s);
+  return s;
+}
+
+
+static void *allocblock (lua_State *L, int c) {
+  Pool *p = &G(L)->pool;
+  PoolSlab *s = p->room[c];
+  void *b;
+  if (s == NULL && (s = newslab(L, c)) == NULL)
+    return NULL;
+  b = s->s.free;
+  s->s.free = nextfree(b);
+  p->used += blocksize(c);
+  if (++s->s.used == nblocks(c))  /* full */
+    unlinkroom(p, s);
+  return b;
+}
+
+
+static void freeblock (global_State *g, PoolSlab *s, void *b) {
+  Pool *p = &g->pool;
+  int c = s->s.cls;
+  nextfree(b) = s->s.free;
+  s->s.free = b;
+  p->used -= blocksize(c);
+  if (s->s.used-- == nblocks(c))  /* it was full */
+    linkroom(p, s);
+  else if (s->s.used == 0 && (p->room[c] != s || s->s.next != NULL))
+    freeslab(g, s);  /* not the only one of its class with room */
+}
+
+
+void *lpool_realloc (lua_State *L, void *block, size_t osize, size_t nsize) {
+  global_State *g = G(L);
+  Pool *p = &g->pool;
+  PoolSlab *s = block ? findslab(p, block) : NULL;
+  void *nblock = NULL;
+  if (nsize == 0) {
+    if (s != NULL)
+      freeblock(g, s, block);
+    else
+      frealloc(g, block, osize, 0);
+    return NULL;
+  }
+  if (s != NULL && classof(nsize) == s->s.cls)
+    return block;  /* fits where it is */
+  if (nsize <= POOL_MAX && p->on) {
+    nblock = allocblock(L, classof(nsize));
+    if (nblock == NULL)
+      p->missed++;
+  }
+  if (nblock == NULL) {
+    if (s == NULL)  /* a block of the heap, or none */
+      return frealloc(g, block, osize, nsize);
+    if (nsize < osize)
+      return block;  /* shrinking cannot fail, stay in the larger block */
+    nblock = frealloc(g, NULL, 0, nsize);
+    if (nblock == NULL)
+      return NULL;
+  }
+  if (block != NULL) {
+    c_memcpy(nblock, block, osize < nsize ? osize : nsize);
+    if (s != NULL)
+      freeblock(g, s, block);
+    else
+      frealloc(g, block, osize, 0);
+  }
+  return nblock;
+}
+
+
+/* give back the empty slabs kept for each class */
+void lpool_trim (lua_State *L) {
+  global_State *g = G(L);
+  int c;
+  for (c = 0; c < POOL_CLASSES; c++) {
+    PoolSlab *s = g->pool.room[c];
+    while (s != NULL) {
+      PoolSlab *next = s->s.next;
+      if (s->s.used == 0)
+        freeslab(g, s);
+      s = next;
+    }
+  }
+}
+
+
+void lpool_close (lua_State *L) {
+  global_State *g = G(L);
+  Pool *p = &g->pool;
+  int i;
+  for (i = 0; i < p->nslab; i++)
+    frealloc(g, p->slab[i], POOL_SLAB, 0);
+  frealloc(g, p->slab, p->sizeslab * sizeof(PoolSlab *), 0);
+  lpool_init(p);
+  p->on = 0;
+}
+
+#endif
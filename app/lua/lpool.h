@@ -0,0 +1,66 @@
+/*
+** Pool of small blocks for the objects of the Lua core
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lpool_h
+#define lpool_h
+
+#include "lua.h"
+#include "llimits.h"
+
+#ifdef LUA_POOL
+
+/*
+** Built in with LUA_POOL in user_config.h. luaM_realloc_ takes the blocks
+** of up to POOL_MAX bytes (strings, tables, closures, upvalues and the
+** small arrays of tables) from slabs of POOL_SLAB bytes, one size class to
+** a slab, so that the many short lived small objects do not cut the heap
+** into pieces. A slab goes back to the heap when its last block is freed,
+** except for one kept for each class until the next full collection.
+**
+** Slabs are taken from the heap through the allocator of the state, so the
+** emergency GC works for them as for any other block. When no slab can be
+** had a small block comes from the heap itself; a block is told to be in
+** a slab by its address, so it is freed right either way.
+*/
+
+#define POOL_MAX	64	/* largest block from the pool */
+#define POOL_GRAIN	8	/* sizes of the classes are multiples of it */
+#define POOL_CLASSES	(POOL_MAX / POOL_GRAIN)
+#define POOL_SLAB	512	/* bytes of a slab, with its header */
+#define POOL_MINSLABS	4	/* first size of the index of slabs */
+
+typedef union PoolSlab {
+  struct {
+    union PoolSlab *next, *prev;  /* list of the slabs of a class with room */
+    void *free;  /* free blocks, linked through their first word */
+    unsigned short used;  /* blocks in use */
+    lu_byte cls;  /* size class */
+  } s;
+  L_Umaxalign dummy;  /* the blocks that follow are aligned */
+} PoolSlab;
+
+typedef struct Pool {
+  int on;  /* small blocks are taken from slabs */
+  PoolSlab *room[POOL_CLASSES];  /* slabs with free blocks, by class */
+  PoolSlab **slab;  /* all slabs, by address */
+  int nslab;
+  int sizeslab;
+  lu_mem used;  /* bytes of the blocks in use, rounded up to their class */
+  lu_mem missed;  /* small blocks that came from the heap */
+} Pool;
+
+/* does luaM_realloc_ go to the pool for this block? */
+#define lpool_wants(p,b,os,ns) \
+	(((ns) <= POOL_MAX && (p)->on) || \
+	 ((b) != NULL && (os) <= POOL_MAX && (p)->nslab > 0))
+
+void lpool_init(Pool *p);
+void *lpool_realloc(lua_State *L, void *block, size_t osize, size_t nsize);
+void lpool_trim(lua_State *L);
+void lpool_close(lua_State *L);
+
+#endif
+
+#endif
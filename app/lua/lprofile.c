@@ -0,0 +1,277 @@
+/*
+** Profiler of the VM
+** See Copyright Notice in lua.h
+*/
+
+#define lprofile_c
+#define LUA_CORE
+#define LUAC_CROSS_FILE
+
+#include "lua.h"
+#include C_HEADER_STRING
+
+#include "ldo.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lprofile.h"
+#include "lrotable.h"
+#include "lstate.h"
+
+#ifdef LUA_PROFILE
+#include "user_interface.h"
+
+extern const luaR_table lua_rotable[];
+#if LUA_OPTIMIZE_MEMORY == 2
+extern const luaR_entry base_funcs_list[];
+#endif
+
+/* the C function `o' calls, NULL if it is not one */
+#define cfunc(o)	(ttislightfunction(o) ? fvalue(o) : \
+	ttisfunction(o) && clvalue(o)->c.isC ? (const void *)clvalue(o)->c.f : NULL)
+
+#define hashptr(p)	((unsigned)((size_t)(p) >> 2))
+
+
+int lprofile_slot (Profile *pr, const Proto *p) {
+  unsigned i = hashptr(p) % PROFILE_FUNCS;
+  int n;
+  for (n = 0; n < PROFILE_FUNCS; n++) {
+    ProfileFunc *f = &pr->func[i];
+    if (f->p == p)
+      return i;
+    if (f->p == NULL) {
+      f->p = p;
+      return i;
+    }
+    if (++i == PROFILE_FUNCS) i = 0;
+  }
+  return PROFILE_FUNCS;  /* full, count it with the rest */
+}
+
+
+static void record (lua_State *L, Profile *pr, lu_mem n) {
+  ProfileStack s;
+  CallInfo *ci;
+  unsigned h = 0;
+  int i, k;
+  s.isC = 0;
+  s.depth = 0;
+  s.truncated = 0;
+  for (ci = L->ci; ci > L->base_ci; ci--) {
+    const void *f = cfunc(ci->func);
+    int isC = f != NULL;
+    if (!isC) {
+      if (!ttisfunction(ci->func))
+        continue;
+      f = clvalue(ci->func)->l.p;
+    }
+    if (s.depth == PROFILE_DEPTH) {
+      s.truncated = 1;
+      break;
+    }
+    if (isC) s.isC |= 1u << s.depth;
+    s.frame[s.depth++] = f;
+    h = h * 31 + hashptr(f);
+  }
+  if (s.depth == 0)
+    return;
+  i = h % PROFILE_STACKS;
+  for (k = 0; k < PROFILE_STACKS; k++) {
+    ProfileStack *t = &pr->stack[i];
+    if (t->count == 0) {
+      s.count = n;
+      *t = s;
+      return;
+    }
+    if (t->depth == s.depth && t->isC == s.isC &&
+        t->truncated == s.truncated &&
+        c_memcmp(t->frame, s.frame, s.depth * sizeof(s.frame[0])) == 0) {
+      t->count += n;
+      return;
+    }
+    if (++i == PROFILE_STACKS) i = 0;
+  }
+  pr->lost += n;
+}
+
+
+void lprofile_sample (lua_State *L) {
+  Profile *pr = G(L)->profile;
+  lu_int32 late = (lu_int32)system_get_time() - pr->next;
+  lu_int32 n;
+  if (late & 0x80000000u)  /* not yet */
+    return;
+  n = 1 + late / pr->period;
+  pr->next += n * pr->period;
+  record(L, pr, n);
+}
+
+
+void lprofile_tick (lua_State *L) {
+  G(L)->profile->tick = PROFILE_TICK;
+  lprofile_sample(L);
+}
+
+
+void lprofile_free (lua_State *L) {
+  luaM_free(L, G(L)->profile);
+  G(L)->profile = NULL;
+}
+
+
+void lprofile_start (lua_State *L, unsigned period) {
+  global_State *g = G(L);
+  if (g->profile == NULL)
+    g->profile = luaM_new(L, Profile);
+  c_memset(g->profile, 0, sizeof(Profile));
+  g->profile->period = period ? period : PROFILE_PERIOD;
+  g->profile->tick = PROFILE_TICK;
+  g->profile->next = (lu_int32)system_get_time() + g->profile->period;
+  g->profile->on = 1;
+}
+
+
+void lprofile_stop (lua_State *L) {
+  if (G(L)->profile)
+    G(L)->profile->on = 0;
+}
+
+
+static int pushcname (lua_State *L, const void *f) {
+  const luaR_table *t;
+  const luaR_entry *e;
+  for (t = lua_rotable; t->name; t++)
+    for (e = t->pentries; e->key.type != LUA_TNIL; e++)
+      if (e->key.type == LUA_TSTRING && ttislightfunction(&e->value) &&
+          fvalue(&e->value) == f) {
+        lua_pushfstring(L, "%s.%s", t->name, e->key.id.strkey);
+        return 1;
+      }
+#if LUA_OPTIMIZE_MEMORY == 2
+  for (e = base_funcs_list; e->key.type != LUA_TNIL; e++)
+    if (ttislightfunction(&e->value) && fvalue(&e->value) == f) {
+      lua_pushstring(L, e->key.id.strkey);
+      return 1;
+    }
+#endif
+  lua_pushnil(L);
+  while (lua_next(L, LUA_GLOBALSINDEX)) {
+    if (lua_type(L, -2) == LUA_TSTRING && cfunc(L->top - 1) == f) {
+      lua_pop(L, 1);
+      return 1;  /* the key is the name */
+    }
+    lua_pop(L, 1);
+  }
+  lua_pushfstring(L, "C:%p", f);
+  return 1;
+}
+
+
+/* push the name of a frame: source:line of a Lua function */
+static void pushframe (lua_State *L, const void *f, int isC) {
+  const Proto *p = (const Proto *)f;
+  char buff[LUA_IDSIZE];
+  if (isC)
+    pushcname(L, f);
+  else {
+    luaO_chunkid(buff, p->source ? getstr(p->source) : "=?", LUA_IDSIZE);
+    if (p->linedefined == 0)
+      lua_pushfstring(L, "%s:main", buff);
+    else
+      lua_pushfstring(L, "%s:%d", buff, p->linedefined);
+  }
+}
+
+
+/* t[name] = t[name] + n, for table at -2 and name at -1 */
+static void addcount (lua_State *L, lu_mem n) {
+  lua_pushvalue(L, -1);
+  lua_rawget(L, -3);
+  lua_pushnumber(L, lua_tonumber(L, -1) + (lua_Number)n);
+  lua_remove(L, -2);
+  lua_rawset(L, -3);
+}
+
+
+int lprofile_pushopcodes (lua_State *L) {
+  Profile *pr = G(L)->profile;
+  int i;
+  lua_newtable(L);
+  for (i = 0; pr && i < NUM_OPCODES; i++)
+    if (pr->op[i]) {
+      lua_pushnumber(L, (lua_Number)pr->op[i]);
+      lua_setfield(L, -2, luaP_opnames[i]);
+    }
+  return 1;
+}
+
+
+int lprofile_pushfunctions (lua_State *L) {
+  Profile *pr = G(L)->profile;
+  int i;
+  lua_newtable(L);
+  if (pr == NULL)
+    return 1;
+  luaD_checkstack(L, 6);
+  for (i = 0; i < PROFILE_FUNCS; i++)
+    if (pr->func[i].p && pr->func[i].count) {
+      pushframe(L, pr->func[i].p, 0);
+      addcount(L, pr->func[i].count);
+    }
+  if (pr->func[PROFILE_FUNCS].count) {
+    lua_pushliteral(L, "(other)");
+    addcount(L, pr->func[PROFILE_FUNCS].count);
+  }
+  return 1;
+}
+
+
+/* pop the string on top and write it, cut to a frame name's length */
+static int writetop (lua_State *L, lua_Writer writer, void *data) {
+  char buff[LUA_IDSIZE + 2 * LUA_MAX_ROTABLE_NAME];
+  size_t l;
+  const char *s = lua_tolstring(L, -1, &l);
+  if (l > sizeof(buff)) l = sizeof(buff);
+  c_memcpy(buff, s, l);
+  lua_pop(L, 1);
+  return writer(L, buff, l, data);
+}
+
+
+/*
+** Write the stacks in the folded format of flamegraph.pl, one stack to a
+** line with the outermost frame first, followed by the number of samples.
+** The writer finds the stack as it was, so it may add to a luaL_Buffer.
+*/
+int lprofile_dumpstacks (lua_State *L, lua_Writer writer, void *data) {
+  Profile *pr = G(L)->profile;
+  int i, k, status = 0;
+  if (pr == NULL)
+    return 0;
+  luaD_checkstack(L, 4);
+  for (i = 0; i < PROFILE_STACKS && status == 0; i++) {
+    const ProfileStack *s = &pr->stack[i];
+    if (s->count == 0)
+      continue;
+    if (s->truncated)
+      status = writer(L, "...;", 4, data);
+    for (k = s->depth - 1; k >= 0 && status == 0; k--) {
+      pushframe(L, s->frame[k], s->isC & (1u << k));
+      status = writetop(L, writer, data);
+      if (status == 0 && k > 0)
+        status = writer(L, ";", 1, data);
+    }
+    if (status == 0) {
+      lua_pushfstring(L, " %f\n", (lua_Number)s->count);
+      status = writetop(L, writer, data);
+    }
+  }
+  if (pr->lost && status == 0) {
+    lua_pushfstring(L, "(lost) %f\n", (lua_Number)pr->lost);
+    status = writetop(L, writer, data);
+  }
+  return status;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+** Profiler of the VM: opcode counts, instructions per function and a
+** histogram of call stacks sampled on a timer
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lprofile_h
+#define lprofile_h
+
+#include "lua.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+
+#ifdef LUA_PROFILE
+
+/*
+** Built in with LUA_PROFILE in user_config.h. Everything the profiler keeps
+** is allocated when it is first started and has a fixed size, so counting
+** and sampling never allocate and never raise an error inside the VM.
+**
+** The functions counted and the ones in sampled stacks are kept from the
+** GC (see lgc.c), so they can still be named once they have run, until the
+** profiler is started again or freed.
+**
+** Stacks are sampled from the VM, which looks at the clock every
+** PROFILE_TICK instructions, and after every call to a C function returns,
+** so the time spent in C is charged to the C function. A sample that comes
+** late counts once for every period that went by.
+*/
+
+#define PROFILE_FUNCS	64	/* functions with an instruction count */
+#define PROFILE_STACKS	64	/* distinct call stacks in the histogram */
+#define PROFILE_DEPTH	12	/* innermost frames kept of a stack */
+#define PROFILE_TICK	256	/* instructions between looks at the clock */
+#define PROFILE_PERIOD	1000	/* default sampling period, in us */
+
+typedef struct ProfileFunc {
+  const Proto *p;  /* NULL in a free slot */
+  lu_mem count;
+} ProfileFunc;
+
+typedef struct ProfileStack {
+  lu_mem count;  /* samples, 0 in a free slot */
+  lu_int32 isC;  /* bit n set if `frame[n]' is a C function */
+  int depth;
+  int truncated;  /* stack was deeper than PROFILE_DEPTH */
+  const void *frame[PROFILE_DEPTH];  /* Proto or C function, innermost first */
+} ProfileStack;
+
+typedef struct Profile {
+  int on;
+  int tick;  /* instructions to the next look at the clock */
+  lu_int32 period;  /* sampling period, in us */
+  lu_int32 next;  /* time of the next sample */
+  lu_mem lost;  /* samples of stacks that found no slot */
+  lu_mem op[NUM_OPCODES];
+  ProfileFunc func[PROFILE_FUNCS + 1];  /* the last one counts the rest */
+  ProfileStack stack[PROFILE_STACKS];
+} Profile;
+
+#define lprofile_on(g)	((g)->profile != NULL && (g)->profile->on)
+
+/* slot of `p' in the function counts, the one of the rest when off */
+#define lprofile_enter(L,p) \
+	(lprofile_on(G(L)) ? lprofile_slot(G(L)->profile, p) : PROFILE_FUNCS)
+
+/* count instruction `i' of the function in `slot' */
+#define lprofile_count(L,i,slot) \
+	if (lprofile_on(G(L))) { Profile *p_ = G(L)->profile; \
+	  p_->op[GET_OPCODE(i)]++; p_->func[slot].count++; \
+	  if (--p_->tick == 0) lprofile_tick(L); }
+
+/* a C function returned, sample it if it took long enough */
+#define lprofile_creturn(L) \
+	if (lprofile_on(G(L))) lprofile_sample(L)
+
+int lprofile_slot(Profile *pr, const Proto *p);
+void lprofile_tick(lua_State *L);
+void lprofile_sample(lua_State *L);
+void lprofile_free(lua_State *L);
+
+/* the interface of node.profile and of the host build */
+void lprofile_start(lua_State *L, unsigned period);
+void lprofile_stop(lua_State *L);
+int lprofile_pushopcodes(lua_State *L);
+int lprofile_pushfunctions(lua_State *L);
+int lprofile_dumpstacks(lua_State *L, lua_Writer writer, void *data);
+
+#endif
+
+#endif
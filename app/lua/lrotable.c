@@ -8,6 +8,7 @@
 #include "lstring.h"
 #include "lobject.h"
 #include "lapi.h"
+#include "lstate.h"
 
 /* Local defines */
 #define LUAR_FINDFUNCTION     0
@@ -49,11 +50,34 @@ static const TValue* luaR_auxfind(const luaR_entry *pentry, const char *strkey,
   return res;
 }
 
+/* Return 1 if the string key of "pentry" is equal to the Lua string "key" */
+static int luaR_streq(const luaR_entry *pentry, const TString *key) {
+  return pentry->key.type == LUA_TSTRING &&
+         c_strlen(pentry->key.id.strkey) == key->tsv.len &&
+         !c_memcmp(pentry->key.id.strkey, getstr(key), key->tsv.len);
+}
+
+/* Find a string keyed entry in a rotable */
+const TValue* luaR_findstrentry(void *data, TString *key, unsigned *ppos) {
+  const luaR_entry *pentries = (const luaR_entry*)data;
+  unsigned i;
+
+  if (pentries == NULL)
+    return NULL;
+  for (i = 0; pentries[i].key.type != LUA_TNIL; i ++)
+    if (luaR_streq(&pentries[i], key)) {
+      if (ppos)
+        *ppos = i;
+      return &pentries[i].value;
+    }
+  return NULL;
+}
+
 int luaR_findfunction(lua_State *L, const luaR_entry *ptable) {
   const TValue *res = NULL;
-  const char *key = luaL_checkstring(L, 2);
-    
-  res = luaR_auxfind(ptable, key, 0, NULL);  
+
+  luaL_checkstring(L, 2);
+  res = luaR_findstrentry((void*)ptable, rawtsvalue(L->base + 1), NULL);
   if (res && ttislightfunction(res)) {
     luaA_pushobject(L, res);
     return 1;
@@ -94,21 +118,23 @@ static void luaR_next_helper(lua_State *L, const luaR_entry *pentries, int pos,
 /* next (used for iteration) */
 void luaR_next(lua_State *L, void *data, TValue *key, TValue *val) {
   const luaR_entry* pentries = (const luaR_entry*)data;
-  char strkey[LUA_MAX_ROTABLE_NAME + 1], *pstrkey = NULL;
-  luaR_numkey numkey = 0;
+  const TValue *res;
   unsigned keypos;
   
   /* Special case: if key is nil, return the first element of the rotable */
   if (ttisnil(key)) 
     luaR_next_helper(L, pentries, 0, key, val);
   else if (ttisstring(key) || ttisnumber(key)) {
-    /* Find the previoud key again */  
-    if (ttisstring(key)) {
-      luaR_getcstr(strkey, rawtsvalue(key), LUA_MAX_ROTABLE_NAME);          
-      pstrkey = strkey;
-    } else   
-      numkey = (luaR_numkey)nvalue(key);
-    luaR_findentry(data, pstrkey, numkey, &keypos);
+    /* Find the previous key again */
+    if (ttisstring(key))
+      res = luaR_findstrentry(data, rawtsvalue(key), &keypos);
+    else
+      res = luaR_findentry(data, NULL, (luaR_numkey)nvalue(key), &keypos);
+    if (res == NULL) {
+      setnilvalue(key);
+      setnilvalue(val);
+      return;
+    }
     /* Advance to next key */
     keypos ++;    
     luaR_next_helper(L, pentries, keypos, key, val);
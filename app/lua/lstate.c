@@ -10,9 +10,12 @@
 #define LUAC_CROSS_FILE
 
 #include "lua.h"
+#include C_HEADER_STRING
 
 #include "ldebug.h"
 #include "ldo.h"
+#include "lflash.h"
+#include "lprofile.h"
 #include "lfunc.h"
 #include "lgc.h"
 #include "llex.h"
@@ -102,6 +105,9 @@ static void preinit_state (lua_State *L, global_State *g) {
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+#ifdef LUA_PROFILE
+  lprofile_free(L);
+#endif
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeall(L);  /* collect all objects */
   lua_assert(g->rootgc == obj2gco(L));
@@ -110,6 +116,9 @@ static void close_state (lua_State *L) {
   luaZ_freebuffer(L, &g->buff);
   freestack(L, L);
   lua_assert(g->totalbytes == sizeof(LG));
+#ifdef LUA_POOL
+  lpool_close(L);
+#endif
   (*g->frealloc)(g->ud, fromstate(L), state_size(LG), 0);
 }
 
@@ -192,7 +201,15 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
 #else
   g->memlimit = 0;
 #endif
+  c_memset(&g->egc, 0, sizeof(EGCState));
   for (i=0; i<NUM_TAGS; i++) g->mt[i] = NULL;
+  g->flash = luaN_image();  /* before any string is created */
+#ifdef LUA_PROFILE
+  g->profile = NULL;
+#endif
+#ifdef LUA_POOL
+  lpool_init(&g->pool);
+#endif
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != 0) {
     /* memory allocation error: free partial state */
     close_state(L);
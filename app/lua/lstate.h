@@ -10,6 +10,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lpool.h"
 #include "ltm.h"
 #include "lzio.h"
 
@@ -62,6 +63,24 @@ typedef struct CallInfo {
 #define isLua(ci)	(ttisfunction((ci)->func) && f_isLua(ci))
 
 
+/*
+** state of the emergency GC, see legc.c
+*/
+typedef struct EGCState {
+  lu_mem base;  /* free heap the adaptive mode is asked to keep */
+  lu_int32 compact;  /* full collections left to run before allocations */
+  lu_mem rate;  /* bytes allocated while a GC cycle runs, averaged */
+  lu_mem allocated;  /* bytes allocated by Lua, counted in luaM_realloc_ */
+  lu_mem mark;  /* `allocated' when the running cycle was seen to start */
+  int running;  /* a cycle was seen to start */
+  lu_int32 cycles;  /* GC cycles completed */
+  lu_int32 steps;  /* GC steps run ahead of the collector's pace */
+  lu_int32 fullgcs;  /* full collections run by the emergency GC */
+  lu_int32 failures;  /* allocations refused to Lua */
+  lu_int32 fragmented;  /* failures with enough heap free, but in pieces */
+} EGCState;
+
+
 /*
 ** `global state', shared by all threads of this state
 */
@@ -88,12 +107,20 @@ typedef struct global_State {
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
   int egcmode;    /* emergency garbage collection operation mode */
+  EGCState egc;
   lua_CFunction panic;  /* to be called in unprotected errors */
   TValue l_registry;
   struct lua_State *mainthread;
   UpVal uvhead;  /* head of double-linked list of all open upvalues */
   struct Table *mt[NUM_TAGS];  /* metatables for basic types */
   TString *tmname[TM_N];  /* array with tag-method names */
+  const struct FlashHeader *flash;  /* mounted image, see lflash.h */
+#ifdef LUA_PROFILE
+  struct Profile *profile;  /* see lprofile.h, NULL until started */
+#endif
+#ifdef LUA_POOL
+  Pool pool;  /* small blocks, see lpool.h */
+#endif
 } global_State;
 
 
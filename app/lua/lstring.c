@@ -13,6 +13,7 @@
 #include "lua.h"
 #include C_HEADER_STRING
 
+#include "lflash.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -52,42 +53,68 @@ void luaS_resize (lua_State *L, int newsize) {
   unset_resizing_strings_gc(L);
 }
 
-static TString *newlstr (lua_State *L, const char *str, size_t l,
-                                       unsigned int h, int readonly) {
-  TString *ts;
-  stringtable *tb;
-  if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
-    luaM_toobig(L);
-  tb = &G(L)->strt;
+static void growstrt (lua_State *L) {
+  stringtable *tb = &G(L)->strt;
   if ((tb->nuse + 1) > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
     luaS_resize(L, tb->size*2);  /* too crowded */
-  ts = cast(TString *, luaM_malloc(L, readonly ? sizeof(char**)+sizeof(TString) : (l+1)*sizeof(char)+sizeof(TString)));
+}
+
+
+static TString *linkstr (lua_State *L, TString *ts, size_t l, unsigned int h) {
+  stringtable *tb = &G(L)->strt;
   ts->tsv.len = l;
   ts->tsv.hash = h;
   ts->tsv.marked = luaC_white(G(L));
   ts->tsv.tt = LUA_TSTRING;
+  h = lmod(h, tb->size);
+  ts->tsv.next = tb->hash[h];  /* chain new entry */
+  tb->hash[h] = obj2gco(ts);
+  tb->nuse++;
+  return ts;
+}
+
+
+static TString *newlstr (lua_State *L, const char *str, size_t l,
+                                       unsigned int h, int readonly) {
+  TString *ts;
+  if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
+    luaM_toobig(L);
+  growstrt(L);
+  ts = cast(TString *, luaM_malloc(L, readonly ? sizeof(char**)+sizeof(TString) : (l+1)*sizeof(char)+sizeof(TString)));
   if (!readonly) {
     c_memcpy(ts+1, str, l*sizeof(char));
     ((char *)(ts+1))[l] = '\0';  /* ending 0 */
   } else {
     *(char **)(ts+1) = (char *)str;
-    luaS_readonly(ts);
   }
-  h = lmod(h, tb->size);
-  ts->tsv.next = tb->hash[h];  /* chain new entry */
-  tb->hash[h] = obj2gco(ts);
-  tb->nuse++;
+  linkstr(L, ts, l, h);
+  if (readonly)
+    luaS_readonly(ts);
   return ts;
 }
 
 
-static TString *luaS_newlstr_helper (lua_State *L, const char *str, size_t l, int readonly) {
-  GCObject *o;
+static unsigned int hashstr (const char *str, size_t l) {
   unsigned int h = cast(unsigned int, l);  /* seed */
   size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
   size_t l1;
   for (l1=l; l1>=step; l1-=step)  /* compute hash */
     h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+  return h;
+}
+
+
+static TString *findstr (lua_State *L, const char *str, size_t l,
+                                       unsigned int h) {
+  GCObject *o;
+  if (G(L)->flash != NULL) {  /* strings of the image come first */
+    const FlashHeader *fh = G(L)->flash;
+    for (o = fh->strt[lmod(h, fh->strtsize)]; o != NULL; o = o->gch.next) {
+      TString *ts = rawgco2ts(o);
+      if (ts->tsv.len == l && (c_memcmp(str, getstr(ts), l) == 0))
+        return ts;
+    }
+  }
   for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
        o != NULL;
        o = o->gch.next) {
@@ -98,10 +125,44 @@ static TString *luaS_newlstr_helper (lua_State *L, const char *str, size_t l, in
       return ts;
     }
   }
+  return NULL;
+}
+
+
+static TString *luaS_newlstr_helper (lua_State *L, const char *str, size_t l, int readonly) {
+  unsigned int h = hashstr(str, l);
+  TString *ts = findstr(L, str, l, h);
+  if (ts != NULL)
+    return ts;
   return newlstr(L, str, l, h, readonly);  /* not found */
 }
 
-static int lua_is_ptr_in_ro_area(const char *p) {
+
+/*
+** makes a string of the `l' chars after the header of `block', a block of
+** sizestrblock(size) bytes; the block is freed if the string exists already
+** and shrunk to fit otherwise. On an error the block is left as it was.
+*/
+TString *luaS_newblock (lua_State *L, char *block, size_t size, size_t l) {
+  const char *str = block + sizeof(TString);
+  unsigned int h = hashstr(str, l);
+  TString *ts = findstr(L, str, l, h);
+  if (ts != NULL) {
+    luaM_freemem(L, block, sizestrblock(size));
+    return ts;
+  }
+  growstrt(L);
+  if (size != l)
+    block = cast(char *, luaM_realloc_(L, block, sizestrblock(size),
+                                                 sizestrblock(l)));
+  ts = cast(TString *, block);
+  ((char *)(ts+1))[l] = '\0';  /* ending 0 */
+  return linkstr(L, ts, l, h);
+}
+
+static int lua_is_ptr_in_ro_area(lua_State *L, const char *p) {
+  if (luaN_isimage(G(L), p))
+    return 1;
 #ifdef LUA_CROSS_COMPILER
   return 0;
 #else
@@ -115,7 +176,7 @@ static int lua_is_ptr_in_ro_area(const char *p) {
 TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
   // If the pointer is in a read-only memory and the string is at least 4 chars in length,
   // create it as a read-only string instead
-  if(lua_is_ptr_in_ro_area(str) && l+1 > sizeof(char**) && l == c_strlen(str))
+  if(lua_is_ptr_in_ro_area(L, str) && l+1 > sizeof(char**) && l == c_strlen(str))
     return luaS_newlstr_helper(L, str, l, LUAS_READONLY_STRING);
   else
     return luaS_newlstr_helper(L, str, l, LUAS_REGULAR_STRING);
@@ -15,6 +15,9 @@
 
 #define sizestring(s) (sizeof(union TString)+(luaS_isreadonly(s) ? sizeof(char **) : ((s)->len+1)*sizeof(char)))
 
+/* a block that becomes a string of up to `n' chars (see luaS_newblock) */
+#define sizestrblock(n)	(sizeof(union TString)+((n)+1)*sizeof(char))
+
 #define sizeudata(u)	(sizeof(union Udata)+(u)->len)
 
 #define luaS_new(L, s)	(luaS_newlstr(L, s, c_strlen(s)))
@@ -22,7 +25,9 @@
 #define luaS_newliteral(L, s)  (luaS_newlstr(L, "" s, \
                                   (sizeof(s)/sizeof(char))-1))
 
-#define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
+/* strings of a flash image are fixed already and must not be written to */
+#define luaS_fix(s)	(testbit((s)->tsv.marked, FIXEDBIT) ? 0 : \
+	l_setbit((s)->tsv.marked, FIXEDBIT))
 #define luaS_readonly(s) l_setbit((s)->tsv.marked, READONLYBIT)
 #define luaS_isreadonly(s) testbit((s)->marked, READONLYBIT)
 
@@ -30,5 +35,7 @@ LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_newrolstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC TString *luaS_newblock (lua_State *L, char *block, size_t size,
+                                  size_t l);
 
 #endif
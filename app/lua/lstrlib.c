@@ -460,6 +460,170 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
+/*
+** A pattern is looked at once for where a match of it can start: the
+** literal chars every match begins with, or else the set of chars its first
+** item matches. The searches then skip with `memchr' to where that is, and
+** a pattern that is all literal needs no `match' at all. What was found is
+** kept in a small cache, keyed by the address of the pattern and confirmed
+** against a copy of it, so a stale line only costs a miss. A pattern is
+** checked whole first, as a skip may find no place to match from before
+** `match' gets to where it is malformed.
+*/
+#define PAT_CACHE_LINES	4	/* must be a power of 2 */
+#define PAT_MAXLEN	32	/* longest pattern kept in the cache */
+
+typedef struct PatInfo {
+  char pat[PAT_MAXLEN];  /* the pattern of the line */
+  size_t len;  /* its length, 0 for a line not in use */
+  unsigned char plain;  /* no specials: a match is `prefix' and has no captures */
+  unsigned char nprefix;  /* chars every match begins with, in `prefix' */
+  unsigned char hasfirst;  /* else the first char of a match is one of `first' */
+  char prefix[PAT_MAXLEN];
+  unsigned char first[256/8];
+} PatInfo;
+
+#ifndef LUA_NO_PATCACHE
+static PatInfo patcache[PAT_CACHE_LINES];
+
+
+/* the char a single char item at `p' matches, -1 if it is not such an item */
+static int literal (const char *p) {
+  switch (*p) {
+    case '\0': case '(': case ')': case '.': case '[':
+      return -1;
+    case '$':
+      return (*(p+1) == '\0') ? -1 : '$';
+    case L_ESC: {
+      int c = uchar(*(p+1));
+      if (c == '\0' || isdigit(c) || c == 'b' || c == 'f' ||
+          c_strchr("acdlpsuwxz", tolower(c)) != NULL)
+        return -1;
+      return c;
+    }
+    default:
+      return uchar(*p);
+  }
+}
+
+
+/* end of the single char class at `p', NULL if it is malformed */
+static const char *classend_safe (const char *p) {
+  if (*p == L_ESC)
+    return (*(p+1) == '\0') ? NULL : p+2;
+  else if (*p == '[') {
+    p++;
+    if (*p == '^') p++;
+    do {
+      if (*p == '\0') return NULL;
+      if (*(p++) == L_ESC && *p != '\0') p++;
+    } while (*p != ']');
+    return p+1;
+  }
+  return p+1;
+}
+
+
+static void analyze (PatInfo *pi, const char *p) {
+  const char *ep;
+  int c, captures = 0;
+  pi->nprefix = pi->hasfirst = 0;
+  for (;;) {  /* the literal prefix; captures take no chars */
+    if (*p == '(') {
+      captures = 1;
+      p++;
+      continue;
+    }
+    if ((c = literal(p)) < 0 || pi->nprefix == PAT_MAXLEN) break;
+    ep = p + ((*p == L_ESC) ? 2 : 1);
+    if (*ep == '?' || *ep == '*' || *ep == '-') break;  /* may be absent */
+    pi->prefix[pi->nprefix++] = c;
+    p = ep;
+    if (*p == '+') break;  /* the rest of the run is not fixed */
+  }
+  pi->plain = (*p == '\0' && !captures);
+  if (pi->nprefix > 0) return;
+  if (*p == L_ESC) {  /* a class, not %b, %f or a back reference */
+    c = uchar(*(p+1));
+    if (c == '\0' || c == 'b' || c == 'f' || isdigit(c)) return;
+  }
+  else if (*p != '[') return;
+  ep = classend_safe(p);
+  if (ep != NULL && *ep != '?' && *ep != '*' && *ep != '-') {
+    for (c = 0; c < 256; c++) {
+      if (singlematch(c, p, ep))
+        pi->first[c >> 3] |= 1 << (c & 7);
+      else
+        pi->first[c >> 3] &= ~(1 << (c & 7));
+    }
+    pi->hasfirst = 1;
+  }
+}
+#endif
+
+
+/* raises the errors `match' raises for a malformed item, wherever it is */
+static void checkpattern (lua_State *L, const char *p) {
+  MatchState ms;
+  ms.L = L;
+  while (*p != '\0') {
+    if (*p == L_ESC && *(p+1) == 'b') {
+      if (*(p+2) == '\0' || *(p+3) == '\0')
+        luaL_error(L, "unbalanced pattern");
+      p += 4;
+    }
+    else if (*p == L_ESC && *(p+1) == 'f') {
+      p += 2;
+      if (*p != '[')
+        luaL_error(L, "missing " LUA_QL("[") " after "
+                      LUA_QL("%%f") " in pattern");
+      p = classend(&ms, p);
+    }
+    else
+      p = classend(&ms, p);
+  }
+}
+
+
+/* what is known of pattern `p' of length `l', from the cache or in `tmp' */
+static const PatInfo *patinfo (lua_State *L, const char *p, size_t l,
+                               PatInfo *tmp) {
+#ifndef LUA_NO_PATCACHE
+  PatInfo *pi;
+  if (l == 0 || l > PAT_MAXLEN) {
+    checkpattern(L, p);
+    analyze(tmp, p);
+    return tmp;
+  }
+  pi = &patcache[((size_t)p >> 3) & (PAT_CACHE_LINES - 1)];
+  if (pi->len != l || c_memcmp(pi->pat, p, l) != 0) {
+    checkpattern(L, p);
+    analyze(pi, p);
+    c_memcpy(pi->pat, p, l);
+    pi->len = l;
+  }
+  return pi;
+#else
+  checkpattern(L, p);
+  return NULL;
+#endif
+}
+
+
+/* first place from `s' on where a match can start, NULL if there is none */
+static const char *skipto (const PatInfo *pi, const char *s, const char *e) {
+  if (pi->nprefix > 0)
+    return lmemfind(s, e - s, pi->prefix, pi->nprefix);
+  else if (pi->hasfirst) {
+    for (; s < e; s++)
+      if (pi->first[uchar(*s) >> 3] & (1 << (uchar(*s) & 7)))
+        return s;
+    return NULL;
+  }
+  return s;
+}
+
+
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   if (i >= ms->level) {
@@ -508,15 +672,20 @@ static int str_find_aux (lua_State *L, int find) {
   }
   else {
     MatchState ms;
-    int anchor = (*p == '^') ? (p++, 1) : 0;
+    PatInfo tmp;
+    int anchor = (*p == '^') ? (p++, l2--, 1) : 0;
+    const PatInfo *pi = anchor ? NULL : patinfo(L, p, l2, &tmp);
     const char *s1=s+init;
     ms.L = L;
     ms.src_init = s;
     ms.src_end = s+l1;
     do {
       const char *res;
+      if (pi != NULL && (s1 = skipto(pi, s1, ms.src_end)) == NULL)
+        break;  /* no place left where a match can start */
       ms.level = 0;
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if ((res = (pi != NULL && pi->plain) ? s1 + pi->nprefix :
+                                             match(&ms, s1, p)) != NULL) {
         if (find) {
           lua_pushinteger(L, s1-s+1);  /* start */
           lua_pushinteger(L, res-s);   /* end */
@@ -544,9 +713,11 @@ static int str_match (lua_State *L) {
 
 static int gmatch_aux (lua_State *L) {
   MatchState ms;
-  size_t ls;
+  PatInfo tmp;
+  size_t ls, lp;
   const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
-  const char *p = lua_tostring(L, lua_upvalueindex(2));
+  const char *p = lua_tolstring(L, lua_upvalueindex(2), &lp);
+  const PatInfo *pi = patinfo(L, p, lp, &tmp);
   const char *src;
   ms.L = L;
   ms.src_init = s;
@@ -555,8 +726,11 @@ static int gmatch_aux (lua_State *L) {
        src <= ms.src_end;
        src++) {
     const char *e;
+    if (pi != NULL && (src = skipto(pi, src, ms.src_end)) == NULL)
+      break;
     ms.level = 0;
-    if ((e = match(&ms, src, p)) != NULL) {
+    if ((e = (pi != NULL && pi->plain) ? src + pi->nprefix :
+                                         match(&ms, src, p)) != NULL) {
       lua_Integer newstart = e-s;
       if (e == src) newstart++;  /* empty match? go at least one position */
       lua_pushinteger(L, newstart);
@@ -640,14 +814,16 @@ static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
 
 
 static int str_gsub (lua_State *L) {
-  size_t srcl;
+  size_t srcl, lp;
   const char *src = luaL_checklstring(L, 1, &srcl);
-  const char *p = luaL_checkstring(L, 2);
+  const char *p = luaL_checklstring(L, 2, &lp);
   int  tr = lua_type(L, 3);
   int max_s = luaL_optint(L, 4, srcl+1);
-  int anchor = (*p == '^') ? (p++, 1) : 0;
+  int anchor = (*p == '^') ? (p++, lp--, 1) : 0;
   int n = 0;
   MatchState ms;
+  PatInfo tmp;
+  const PatInfo *pi = anchor ? NULL : patinfo(L, p, lp, &tmp);
   luaL_Buffer b;
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE ||
@@ -659,8 +835,14 @@ static int str_gsub (lua_State *L) {
   ms.src_end = src+srcl;
   while (n < max_s) {
     const char *e;
+    if (pi != NULL) {  /* copy up to where a match can start */
+      const char *next = skipto(pi, src, ms.src_end);
+      if (next == NULL) break;
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
     ms.level = 0;
-    e = match(&ms, src, p);
+    e = (pi != NULL && pi->plain) ? src + pi->nprefix : match(&ms, src, p);
     if (e) {
       n++;
       add_value(&ms, &b, src, e);
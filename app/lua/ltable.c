@@ -120,6 +120,8 @@ static Node *mainposition (const Table *t, const TValue *key) {
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
+  if (ttisint(key))
+    return ivalue(key);
   if (ttisnumber(key)) {
     lua_Number n = nvalue(key);
     int k;
@@ -165,7 +167,7 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   int i = findindex(L, t, key);  /* find original element */
   for (i++; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));
+      setivalue(key, i+1);
       setobj2s(L, key+1, &t->array[i]);
       return 1;
     }
@@ -372,8 +374,11 @@ static int move_node (lua_State *L, Table *t, Node *node) {
 static int move_number (lua_State *L, Table *t, Node *node) {
   int key;
   lua_Number n = nvalue(key2tval(node));
-  lua_number2int(key, n);
-  if (luai_numeq(cast_num(key), nvalue(key2tval(node)))) {/* index is int? */
+  if (ttisint(key2tval(node)))
+    key = ivalue(key2tval(node));
+  else
+    lua_number2int(key, n);
+  if (luai_numeq(cast_num(key), n)) {/* index is int? */
     /* (1 <= key && key <= t->sizearray) */
     if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray)) {
       setobjt2t(L, &t->array[key-1], gval(node));
@@ -568,7 +573,8 @@ const TValue *luaH_getnum (Table *t, int key) {
     lua_Number nk = cast_num(key);
     Node *n = hashnum(t, nk);
     do {  /* check whether `key' is somewhere in the chain */
-      if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
+      if (ttisint(gkey(n)) ? ivalue(gkey(n)) == key :
+          ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
         return gval(n);  /* that's it */
       else n = gnext(n);
     } while (n);
@@ -598,12 +604,10 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 
 /* same thing for rotables */
 const TValue *luaH_getstr_ro (void *t, TString *key) {
-  char keyname[LUA_MAX_ROTABLE_NAME + 1];
   const TValue *res;  
   if (!t)
     return luaO_nilobject;
-  luaR_getcstr(keyname, key, LUA_MAX_ROTABLE_NAME);   
-  res = luaR_findentry(t, keyname, 0, NULL);
+  res = luaR_findstrentry(t, key, NULL);
   return res ? res : luaO_nilobject;
 }
 
@@ -617,7 +621,10 @@ const TValue *luaH_get (Table *t, const TValue *key) {
     case LUA_TSTRING: return luaH_getstr(t, rawtsvalue(key));
     case LUA_TNUMBER: {
       int k;
-      lua_Number n = nvalue(key);
+      lua_Number n;
+      if (ttisint(key))
+        return luaH_getnum(t, ivalue(key));
+      n = nvalue(key);
       lua_number2int(k, n);
       if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
         return luaH_getnum(t, k);  /* use specialized version */
@@ -642,7 +649,10 @@ const TValue *luaH_get_ro (void *t, const TValue *key) {
     case LUA_TSTRING: return luaH_getstr_ro(t, rawtsvalue(key));
     case LUA_TNUMBER: {
       int k;
-      lua_Number n = nvalue(key);
+      lua_Number n;
+      if (ttisint(key))
+        return luaH_getnum_ro(t, ivalue(key));
+      n = nvalue(key);
       lua_number2int(k, n);
       if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
         return luaH_getnum_ro(t, k);  /* use specialized version */
@@ -662,7 +672,7 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
     return cast(TValue *, p);
   else {
     if (ttisnil(key)) luaG_runerror(L, "table index is nil");
-    else if (ttisnumber(key) && luai_numisnan(nvalue(key)))
+    else if (ttisnumber(key) && !ttisint(key) && luai_numisnan(nvalue(key)))
       luaG_runerror(L, "table index is NaN");
     return newkey(L, t, key);
   }
@@ -675,7 +685,7 @@ TValue *luaH_setnum (lua_State *L, Table *t, int key) {
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     return newkey(L, t, &k);
   }
 }
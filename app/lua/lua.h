@@ -256,6 +256,11 @@ LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
 
+LUA_API char *(lua_resizestrblock) (lua_State *L, char *s, size_t osize,
+                                                           size_t nsize);
+LUA_API void  (lua_pushstrblock) (lua_State *L, char *s, size_t size,
+                                                         size_t len);
+
 
 
 /* 
@@ -0,0 +1,456 @@
+/*
+** Build Lua images (see lflash.h) for execution in place
+** See Copyright Notice in lua.h
+*/
+
+#define LUAC_CROSS_FILE
+
+#include "luac_cross.h"
+#include C_HEADER_STRING
+
+#define luac_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lflash.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "lundump.h"
+
+/* offsets and sizes of the VM structures on the target */
+typedef struct {
+ int h_strt, h_strtsize, h_nuse, h_main, h_index, h_sizeindex, h_nmodules, h_size;
+ int s_tt, s_marked, s_hash, s_len, s_size, s_align;
+ int v_tt, v_size, v_align;
+ int l_startpc, l_endpc, l_size;
+ int p_tt, p_marked, p_k, p_code, p_p, p_lineinfo, p_locvars, p_upvalues,
+     p_source, p_sizeupvalues, p_sizek, p_sizecode, p_sizelineinfo, p_sizep,
+     p_sizelocvars, p_linedefined, p_lastlinedefined, p_gclist, p_nups,
+     p_numparams, p_is_vararg, p_maxstacksize, p_size;
+} Layout;
+
+typedef struct {
+ lua_State* L;
+ int strip;
+ int status;
+ FlashTargetInfo target;
+ Layout l;
+ lu_byte* b;		/* image being built */
+ size_t size;
+ size_t sizeb;
+ lu_byte* bits;		/* relocation bitmap */
+ size_t sizebits;
+ Table* offsets;	/* image offset of each string and Proto */
+ TString** strings;	/* strings in image order */
+ int nstrings;
+ int sizestrings;
+} ImageState;
+
+static int field(int* pos, int size, int align)
+{
+ int o=(*pos+align-1)&~(align-1);
+ *pos=o+size;
+ return o;
+}
+
+#define PTR(pos)	field(pos,P,P)
+#define INT(pos)	field(pos,4,4)
+#define BYTE(pos)	field(pos,1,1)
+
+static void layout(Layout* l, const FlashTargetInfo* t)
+{
+ int P=t->sizeof_ptr;
+ int v=t->sizeof_lua_Number>P ? t->sizeof_lua_Number : P;
+ int pos;
+ pos=16;				/* FlashHeader */
+ l->h_strt=PTR(&pos);
+ l->h_strtsize=INT(&pos);
+ l->h_nuse=INT(&pos);
+ l->h_main=PTR(&pos);
+ l->h_index=PTR(&pos);
+ l->h_sizeindex=INT(&pos);
+ l->h_nmodules=INT(&pos);
+ l->h_size=field(&pos,0,P);
+ pos=P;				/* TString, after `next' */
+ l->s_tt=BYTE(&pos);
+ l->s_marked=BYTE(&pos);
+ l->s_hash=INT(&pos);
+ l->s_len=PTR(&pos);
+ l->s_align=t->align_max>P ? t->align_max : P;
+ l->s_size=field(&pos,0,l->s_align);
+ l->v_align=t->align_lua_Number>P ? t->align_lua_Number : P;
+ pos=v;				/* TValue, after `value' */
+ l->v_tt=INT(&pos);
+ l->v_size=field(&pos,0,l->v_align);
+ pos=P;				/* LocVar, after `varname' */
+ l->l_startpc=INT(&pos);
+ l->l_endpc=INT(&pos);
+ l->l_size=field(&pos,0,P);
+ pos=P;				/* Proto, after `next' */
+ l->p_tt=BYTE(&pos);
+ l->p_marked=BYTE(&pos);
+ l->p_k=PTR(&pos);
+ l->p_code=PTR(&pos);
+ l->p_p=PTR(&pos);
+ l->p_lineinfo=PTR(&pos);
+ l->p_locvars=PTR(&pos);
+ l->p_upvalues=PTR(&pos);
+ l->p_source=PTR(&pos);
+ l->p_sizeupvalues=INT(&pos);
+ l->p_sizek=INT(&pos);
+ l->p_sizecode=INT(&pos);
+ l->p_sizelineinfo=INT(&pos);
+ l->p_sizep=INT(&pos);
+ l->p_sizelocvars=INT(&pos);
+ l->p_linedefined=INT(&pos);
+ l->p_lastlinedefined=INT(&pos);
+ l->p_gclist=PTR(&pos);
+ l->p_nups=BYTE(&pos);
+ l->p_numparams=BYTE(&pos);
+ l->p_is_vararg=BYTE(&pos);
+ l->p_maxstacksize=BYTE(&pos);
+ l->p_size=field(&pos,0,P);
+}
+
+#define SAME(a,b)	if ((int)(a)!=(int)(b)) return 0
+
+/* when building for this host the layout must be the compiler's */
+static int nativelayout(const Layout* l)
+{
+ SAME(l->h_strt,offsetof(FlashHeader,strt));
+ SAME(l->h_main,offsetof(FlashHeader,main));
+ SAME(l->h_index,offsetof(FlashHeader,index));
+ SAME(l->h_nmodules,offsetof(FlashHeader,nmodules));
+ SAME(l->h_size,sizeof(FlashHeader));
+ SAME(l->s_hash,offsetof(TString,tsv.hash));
+ SAME(l->s_len,offsetof(TString,tsv.len));
+ SAME(l->s_size,sizeof(TString));
+ SAME(l->v_tt,offsetof(TValue,tt));
+ SAME(l->v_size,sizeof(TValue));
+ SAME(l->l_endpc,offsetof(LocVar,endpc));
+ SAME(l->l_size,sizeof(LocVar));
+ SAME(l->p_marked,offsetof(Proto,marked));
+ SAME(l->p_k,offsetof(Proto,k));
+ SAME(l->p_source,offsetof(Proto,source));
+ SAME(l->p_lastlinedefined,offsetof(Proto,lastlinedefined));
+ SAME(l->p_gclist,offsetof(Proto,gclist));
+ SAME(l->p_maxstacksize,offsetof(Proto,maxstacksize));
+ SAME(l->p_size,sizeof(Proto));
+ return 1;
+}
+
+/* reserve size bytes of image, zeroed */
+static size_t Alloc(size_t size, int align, ImageState* S)
+{
+ size_t o=(S->size+align-1)&~(size_t)(align-1);
+ size_t n=S->sizeb;
+ if (o+size>n)
+ {
+  while (o+size>n) n=n ? 2*n : 1024;
+  luaM_reallocvector(S->L,S->b,S->sizeb,n,lu_byte);
+  memset(S->b+S->sizeb,0,n-S->sizeb);
+  S->sizeb=n;
+ }
+ S->size=o+size;
+ return o;
+}
+
+/* targets are little endian */
+static void PutBytes(size_t o, const void* p, int size, ImageState* S)
+{
+ int x=1;
+ int i;
+ if (*(char*)&x)
+  memcpy(S->b+o,p,size);
+ else
+  for (i=0; i<size; i++) S->b[o+i]=((const lu_byte*)p)[size-1-i];
+}
+
+static void PutInt(size_t o, long long x, int size, ImageState* S)
+{
+ int i;
+ for (i=0; i<size; i++,x>>=8) S->b[o+i]=(lu_byte)(x&0xff);
+}
+
+/* make the relocation bitmap n bytes at least */
+static void Bits(size_t n, ImageState* S)
+{
+ size_t m=S->sizebits;
+ if (n<=m) return;
+ while (n>m) m=m ? 2*m : 128;
+ luaM_reallocvector(S->L,S->bits,S->sizebits,m,lu_byte);
+ memset(S->bits+S->sizebits,0,m-S->sizebits);
+ S->sizebits=m;
+}
+
+static void PutPtr(size_t o, size_t to, ImageState* S)
+{
+ size_t w=o/S->target.sizeof_ptr;
+ PutInt(o,to,S->target.sizeof_ptr,S);
+ if (to==0) return;			/* NULL */
+ Bits(w/8+1,S);
+ S->bits[w/8]|=1<<(w%8);
+}
+
+static size_t GetPtr(size_t o, ImageState* S)
+{
+ size_t x=0;
+ int i;
+ for (i=0; i<S->target.sizeof_ptr; i++) x|=(size_t)S->b[o+i]<<(8*i);
+ return x;
+}
+
+static void PutNumber(size_t o, lua_Number x, ImageState* S)
+{
+ if (S->target.lua_Number_integral)
+ {
+  int size=S->target.sizeof_lua_Number;
+  long long y=(long long)x;
+  long long max=(1LL<<(8*size-1))-1;
+  if ((lua_Number)y!=x) S->status=LUA_ERR_CC_NOTINTEGER;
+  if (y>max || y<-max-1) S->status=LUA_ERR_CC_INTOVERFLOW;
+  PutInt(o,y,size,S);
+ }
+ else if (S->target.sizeof_lua_Number==4)
+ {
+  float y=(float)x;
+  PutBytes(o,&y,4,S);
+ }
+ else
+ {
+  double y=(double)x;
+  PutBytes(o,&y,8,S);
+ }
+}
+
+static size_t String(TString* ts, ImageState* S)
+{
+ const Layout* l=&S->l;
+ const TValue* v;
+ size_t o,len;
+ if (ts==NULL) return 0;
+ v=luaH_getstr(S->offsets,ts);
+ if (ttisnumber(v)) return (size_t)nvalue(v);
+ len=ts->tsv.len;
+ o=Alloc(l->s_size+len+1,l->s_align,S);
+ S->b[o+l->s_tt]=LUA_TSTRING;
+ S->b[o+l->s_marked]=bitmask(FIXEDBIT);
+ PutInt(o+l->s_hash,ts->tsv.hash,4,S);
+ PutInt(o+l->s_len,len,S->target.sizeof_ptr,S);
+ memcpy(S->b+o+l->s_size,getstr(ts),len);	/* ending 0 from Alloc */
+ setnvalue(luaH_setstr(S->L,S->offsets,ts),(lua_Number)o);
+ luaM_growvector(S->L,S->strings,S->nstrings,S->sizestrings,TString*,MAX_INT,"strings");
+ S->strings[S->nstrings++]=ts;
+ return o;
+}
+
+static size_t Vector(int n, int size, int align, ImageState* S)
+{
+ return n==0 ? 0 : Alloc((size_t)n*size,align,S);
+}
+
+static size_t Function(const Proto* f, TString* source, ImageState* S)
+{
+ const Layout* l=&S->l;
+ int P=S->target.sizeof_ptr;
+ int strip=S->strip;
+ int i,sizelineinfo=strip ? 0 : f->sizelineinfo;
+ int sizelocvars=strip ? 0 : f->sizelocvars;
+ int sizeupvalues=strip ? 0 : f->sizeupvalues;
+ size_t o,k,code,p,lineinfo,locvars,upvalues,src;
+ size_t* sub=NULL;
+ TValue key;
+ const TValue* v;
+ setpvalue(&key,cast(void*,f));
+ v=luaH_get(S->offsets,&key);
+ if (ttisnumber(v)) return (size_t)nvalue(v);	/* a module, already in */
+ src=String(strip ? source : f->source,S);
+ for (i=0; i<f->sizek; i++)
+  if (ttisstring(&f->k[i])) String(rawtsvalue(&f->k[i]),S);
+ for (i=0; i<sizelocvars; i++) String(f->locvars[i].varname,S);
+ for (i=0; i<sizeupvalues; i++) String(f->upvalues[i],S);
+ if (f->sizep>0)
+ {
+  sub=luaM_newvector(S->L,f->sizep,size_t);
+  for (i=0; i<f->sizep; i++) sub[i]=Function(f->p[i],source,S);
+ }
+ k=Vector(f->sizek,l->v_size,l->v_align,S);
+ for (i=0; i<f->sizek; i++)
+ {
+  const TValue* v=&f->k[i];
+  size_t o=k+(size_t)i*l->v_size;
+  PutInt(o+l->v_tt,ttype(v),4,S);
+  switch (ttype(v))
+  {
+   case LUA_TNIL:
+	break;
+   case LUA_TBOOLEAN:
+	PutInt(o,bvalue(v),4,S);
+	break;
+   case LUA_TNUMBER:
+	PutNumber(o,nvalue(v),S);
+	break;
+   case LUA_TSTRING:
+	PutPtr(o,String(rawtsvalue(v),S),S);
+	break;
+   default:
+	lua_assert(0);
+  }
+ }
+ code=Vector(f->sizecode,sizeof(Instruction),4,S);
+ for (i=0; i<f->sizecode; i++) PutInt(code+4*i,f->code[i],4,S);
+ p=Vector(f->sizep,P,P,S);
+ for (i=0; i<f->sizep; i++) PutPtr(p+(size_t)i*P,sub[i],S);
+ luaM_freearray(S->L,sub,f->sizep,size_t);
+ lineinfo=Vector(sizelineinfo,4,4,S);
+ for (i=0; i<sizelineinfo; i++) PutInt(lineinfo+4*i,f->lineinfo[i],4,S);
+ locvars=Vector(sizelocvars,l->l_size,P,S);
+ for (i=0; i<sizelocvars; i++)
+ {
+  size_t v=locvars+(size_t)i*l->l_size;
+  PutPtr(v,String(f->locvars[i].varname,S),S);
+  PutInt(v+l->l_startpc,f->locvars[i].startpc,4,S);
+  PutInt(v+l->l_endpc,f->locvars[i].endpc,4,S);
+ }
+ upvalues=Vector(sizeupvalues,P,P,S);
+ for (i=0; i<sizeupvalues; i++)
+  PutPtr(upvalues+(size_t)i*P,String(f->upvalues[i],S),S);
+ o=Alloc(l->p_size,P,S);
+ S->b[o+l->p_tt]=LUA_TPROTO;
+ S->b[o+l->p_marked]=bitmask(FIXEDBIT)|bitmask(READONLYBIT);
+ PutPtr(o+l->p_k,k,S);
+ PutPtr(o+l->p_code,code,S);
+ PutPtr(o+l->p_p,p,S);
+ PutPtr(o+l->p_lineinfo,lineinfo,S);
+ PutPtr(o+l->p_locvars,locvars,S);
+ PutPtr(o+l->p_upvalues,upvalues,S);
+ PutPtr(o+l->p_source,src,S);
+ PutInt(o+l->p_sizeupvalues,sizeupvalues,4,S);
+ PutInt(o+l->p_sizek,f->sizek,4,S);
+ PutInt(o+l->p_sizecode,f->sizecode,4,S);
+ PutInt(o+l->p_sizelineinfo,sizelineinfo,4,S);
+ PutInt(o+l->p_sizep,f->sizep,4,S);
+ PutInt(o+l->p_sizelocvars,sizelocvars,4,S);
+ PutInt(o+l->p_linedefined,f->linedefined,4,S);
+ PutInt(o+l->p_lastlinedefined,f->lastlinedefined,4,S);
+ S->b[o+l->p_nups]=f->nups;
+ S->b[o+l->p_numparams]=f->numparams;
+ S->b[o+l->p_is_vararg]=f->is_vararg;
+ S->b[o+l->p_maxstacksize]=f->maxstacksize;
+ setnvalue(luaH_set(S->L,S->offsets,&key),(lua_Number)o);
+ return o;
+}
+
+/* chain the strings into the string table of the image */
+static size_t StringTable(int* sizestrt, ImageState* S)
+{
+ int P=S->target.sizeof_ptr;
+ int n=1;
+ int i;
+ size_t strt;
+ while (n<S->nstrings) n<<=1;
+ strt=Alloc((size_t)n*P,P,S);
+ for (i=0; i<S->nstrings; i++)
+ {
+  TString* ts=S->strings[i];
+  size_t o=(size_t)nvalue(luaH_getstr(S->offsets,ts));
+  size_t bucket=strt+(size_t)lmod(ts->tsv.hash,n)*P;
+  PutPtr(o,GetPtr(bucket,S),S);			/* `next' is the first field */
+  PutPtr(bucket,o,S);
+ }
+ *sizestrt=n;
+ return strt;
+}
+
+/* hash the modules into the index of the image by their names */
+static size_t ModuleIndex(const Proto* const* modules, const char* const* names,
+                          int nmodules, TString* source, int* sizeindex,
+                          ImageState* S)
+{
+ lua_State* L=S->L;
+ int P=S->target.sizeof_ptr;
+ int n=0;
+ int i;
+ size_t index;
+ if (nmodules>0) for (n=2; n<2*nmodules; n<<=1) ;	/* half full at most */
+ index=Vector(n,2*P,P,S);
+ for (i=0; i<nmodules; i++)
+ {
+  TString* ts=luaS_new(L,names[i]);
+  size_t slot;
+  setsvalue2s(L,L->top,ts); incr_top(L);	/* anchor it */
+  slot=index+(size_t)lmod(ts->tsv.hash,n)*2*P;
+  while (GetPtr(slot,S)!=0)
+   slot=slot+2*P<index+(size_t)n*2*P ? slot+2*P : index;
+  PutPtr(slot,String(ts,S),S);
+  PutPtr(slot+P,Function(modules[i],source,S),S);
+  L->top--;
+ }
+ *sizeindex=n;
+ return index;
+}
+
+/*
+** write f as an image, followed by its relocation bitmap. modules, compiled
+** into f or not, are put in the index of the image under their names
+*/
+int luaN_dump(lua_State* L, const Proto* f, const Proto* const* modules,
+              const char* const* names, int nmodules, lua_Writer w, void* data,
+              int strip, FlashTargetInfo target)
+{
+ ImageState S;
+ const Layout* l=&S.l;
+ int P=target.sizeof_ptr;
+ int sizestrt,sizeindex;
+ TString* source;
+ size_t main,index,strt,sizebits;
+ memset(&S,0,sizeof(S));
+ S.L=L;
+ S.strip=strip;
+ S.target=target;
+ layout(&S.l,&target);
+ if (P==sizeof(void*) && target.sizeof_lua_Number==sizeof(lua_Number) &&
+     target.align_lua_Number==offsetof(struct {char c; lua_Number n;},n) &&
+     target.align_max==offsetof(struct {char c; L_Umaxalign u;},u) &&
+     !nativelayout(l))
+  return LUA_ERR_CC_LAYOUT;
+ S.offsets=luaH_new(L,0,0);
+ sethvalue(L,L->top,S.offsets); incr_top(L);	/* anchor them */
+ source=luaS_newliteral(L,"=?");
+ setsvalue2s(L,L->top,source); incr_top(L);
+ Alloc(l->h_size,P,&S);
+ main=Function(f,source,&S);
+ index=ModuleIndex(modules,names,nmodules,source,&sizeindex,&S);
+ strt=StringTable(&sizestrt,&S);
+ Alloc(0,P,&S);				/* size is a multiple of words */
+ PutInt(0,FLASH_MAGIC,4,&S);
+ PutInt(4,FLASH_VERSION,4,&S);
+ PutInt(8,FLASH_CONFIG(P,target.sizeof_lua_Number,target.lua_Number_integral,l->v_size),4,&S);
+ PutInt(12,S.size,4,&S);
+ PutPtr(l->h_strt,strt,&S);
+ PutInt(l->h_strtsize,sizestrt,4,&S);
+ PutInt(l->h_nuse,S.nstrings,4,&S);
+ PutPtr(l->h_main,main,&S);
+ PutPtr(l->h_index,index,&S);
+ PutInt(l->h_sizeindex,sizeindex,4,&S);
+ PutInt(l->h_nmodules,nmodules,4,&S);
+ sizebits=(S.size/P+7)/8;
+ Bits(sizebits,&S);
+ if (S.status==0)
+ {
+  lua_unlock(L);
+  S.status=(*w)(L,S.b,S.size,data) || (*w)(L,S.bits,sizebits,data);
+  lua_lock(L);
+ }
+ luaM_freearray(L,S.b,S.sizeb,lu_byte);
+ luaM_freearray(L,S.bits,S.sizebits,lu_byte);
+ luaM_freearray(L,S.strings,S.sizestrings,TString*);
+ L->top-=2;
+ return S.status;
+}
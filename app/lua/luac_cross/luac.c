@@ -11,6 +11,8 @@
 #include C_HEADER_STDIO
 #include C_HEADER_STDLIB
 #include C_HEADER_STRING
+#include <dirent.h>
+#include <sys/stat.h>
 
 #define luac_c
 #define LUA_CORE
@@ -19,12 +21,14 @@
 #include "lauxlib.h"
 
 #include "ldo.h"
+#include "lflash.h"
 #include "lfunc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstring.h"
 #include "lundump.h"
+#include "lualib.h"
 
 #define PROGNAME	"luac"		/* default program name */
 #define	OUTPUT		PROGNAME ".out"	/* default output file */
@@ -32,6 +36,8 @@
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int flash=0;			/* dump a flash image? */
+static int testing=0;			/* run the image on this host? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -56,13 +62,16 @@ static void usage(const char* message)
  else
   fprintf(stderr,"%s: %s\n",progname,message);
  fprintf(stderr,
- "usage: %s [options] [filenames].\n"
+ "usage: %s [options] [filenames or directories].\n"
  "Available options are:\n"
  "  -        process stdin\n"
  "  -l       list\n"
  "  -o name  output to file " LUA_QL("name") " (default is \"%s\")\n"
  "  -p       parse only\n"
  "  -s       strip debug information\n"
+ "  -f       output a flash image for the target instead of bytecode,\n"
+ "           with each file a module for " LUA_QL("require") "\n"
+ "  -t       output a flash image for this host, then run it from the image\n"
  "  -v       show version information\n"
  "  -cci bits       cross-compile with given integer size\n"
  "  -ccn type bits  cross-compile with given lua_Number type and size\n"
@@ -103,6 +112,10 @@ static int doargs(int argc, char* argv[])
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
    stripping=1;
+  else if (IS("-f"))			/* flash image */
+   flash=1;
+  else if (IS("-t"))			/* flash image for this host, run it */
+   flash=testing=1;
   else if (IS("-v"))			/* show version */
    ++version;
   else if (IS("-cci")) /* target integer size */
@@ -135,6 +148,7 @@ static int doargs(int argc, char* argv[])
   else					/* unknown option */
    usage(argv[i]);
  }
+ if (testing && output==NULL) usage(LUA_QL("-t") " needs an output file");
  if (i==argc && (listing || !dumping))
  {
   dumping=0;
@@ -148,6 +162,66 @@ static int doargs(int argc, char* argv[])
  return i;
 }
 
+static int cmpname(const void* a, const void* b)
+{
+ return strcmp(*(char* const*)a,*(char* const*)b);
+}
+
+/* replace each directory given by the Lua files in it, in name order */
+static char** expand(int* argc, char* argv[])
+{
+ int n=0,size=*argc,i;
+ char** files=malloc(size*sizeof(char*));
+ if (files==NULL) fatal("not enough memory for file names");
+ for (i=0; i<*argc; i++)
+ {
+  struct stat st;
+  struct dirent* e;
+  DIR* d;
+  int first=n;
+  if (IS("-") || stat(argv[i],&st)!=0 || !S_ISDIR(st.st_mode))
+  {
+   files[n++]=argv[i];
+   continue;
+  }
+  if ((d=opendir(argv[i]))==NULL)
+  {
+   fprintf(stderr,"%s: cannot open %s: %s\n",progname,argv[i],strerror(errno));
+   exit(EXIT_FAILURE);
+  }
+  while ((e=readdir(d))!=NULL)
+  {
+   size_t l=strlen(e->d_name);
+   if (l<=4 || strcmp(e->d_name+l-4,".lua")!=0) continue;
+   if (n==size && (files=realloc(files,(size*=2)*sizeof(char*)))==NULL)
+    fatal("not enough memory for file names");
+   if ((files[n]=malloc(strlen(argv[i])+l+2))==NULL)
+    fatal("not enough memory for file names");
+   sprintf(files[n++],"%s/%s",argv[i],e->d_name);
+  }
+  closedir(d);
+  qsort(files+first,n-first,sizeof(char*),cmpname);
+ }
+ *argc=n;
+ return files;
+}
+
+/* module name of a file: its name without directory and extension */
+static char* modname(const char* filename)
+{
+ const char* b=strrchr(filename,'/');
+ const char* e;
+ char* name;
+ b=b ? b+1 : filename;
+ e=strrchr(b,'.');
+ if (e==NULL || e==b) e=b+strlen(b);
+ name=malloc(e-b+1);
+ if (name==NULL) fatal("not enough memory for module names");
+ memcpy(name,b,e-b);
+ name[e-b]=0;
+ return name;
+}
+
 #define toproto(L,i) (clvalue(L->top+(i))->l.p)
 
 static const Proto* combine(lua_State* L, int n)
@@ -184,6 +258,85 @@ static int writer(lua_State* L, const void* p, size_t size, void* u)
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+static FlashTargetInfo flashtarget(void)
+{
+ FlashTargetInfo t;
+ if (testing)
+ {
+  struct { char c; lua_Number n; } n;
+  struct { char c; L_Umaxalign u; } u;
+  t.sizeof_ptr=sizeof(void*);
+  t.sizeof_lua_Number=sizeof(lua_Number);
+  t.lua_Number_integral=(((lua_Number)0.5)==0);
+  t.align_lua_Number=(char*)&n.n-(char*)&n;
+  t.align_max=(char*)&u.u-(char*)&u;
+ }
+ else
+ {
+  /* the ESP8266: 32 bit pointers, numbers aligned to their size */
+  if (!target.little_endian || target.is_arm_fpa)
+   fatal("flash images are for little endian targets only");
+  t.sizeof_ptr=4;
+  t.sizeof_lua_Number=target.sizeof_lua_Number;
+  t.lua_Number_integral=target.lua_Number_integral;
+  t.align_lua_Number=target.sizeof_lua_Number;
+  t.align_max=8;
+ }
+ return t;
+}
+
+/*
+** load the image written to output, mount it in a new state and run it;
+** its modules are found by `require'
+*/
+static void runimage(void)
+{
+ static const luaL_Reg libs[] = {
+  {"", luaopen_base},
+  {LUA_STRLIBNAME, luaopen_string},
+  {LUA_TABLIBNAME, luaopen_table},
+  {LUA_MATHLIBNAME, luaopen_math},
+  {LUA_LOADLIBNAME, luaopen_package},
+  {NULL, NULL}
+ };
+ const luaL_Reg* lib;
+ FILE* D=fopen(output,"rb");
+ lua_State* L;
+ FlashHeader h;
+ char* image;
+ long size;
+ lu_mem heap;
+ if (D==NULL) cannot("open");
+ if (fseek(D,0,SEEK_END)!=0 || (size=ftell(D))<(long)sizeof(h) ||
+     fseek(D,0,SEEK_SET)!=0) cannot("read");
+ image=malloc(size);
+ if (image==NULL) fatal("not enough memory for image");
+ if (fread(image,size,1,D)!=1) cannot("read");
+ fclose(D);
+ memcpy(&h,image,sizeof(h));
+ if ((long)(h.size+FLASH_BITMAPSIZE(h.size))!=size) fatal("bad image size");
+ luaN_relocate(image,h.size,(lu_byte*)image+h.size,image);
+ luaN_setimage(image);
+ L=lua_open();
+ if (L==NULL) fatal("not enough memory for state");
+ if (G(L)->flash==NULL) fatal("image not mounted");
+ for (lib=libs; lib->func; lib++)
+ {
+  lua_pushcfunction(L,lib->func);
+  lua_pushstring(L,lib->name);
+  lua_call(L,1,0);
+ }
+ heap=G(L)->totalbytes;
+ luaN_pushmain(L);
+ heap=G(L)->totalbytes-heap;
+ fprintf(stderr,"%s: %s: %u bytes, %d strings, %d modules, main function in %u bytes of heap\n",
+	progname,output,(unsigned)h.size,(int)h.nuse,(int)h.nmodules,(unsigned)heap);
+ if (lua_pcall(L,0,0,0)!=0) fatal(lua_tostring(L,-1));
+ lua_close(L);
+ luaN_setimage(NULL);
+ free(image);
+}
+
 struct Smain {
  int argc;
  char** argv;
@@ -195,13 +348,35 @@ static int pmain(lua_State* L)
  int argc=s->argc;
  char** argv=s->argv;
  const Proto* f;
- int i;
+ const Proto** modules=NULL;
+ char** names=NULL;
+ int nmodules=0;
+ int i,j;
  if (!lua_checkstack(L,argc)) fatal("too many input files");
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
   if (luaL_loadfile(L,filename)!=0) fatal(lua_tostring(L,-1));
  }
+ if (flash)
+ {
+  modules=malloc(argc*sizeof(Proto*));
+  names=malloc(argc*sizeof(char*));
+  if (modules==NULL || names==NULL) fatal("not enough memory for modules");
+  for (i=0; i<argc; i++)
+  {
+   if (IS("-")) continue;		/* stdin has no name */
+   modules[nmodules]=toproto(L,i-argc);
+   names[nmodules]=modname(argv[i]);
+   for (j=0; j<nmodules; j++)
+    if (strcmp(names[j],names[nmodules])==0)
+    {
+     fprintf(stderr,"%s: module " LUA_QS " given twice\n",progname,names[j]);
+     exit(EXIT_FAILURE);
+    }
+   nmodules++;
+  }
+ }
  f=combine(L,argc);
  if (listing) luaU_print(f,listing>1);
  if (dumping)
@@ -209,13 +384,19 @@ static int pmain(lua_State* L)
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
-  int result=luaU_dump_crosscompile(L,f,writer,D,stripping,target);
+  int result=flash ? luaN_dump(L,f,modules,(const char* const*)names,nmodules,
+                               writer,D,stripping,flashtarget()) :
+                     luaU_dump_crosscompile(L,f,writer,D,stripping,target);
   lua_unlock(L);
   if (result==LUA_ERR_CC_INTOVERFLOW) fatal("value too big or small for target integer type");
   if (result==LUA_ERR_CC_NOTINTEGER) fatal("target lua_Number is integral but fractional value found");
+  if (result==LUA_ERR_CC_LAYOUT) fatal("flash image layout does not match this host");
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
  }
+ for (i=0; i<nmodules; i++) free(names[i]);
+ free(names);
+ free(modules);
  return 0;
 }
 
@@ -235,11 +416,14 @@ int main(int argc, char* argv[])
  int i=doargs(argc,argv);
  argc-=i; argv+=i;
  if (argc<=0) usage("no input files given");
+ argv=expand(&argc,argv);
+ if (argc<=0) usage("no Lua files in the directories given");
  L=lua_open();
  if (L==NULL) fatal("not enough memory for state");
  s.argc=argc;
  s.argv=argv;
  if (lua_cpcall(L,pmain,&s)!=0) fatal(lua_tostring(L,-1));
  lua_close(L);
+ if (testing && dumping) runimage();
  return EXIT_SUCCESS;
 }
@@ -880,7 +880,7 @@ union luai_Cast { double l_d; long l_l; };
 
 #define LUA_INTFRMLEN		"l"
 #define LUA_INTFRM_T		long
-#ifndef LUA_CROSS_COMPILER
+#if !defined(LUA_CROSS_COMPILER) && !defined(NODEMCU_HOST)
 typedef short int16_t;
 typedef long int32_t;
 #endif
@@ -902,6 +902,27 @@ typedef long int32_t;
 #define LUA_META_ROTABLES 
 #endif
 
+/* the profiler (see lprofile.h), the heap tracer (see c_heaptrace.h) and
+   the pool of small blocks (see lpool.h) are for the VM on the device and
+   on the host build, never for the cross compiler */
+#if defined(LUA_PROFILE) && defined(LUA_CROSS_COMPILER)
+#undef LUA_PROFILE
+#endif
+#if defined(HEAP_TRACE) && defined(LUA_CROSS_COMPILER)
+#undef HEAP_TRACE
+#endif
+#if defined(LUA_POOL) && defined(LUA_CROSS_COMPILER)
+#undef LUA_POOL
+#endif
+
+/* integers tagged apart from the numbers (see LUA_TNUMINT in lobject.h) are
+   for double numbers only, and a packed value has no room for the tag;
+   LUA_NO_INTFAST lets the host build the VM without them to compare */
+#if defined(LUA_INTFAST) && (defined(LUA_NUMBER_INTEGRAL) || \
+    defined(LUA_PACK_VALUE) || defined(LUA_NO_INTFAST))
+#undef LUA_INTFAST
+#endif
+
 #if LUA_OPTIMIZE_MEMORY == 2 && defined(LUA_USE_POPEN)
 #error "Pipes not supported in aggresive optimization mode (LUA_OPTIMIZE_MEMORY=2)"
 #endif
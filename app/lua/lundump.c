@@ -213,7 +213,7 @@ static void LoadConstants(LoadState* S, Proto* f)
    	setbvalue(o,LoadChar(S)!=0);
 	break;
    case LUA_TNUMBER:
-	setnvalue(o,LoadNumber(S));
+	luaO_setnumber(o,LoadNumber(S));
 	break;
    case LUA_TSTRING:
 	setsvalue2n(S->L,o,LoadString(S));
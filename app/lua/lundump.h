@@ -61,4 +61,7 @@ LUAI_FUNC void luaU_print (const Proto* f, int full);
 /* target lua_Number is integral but a constant is non-integer */
 #define LUA_ERR_CC_NOTINTEGER 102
 
+/* target layout of a flash image does not match this host */
+#define LUA_ERR_CC_LAYOUT 103
+
 #endif
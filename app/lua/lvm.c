@@ -20,6 +20,7 @@
 #include "lgc.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lprofile.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -55,7 +56,7 @@ const TValue *luaV_tonumber (const TValue *obj, TValue *n) {
   lua_Number num;
   if (ttisnumber(obj)) return obj;
   if (ttisstring(obj) && luaO_str2d(svalue(obj), &num)) {
-    setnvalue(n, num);
+    luaO_setnumber(n, num);
     return n;
   }
   else
@@ -69,8 +70,12 @@ int luaV_tostring (lua_State *L, StkId obj) {
   else {
     char s[LUAI_MAXNUMBER2STR];
     ptrdiff_t objr = savestack(L, obj);
-    lua_Number n = nvalue(obj);
-    lua_number2str(s, n);
+    if (ttisint(obj))
+      c_sprintf(s, "%ld", cast(long, ivalue(obj)));
+    else {
+      lua_Number n = nvalue(obj);
+      lua_number2str(s, n);
+    }
     setsvalue2s(L, restorestack(L, objr), luaS_new(L, s));
     return 1;
   }
@@ -259,6 +264,8 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
+  else if (ttisint(l) && ttisint(r))
+    return ivalue(l) < ivalue(r);
   else if (ttisnumber(l))
     return luai_numlt(nvalue(l), nvalue(r));
   else if (ttisstring(l))
@@ -273,6 +280,8 @@ static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
+  else if (ttisint(l) && ttisint(r))
+    return ivalue(l) <= ivalue(r);
   else if (ttisnumber(l))
     return luai_numle(nvalue(l), nvalue(r));
   else if (ttisstring(l))
@@ -290,7 +299,9 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
   lua_assert(ttype(t1) == ttype(t2));
   switch (ttype(t1)) {
     case LUA_TNIL: return 1;
-    case LUA_TNUMBER: return luai_numeq(nvalue(t1), nvalue(t2));
+    case LUA_TNUMBER:
+      if (ttisint(t1) && ttisint(t2)) return ivalue(t1) == ivalue(t2);
+      return luai_numeq(nvalue(t1), nvalue(t2));
     case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);  /* true must be 1 !! */
     case LUA_TLIGHTUSERDATA: 
     case LUA_TROTABLE:
@@ -359,13 +370,70 @@ void luaV_concat (lua_State *L, int total, int last) {
 }
 
 
+/*
+** Arithmetic on integers (see LUA_INTFAST), each false if the result is not
+** an integer that fits: it is then worked out on doubles. A product or a
+** quotient that is 0 with a negative operand is -0 for the doubles.
+*/
+#define INTMIN	(-0x7fffffff - 1)
+
+#define intadd(r,a,b) \
+  (*(r) = cast(l_int32, cast(lu_int32, a) + cast(lu_int32, b)), \
+   ((*(r) ^ (a)) & (*(r) ^ (b))) >= 0)
+#define intsub(r,a,b) \
+  (*(r) = cast(l_int32, cast(lu_int32, a) - cast(lu_int32, b)), \
+   (((a) ^ (b)) & (*(r) ^ (a))) >= 0)
+
+static int intmul (l_int32 *r, l_int32 a, l_int32 b) {
+  long long p = (long long)a * b;
+  if (p != cast(l_int32, p) || (p == 0 && (a < 0 || b < 0)))
+    return 0;
+  *r = cast(l_int32, p);
+  return 1;
+}
+
+static int intdiv (l_int32 *r, l_int32 a, l_int32 b) {
+  if (b == 0 || (b == -1 && a == INTMIN) || a % b != 0 || (a == 0 && b < 0))
+    return 0;  /* by 0, overflow, a fraction or -0 */
+  *r = a / b;
+  return 1;
+}
+
+static int intmod (l_int32 *r, l_int32 a, l_int32 b) {
+  l_int32 m;
+  if (b == 0) return 0;  /* nan */
+  m = (b == -1) ? 0 : a % b;
+  if (m != 0 && (m ^ b) < 0) m += b;  /* the sign of the divisor */
+  *r = m;
+  return 1;
+}
+
+static int intarith (l_int32 *r, l_int32 a, l_int32 b, TMS op) {
+  switch (op) {
+    case TM_ADD: return intadd(r, a, b);
+    case TM_SUB: return intsub(r, a, b);
+    case TM_MUL: return intmul(r, a, b);
+    case TM_DIV: return intdiv(r, a, b);
+    case TM_MOD: return intmod(r, a, b);
+    case TM_UNM: return intsub(r, 0, a) && a != 0;
+    default: return 0;
+  }
+}
+
+
 static void Arith (lua_State *L, StkId ra, const TValue *rb,
                    const TValue *rc, TMS op) {
   TValue tempb, tempc;
   const TValue *b, *c;
+  l_int32 ir;
   if ((b = luaV_tonumber(rb, &tempb)) != NULL &&
       (c = luaV_tonumber(rc, &tempc)) != NULL) {
-    lua_Number nb = nvalue(b), nc = nvalue(c);
+    lua_Number nb, nc;
+    if (ttisint(b) && ttisint(c) && intarith(&ir, ivalue(b), ivalue(c), op)) {
+      setivalue(ra, ir);
+      return;
+    }
+    nb = nvalue(b), nc = nvalue(c);
     switch (op) {
       case TM_ADD: setnvalue(ra, luai_numadd(nb, nc)); break;
       case TM_SUB: setnvalue(ra, luai_numsub(nb, nc)); break;
@@ -388,6 +456,22 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 
 
 
+/*
+** makes the limit of a loop on integers an integer: the last value a step
+** of that sign reaches. False if it has none in range, the loop then runs on
+** doubles.
+*/
+static int forlimit (TValue *limit, l_int32 step) {
+  lua_Number l, f;
+  if (ttisint(limit)) return 1;
+  l = nvalue(limit);
+  f = (step > 0) ? floor(l) : -floor(-l);
+  if (!(f >= -2147483648.0 && f < 2147483648.0)) return 0;  /* or nan */
+  setivalue(limit, cast(l_int32, f));
+  return 1;
+}
+
+
 /*
 ** some macros for common tasks in `luaV_execute'
 */
@@ -422,6 +506,22 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
           Protect(Arith(L, ra, rb, rc, tm)); \
       }
 
+/* the same, on integers first */
+#define intarith_op(iop,op,tm) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        l_int32 ir; \
+        if (ttisint(rb) && ttisint(rc) && iop(&ir, ivalue(rb), ivalue(rc))) { \
+          setivalue(ra, ir); \
+        } \
+        else if (ttisnumber(rb) && ttisnumber(rc)) { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else \
+          Protect(Arith(L, ra, rb, rc, tm)); \
+      }
+
 
 
 void luaV_execute (lua_State *L, int nexeccalls) {
@@ -429,16 +529,25 @@ void luaV_execute (lua_State *L, int nexeccalls) {
   StkId base;
   TValue *k;
   const Instruction *pc;
+#ifdef LUA_PROFILE
+  int pslot;  /* slot of the function's instruction count */
+#endif
  reentry:  /* entry point */
   lua_assert(isLua(L->ci));
   pc = L->savedpc;
   cl = &clvalue(L->ci->func)->l;
   base = L->base;
   k = cl->p->k;
+#ifdef LUA_PROFILE
+  pslot = lprofile_enter(L, cl->p);
+#endif
   /* main loop of interpreter */
   for (;;) {
     const Instruction i = *pc++;
     StkId ra;
+#ifdef LUA_PROFILE
+    lprofile_count(L, i, pslot);
+#endif
     if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
         (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
       traceexec(L, pc);
@@ -524,23 +633,23 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         continue;
       }
       case OP_ADD: {
-        arith_op(luai_numadd, TM_ADD);
+        intarith_op(intadd, luai_numadd, TM_ADD);
         continue;
       }
       case OP_SUB: {
-        arith_op(luai_numsub, TM_SUB);
+        intarith_op(intsub, luai_numsub, TM_SUB);
         continue;
       }
       case OP_MUL: {
-        arith_op(luai_nummul, TM_MUL);
+        intarith_op(intmul, luai_nummul, TM_MUL);
         continue;
       }
       case OP_DIV: {
-        arith_op(luai_lnumdiv, TM_DIV);
+        intarith_op(intdiv, luai_lnumdiv, TM_DIV);
         continue;
       }
       case OP_MOD: {
-        arith_op(luai_lnummod, TM_MOD);
+        intarith_op(intmod, luai_lnummod, TM_MOD);
         continue;
       }
       case OP_POW: {
@@ -549,7 +658,11 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       }
       case OP_UNM: {
         TValue *rb = RB(i);
-        if (ttisnumber(rb)) {
+        l_int32 ir;
+        if (ttisint(rb) && intsub(&ir, 0, ivalue(rb)) && ir != 0) {
+          setivalue(ra, ir);
+        }
+        else if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
         }
@@ -568,11 +681,11 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         switch (ttype(rb)) {
           case LUA_TTABLE: 
           case LUA_TROTABLE: {
-            setnvalue(ra, ttistable(rb) ? cast_num(luaH_getn(hvalue(rb))) : cast_num(luaH_getn_ro(rvalue(rb))));
+            setivalue(ra, ttistable(rb) ? luaH_getn(hvalue(rb)) : luaH_getn_ro(rvalue(rb)));
             break;
           }
           case LUA_TSTRING: {
-            setnvalue(ra, cast_num(tsvalue(rb)->len));
+            setivalue(ra, tsvalue(rb)->len);
             break;
           }
           default: {  /* try metamethod */
@@ -599,7 +712,11 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       case OP_EQ: {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        Protect(
+        if (ttisint(rb) && ttisint(rc)) {
+          if ((ivalue(rb) == ivalue(rc)) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
           if (equalobj(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
@@ -607,16 +724,28 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         continue;
       }
       case OP_LT: {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisint(rb) && ttisint(rc)) {
+          if ((ivalue(rb) < ivalue(rc)) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (luaV_lessthan(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
         continue;
       }
       case OP_LE: {
-        Protect(
-          if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisint(rb) && ttisint(rc)) {
+          if ((ivalue(rb) <= ivalue(rc)) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (lessequal(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
@@ -706,6 +835,19 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
       }
       case OP_FORLOOP: {
+        if (ttisint(ra)) {  /* all three are, see OP_FORPREP */
+          l_int32 istep = ivalue(ra+2);
+          l_int32 iidx;
+          /* past the limit if it overflows */
+          if (intadd(&iidx, ivalue(ra), istep) &&
+              (istep > 0 ? iidx <= ivalue(ra+1) : ivalue(ra+1) <= iidx)) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setivalue(ra, iidx);  /* update internal index... */
+            setivalue(ra+3, iidx);  /* ...and external index */
+          }
+          continue;
+        }
+        {
         lua_Number step = nvalue(ra+2);
         lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
         lua_Number limit = nvalue(ra+1);
@@ -715,6 +857,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           setnvalue(ra, idx);  /* update internal index... */
           setnvalue(ra+3, idx);  /* ...and external index */
         }
+        }
         continue;
       }
       case OP_FORPREP: {
@@ -728,6 +871,18 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           luaG_runerror(L, LUA_QL("for") " limit must be a number");
         else if (!tonumber(pstep, ra+2))
           luaG_runerror(L, LUA_QL("for") " step must be a number");
+        if (ttisint(ra) && ttisint(pstep) && forlimit(ra+1, ivalue(pstep))) {
+          l_int32 iidx;
+          if (intsub(&iidx, ivalue(ra), ivalue(pstep))) {
+            setivalue(ra, iidx);
+            dojump(L, pc, GETARG_sBx(i));
+            continue;
+          }
+        }
+        if (ttisint(ra)) {  /* a loop on doubles */
+          setnvalue(ra+1, nvalue(ra+1));
+          setnvalue(ra+2, nvalue(ra+2));
+        }
         setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
         dojump(L, pc, GETARG_sBx(i));
         continue;
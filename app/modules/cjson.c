@@ -36,6 +36,8 @@
  *       difficult to know object/array sizes ahead of time.
  */
 
+#define HEAP_TRACE_TAG HEAP_TAG_CJSON
+
 // #include <assert.h>
 #include "c_string.h"
 #include "c_math.h"
@@ -868,16 +870,19 @@ static int json_encode(lua_State *l)
     json_config_t *cfg = json_fetch_config(l);
     strbuf_t local_encode_buf;
     strbuf_t *encode_buf;
+    luaL_BigBuffer big;
     char *json;
     int len;
 
     luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
 
     if (!cfg->encode_keep_buffer) {
-        /* Use private buffer */
+        /* Use private buffer, which becomes the string without a copy.
+         * The value goes above the slot the buffer keeps. */
+        luaL_bigbuffinit(l, &big, 0);
         encode_buf = &local_encode_buf;
-        if(-1==strbuf_init(encode_buf, 0))
-            return luaL_error(l, "not enough memory");
+        strbuf_init_big(encode_buf, &big);
+        lua_pushvalue(l, 1);
     } else {
         /* Reuse existing buffer */
         encode_buf = &cfg->encode_buf;
@@ -887,10 +892,12 @@ static int json_encode(lua_State *l)
     json_append_data(l, cfg, 0, encode_buf);
     json = strbuf_string(encode_buf, &len);
 
-    lua_pushlstring(l, json, len);
-
-    if (!cfg->encode_keep_buffer)
-        strbuf_free(encode_buf);
+    if (!cfg->encode_keep_buffer) {
+        lua_pop(l, 1);
+        luaL_addbigsize(&big, len - big.n);
+        luaL_pushbigresult(&big);
+    } else
+        lua_pushlstring(l, json, len);
 
     return 1;
 }
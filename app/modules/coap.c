@@ -1,5 +1,7 @@
 // Module for coapwork
 
+#define HEAP_TRACE_TAG HEAP_TAG_COAP
+
 //#include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
@@ -13,7 +15,6 @@
 #include "c_types.h"
 #include "mem.h"
 #include "espconn.h"
-#include "driver/uart.h"
 
 #include "coap.h"
 #include "uri.h"
@@ -22,15 +23,45 @@
 #include "coap_io.h"
 #include "coap_server.h"
 
-coap_queue_t *gQueue = NULL;
+coap_wheel_t gQueue;
 
 typedef struct lcoap_userdata
 {
   lua_State *L;
   struct espconn *pesp_conn;
   int self_ref;
+  // client request in progress, kept while blocks are left to send or read
+  coap_uri_t *uri;
+  coap_method_t method;
+  unsigned type;
+  int cb_ref;             // function(code, payload, more) the response goes to
+  int payload_ref;        // payload larger than one block, sent with Block1
+  coap_block_t block1;    // next block of the payload
+  coap_block_t block2;    // next block of the response
+  coap_tid_t tid;         // of its last confirmable request
 }lcoap_userdata;
 
+// ends the client request in progress
+static void coap_transfer_end( lua_State* L, lcoap_userdata *cud )
+{
+  if(cud->uri){
+    c_free(cud->uri);
+    cud->uri = NULL;
+  }
+  if(LUA_NOREF!=cud->cb_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, cud->cb_ref);
+    cud->cb_ref = LUA_NOREF;
+  }
+  if(LUA_NOREF!=cud->payload_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, cud->payload_ref);
+    cud->payload_ref = LUA_NOREF;
+  }
+  if(LUA_NOREF!=cud->self_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, cud->self_ref);
+    cud->self_ref = LUA_NOREF;
+  }
+}
+
 static void coap_received(void *arg, char *pdata, unsigned short len)
 {
   NODE_DBG("coap_received is called.\n");
@@ -71,6 +102,10 @@ static int coap_create( lua_State* L, const char* mt )
   // pre-initialize it, in case of errors
   cud->self_ref = LUA_NOREF;
   cud->pesp_conn = NULL;
+  cud->uri = NULL;
+  cud->cb_ref = LUA_NOREF;
+  cud->payload_ref = LUA_NOREF;
+  cud->tid = COAP_INVALID_TID;
 
   // set its metatable
   luaL_getmetatable(L, mt);
@@ -117,14 +152,12 @@ static int coap_delete( lua_State* L, const char* mt )
   }
 
   // free (unref) callback ref
-  if(LUA_NOREF!=cud->self_ref){
-    luaL_unref(L, LUA_REGISTRYINDEX, cud->self_ref);
-    cud->self_ref = LUA_NOREF;
-  }
+  coap_transfer_end(L, cud);
 
   cud->L = NULL;
   if(cud->pesp_conn)
   {
+    coap_remove_conn(&gQueue, cud->pesp_conn);  // its requests would be sent again on freed memory
     if(cud->pesp_conn->proto.udp->remote_port || cud->pesp_conn->proto.udp->local_port)
       espconn_delete(cud->pesp_conn);
     c_free(cud->pesp_conn->proto.udp);
@@ -221,10 +254,144 @@ static int coap_on( lua_State* L, const char* mt )
   return 0;  
 }
 
+// builds and sends the request for the blocks cud->block1/block2 name,
+// payload is only used when it is not sent in blocks
+static void coap_send_block( lcoap_userdata *cud, const char *payload, size_t l )
+{
+  struct espconn *pesp_conn = cud->pesp_conn;
+  coap_pdu_t *pdu = coap_new_pdu();   // should call coap_delete_pdu() somewhere
+  if(!pdu)
+    return;
+  coap_rw_buffer_t scratch = pdu->scratch;    // pdu->scratch.p is free-ed with the pdu
+
+  if(LUA_NOREF!=cud->payload_ref){
+    size_t off = COAP_BLOCK_OFFSET(&cud->block1), size = COAP_BLOCK_SIZE(cud->block1.szx);
+    lua_rawgeti(cud->L, LUA_REGISTRYINDEX, cud->payload_ref);
+    payload = lua_tolstring(cud->L, -1, &l);    // stays alive through payload_ref
+    lua_pop(cud->L, 1);
+    if(off > l)
+      off = l;
+    cud->block1.m = l - off > size;
+    payload += off;
+    l = cud->block1.m ? size : l - off;
+  }
+  coap_make_request(&scratch, pdu->pkt, cud->type, cud->method, cud->uri, payload, l);
+  if(LUA_NOREF!=cud->payload_ref)
+    coap_add_block(&scratch, pdu->pkt, COAP_OPTION_BLOCK1, &cud->block1);
+  if(cud->block2.num > 0)
+    coap_add_block(&scratch, pdu->pkt, COAP_OPTION_BLOCK2, &cud->block2);
+
+#ifdef COAP_DEBUG
+  coap_dumpPacket(pdu->pkt);
+#endif
+
+  int rc;
+  if (0 != (rc = coap_build(pdu->msg.p, &(pdu->msg.len), pdu->pkt))){
+    NODE_DBG("coap_build failed rc=%d\n", rc);
+    coap_delete_pdu(pdu);
+    return;
+  }
+#ifdef COAP_DEBUG
+  NODE_DBG("Sending: ");
+  coap_dump(pdu->msg.p, pdu->msg.len, true);
+  NODE_DBG("\n");
+#endif
+  coap_tid_t tid = COAP_INVALID_TID;
+  if (pdu->pkt->hdr.t == COAP_TYPE_CON){
+    tid = cud->tid = coap_send_confirmed(pesp_conn, pdu);
+  }
+  else {
+    tid = coap_send(pesp_conn, pdu);
+  }
+  if (pdu->pkt->hdr.t != COAP_TYPE_CON || tid == COAP_INVALID_TID){
+    coap_delete_pdu(pdu);
+  }
+}
+
+// goes on with the request in progress once its response pkt came in
+static void coap_transfer_next( lcoap_userdata *cud, const coap_packet_t *pkt )
+{
+  lua_State *L = cud->L;
+  coap_block_t b;
+  int more, cb = 0;
+
+  if(LUA_NOREF!=cud->payload_ref && pkt->hdr.code == COAP_RSPCODE_CONTINUE && coap_get_block(pkt, COAP_OPTION_BLOCK1, &b)){
+    // the server took the block, go on in the size it asked for
+    uint32_t off = COAP_BLOCK_OFFSET(&cud->block1) + COAP_BLOCK_SIZE(cud->block1.szx);
+    if(b.szx < cud->block1.szx)
+      cud->block1.szx = b.szx;
+    cud->block1.num = off >> (cud->block1.szx + 4);
+    coap_send_block(cud, NULL, 0);
+    return;
+  }
+  if(LUA_NOREF!=cud->payload_ref){   // the upload is done, or was refused
+    luaL_unref(L, LUA_REGISTRYINDEX, cud->payload_ref);
+    cud->payload_ref = LUA_NOREF;
+  }
+
+  more = LUA_NOREF!=cud->cb_ref && COAP_RESPONSE_CLASS(pkt->hdr.code) == 2 &&
+         coap_get_block(pkt, COAP_OPTION_BLOCK2, &b) && b.m;
+  if(LUA_NOREF!=cud->cb_ref){
+    cb = 1;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cud->self_ref);   // keeps the client alive through the callback
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cud->cb_ref);
+    lua_pushinteger(L, (pkt->hdr.code >> 5) * 100 + (pkt->hdr.code & 0x1F));
+    if(pkt->payload.len)
+      lua_pushlstring(L, pkt->payload.p, pkt->payload.len);
+    else
+      lua_pushliteral(L, "");
+    lua_pushboolean(L, more);
+  }
+  // ask for the next block before the callback runs, it may start a new request
+  if(more){
+    cud->block2.num = b.num + 1;
+    cud->block2.m = 0;
+    cud->block2.szx = b.szx;
+    coap_send_block(cud, NULL, 0);
+  } else {
+    coap_transfer_end(L, cud);
+  }
+  if(cb){
+    lua_call(L, 3, 0);
+    lua_pop(L, 1);
+  }
+}
+
+// the wheel gave up on a request, the transfer it belongs to ends with
+// function(nil, "timeout")
+static void coap_transfer_timeout(coap_queue_t *node)
+{
+  struct espconn *pesp_conn = node->pconn;
+  lcoap_userdata *cud = pesp_conn ? (lcoap_userdata *)pesp_conn->reverse : NULL;
+  lua_State *L;
+  int cb = 0;
+
+  if(cud == NULL || cud->uri == NULL || cud->tid != node->id)
+    return;     // not the request in progress
+  L = cud->L;
+  if(LUA_NOREF!=cud->cb_ref){
+    cb = 1;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cud->self_ref);   // keeps the client alive through the callback
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cud->cb_ref);
+    lua_pushnil(L);
+    lua_pushliteral(L, "timeout");
+  }
+  coap_transfer_end(L, cud);
+  if(cb){
+    lua_call(L, 2, 0);
+    lua_pop(L, 1);
+  }
+  if(gQueue.count == 0 && cud->uri == NULL){ // as when the response had come in
+    if(pesp_conn->proto.udp->remote_port || pesp_conn->proto.udp->local_port)
+      espconn_delete(pesp_conn);
+  }
+}
+
 static void coap_response_handler(void *arg, char *pdata, unsigned short len)
 {
   NODE_DBG("coap_response_handler is called.\n");
   struct espconn *pesp_conn = arg;
+  lcoap_userdata *cud = (lcoap_userdata *)pesp_conn->reverse;
 
   coap_packet_t pkt;
   pkt.content.p = NULL;
@@ -272,14 +439,15 @@ static void coap_response_handler(void *arg, char *pdata, unsigned short len)
 
     coap_transaction_id(ip, port, &pkt, &id);
 
-    /* transaction done, remove the node from queue */
-    // stop timer
-    coap_timer_stop();
-    // remove the node
+    /* transaction done, remove the node from queue, the wheel timer
+     * stops on its own once the queue is empty */
     coap_remove_node(&gQueue, id);
-    // calculate time elapsed
-    coap_timer_update(&gQueue);
-    coap_timer_start(&gQueue);
+
+    if (cud->uri)
+    {
+      coap_transfer_next(cud, &pkt);
+      goto end;
+    }
 
     if (COAP_RESPONSE_CLASS(pkt.hdr.code) == 2)
     {
@@ -295,14 +463,14 @@ static void coap_response_handler(void *arg, char *pdata, unsigned short len)
   }
 
 end:
-  if(!gQueue){ // if there is no node pending in the queue, disconnect from host.
+  if(gQueue.count == 0 && cud->uri == NULL){ // if there is no node pending in the queue, disconnect from host.
     if(pesp_conn->proto.udp->remote_port || pesp_conn->proto.udp->local_port)
       espconn_delete(pesp_conn);
   }
   // c_memset(buf, 0, sizeof(buf));
 }
 
-// Lua: client:request( [CON], uri, [payload] )
+// Lua: client:request( [CON], uri, [payload], [function(code, payload, more)] )
 static int coap_request( lua_State* L, coap_method_t m )
 {
   struct espconn *pesp_conn = NULL;
@@ -338,10 +506,21 @@ static int coap_request( lua_State* L, coap_method_t m )
   if (url == NULL)
     return luaL_error( L, "wrong arg type" );
 
-  coap_uri_t *uri = coap_new_uri(url, l);   // should call free(uri) somewhere
+  coap_uri_t *uri = coap_new_uri(url, l);   // free-ed in coap_transfer_end()
   if (uri == NULL)
     return luaL_error( L, "uri wrong format." );
 
+  coap_transfer_end(L, cud);    // a new request drops the one in progress
+  cud->uri = uri;
+  cud->method = m;
+  cud->type = t;
+  cud->block1.num = 0;
+  cud->block1.m = 0;
+  cud->block1.szx = COAP_BLOCK1_SZX;
+  cud->block2.num = 0;
+  cud->block2.m = 0;
+  cud->block2.szx = 0;
+
   pesp_conn->proto.udp->remote_port = uri->port;
   NODE_DBG("UDP port is set: %d.\n", uri->port);
   pesp_conn->proto.udp->local_port = espconn_port();
@@ -361,61 +540,38 @@ static int coap_request( lua_State* L, coap_method_t m )
     NODE_DBG("\n");
   }
 
-  coap_pdu_t *pdu = coap_new_pdu();   // should call coap_delete_pdu() somewhere
-  if(!pdu){
-    if(uri)
-      c_free(uri);
-    return;
-  }
-
   const char *payload = NULL;
   l = 0;
   if( lua_isstring(L, stack) ){
     payload = luaL_checklstring( L, stack, &l );
     if (payload == NULL)
       l = 0;
+    if (l > COAP_BLOCK_SIZE(COAP_BLOCK1_SZX)){   // too large for one request, send it in blocks
+      lua_pushvalue(L, stack);
+      cud->payload_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    stack++;
   }
 
-  coap_make_request(&(pdu->scratch), pdu->pkt, t, m, uri, payload, l);
-
-#ifdef COAP_DEBUG
-  coap_dumpPacket(pdu->pkt);
-#endif
+  if (lua_type(L, stack) == LUA_TFUNCTION || lua_type(L, stack) == LUA_TLIGHTFUNCTION){
+    lua_pushvalue(L, stack);
+    cud->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
 
-  int rc;
-  if (0 != (rc = coap_build(pdu->msg.p, &(pdu->msg.len), pdu->pkt))){
-    NODE_DBG("coap_build failed rc=%d\n", rc);
+  if(LUA_NOREF!=cud->cb_ref || LUA_NOREF!=cud->payload_ref){
+    lua_pushvalue(L, 1);  // keep the client until the request is done
+    cud->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
-  else
-  {
-#ifdef COAP_DEBUG
-    NODE_DBG("Sending: ");
-    coap_dump(pdu->msg.p, pdu->msg.len, true);
-    NODE_DBG("\n");
-#endif
-    espconn_regist_recvcb(pesp_conn, coap_response_handler);
-    sint8_t con = espconn_create(pesp_conn);
-    if( ESPCONN_OK != con){
-      NODE_DBG("Connect to host. code:%d\n", con);
-      // coap_delete_pdu(pdu);
-    } 
-    // else 
-    {
-      coap_tid_t tid = COAP_INVALID_TID;
-      if (pdu->pkt->hdr.t == COAP_TYPE_CON){
-        tid = coap_send_confirmed(pesp_conn, pdu);
-      }
-      else {
-        tid = coap_send(pesp_conn, pdu);
-      }
-      if (pdu->pkt->hdr.t != COAP_TYPE_CON || tid == COAP_INVALID_TID){
-        coap_delete_pdu(pdu);
-      }
-    }
+
+  espconn_regist_recvcb(pesp_conn, coap_response_handler);
+  sint8_t con = espconn_create(pesp_conn);
+  if( ESPCONN_OK != con){
+    NODE_DBG("Connect to host. code:%d\n", con);
   }
+  coap_send_block(cud, payload, l);
 
-  if(uri)
-    c_free((void *)uri);
+  if(LUA_NOREF==cud->cb_ref && LUA_NOREF==cud->payload_ref)
+    coap_transfer_end(L, cud);  // nothing to follow up on
 
   NODE_DBG("coap_request is called.\n");
   return 0;  
@@ -445,17 +601,29 @@ static int coap_regist( lua_State* L, const char* mt, int isvar )
   }
 
   if(h->name==NULL || c_strcmp(h->name, name)!=0){   // not exists. make a new one.
-    h->next = (coap_luser_entry *)c_zalloc(sizeof(coap_luser_entry));
-    h = h->next;
-    if(h == NULL)
+    coap_luser_entry *head = isvar ? variable_entry : function_entry;
+    coap_luser_entry *e = (coap_luser_entry *)c_zalloc(sizeof(coap_luser_entry));
+    char *copy = (char *)c_zalloc(l + 1);   // the lua string may be collected, keep a copy
+    if(e == NULL || copy == NULL){
+      if(e) c_free(e);
+      if(copy) c_free(copy);
       return luaL_error(L, "not enough memory");
-    h->next = NULL;
-    h->name = NULL;
-    h->L = NULL;
+    }
+    c_memcpy(copy, name, l);
+    e->next = NULL;
+    e->name = copy;
+    e->L = NULL;
+    e->body_ref = LUA_NOREF;
+    if(!endpoint_regist(head, e)){
+      c_free(copy);
+      c_free(e);
+      return luaL_error(L, "not enough memory");
+    }
+    h->next = e;
+    h = e;
   }  
 
   h->L = L;
-  h->name = name;
 
   NODE_DBG("coap_regist is called.\n");
   return 0;  
@@ -465,6 +633,7 @@ static int coap_regist( lua_State* L, const char* mt, int isvar )
 static int coap_createServer( lua_State* L )
 {
   const char *mt = "coap_server";
+  endpoint_setup();   // the routes take heap, only a server needs them
   return coap_create(L, mt);
 }
 
@@ -524,25 +693,25 @@ static int coap_client_gcdelete( lua_State* L )
   return coap_delete(L, mt);
 }
 
-// client:get( string, function(sent) )
+// client:get( string, function(code, payload, more) )
 static int coap_client_get( lua_State* L )
 {
   return coap_request(L, COAP_METHOD_GET);
 }
 
-// client:post( string, function(sent) )
+// client:post( string, function(code, payload, more) )
 static int coap_client_post( lua_State* L )
 {
   return coap_request(L, COAP_METHOD_POST);
 }
 
-// client:put( string, function(sent) )
+// client:put( string, function(code, payload, more) )
 static int coap_client_put( lua_State* L )
 {
   return coap_request(L, COAP_METHOD_PUT);
 }
 
-// client:delete( string, function(sent) )
+// client:delete( string, function(code, payload, more) )
 static int coap_client_delete( lua_State* L )
 {
   return coap_request(L, COAP_METHOD_DELETE);
@@ -592,7 +761,8 @@ const LUA_REG_TYPE coap_map[] =
 
 LUALIB_API int luaopen_coap( lua_State *L )
 {
-  endpoint_setup();
+  coap_setup();
+  gQueue.expired = coap_transfer_timeout;
 #if LUA_OPTIMIZE_MEMORY > 0
   luaL_rometatable(L, "coap_server", (void *)coap_server_map);  // create metatable for coap_server 
   luaL_rometatable(L, "coap_client", (void *)coap_client_map);  // create metatable for coap_client  
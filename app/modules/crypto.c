@@ -9,6 +9,7 @@
 #include "c_types.h"
 #include "c_stdlib.h"
 #include "../crypto/digests.h"
+#include "../crypto/mech.h"
 
 #include "user_interface.h"
 
@@ -25,7 +26,7 @@ static int crypto_sha1( lua_State* L )
   SHA1_CTX ctx;
   uint8_t digest[20];
   // Read the string from lua (with length)
-  int len;
+  size_t len;
   const char* msg = luaL_checklstring(L, 1, &len);
   // Use the SHA* functions in the rom
   SHA1Init(&ctx);
@@ -46,7 +47,7 @@ static const char* bytes64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwx
   */
 static int crypto_base64_encode( lua_State* L )
 {
-  int len;
+  size_t len;
   const char* msg = luaL_checklstring(L, 1, &len);
   int blen = (len + 2) / 3 * 4;
   char* out = (char*)c_malloc(blen);
@@ -72,7 +73,7 @@ static int crypto_base64_encode( lua_State* L )
   */
 static int crypto_hex_encode( lua_State* L)
 {
-  int len;
+  size_t len;
   const char* msg = luaL_checklstring(L, 1, &len);
   char* out = (char*)c_malloc(len * 2);
   int i, j = 0;
@@ -92,7 +93,7 @@ static int crypto_hex_encode( lua_State* L)
   */
 static int crypto_mask( lua_State* L )
 {
-  int len, mask_len;
+  size_t len, mask_len;
   const char* msg = luaL_checklstring(L, 1, &len);
   const char* mask = luaL_checklstring(L, 2, &mask_len);
   int i;
@@ -152,6 +153,59 @@ static int crypto_lhmac (lua_State *L)
 }
 
 
+/* data = crypto.encrypt("AES-CBC", key, plain [, iv])
+ * plain = crypto.decrypt("AES-CBC", key, data [, iv])
+ *
+ * The key is 16 or 32 bytes, for AES-128 or AES-256, and the iv up to 16,
+ * zeros if left out or short. AES-CBC pads the plain text with zeros to a
+ * whole number of blocks, which decrypt leaves on; AES-CTR keeps the length.
+ */
+static int crypto_encdec (lua_State *L, crypto_op_dir_t dir)
+{
+  const crypto_mech_t *mech = crypto_encryption_mech (luaL_checkstring (L, 1));
+  if (!mech)
+    return luaL_error (L, "unknown cipher mech");
+
+  crypto_op_t op;
+  size_t len;
+  const char *data;
+  os_memset (&op, 0, sizeof (op));
+  op.op = dir;
+  op.key = luaL_checklstring (L, 2, &op.key_len);
+  data = luaL_checklstring (L, 3, &len);
+  op.iv = luaL_optlstring (L, 4, "", &op.iv_len);
+  op.data_len = len;
+  if (crypto_check_op (mech, &op) != 0)
+    return luaL_error (L, "bad key, iv or data length");
+  op.data_len = crypto_output_len (mech, len);
+
+  // the cipher runs in the block of the result string
+  luaL_BigBuffer b;
+  luaL_bigbuffinit (L, &b, op.data_len);
+  if (op.data_len > 0)
+  {
+    op.data = b.b;
+    os_memcpy (op.data, data, len);
+    os_memset (op.data + len, 0, op.data_len - len);
+    if (mech->run (&op) != 0)
+      return bad_mem (L);
+    luaL_addbigsize (&b, op.data_len);
+  }
+  luaL_pushbigresult (&b);
+  return 1;
+}
+
+static int crypto_encrypt (lua_State *L)
+{
+  return crypto_encdec (L, OP_ENCRYPT);
+}
+
+static int crypto_decrypt (lua_State *L)
+{
+  return crypto_encdec (L, OP_DECRYPT);
+}
+
+
 // Module function map
 #define MIN_OPT_LEVEL 2
 #include "lrodefs.h"
@@ -163,6 +217,8 @@ const LUA_REG_TYPE crypto_map[] =
   { LSTRKEY( "mask" ), LFUNCVAL( crypto_mask ) },
   { LSTRKEY( "hash"   ), LFUNCVAL( crypto_lhash ) },
   { LSTRKEY( "hmac"   ), LFUNCVAL( crypto_lhmac ) },
+  { LSTRKEY( "encrypt" ), LFUNCVAL( crypto_encrypt ) },
+  { LSTRKEY( "decrypt" ), LFUNCVAL( crypto_decrypt ) },
 
 #if LUA_OPTIMIZE_MEMORY > 0
 
@@ -11,48 +11,142 @@
 #include "flash_fs.h"
 #include "c_string.h"
 
-static volatile int file_fd = FS_OPEN_OK - 1;
+// file.copy() moves data one SPIFFS logical page at a time
+#define FILE_COPY_CHUNK 256
+
+// A file object returned by file.open()
+typedef struct _file_fd_ud {
+  int fd;
+} file_fd_ud;
+
+// Registry reference to the file object the module level functions
+// (file.read(), file.write(), ...) work on: the one last opened.
+static int file_fd_ref = LUA_NOREF;
+
+// Returns the file object passed as first argument or, for the module level
+// functions, the default one (NULL if there is none). *argpos is set to the
+// position of the first argument after the object.
+static file_fd_ud *file_get_obj( lua_State *L, int *argpos )
+{
+  file_fd_ud *ud;
+  if( lua_isuserdata( L, 1 ) ){
+    *argpos = 2;
+    return (file_fd_ud *)luaL_checkudata( L, 1, "file.obj" );
+  }
+  *argpos = 1;
+  if( file_fd_ref == LUA_NOREF )
+    return NULL;
+  lua_rawgeti( L, LUA_REGISTRYINDEX, file_fd_ref );
+  ud = (file_fd_ud *)lua_touserdata( L, -1 );
+  lua_pop( L, 1 );  // still referenced from the registry
+  return ud;
+}
+
+// Returns the descriptor of an open file object or raises an error
+static int file_get_fd( lua_State *L, int *argpos )
+{
+  file_fd_ud *ud = file_get_obj( L, argpos );
+  if( ud == NULL || ud->fd < FS_OPEN_OK )
+    luaL_error( L, "open a file first" );
+  return ud->fd;
+}
+
+// Drops the default file object, closing it if requested. It is otherwise
+// flushed and left to the script (or __gc) to close.
+static void file_drop_default( lua_State *L, int do_close )
+{
+  file_fd_ud *ud;
+  if( file_fd_ref == LUA_NOREF )
+    return;
+  lua_rawgeti( L, LUA_REGISTRYINDEX, file_fd_ref );
+  ud = (file_fd_ud *)lua_touserdata( L, -1 );
+  lua_pop( L, 1 );
+  if( ud->fd >= FS_OPEN_OK ){
+    if( do_close ){
+      fs_close( ud->fd );
+      ud->fd = FS_OPEN_OK - 1;
+    }
+#if defined(BUILD_SPIFFS)
+    else {
+      fs_flush( ud->fd );
+    }
+#endif
+  }
+  luaL_unref( L, LUA_REGISTRYINDEX, file_fd_ref );
+  file_fd_ref = LUA_NOREF;
+}
 
-// Lua: open(filename, mode)
+// Lua: fobj = open(filename, mode)
 static int file_open( lua_State* L )
 {
   size_t len;
-  if((FS_OPEN_OK - 1)!=file_fd){
-    fs_close(file_fd);
-    file_fd = FS_OPEN_OK - 1;
-  }
+  int fd;
+  file_fd_ud *ud;
 
   const char *fname = luaL_checklstring( L, 1, &len );
   if( len > FS_NAME_MAX_LENGTH )
     return luaL_error(L, "filename too long");
   const char *mode = luaL_optstring(L, 2, "r");
 
-  file_fd = fs_open(fname, fs_mode2flag(mode));
+  // the previously opened file stays open as long as the script keeps its
+  // object; it is flushed so the new descriptor sees its data
+  file_drop_default(L, 0);
+
+  fd = fs_open(fname, fs_mode2flag(mode));
+  if(fd < FS_OPEN_OK){
+    // descriptors may still be held by file objects awaiting collection
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    fd = fs_open(fname, fs_mode2flag(mode));
+  }
 
-  if(file_fd < FS_OPEN_OK){
-    file_fd = FS_OPEN_OK - 1;
+  if(fd < FS_OPEN_OK){
     lua_pushnil(L);
-  } else {
-    lua_pushboolean(L, 1);
+    return 1;
   }
+
+  ud = (file_fd_ud *)lua_newuserdata(L, sizeof(file_fd_ud));
+  ud->fd = fd;
+  luaL_getmetatable(L, "file.obj");
+  lua_setmetatable(L, -2);
+
+  // it also becomes the file the module level functions work on
+  lua_pushvalue(L, -1);
+  file_fd_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   return 1; 
 }
 
 // Lua: close()
+//      fobj:close()
 static int file_close( lua_State* L )
 {
-  if((FS_OPEN_OK - 1)!=file_fd){
-    fs_close(file_fd);
-    file_fd = FS_OPEN_OK - 1;
+  int argpos;
+  file_fd_ud *ud = file_get_obj( L, &argpos );
+  if( ud && ud->fd >= FS_OPEN_OK ){
+    fs_close(ud->fd);
+    ud->fd = FS_OPEN_OK - 1;
   }
+  if( argpos == 1 )
+    file_drop_default(L, 1);
   return 0;  
 }
 
+// fobj.__gc
+static int file_obj_free( lua_State* L )
+{
+  file_fd_ud *ud = (file_fd_ud *)luaL_checkudata(L, 1, "file.obj");
+  if( ud->fd >= FS_OPEN_OK ){
+    fs_close(ud->fd);
+    ud->fd = FS_OPEN_OK - 1;
+  }
+  return 0;
+}
+
 // Lua: format()
 static int file_format( lua_State* L )
 {
   size_t len;
-  file_close(L);
+  // the format takes every descriptor away
+  file_drop_default(L, 1);
   if( !fs_format() )
   {
     NODE_ERR( "\ni*** ERROR ***: unable to format. FS might be compromised.\n" );
@@ -101,19 +195,21 @@ static int file_list( lua_State* L )
   return 1;
 }
 
+// Lua: seek(whence, offset)
+//      fobj:seek(whence, offset)
 static int file_seek (lua_State *L) 
 {
   static const int mode[] = {FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END};
   static const char *const modenames[] = {"set", "cur", "end", NULL};
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
-  int op = luaL_checkoption(L, 1, "cur", modenames);
-  long offset = luaL_optlong(L, 2, 0);
-  op = fs_seek(file_fd, offset, mode[op]);
+  int argpos;
+  int fd = file_get_fd(L, &argpos);
+  int op = luaL_checkoption(L, argpos, "cur", modenames);
+  long offset = luaL_optlong(L, argpos + 1, 0);
+  op = fs_seek(fd, offset, mode[op]);
   if (op)
     lua_pushnil(L);  /* error */
   else
-    lua_pushinteger(L, fs_tell(file_fd));
+    lua_pushinteger(L, fs_tell(fd));
   return 1;
 }
 
@@ -124,17 +220,18 @@ static int file_remove( lua_State* L )
   const char *fname = luaL_checklstring( L, 1, &len );
   if( len > FS_NAME_MAX_LENGTH )
     return luaL_error(L, "filename too long");
-  file_close(L);
+  file_drop_default(L, 0);
   SPIFFS_remove(&fs, (char *)fname);
   return 0;  
 }
 
 // Lua: flush()
+//      fobj:flush()
 static int file_flush( lua_State* L )
 {
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
-  if(fs_flush(file_fd) == 0)
+  int argpos;
+  int fd = file_get_fd(L, &argpos);
+  if(fs_flush(fd) == 0)
     lua_pushboolean(L, 1);
   else
     lua_pushnil(L);
@@ -144,7 +241,7 @@ static int file_flush( lua_State* L )
 // Lua: check()
 static int file_check( lua_State* L )
 {
-  file_close(L);
+  file_drop_default(L, 0);
   lua_pushinteger(L, fs_check());
   return 1;
 }
@@ -154,10 +251,7 @@ static int file_check( lua_State* L )
 static int file_rename( lua_State* L )
 {
   size_t len;
-  if((FS_OPEN_OK - 1)!=file_fd){
-    fs_close(file_fd);
-    file_fd = FS_OPEN_OK - 1;
-  }
+  file_drop_default(L, 0);
 
   const char *oldname = luaL_checklstring( L, 1, &len );
   if( len > FS_NAME_MAX_LENGTH )
@@ -194,30 +288,49 @@ static int file_fsinfo( lua_State* L )
 #endif
 
 // g_read()
-static int file_g_read( lua_State* L, int n, int16_t end_char )
+static int file_g_read( lua_State* L, int n, int16_t end_char, int fd )
 {
   if(n< 0 || n>LUAL_BUFFERSIZE) 
     n = LUAL_BUFFERSIZE;
   if(end_char < 0 || end_char >255)
     end_char = EOF;
-  int ec = (int)end_char;
   
-  luaL_Buffer b;
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
-
-  luaL_buffinit(L, &b);
-  char *p = luaL_prepbuffer(&b);
-  int c = EOF;
-  int i = 0;
-
-  do{
-    c = fs_getc(file_fd);
-    if(c==EOF){
+  luaL_BigBuffer b;
+
+  // the chunk is read straight into the block of the result string
+  luaL_bigbuffinit(L, &b, n);
+  char *p = b.b;
+  int i;
+
+#ifdef FILE_NO_BLOCK_READ
+  // a byte at a time, as before, for the host build to compare
+  int c;
+  for(i = 0; i < n; ){
+    if((c = fs_getc(fd)) == EOF)
+      break;
+    p[i++] = (char)c;
+    if(c == end_char)
       break;
+  }
+  n = i;
+#else
+  // read the whole chunk in one go, then look for the end char in RAM
+  n = fs_read(fd, p, n);
+  if(n < 0)
+    n = 0;
+  i = n;
+  if(end_char != EOF){
+    for(i = 0; i < n; i++){
+      if(p[i] == (char)end_char){
+        i++;
+        break;
+      }
     }
-    p[i++] = (char)(0xFF & c);
-  }while((c!=EOF) && (c!=ec) && (i<n) );
+    // give back whatever was read past the end char
+    if(i < n)
+      fs_seek(fd, i - n, FS_SEEK_CUR);
+  }
+#endif
 
 #if 0
   if(i>0 && p[i-1] == '\n')
@@ -225,12 +338,12 @@ static int file_g_read( lua_State* L, int n, int16_t end_char )
 #endif
     
   if(i==0){
-    luaL_pushresult(&b);  /* close buffer */
+    luaL_pushbigresult(&b);  /* close buffer */
     return (lua_objlen(L, -1) > 0);  /* check whether read something */
   }
 
-  luaL_addsize(&b, i);
-  luaL_pushresult(&b);  /* close buffer */
+  luaL_addbigsize(&b, i);
+  luaL_pushbigresult(&b);  /* close buffer */
   return 1;  /* read at least an `eol' */ 
 }
 
@@ -238,44 +351,138 @@ static int file_g_read( lua_State* L, int n, int16_t end_char )
 // file.read() will read all byte in file
 // file.read(10) will read 10 byte from file, or EOF is reached.
 // file.read('q') will read until 'q' or EOF is reached. 
+// fobj:read() does the same on a file object.
 static int file_read( lua_State* L )
 {
   unsigned need_len = LUAL_BUFFERSIZE;
   int16_t end_char = EOF;
   size_t el;
-  if( lua_type( L, 1 ) == LUA_TNUMBER )
+  int argpos;
+  int fd = file_get_fd(L, &argpos);
+  if( lua_type( L, argpos ) == LUA_TNUMBER )
   {
-    need_len = ( unsigned )luaL_checkinteger( L, 1 );
+    need_len = ( unsigned )luaL_checkinteger( L, argpos );
     if( need_len > LUAL_BUFFERSIZE ){
       need_len = LUAL_BUFFERSIZE;
     }
   }
-  else if(lua_isstring(L, 1))
+  else if(lua_isstring(L, argpos))
   {
-    const char *end = luaL_checklstring( L, 1, &el );
+    const char *end = luaL_checklstring( L, argpos, &el );
     if(el!=1){
       return luaL_error( L, "wrong arg range" );
     }
     end_char = (int16_t)end[0];
   }
 
-  return file_g_read(L, need_len, end_char);
+  return file_g_read(L, need_len, end_char, fd);
 }
 
 // Lua: readline()
+//      fobj:readline()
 static int file_readline( lua_State* L )
 {
-  return file_g_read(L, LUAL_BUFFERSIZE, '\n');
+  int argpos;
+  int fd = file_get_fd(L, &argpos);
+  return file_g_read(L, LUAL_BUFFERSIZE, '\n', fd);
+}
+
+// Lua: readblock(n)
+// file.readblock(4096) reads up to 4096 bytes from the file, not limited
+// by LUAL_BUFFERSIZE. Returns nil at EOF.
+// fobj:readblock(n) does the same on a file object.
+static int file_readblock( lua_State* L )
+{
+  int argpos;
+  int fd = file_get_fd(L, &argpos);
+  lua_Integer n = luaL_checkinteger( L, argpos );
+  size_t need_len, total = 0, rl;
+  luaL_BigBuffer b;
+  luaL_argcheck(L, n >= 0, argpos, "wrong arg range");
+  need_len = ( size_t )n;
+#if defined(BUILD_SPIFFS)
+  // no more room than the file has left, read in one go into the block
+  // that becomes the string
+  int left = fs_size(fd) - fs_tell(fd);
+  if( left >= 0 && need_len > (size_t)left )
+    need_len = left;
+#endif
+
+  luaL_bigbuffinit(L, &b, need_len);
+  while( total < need_len ){
+    size_t chunk = need_len - total;
+    rl = fs_read(fd, luaL_prepbigbuffer(&b, chunk), chunk);
+    if( (int)rl <= 0 )
+      break;
+    luaL_addbigsize(&b, rl);
+    total += rl;
+    if( rl < chunk )
+      break;
+  }
+  luaL_pushbigresult(&b);
+  if( total == 0 ){
+    lua_pop(L, 1);
+    lua_pushnil(L);
+  }
+  return 1;
+}
+
+// Lua: copy("src", "dst")
+// Copies src to dst in page sized chunks, returns the number of bytes
+// copied or nil on error.
+static int file_copy( lua_State* L )
+{
+  size_t len;
+  char buf[ FILE_COPY_CHUNK ];
+  int sfd, dfd;
+  size_t rl, total = 0;
+  int ok = 1;
+
+  const char *srcname = luaL_checklstring( L, 1, &len );
+  if( len > FS_NAME_MAX_LENGTH )
+    return luaL_error(L, "filename too long");
+  const char *dstname = luaL_checklstring( L, 2, &len );
+  if( len > FS_NAME_MAX_LENGTH )
+    return luaL_error(L, "filename too long");
+
+  sfd = fs_open(srcname, FS_RDONLY);
+  if(sfd < FS_OPEN_OK){
+    lua_pushnil(L);
+    return 1;
+  }
+  dfd = fs_open(dstname, FS_WRONLY | FS_CREAT | FS_TRUNC);
+  if(dfd < FS_OPEN_OK){
+    fs_close(sfd);
+    lua_pushnil(L);
+    return 1;
+  }
+
+  while( (rl = fs_read(sfd, buf, sizeof(buf))) > 0 ){
+    if( fs_write(dfd, buf, rl) != rl ){
+      ok = 0;
+      break;
+    }
+    total += rl;
+  }
+  fs_close(sfd);
+  fs_close(dfd);
+
+  if(ok)
+    lua_pushinteger(L, total);
+  else
+    lua_pushnil(L);
+  return 1;
 }
 
 // Lua: write("string")
+//      fobj:write("string")
 static int file_write( lua_State* L )
 {
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
+  int argpos;
+  int fd = file_get_fd(L, &argpos);
   size_t l, rl;
-  const char *s = luaL_checklstring(L, 1, &l);
-  rl = fs_write(file_fd, s, l);
+  const char *s = luaL_checklstring(L, argpos, &l);
+  rl = fs_write(fd, s, l);
   if(rl==l)
     lua_pushboolean(L, 1);
   else
@@ -284,15 +491,16 @@ static int file_write( lua_State* L )
 }
 
 // Lua: writeline("string")
+//      fobj:writeline("string")
 static int file_writeline( lua_State* L )
 {
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
+  int argpos;
+  int fd = file_get_fd(L, &argpos);
   size_t l, rl;
-  const char *s = luaL_checklstring(L, 1, &l);
-  rl = fs_write(file_fd, s, l);
+  const char *s = luaL_checklstring(L, argpos, &l);
+  rl = fs_write(fd, s, l);
   if(rl==l){
-    rl = fs_write(file_fd, "\n", 1);
+    rl = fs_write(fd, "\n", 1);
     if(rl==1)
       lua_pushboolean(L, 1);
     else
@@ -307,6 +515,26 @@ static int file_writeline( lua_State* L )
 // Module function map
 #define MIN_OPT_LEVEL 2
 #include "lrodefs.h"
+static const LUA_REG_TYPE file_obj_map[] =
+{
+  { LSTRKEY( "close" ), LFUNCVAL( file_close ) },
+  { LSTRKEY( "write" ), LFUNCVAL( file_write ) },
+  { LSTRKEY( "writeline" ), LFUNCVAL( file_writeline ) },
+  { LSTRKEY( "read" ), LFUNCVAL( file_read ) },
+  { LSTRKEY( "readline" ), LFUNCVAL( file_readline ) },
+  { LSTRKEY( "readblock" ), LFUNCVAL( file_readblock ) },
+#if defined(BUILD_WOFS)
+#elif defined(BUILD_SPIFFS)
+  { LSTRKEY( "seek" ), LFUNCVAL( file_seek ) },
+  { LSTRKEY( "flush" ), LFUNCVAL( file_flush ) },
+#endif
+  { LSTRKEY( "__gc" ), LFUNCVAL( file_obj_free ) },
+#if LUA_OPTIMIZE_MEMORY > 0
+  { LSTRKEY( "__index" ), LROVAL( file_obj_map ) },
+#endif
+  { LNILKEY, LNILVAL }
+};
+
 const LUA_REG_TYPE file_map[] = 
 {
   { LSTRKEY( "list" ), LFUNCVAL( file_list ) },
@@ -316,6 +544,8 @@ const LUA_REG_TYPE file_map[] =
   { LSTRKEY( "writeline" ), LFUNCVAL( file_writeline ) },
   { LSTRKEY( "read" ), LFUNCVAL( file_read ) },
   { LSTRKEY( "readline" ), LFUNCVAL( file_readline ) },
+  { LSTRKEY( "readblock" ), LFUNCVAL( file_readblock ) },
+  { LSTRKEY( "copy" ), LFUNCVAL( file_copy ) },
   { LSTRKEY( "format" ), LFUNCVAL( file_format ) },
 #if defined(BUILD_WOFS)
 #elif defined(BUILD_SPIFFS)
@@ -336,11 +566,22 @@ const LUA_REG_TYPE file_map[] =
 LUALIB_API int luaopen_file( lua_State *L )
 {
 #if LUA_OPTIMIZE_MEMORY > 0
+  luaL_rometatable(L, "file.obj", (void *)file_obj_map);  // create metatable for file.obj
   return 0;
 #else // #if LUA_OPTIMIZE_MEMORY > 0
   luaL_register( L, AUXLIB_FILE, file_map );
   // Add constants
 
+  // create metatable for file.obj
+  luaL_newmetatable(L, "file.obj");
+  // metatable.__index = metatable
+  lua_pushliteral(L, "__index");
+  lua_pushvalue(L,-2);
+  lua_rawset(L,-3);
+  // Setup the methods inside metatable
+  luaL_register( L, NULL, file_obj_map );
+  lua_pop(L, 1);
+
   return 1;
 #endif // #if LUA_OPTIMIZE_MEMORY > 0  
 }
@@ -1,5 +1,7 @@
 // Module for mqtt
 
+#define HEAP_TRACE_TAG HEAP_TAG_MQTT
+
 //#include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
@@ -12,12 +14,24 @@
 
 #include "c_types.h"
 #include "mem.h"
+#include "user_interface.h"
 #include "espconn.h"
 
 #include "mqtt_msg.h"
 #include "msg_queue.h"
+#include "flash_fs.h"
 
 #define MQTT_BUF_SIZE 1024
+#define MQTT_ACK_BUF_SIZE 16      // PUBACK/PUBREC/PUBREL/PUBCOMP/PINGRESP
+#define MQTT_ACK_QUEUE 8          // acks and PINGREQ waiting to be sent
+#define MQTT_WINDOW_MAX 64        // messages waiting for an answer at once, at most
+#define MQTT_FRAME_HEADER_SIZE 5  // type byte + up to 4 remaining length bytes
+#ifndef MQTT_QUEUE_SIZE
+#define MQTT_QUEUE_SIZE 2048      // outbound queue arena per client, fits one MQTT_BUF_SIZE message
+#endif
+#ifndef MQTT_RECV_MAX_SIZE
+#define MQTT_RECV_MAX_SIZE 4096   // largest packet reassembled from several segments, < 64k
+#endif
 #define MQTT_DEFAULT_KEEPALIVE 60
 #define MQTT_MAX_CLIENT_LEN   64
 #define MQTT_MAX_USER_LEN     64
@@ -50,7 +64,19 @@ typedef struct mqtt_state_t
   uint16_t message_length;
   uint16_t message_length_read;
   mqtt_connection_t mqtt_connection;
-  msg_queue_t* pending_msg_q;
+  msg_queue_t pending_msg_q;
+  uint8_t window;             // messages the queue may have waiting for an answer
+  uint8_t ack_head;           // oldest of the acks to send, apart from the queue
+  uint8_t ack_count;          // so that a queue full of publishes holds none back
+  uint8_t ack_sending;        // the one at ack_head is with espconn
+  uint8_t ack_type[MQTT_ACK_QUEUE];
+  uint16_t ack_id[MQTT_ACK_QUEUE];
+  uint8_t ack_buffer[MQTT_ACK_BUF_SIZE];
+  uint8_t* recv_buffer;       // packet split across tcp segments
+  uint16_t recv_length;       // bytes of it received so far
+  uint16_t recv_total;        // its full length, 0 until the fixed header is complete
+  uint32_t recv_skip;         // bytes left to drop of a packet over MQTT_RECV_MAX_SIZE
+  uint8_t recv_header[MQTT_FRAME_HEADER_SIZE];
 } mqtt_state_t;
 
 typedef struct lmqtt_userdata
@@ -66,6 +92,7 @@ typedef struct lmqtt_userdata
   mqtt_state_t  mqtt_state;
   mqtt_connect_info_t connect_info;
   uint16_t keep_alive_tick;
+  uint16_t retry_tick;  // seconds the messages sent have waited for an answer
   uint32_t event_timeout;
   uint8_t secure;
   bool connected;     // indicate socket connected, not mqtt prot connected.
@@ -77,6 +104,43 @@ static void socket_connect(struct espconn *pesp_conn);
 static void mqtt_socket_reconnected(void *arg, sint8_t err);
 static void mqtt_socket_connected(void *arg);
 
+static void mqtt_recv_reset(lmqtt_userdata *mud)
+{
+  if(mud->mqtt_state.recv_buffer)
+    c_free(mud->mqtt_state.recv_buffer);
+  mud->mqtt_state.recv_buffer = NULL;
+  mud->mqtt_state.recv_length = 0;
+  mud->mqtt_state.recv_total = 0;
+  mud->mqtt_state.recv_skip = 0;
+}
+
+// Queue the messages that wait for an answer again, publishes marked as
+// duplicates: the broker did not answer in time, or the connection is new.
+static void mqtt_resend(lmqtt_userdata *mud)
+{
+  msg_queue_t *q = &(mud->mqtt_state.pending_msg_q);
+  msg_node_t *node = NULL;
+  while((node = msg_next(q, node)) != NULL){
+    if(node->state != MSG_SENT)
+      continue;
+    if(node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos > 0)
+      node->msg.data[0] |= 0x08;   // DUP = 1
+    msg_set_state(q, node, MSG_QUEUED);
+  }
+  mud->retry_tick = 0;
+}
+
+// Nothing is in flight on a new connection. The acks belonged to the one
+// before, the queue is sent again once the broker has accepted this one.
+static void mqtt_send_reset(lmqtt_userdata *mud)
+{
+  mud->mqtt_state.ack_head = 0;
+  mud->mqtt_state.ack_count = 0;
+  mud->mqtt_state.ack_sending = 0;
+  msg_busy(&(mud->mqtt_state.pending_msg_q), NULL);
+  mqtt_resend(mud);
+}
+
 static void mqtt_socket_disconnected(void *arg)    // tcp only
 {
   NODE_DBG("enter mqtt_socket_disconnected.\n");
@@ -89,6 +153,8 @@ static void mqtt_socket_disconnected(void *arg)    // tcp only
     return;
 
   os_timer_disarm(&mud->mqttTimer);
+  mqtt_recv_reset(mud);
+  mqtt_send_reset(mud);
 
   if(mud->connected){     // call back only called when socket is from connection to disconnection.
     mud->connected = false;
@@ -195,32 +261,108 @@ static void deliver_publish(lmqtt_userdata * mud, uint8_t* message, int length)
   NODE_DBG("leave deliver_publish.\n");
 }
 
-static void mqtt_socket_received(void *arg, char *pdata, unsigned short len)
+// Queue an ack (PUBACK, PUBREC, PUBCOMP, PINGRESP) or a PINGREQ. They are
+// kept apart from the queue, which publishes may have filled up, and go out
+// before it. 0 if MQTT_ACK_QUEUE of them are waiting already.
+static int mqtt_queue_ack(lmqtt_userdata *mud, int msg_type, uint16_t msg_id)
 {
-  NODE_DBG("enter mqtt_socket_received.\n");
+  mqtt_state_t *st = &mud->mqtt_state;
+  int i;
+  if(st->ack_count == MQTT_ACK_QUEUE){
+    NODE_DBG("MQTT: no room for ack type %d\r\n", msg_type);
+    return 0;
+  }
+  i = (st->ack_head + st->ack_count++) % MQTT_ACK_QUEUE;
+  st->ack_type[i] = msg_type;
+  st->ack_id[i] = msg_id;
+  return 1;
+}
 
-  uint8_t msg_type;
-  uint8_t msg_qos;
+// Hand espconn the next message unless it is still sending one: the oldest
+// ack, else the oldest message queued, which has to wait if it needs an
+// answer and the window is full. What espconn refuses is tried again from
+// the sent callback or the timer.
+static void mqtt_send_next(lmqtt_userdata *mud)
+{
+  mqtt_state_t *st = &mud->mqtt_state;
+  msg_queue_t *q = &(st->pending_msg_q);
+  mqtt_message_t *msg;
+  msg_node_t *node = NULL;
   uint16_t msg_id;
-  msg_queue_t *node = NULL;
-  int length = (int)len;
-  // uint8_t in_buffer[MQTT_BUF_SIZE];
-  uint8_t *in_buffer = (uint8_t *)pdata;
+  sint8 r;
 
-  struct espconn *pesp_conn = arg;
-  if(pesp_conn == NULL)
+  if(!mud->connected || mud->pesp_conn == NULL || mud->connState != MQTT_DATA)
     return;
-  lmqtt_userdata *mud = (lmqtt_userdata *)pesp_conn->reverse;
-  if(mud == NULL)
+  if(st->ack_sending || q->busy)
     return;
+  if(st->ack_count > 0){
+    msg_id = st->ack_id[st->ack_head];
+    mqtt_msg_init(&st->mqtt_connection, st->ack_buffer, MQTT_ACK_BUF_SIZE);
+    switch(st->ack_type[st->ack_head]){
+      case MQTT_MSG_TYPE_PUBACK:
+        msg = mqtt_msg_puback(&st->mqtt_connection, msg_id);
+        break;
+      case MQTT_MSG_TYPE_PUBREC:
+        msg = mqtt_msg_pubrec(&st->mqtt_connection, msg_id);
+        break;
+      case MQTT_MSG_TYPE_PUBCOMP:
+        msg = mqtt_msg_pubcomp(&st->mqtt_connection, msg_id);
+        break;
+      case MQTT_MSG_TYPE_PINGREQ:
+        msg = mqtt_msg_pingreq(&st->mqtt_connection);
+        break;
+      default:
+        msg = mqtt_msg_pingresp(&st->mqtt_connection);
+        break;
+    }
+  } else {
+    while((node = msg_next(q, node)) != NULL && node->state != MSG_QUEUED)
+      ;
+    if(node == NULL)
+      return;
+    // a PUBREL is part of its publish, which the window counted already
+    if(((node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos > 0) ||
+        node->msg_type == MQTT_MSG_TYPE_SUBSCRIBE ||
+        node->msg_type == MQTT_MSG_TYPE_UNSUBSCRIBE) &&
+        msg_inflight(q) >= st->window)
+      return;
+    msg = &node->msg;
+  }
 
-READPACKET:
-  if(length > MQTT_BUF_SIZE || length <= 0)
-	  return;
+  if(mud->secure)
+    r = espconn_secure_sent(mud->pesp_conn, msg->data, msg->length);
+  else
+    r = espconn_sent(mud->pesp_conn, msg->data, msg->length);
+  if(r != ESPCONN_OK){
+    NODE_DBG("MQTT: send refused (%d), try again later\r\n", r);
+    return;
+  }
+  NODE_DBG("Sent: %d\n", msg->length);
+  if(node){
+    if(msg_inflight(q) == 0)
+      mud->retry_tick = 0;
+    msg_set_state(q, node, MSG_SENT);
+    msg_busy(q, node);
+  } else {
+    st->ack_sending = 1;
+  }
+  mud->event_timeout = MQTT_SEND_TIMEOUT;
+  mud->keep_alive_tick = 0;
+}
 
-  // c_memcpy(in_buffer, pdata, length);
-  uint8_t temp_buffer[MQTT_BUF_SIZE];
-  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_BUF_SIZE);
+// handle one complete mqtt packet
+static void mqtt_socket_packet(struct espconn *pesp_conn, lmqtt_userdata *mud, uint8_t *in_buffer, uint16_t length)
+{
+  NODE_DBG("enter mqtt_socket_packet.\n");
+
+  uint8_t msg_type;
+  uint8_t msg_qos;
+  uint16_t msg_id;
+  msg_node_t *node = NULL;
+  msg_queue_t *q = &(mud->mqtt_state.pending_msg_q);
+
+  uint8_t temp_buffer[MQTT_ACK_BUF_SIZE];
+  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_ACK_BUF_SIZE);
   mqtt_message_t *temp_msg = NULL;
   switch(mud->connState){
     case MQTT_CONNECT_SENDING:
@@ -235,6 +377,8 @@ READPACKET:
       } else {
         mud->connState = MQTT_DATA;
         NODE_DBG("MQTT: Connected\r\n");
+        // what was queued while there was no connection goes out now
+        mqtt_send_next(mud);
         if(mud->cb_connect_ref == LUA_NOREF)
           break;
         if(mud->self_ref == LUA_NOREF)
@@ -250,24 +394,26 @@ READPACKET:
 
     case MQTT_DATA:
       mud->mqtt_state.message_length_read = length;
-      mud->mqtt_state.message_length = mqtt_get_total_length(in_buffer, mud->mqtt_state.message_length_read);
+      mud->mqtt_state.message_length = length;
       msg_type = mqtt_get_type(in_buffer);
       msg_qos = mqtt_get_qos(in_buffer);
       msg_id = mqtt_get_id(in_buffer, mud->mqtt_state.message_length);
 
-      msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
-
-      NODE_DBG("MQTT_DATA: type: %d, qos: %d, msg_id: %d, pending_id: %d\r\n",
+      NODE_DBG("MQTT_DATA: type: %d, qos: %d, msg_id: %d, in flight: %d\r\n",
             msg_type,
             msg_qos,
             msg_id,
-            (pending_msg)?pending_msg->msg_id:0);
+            msg_inflight(q));
+      // answers are matched to the message by id, any of those in flight
       switch(msg_type)
       {
         case MQTT_MSG_TYPE_SUBACK:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_SUBSCRIBE && pending_msg->msg_id == msg_id){
+          node = msg_find(q, msg_id, MQTT_MSG_TYPE_SUBSCRIBE);
+          if(node){
             NODE_DBG("MQTT: Subscribe successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_set_state(q, node, MSG_DONE);
+            mud->retry_tick = 0;
+            mqtt_send_next(mud);
             if (mud->cb_suback_ref == LUA_NOREF)
               break;
             if (mud->self_ref == LUA_NOREF)
@@ -280,31 +426,31 @@ READPACKET:
           }
           break;
         case MQTT_MSG_TYPE_UNSUBACK:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_UNSUBSCRIBE && pending_msg->msg_id == msg_id){
+          node = msg_find(q, msg_id, MQTT_MSG_TYPE_UNSUBSCRIBE);
+          if(node){
             NODE_DBG("MQTT: UnSubscribe successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_set_state(q, node, MSG_DONE);
+            mud->retry_tick = 0;
           }
           break;
         case MQTT_MSG_TYPE_PUBLISH:
-          if(msg_qos == 1){
-            temp_msg = mqtt_msg_puback(&mud->mqtt_state.mqtt_connection, msg_id);
-            node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg, 
-                      msg_id, MQTT_MSG_TYPE_PUBACK, (int)mqtt_get_qos(temp_msg->data) );
-          }
-          else if(msg_qos == 2){
-            temp_msg = mqtt_msg_pubrec(&mud->mqtt_state.mqtt_connection, msg_id);
-            node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg, 
-                      msg_id, MQTT_MSG_TYPE_PUBREC, (int)mqtt_get_qos(temp_msg->data) );
-          }
           if(msg_qos == 1 || msg_qos == 2){
+            // Without room for the ack the message is not delivered either,
+            // the broker sends it again.
+            if(!mqtt_queue_ack(mud, msg_qos == 1 ? MQTT_MSG_TYPE_PUBACK : MQTT_MSG_TYPE_PUBREC, msg_id))
+              break;
             NODE_DBG("MQTT: Queue response QoS: %d\r\n", msg_qos);
+            mqtt_send_next(mud);
           }
           deliver_publish(mud, in_buffer, mud->mqtt_state.message_length);
           break;
         case MQTT_MSG_TYPE_PUBACK:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
+          node = msg_find(q, msg_id, MQTT_MSG_TYPE_PUBLISH);
+          if(node && node->publish_qos == 1){
             NODE_DBG("MQTT: Publish with QoS = 1 successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_set_state(q, node, MSG_DONE);
+            mud->retry_tick = 0;
+            mqtt_send_next(mud);
             if(mud->cb_puback_ref == LUA_NOREF)
               break;
             if(mud->self_ref == LUA_NOREF)
@@ -318,29 +464,31 @@ READPACKET:
 
           break;
         case MQTT_MSG_TYPE_PUBREC:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
-            NODE_DBG("MQTT: Publish  with QoS = 2 Received PUBREC\r\n"); 
-            // Note: actrually, should not destroy the msg until PUBCOMP is received.
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+          node = msg_find(q, msg_id, MQTT_MSG_TYPE_PUBLISH);
+          if(node && node->publish_qos == 2){
+            NODE_DBG("MQTT: Publish  with QoS = 2 Received PUBREC\r\n");
+            // the PUBREL takes the place of the publish, which is shorter
             temp_msg = mqtt_msg_pubrel(&mud->mqtt_state.mqtt_connection, msg_id);
-            node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg, 
-                      msg_id, MQTT_MSG_TYPE_PUBREL, (int)mqtt_get_qos(temp_msg->data) );
+            c_memcpy(node->msg.data, temp_msg->data, temp_msg->length);
+            node->msg.length = temp_msg->length;
+            node->msg_type = MQTT_MSG_TYPE_PUBREL;
+            msg_set_state(q, node, MSG_QUEUED);
+            mud->retry_tick = 0;
             NODE_DBG("MQTT: Response PUBREL\r\n");
           }
           break;
         case MQTT_MSG_TYPE_PUBREL:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBREC && pending_msg->msg_id == msg_id){
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-            temp_msg = mqtt_msg_pubcomp(&mud->mqtt_state.mqtt_connection, msg_id);
-            node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg, 
-                      msg_id, MQTT_MSG_TYPE_PUBCOMP, (int)mqtt_get_qos(temp_msg->data) );
+          // without room for the PUBCOMP the broker sends the PUBREL again
+          if(mqtt_queue_ack(mud, MQTT_MSG_TYPE_PUBCOMP, msg_id))
             NODE_DBG("MQTT: Response PUBCOMP\r\n");
-          }
           break;
         case MQTT_MSG_TYPE_PUBCOMP:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBREL && pending_msg->msg_id == msg_id){
+          node = msg_find(q, msg_id, MQTT_MSG_TYPE_PUBREL);
+          if(node){
             NODE_DBG("MQTT: Publish  with QoS = 2 successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_set_state(q, node, MSG_DONE);
+            mud->retry_tick = 0;
+            mqtt_send_next(mud);
             if(mud->cb_puback_ref == LUA_NOREF)
               break;
             if(mud->self_ref == LUA_NOREF)
@@ -353,9 +501,7 @@ READPACKET:
           }
           break;
         case MQTT_MSG_TYPE_PINGREQ:
-            temp_msg = mqtt_msg_pingresp(&mud->mqtt_state.mqtt_connection);
-            node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg, 
-                      msg_id, MQTT_MSG_TYPE_PINGRESP, (int)mqtt_get_qos(temp_msg->data) );
+          if(mqtt_queue_ack(mud, MQTT_MSG_TYPE_PINGRESP, 0))
             NODE_DBG("MQTT: Response PINGRESP\r\n");
           break;
         case MQTT_MSG_TYPE_PINGRESP:
@@ -363,37 +509,108 @@ READPACKET:
           NODE_DBG("MQTT: PINGRESP received\r\n");
           break;
       }
-      // NOTE: this is done down here and not in the switch case above
-      // because the PSOCK_READBUF_LEN() won't work inside a switch
-      // statement due to the way protothreads resume.
-      if(msg_type == MQTT_MSG_TYPE_PUBLISH)
-      {
+      mqtt_send_next(mud);
+      break;
+
+    case MQTT_INIT:
+      break;
+  }
+  NODE_DBG("leave mqtt_socket_packet.\n");
+}
 
-        length = mud->mqtt_state.message_length_read;
+// tcp may split a packet over several segments or coalesce several packets
+// into one. Complete packets are handled straight from pdata, the rest is
+// collected in recv_buffer until the remaining length has arrived.
+static void mqtt_socket_received(void *arg, char *pdata, unsigned short len)
+{
+  NODE_DBG("enter mqtt_socket_received.\n");
+
+  uint8_t *in_buffer = (uint8_t *)pdata;
+  int length = (int)len;
+  int total;
+  int n;
+
+  struct espconn *pesp_conn = arg;
+  if(pesp_conn == NULL)
+    return;
+  lmqtt_userdata *mud = (lmqtt_userdata *)pesp_conn->reverse;
+  if(mud == NULL)
+    return;
+  mqtt_state_t *st = &mud->mqtt_state;
+
+  while(length > 0){
+    if(st->recv_skip > 0){
+      n = (st->recv_skip < length) ? st->recv_skip : length;
+      st->recv_skip -= n;
+      in_buffer += n;
+      length -= n;
+      continue;
+    }
 
-        if(mud->mqtt_state.message_length < mud->mqtt_state.message_length_read)
-				{
-					length -= mud->mqtt_state.message_length;
-					in_buffer += mud->mqtt_state.message_length;
+    if(st->recv_length == 0){
+      total = mqtt_get_frame_length(in_buffer, length);
+      if(total > 0 && total <= length){
+        mqtt_socket_packet(pesp_conn, mud, in_buffer, total);
+        in_buffer += total;
+        length -= total;
+        continue;
+      }
+    }
 
-					NODE_DBG("Get another published message\r\n");
-					goto READPACKET;
-				}
+    if(st->recv_total == 0){
+      // fixed header split across segments, collect it byte by byte
+      st->recv_header[st->recv_length++] = *in_buffer++;
+      length--;
+      total = mqtt_get_frame_length(st->recv_header, st->recv_length);
+      if(total == 0)
+        continue;
+      if(total < 0){
+        NODE_DBG("MQTT: Invalid packet\r\n");
+        mqtt_recv_reset(mud);
+        if(mud->secure)
+          espconn_secure_disconnect(pesp_conn);
+        else
+          espconn_disconnect(pesp_conn);
+        return;
       }
-      break;
-  }
+      if(total > MQTT_RECV_MAX_SIZE){
+        NODE_ERR("MQTT: drop packet of %d bytes\n", total);
+        st->recv_skip = total - st->recv_length;
+        st->recv_length = 0;
+        continue;
+      }
+      st->recv_buffer = (uint8_t *)c_zalloc(total);
+      if(st->recv_buffer == NULL){
+        NODE_ERR("MQTT: no memory for packet of %d bytes\n", total);
+        st->recv_skip = total - st->recv_length;
+        st->recv_length = 0;
+        continue;
+      }
+      c_memcpy(st->recv_buffer, st->recv_header, st->recv_length);
+      st->recv_total = total;
+    }
 
-  if(node && (1==msg_size(&(mud->mqtt_state.pending_msg_q))) && mud->event_timeout == 0){
-    mud->event_timeout = MQTT_SEND_TIMEOUT;
-    NODE_DBG("Sent: %d\n", node->msg.length);
-    if( mud->secure )
-      espconn_secure_sent( pesp_conn, node->msg.data, node->msg.length );
-    else
-      espconn_sent( pesp_conn, node->msg.data, node->msg.length );
+    n = st->recv_total - st->recv_length;
+    if(n > length)
+      n = length;
+    c_memcpy(st->recv_buffer + st->recv_length, in_buffer, n);
+    st->recv_length += n;
+    in_buffer += n;
+    length -= n;
+
+    if(st->recv_length == st->recv_total){
+      uint8_t *packet = st->recv_buffer;
+      total = st->recv_total;
+      st->recv_buffer = NULL;
+      st->recv_length = 0;
+      st->recv_total = 0;
+      mqtt_socket_packet(pesp_conn, mud, packet, total);
+      c_free(packet);
+    }
   }
+
   NODE_DBG("receive, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
   NODE_DBG("leave mqtt_socket_received.\n");
-  return;
 }
 
 static void mqtt_socket_sent(void *arg)
@@ -417,27 +634,28 @@ static void mqtt_socket_sent(void *arg)
     return;
   }
   NODE_DBG("sent1, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
-  // qos = 0, publish and forgot.
-  msg_queue_t *node = msg_peek(&(mud->mqtt_state.pending_msg_q));
-  if(node && node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos == 0) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  	if(mud->cb_puback_ref == LUA_NOREF)
-			return;
-		if(mud->self_ref == LUA_NOREF)
-			return;
-    if(mud->L == NULL)
-      return;
-		lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
-		lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
-		lua_call(mud->L, 1, 0);
-  } else if(node && node->msg_type == MQTT_MSG_TYPE_PUBACK && node->publish_qos == 1) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  } else if(node && node->msg_type == MQTT_MSG_TYPE_PUBCOMP) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  } else if(node && node->msg_type == MQTT_MSG_TYPE_PINGREQ) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+  mqtt_state_t *st = &mud->mqtt_state;
+  msg_node_t *node = st->pending_msg_q.busy;
+  bool puback = false;
+  if(st->ack_sending){
+    st->ack_sending = 0;
+    st->ack_head = (st->ack_head + 1) % MQTT_ACK_QUEUE;
+    st->ack_count--;
+  } else if(node){
+    // qos = 0, publish and forgot.
+    if(node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos == 0 && node->state == MSG_SENT){
+      msg_set_state(&(st->pending_msg_q), node, MSG_DONE);
+      puback = true;
+    }
+    msg_busy(&(st->pending_msg_q), NULL);
   }
+  mqtt_send_next(mud);
   NODE_DBG("sent2, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
+  if(puback && mud->cb_puback_ref != LUA_NOREF && mud->self_ref != LUA_NOREF && mud->L != NULL){
+    lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
+    lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
+    lua_call(mud->L, 1, 0);
+  }
   NODE_DBG("leave mqtt_socket_sent.\n");
 }
 
@@ -451,6 +669,8 @@ static void mqtt_socket_connected(void *arg)
   if(mud == NULL)
     return;
   mud->connected = true;
+  mqtt_recv_reset(mud);
+  mqtt_send_reset(mud);
   espconn_regist_recvcb(pesp_conn, mqtt_socket_received);
   espconn_regist_sentcb(pesp_conn, mqtt_socket_sent);
   espconn_regist_disconcb(pesp_conn, mqtt_socket_disconnected);
@@ -494,10 +714,17 @@ void mqtt_socket_timer(void *arg)
       return;
     } else {
       NODE_DBG("event timeout. \n");
-      if(mud->connState == MQTT_DATA)
-        msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-      // should remove the head of the queue and re-send with DUP = 1
-      // Not implemented yet.
+      if(mud->connState == MQTT_DATA){
+        // espconn never called back, send the message again
+        msg_node_t *pending_msg = mud->mqtt_state.pending_msg_q.busy;
+        mud->mqtt_state.ack_sending = 0;
+        if(pending_msg && pending_msg->state == MSG_SENT){
+          if(pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->publish_qos > 0)
+            pending_msg->msg.data[0] |= 0x08;   // DUP = 1
+          msg_set_state(&(mud->mqtt_state.pending_msg_q), pending_msg, MSG_QUEUED);
+        }
+        msg_busy(&(mud->mqtt_state.pending_msg_q), NULL);
+      }
     }
   }
 
@@ -515,34 +742,19 @@ void mqtt_socket_timer(void *arg)
   } else if(mud->connState == MQTT_CONNECT_SENT){ // wait for CONACK time out.
     NODE_DBG("MQTT_CONNECT failed.\n");
   } else if(mud->connState == MQTT_DATA){
-    msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
-    if(pending_msg){
-      mud->event_timeout = MQTT_SEND_TIMEOUT;
-      if(mud->secure)
-        espconn_secure_sent(mud->pesp_conn, pending_msg->msg.data, pending_msg->msg.length);
-      else
-        espconn_sent(mud->pesp_conn, pending_msg->msg.data, pending_msg->msg.length);
-      mud->keep_alive_tick = 0;
-      NODE_DBG("id: %d - qos: %d, length: %d\n", pending_msg->msg_id, pending_msg->publish_qos, pending_msg->msg.length);
-    } else {
-      // no queued event.
-      mud->keep_alive_tick ++;
-      if(mud->keep_alive_tick > mud->mqtt_state.connect_info->keepalive){
-        mud->event_timeout = MQTT_SEND_TIMEOUT;
-        uint8_t temp_buffer[MQTT_BUF_SIZE];
-        mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_BUF_SIZE);
-        NODE_DBG("\r\nMQTT: Send keepalive packet\r\n");
-        mqtt_message_t* temp_msg = mqtt_msg_pingreq(&mud->mqtt_state.mqtt_connection);
-        msg_queue_t *node = msg_enqueue( &(mud->mqtt_state.pending_msg_q), temp_msg, 
-                            0, MQTT_MSG_TYPE_PINGREQ, (int)mqtt_get_qos(temp_msg->data) );
-        // only one message in queue, send immediately.
-        if(mud->secure)
-          espconn_secure_sent(mud->pesp_conn, temp_msg->data, temp_msg->length);
-        else
-          espconn_sent(mud->pesp_conn, temp_msg->data, temp_msg->length);
+    if(msg_inflight(&(mud->mqtt_state.pending_msg_q)) > 0 &&
+        ++mud->retry_tick >= MQTT_SEND_TIMEOUT){
+      NODE_DBG("no answer, send again\n");
+      mqtt_resend(mud);
+    }
+    mud->keep_alive_tick ++;
+    if(mud->keep_alive_tick > mud->mqtt_state.connect_info->keepalive){
+      NODE_DBG("\r\nMQTT: Send keepalive packet\r\n");
+      if(mqtt_queue_ack(mud, MQTT_MSG_TYPE_PINGREQ, 0))
         mud->keep_alive_tick = 0;
-      }
     }
+    // also what espconn refused before
+    mqtt_send_next(mud);
   }
   NODE_DBG("keep_alive_tick: %d\n", mud->keep_alive_tick);
   NODE_DBG("leave mqtt_socket_timer.\n");
@@ -582,6 +794,7 @@ static int mqtt_socket_client( lua_State* L )
   mud->secure = 0;
 
   mud->keep_alive_tick = 0;
+  mud->retry_tick = 0;
   mud->event_timeout = 0;
   mud->connState = MQTT_INIT;
   mud->connected = false;
@@ -661,7 +874,9 @@ static int mqtt_socket_client( lua_State* L )
   mud->connect_info.will_retain = 0;
   mud->connect_info.keepalive = keepalive;
 
-  mud->mqtt_state.pending_msg_q = NULL;
+  if(!msg_queue_init(&(mud->mqtt_state.pending_msg_q), MQTT_QUEUE_SIZE))
+    return luaL_error(L, "not enough memory");
+  mud->mqtt_state.window = 1;
   mud->mqtt_state.auto_reconnect = 0;
   mud->mqtt_state.port = 1883;
   mud->mqtt_state.connect_info = &mud->connect_info;
@@ -686,6 +901,8 @@ static int mqtt_delete( lua_State* L )
 
   os_timer_disarm(&mud->mqttTimer);
   mud->connected = false;
+  mqtt_recv_reset(mud);
+  msg_queue_free(&(mud->mqtt_state.pending_msg_q));
 
   // ---- alloc-ed in mqtt_socket_connect()
   if(mud->pesp_conn){     // for client connected to tcp server, this should set NULL in disconnect cb
@@ -777,7 +994,7 @@ static void socket_connect(struct espconn *pesp_conn)
 }
 
 static void socket_dns_found(const char *name, ip_addr_t *ipaddr, void *arg);
-static dns_reconn_count = 0;
+static int dns_reconn_count = 0;
 static ip_addr_t host_ip; // for dns
 static void socket_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
 {
@@ -823,8 +1040,8 @@ static int mqtt_socket_connect( lua_State* L )
   lmqtt_userdata *mud = NULL;
   unsigned port = 1883;
   size_t il;
-  ip_addr_t ipaddr;
-  const char *domain;
+  ip_addr_t ipaddr = { 0 };
+  const char *domain = NULL;
   int stack = 1;
   unsigned secure = 0, auto_reconnect = 0;
   int top = lua_gettop(L);
@@ -1125,21 +1342,15 @@ static int mqtt_socket_subscribe( lua_State* L ) {
     mud->cb_suback_ref = luaL_ref( L, LUA_REGISTRYINDEX );
   }
 
-  msg_queue_t *node = msg_enqueue( &(mud->mqtt_state.pending_msg_q), temp_msg, 
+  msg_node_t *node = msg_enqueue( &(mud->mqtt_state.pending_msg_q), temp_msg, 
                             msg_id, MQTT_MSG_TYPE_SUBSCRIBE, (int)mqtt_get_qos(temp_msg->data) );
 
-  NODE_DBG("topic: %s - id: %d - qos: %d, length: %d\n", topic, node->msg_id, node->publish_qos, node->msg.length);
-
-  if(node && (1==msg_size(&(mud->mqtt_state.pending_msg_q))) && mud->event_timeout == 0){
-  	mud->event_timeout = MQTT_SEND_TIMEOUT;
-  	NODE_DBG("Sent: %d\n", node->msg.length);
-  	if( mud->secure )
-  		espconn_secure_sent( mud->pesp_conn, node->msg.data, node->msg.length );
-  	else
-  		espconn_sent( mud->pesp_conn, node->msg.data, node->msg.length );
-    mud->keep_alive_tick = 0;
+  if(node){
+    NODE_DBG("topic: %s - id: %d - qos: %d, length: %d\n", topic, node->msg_id, node->publish_qos, node->msg.length);
   }
 
+  mqtt_send_next(mud);
+
   if(!node){
     lua_pushboolean(L, 0);
   } else {
@@ -1151,6 +1362,10 @@ static int mqtt_socket_subscribe( lua_State* L ) {
 }
 
 // Lua: bool = mqtt:publish( topic, payload, qos, retain, function() )
+// Messages are queued while the window is full. qos > 0 ones are also
+// queued while there is no connection and sent once the broker accepts the
+// next one. false means the queue (and spill file for qos > 0) is full, or
+// a qos 0 message found no connection.
 static int mqtt_socket_publish( lua_State* L )
 {
   NODE_DBG("enter mqtt_socket_publish.\n");
@@ -1159,6 +1374,7 @@ static int mqtt_socket_publish( lua_State* L )
   size_t l;
   uint8_t stack = 1;
   uint16_t msg_id = 0;
+  int queued = 0;
   mud = (lmqtt_userdata *)luaL_checkudata(L, stack, "mqtt.socket");
   luaL_argcheck(L, mud, stack, "mqtt.socket expected");
   stack++;
@@ -1168,18 +1384,6 @@ static int mqtt_socket_publish( lua_State* L )
     return 1;
   }
 
-  if(mud->pesp_conn == NULL){
-    NODE_DBG("mud->pesp_conn is NULL.\n");
-    lua_pushboolean(L, 0);
-    return 1;
-  }
-
-  if(!mud->connected){
-    luaL_error( L, "not connected" );
-    lua_pushboolean(L, 0);
-    return 1;
-  }
-
   const char *topic = luaL_checklstring( L, stack, &l );
   stack ++;
   if (topic == NULL){
@@ -1209,30 +1413,86 @@ static int mqtt_socket_publish( lua_State* L )
     mud->cb_puback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
-  msg_queue_t *node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg, 
+  if(qos == 0 && !mud->connected){
+    NODE_DBG("not connected, qos 0 message dropped.\n");
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+
+  // once qos > 0 messages overflowed to the spill file, the following
+  // ones go there too to keep them in order.
+  msg_node_t *node = NULL;
+  if(qos == 0 || msg_spilled(&(mud->mqtt_state.pending_msg_q)) == 0)
+    node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg, 
+                      msg_id, MQTT_MSG_TYPE_PUBLISH, (int)qos );
+  if(node)
+    queued = 1;
+  else if(qos > 0)
+    queued = msg_spill(&(mud->mqtt_state.pending_msg_q), temp_msg,
                       msg_id, MQTT_MSG_TYPE_PUBLISH, (int)qos );
 
-  if(node && (1==msg_size(&(mud->mqtt_state.pending_msg_q))) && mud->event_timeout == 0){
-    mud->event_timeout = MQTT_SEND_TIMEOUT;
-    NODE_DBG("Sent: %d\n", node->msg.length);
-    if( mud->secure )
-      espconn_secure_sent( mud->pesp_conn, node->msg.data, node->msg.length );
-    else
-      espconn_sent( mud->pesp_conn, node->msg.data, node->msg.length );
-    mud->keep_alive_tick = 0;
-  }
+  mqtt_send_next(mud);
 
-  if(!node){
-    lua_pushboolean(L, 0);
-  } else {
-    lua_pushboolean(L, 1);  // enqueued succeed.
-  }
+  lua_pushboolean(L, queued);
 
   NODE_DBG("publish, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
   NODE_DBG("leave mqtt_socket_publish.\n");
   return 1;
 }
 
+// Lua: count, spilled = mqtt:queued()
+static int mqtt_socket_queued( lua_State* L )
+{
+  lmqtt_userdata *mud = (lmqtt_userdata *)luaL_checkudata(L, 1, "mqtt.socket");
+  luaL_argcheck(L, mud, 1, "mqtt.socket expected");
+
+  lua_pushinteger(L, msg_size(&(mud->mqtt_state.pending_msg_q)));
+  lua_pushinteger(L, msg_spilled(&(mud->mqtt_state.pending_msg_q)));
+  return 2;
+}
+
+// Lua: previous = mqtt:window( [n] )
+// Up to n qos > 0 publishes and subscriptions wait for the broker's answer
+// at once, 1 unless set.
+static int mqtt_socket_window( lua_State* L )
+{
+  lmqtt_userdata *mud = (lmqtt_userdata *)luaL_checkudata(L, 1, "mqtt.socket");
+  luaL_argcheck(L, mud, 1, "mqtt.socket expected");
+  int window = mud->mqtt_state.window;
+
+  if(!lua_isnoneornil(L, 2)){
+    int n = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, n >= 1 && n <= MQTT_WINDOW_MAX, 2, "window out of range");
+    mud->mqtt_state.window = n;
+    mqtt_send_next(mud);
+  }
+  lua_pushinteger(L, window);
+  return 1;
+}
+
+// Lua: mqtt:spill( filename )
+// qos > 0 publishes that don't fit the queue are kept in filename and sent
+// once there is room again, also after a restart. mqtt:spill() stops it.
+static int mqtt_socket_spill( lua_State* L )
+{
+  size_t l;
+  lmqtt_userdata *mud = (lmqtt_userdata *)luaL_checkudata(L, 1, "mqtt.socket");
+  luaL_argcheck(L, mud, 1, "mqtt.socket expected");
+
+  if(lua_isnoneornil(L, 2)){
+    msg_spill_close(&(mud->mqtt_state.pending_msg_q));
+    return 0;
+  }
+  const char *fname = luaL_checklstring( L, 2, &l );
+  luaL_argcheck(L, l>0 && l<=FS_NAME_MAX_LENGTH && c_strlen(fname)==l, 2, "filename invalid");
+  if(!msg_spill_open(&(mud->mqtt_state.pending_msg_q), fname))
+    return luaL_error( L, "can not spill to %s", fname );
+  // messages from before a restart keep their ids, new ones start past them
+  if(mud->mqtt_state.mqtt_connection.message_id < msg_spill_max_id(&(mud->mqtt_state.pending_msg_q)))
+    mud->mqtt_state.mqtt_connection.message_id = msg_spill_max_id(&(mud->mqtt_state.pending_msg_q));
+  return 0;
+}
+
 // Lua: mqtt:lwt( topic, message, qos, retain, function(client) )
 static int mqtt_socket_lwt( lua_State* L )
 {
@@ -1323,6 +1583,9 @@ static const LUA_REG_TYPE mqtt_socket_map[] =
   { LSTRKEY( "subscribe" ), LFUNCVAL ( mqtt_socket_subscribe ) },
   { LSTRKEY( "lwt" ), LFUNCVAL ( mqtt_socket_lwt ) },
   { LSTRKEY( "on" ), LFUNCVAL ( mqtt_socket_on ) },
+  { LSTRKEY( "queued" ), LFUNCVAL ( mqtt_socket_queued ) },
+  { LSTRKEY( "window" ), LFUNCVAL ( mqtt_socket_window ) },
+  { LSTRKEY( "spill" ), LFUNCVAL ( mqtt_socket_spill ) },
   { LSTRKEY( "__gc" ), LFUNCVAL ( mqtt_delete ) },
 #if LUA_OPTIMIZE_MEMORY > 0
   { LSTRKEY( "__index" ), LROVAL ( mqtt_socket_map ) },
@@ -1,5 +1,7 @@
 // Module for network
 
+#define HEAP_TRACE_TAG HEAP_TAG_NET
+
 //#include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
@@ -25,6 +27,11 @@ unsigned int default_private_key_len = 0;
 #define TCP ESPCONN_TCP
 #define UDP ESPCONN_UDP
 
+// Largest payload handed to espconn_sent in one go
+#define NET_SEND_MSS 1460
+// Wait before handing a segment espconn refused to it again
+#define NET_SEND_RETRY_MS 100
+
 static ip_addr_t host_ip; // for dns
 
 #if 0
@@ -41,6 +48,17 @@ static uint16_t tcp_server_timeover = 30;
 static struct espconn *pTcpServer = NULL;
 static struct espconn *pUdpServer = NULL;
 
+// A string queued by socket:send(). The Lua string is kept alive by a
+// registry ref and segments are sent straight from its storage.
+typedef struct lnet_sendbuf
+{
+  struct lnet_sendbuf *next;
+  int str_ref;
+  const char *data;
+  size_t len;
+  size_t offset;    // bytes already sent
+}lnet_sendbuf;
+
 typedef struct lnet_userdata
 {
   struct espconn *pesp_conn;
@@ -54,8 +72,96 @@ typedef struct lnet_userdata
 #ifdef CLIENT_SSL_ENABLE
   uint8_t secure;
 #endif
+  lnet_sendbuf *send_head;
+  lnet_sendbuf *send_tail;
+  size_t send_queued;     // bytes queued, including the segment in flight
+  size_t send_inflight;   // length of the segment handed to espconn, 0 if none
+  ETSTimer send_timer;    // retries a segment espconn refused
+  uint8_t send_retry;     // send_timer is armed
 }lnet_userdata;
 
+static void net_send_next(lnet_userdata *nud);
+
+static void net_send_retry(void *arg)
+{
+  lnet_userdata *nud = (lnet_userdata *)arg;
+  nud->send_retry = 0;
+  net_send_next(nud);
+}
+
+// Hand the next segment of the send queue to espconn
+static void net_send_next(lnet_userdata *nud)
+{
+  lnet_sendbuf *sb = nud->send_head;
+  if(sb == NULL || nud->send_inflight || nud->pesp_conn == NULL)
+    return;
+  size_t seg = sb->len - sb->offset;
+  if(seg > NET_SEND_MSS)
+    seg = NET_SEND_MSS;
+  nud->send_inflight = seg;
+  sint8_t res;
+#ifdef CLIENT_SSL_ENABLE
+  if(nud->secure)
+    res = espconn_secure_sent(nud->pesp_conn, (unsigned char *)sb->data + sb->offset, seg);
+  else
+#endif
+    res = espconn_sent(nud->pesp_conn, (unsigned char *)sb->data + sb->offset, seg);
+  if(res != 0){
+    NODE_DBG("espconn_sent failed: %d\n", res);
+    nud->send_inflight = 0;
+    // no sent callback will come to move the queue on, so a timer does
+    if(!nud->send_retry){
+      nud->send_retry = 1;
+      os_timer_disarm(&nud->send_timer);
+      os_timer_setfn(&nud->send_timer, (os_timer_func_t *)net_send_retry, nud);
+      os_timer_arm(&nud->send_timer, NET_SEND_RETRY_MS, 0);
+    }
+  }
+}
+
+// Drop everything still queued, releasing the strings
+static void net_send_clear(lua_State *L, lnet_userdata *nud)
+{
+  lnet_sendbuf *sb = nud->send_head;
+  while(sb){
+    lnet_sendbuf *next = sb->next;
+    luaL_unref(L, LUA_REGISTRYINDEX, sb->str_ref);
+    c_free(sb);
+    sb = next;
+  }
+  nud->send_head = nud->send_tail = NULL;
+  nud->send_queued = 0;
+  nud->send_inflight = 0;
+  if(nud->send_retry){
+    os_timer_disarm(&nud->send_timer);
+    nud->send_retry = 0;
+  }
+}
+
+// Append the string at stack index idx to the send queue
+static void net_send_enqueue(lua_State *L, lnet_userdata *nud, int idx)
+{
+  size_t l;
+  const char *payload = luaL_checklstring(L, idx, &l);
+  if(l == 0)
+    return;
+  lnet_sendbuf *sb = (lnet_sendbuf *)c_zalloc(sizeof(lnet_sendbuf));
+  if(sb == NULL){
+    luaL_error(L, "not enough memory");
+    return;
+  }
+  lua_pushvalue(L, idx);
+  sb->str_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  sb->data = payload;
+  sb->len = l;
+  if(nud->send_tail)
+    nud->send_tail->next = sb;
+  else
+    nud->send_head = sb;
+  nud->send_tail = sb;
+  nud->send_queued += l;
+}
+
 static void net_server_disconnected(void *arg)    // for tcp server only
 {
   NODE_DBG("net_server_disconnected is called.\n");
@@ -82,6 +188,7 @@ static void net_server_disconnected(void *arg)    // for tcp server only
     lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);  // pass the userdata(client) to callback func in lua
     lua_call(gL, 1, 0);
   }
+  net_send_clear(gL, nud);
   int i;
   lua_gc(gL, LUA_GCSTOP, 0);
   for(i=0;i<MAX_SOCKET;i++){
@@ -114,6 +221,7 @@ static void net_socket_disconnected(void *arg)    // tcp only
     lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);  // pass the userdata(client) to callback func in lua
     lua_call(gL, 1, 0);
   }
+  net_send_clear(gL, nud);
 
   if(pesp_conn->proto.tcp)
     c_free(pesp_conn->proto.tcp);
@@ -174,6 +282,23 @@ static void net_socket_sent(void *arg)
   lnet_userdata *nud = (lnet_userdata *)pesp_conn->reverse;
   if(nud == NULL)
     return;
+  if(nud->send_head && nud->send_inflight){
+    lnet_sendbuf *sb = nud->send_head;
+    sb->offset += nud->send_inflight;
+    nud->send_queued -= nud->send_inflight;
+    nud->send_inflight = 0;
+    if(sb->offset >= sb->len){
+      nud->send_head = sb->next;
+      if(nud->send_head == NULL)
+        nud->send_tail = NULL;
+      luaL_unref(gL, LUA_REGISTRYINDEX, sb->str_ref);
+      c_free(sb);
+    }
+  }
+  if(nud->send_head){   // more to go, the sent callback fires once drained
+    net_send_next(nud);
+    return;
+  }
   if(nud->cb_send_ref == LUA_NOREF)
     return;
   if(nud->self_ref == LUA_NOREF)
@@ -327,6 +452,9 @@ static void net_server_connected(void *arg) // for tcp only
 #ifdef CLIENT_SSL_ENABLE
   skt->secure = 0;    // as a server SSL is not supported.
 #endif
+  skt->send_head = skt->send_tail = NULL;
+  skt->send_queued = skt->send_inflight = 0;
+  skt->send_retry = 0;
 
   skt->pesp_conn = pesp_conn;   // point to the espconn made by low level sdk
   pesp_conn->reverse = skt;   // let espcon carray the info of this userdata(net.socket)
@@ -433,6 +561,9 @@ static int net_create( lua_State* L, const char* mt )
 #ifdef CLIENT_SSL_ENABLE
   nud->secure = secure;
 #endif
+  nud->send_head = nud->send_tail = NULL;
+  nud->send_queued = nud->send_inflight = 0;
+  nud->send_retry = 0;
 
   // set its metatable
   luaL_getmetatable(L, mt);
@@ -550,6 +681,8 @@ static int net_delete( lua_State* L, const char* mt )
     nud->pesp_conn = NULL;    // for socket, it will free this when disconnected
   }
 
+  net_send_clear(L, nud);
+
   // free (unref) callback ref
   if(LUA_NOREF!=nud->cb_connect_ref){
     luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_connect_ref);
@@ -1066,16 +1199,42 @@ static int net_send( lua_State* L, const char* mt )
   NODE_DBG(" sending data.\n");
 #endif
 
-  const char *payload = luaL_checklstring( L, 2, &l );
-  if (l>1460 || payload == NULL)
-    return luaL_error( L, "need <1460 payload" );
-
   if (lua_type(L, 3) == LUA_TFUNCTION || lua_type(L, 3) == LUA_TLIGHTFUNCTION){
     lua_pushvalue(L, 3);  // copy argument (func) to the top of stack
     if(nud->cb_send_ref != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_send_ref);
     nud->cb_send_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
+
+  if(pesp_conn->type == ESPCONN_TCP){
+    // tcp sockets queue any amount of data, as a string or a list of
+    // strings, and send it in NET_SEND_MSS segments
+    if(lua_istable(L, 2)){
+      int i, n = lua_objlen(L, 2);
+      // nothing is queued unless all of it can be
+      for(i = 1; i <= n; i++){
+        lua_rawgeti(L, 2, i);
+        if(!lua_isstring(L, -1))
+          return luaL_argerror(L, 2, "list of strings expected");
+        lua_pop(L, 1);
+      }
+      for(i = 1; i <= n; i++){
+        lua_rawgeti(L, 2, i);
+        net_send_enqueue(L, nud, lua_gettop(L));
+        lua_pop(L, 1);
+      }
+    } else {
+      net_send_enqueue(L, nud, 2);
+    }
+    net_send_next(nud);
+    lua_pushinteger(L, nud->send_queued);
+    return 1;
+  }
+
+  const char *payload = luaL_checklstring( L, 2, &l );
+  if (l>NET_SEND_MSS || payload == NULL)
+    return luaL_error( L, "need <1460 payload" );
+
 #ifdef CLIENT_SSL_ENABLE
   if(nud->secure)
     espconn_secure_sent(pesp_conn, (unsigned char *)payload, l);
@@ -1086,6 +1245,16 @@ static int net_send( lua_State* L, const char* mt )
   return 0;  
 }
 
+// Lua: socket:queued()
+// Returns the number of bytes queued by send() and not yet acknowledged
+static int net_socket_queued( lua_State* L )
+{
+  lnet_userdata *nud = (lnet_userdata *)luaL_checkudata(L, 1, "net.socket");
+  luaL_argcheck(L, nud, 1, "Server/Socket expected");
+  lua_pushinteger(L, nud->send_queued);
+  return 1;
+}
+
 // Lua: socket:dns( string, function(socket, ip) )
 static int net_dns( lua_State* L, const char* mt )
 {
@@ -1464,6 +1633,21 @@ static int net_getdnsserver( lua_State* L )
   return 1;
 }
 
+#ifdef CLIENT_SSL_ENABLE
+// Lua: net.tls.setmfl(size), size 512, 1024, 2048 or 4096 for the maximum
+// fragment length the next secure connections ask the server for, which
+// their record buffers are sized to; nil or 0 not to ask
+static int net_tls_setmfl( lua_State* L )
+{
+  int size = luaL_optint( L, 1, 0 );
+
+  if (size < 0 || size > 0xffff || espconn_secure_set_size( size ) != ESPCONN_OK)
+    return luaL_error( L, "fragment length must be 512, 1024, 2048 or 4096" );
+
+  return 0;
+}
+#endif
+
 #if 0
 static int net_array_index( lua_State* L )
 {
@@ -1515,6 +1699,7 @@ static const LUA_REG_TYPE net_socket_map[] =
   { LSTRKEY( "close" ), LFUNCVAL ( net_socket_close ) },
   { LSTRKEY( "on" ), LFUNCVAL ( net_socket_on ) },
   { LSTRKEY( "send" ), LFUNCVAL ( net_socket_send ) },
+  { LSTRKEY( "queued" ), LFUNCVAL ( net_socket_queued ) },
   { LSTRKEY( "hold" ), LFUNCVAL ( net_socket_hold ) },
   { LSTRKEY( "unhold" ), LFUNCVAL ( net_socket_unhold ) },
   { LSTRKEY( "dns" ), LFUNCVAL ( net_socket_dns ) },
@@ -1543,6 +1728,14 @@ static const LUA_REG_TYPE net_dns_map[] =
   { LNILKEY, LNILVAL }
 };
 
+#ifdef CLIENT_SSL_ENABLE
+static const LUA_REG_TYPE net_tls_map[] =
+{
+  { LSTRKEY( "setmfl" ), LFUNCVAL ( net_tls_setmfl ) },
+  { LNILKEY, LNILVAL }
+};
+#endif
+
 const LUA_REG_TYPE net_map[] = 
 {
   { LSTRKEY( "createServer" ), LFUNCVAL ( net_createServer ) },
@@ -1551,6 +1744,9 @@ const LUA_REG_TYPE net_map[] =
   { LSTRKEY( "multicastLeave"), LFUNCVAL( net_multicastLeave ) },
 #if LUA_OPTIMIZE_MEMORY > 0
   { LSTRKEY( "dns" ), LROVAL( net_dns_map ) },
+#ifdef CLIENT_SSL_ENABLE
+  { LSTRKEY( "tls" ), LROVAL( net_tls_map ) },
+#endif
   { LSTRKEY( "TCP" ), LNUMVAL( TCP ) },
   { LSTRKEY( "UDP" ), LNUMVAL( UDP ) },
 
@@ -1619,6 +1815,13 @@ LUALIB_API int luaopen_net( lua_State *L )
   luaL_register( L, NULL, net_dns_map );
   lua_setfield( L, -2, "dns" );
 
+#ifdef CLIENT_SSL_ENABLE
+  lua_settop(L, n);
+  lua_newtable( L );
+  luaL_register( L, NULL, net_tls_map );
+  lua_setfield( L, -2, "tls" );
+#endif
+
   return 1;
 #endif // #if LUA_OPTIMIZE_MEMORY > 0  
 }
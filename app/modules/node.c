@@ -4,11 +4,17 @@
 #include "lauxlib.h"
 
 #include "ldo.h"
+#include "legc.h"
+#include "lflash.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lprofile.h"
+#include "lstate.h"
 #include "lstring.h"
+#include "ltm.h"
 #include "lundump.h"
 
 #include "platform.h"
@@ -24,6 +30,7 @@
 #include "flash_api.h"
 #include "flash_fs.h"
 #include "user_version.h"
+#include "c_heaptrace.h"
 
 #define CPU80MHZ 80
 #define CPU160MHZ 160
@@ -396,6 +403,200 @@ static int node_compile( lua_State* L )
   return 0;
 }
 
+// Lua: flashreload(filename) -- load a Lua image built by luac.cross -f into
+// flash on the next restart, restarts at once
+static int node_flashreload( lua_State* L )
+{
+  const char *fname = luaL_checkstring( L, 1 );
+  const char *err = luaN_reload( fname );
+  if ( err )
+    return luaL_error( L, "%s", err );
+  system_restart();
+  return 0;
+}
+
+// Lua: func = flashindex([module]) -- main function of the flash image or of
+// one of its modules, nil if none
+static int node_flashindex( lua_State* L )
+{
+  size_t l;
+  const char *name = luaL_optlstring( L, 1, NULL, &l );
+  if ( name )
+    luaN_pushmodule( L, name, l );
+  else
+    luaN_pushmain( L );
+  return 1;
+}
+
+#ifdef LUA_PROFILE
+static int profile_tobuffer( lua_State* L, const void* p, size_t size, void* b )
+{
+  UNUSED(L);
+  luaL_addlstring( (luaL_Buffer *)b, (const char *)p, size );
+  return 0;
+}
+
+// Lua: profile("start"[, period_us]) -- count from now on, sample stacks every
+//        period_us (1000 by default)
+//      profile("stop")
+//      profile("free") -- release what the profiler holds
+//      t = profile("opcodes") -- instructions executed by opcode name
+//      t = profile("functions") -- instructions by function, "source:line"
+//      s = profile("stacks"[, filename]) -- folded stacks for flamegraph.pl,
+//        written to filename if given
+static int node_profile( lua_State* L )
+{
+  static const char *const opts[] = { "start", "stop", "free", "opcodes",
+                                      "functions", "stacks", NULL };
+  switch ( luaL_checkoption( L, 1, NULL, opts ) )
+  {
+    case 0:
+      lprofile_start( L, luaL_optinteger( L, 2, 0 ) );
+      return 0;
+    case 1:
+      lprofile_stop( L );
+      return 0;
+    case 2:
+      lprofile_free( L );
+      return 0;
+    case 3:
+      return lprofile_pushopcodes( L );
+    case 4:
+      return lprofile_pushfunctions( L );
+    default:
+      break;
+  }
+  if ( lua_isstring( L, 2 ) )
+  {
+    int file_fd = fs_open( lua_tostring( L, 2 ), fs_mode2flag( "w" ) );
+    int result;
+    if ( file_fd < FS_OPEN_OK )
+      return luaL_error( L, "cannot open/write to file" );
+    result = lprofile_dumpstacks( L, writer, &file_fd );
+    fs_close( file_fd );
+    if ( result )
+      return luaL_error( L, "cannot write to file" );
+    return 0;
+  }
+  else
+  {
+    luaL_Buffer b;
+    luaL_buffinit( L, &b );
+    lprofile_dumpstacks( L, profile_tobuffer, &b );
+    luaL_pushresult( &b );
+    return 1;
+  }
+}
+#endif
+
+// Lua: t = memstat() -- the heap: t.heap free, t.lua held by Lua, and the
+//        objects and bytes of Lua objects by type, in t.objects and t.bytes
+//      With LUA_POOL t.pool = { slabs, bytes, used, missed }: the slabs of
+//        small objects, their bytes, the bytes of the objects in them and
+//        the small objects that had to come from the heap
+//      With HEAP_TRACE also t.peak and t.failed of the traced heap,
+//        t.tags[subsystem] = { bytes, peak, blocks, allocs }, and the blocks
+//        in use and allocated by size, in t.sizes and t.allocs
+static int node_memstat( lua_State* L )
+{
+  lu_mem count[ LUA_TUPVAL + 1 ], bytes[ LUA_TUPVAL + 1 ];
+  int i;
+  luaC_census( L, count, bytes );
+  lua_createtable( L, 0, 10 );
+  lua_pushinteger( L, system_get_free_heap_size() );
+  lua_setfield( L, -2, "heap" );
+  lua_pushinteger( L, G(L)->totalbytes );
+  lua_setfield( L, -2, "lua" );
+  lua_newtable( L );
+  lua_newtable( L );
+  for ( i = LUA_TSTRING; i <= LUA_TUPVAL; i++ )
+  {
+    lua_pushinteger( L, count[i] );
+    lua_setfield( L, -3, luaT_typenames[i] );
+    lua_pushinteger( L, bytes[i] );
+    lua_setfield( L, -2, luaT_typenames[i] );
+  }
+  lua_setfield( L, -3, "bytes" );
+  lua_setfield( L, -2, "objects" );
+#ifdef LUA_POOL
+  lua_createtable( L, 0, 4 );
+  lua_pushinteger( L, G(L)->pool.nslab );
+  lua_setfield( L, -2, "slabs" );
+  lua_pushinteger( L, G(L)->pool.nslab * POOL_SLAB );
+  lua_setfield( L, -2, "bytes" );
+  lua_pushinteger( L, G(L)->pool.used );
+  lua_setfield( L, -2, "used" );
+  lua_pushinteger( L, G(L)->pool.missed );
+  lua_setfield( L, -2, "missed" );
+  lua_setfield( L, -2, "pool" );
+#endif
+#ifdef HEAP_TRACE
+  lua_pushinteger( L, c_heap.peak );
+  lua_setfield( L, -2, "peak" );
+  lua_pushinteger( L, c_heap.failed );
+  lua_setfield( L, -2, "failed" );
+  lua_createtable( L, 0, HEAP_TAGS );
+  for ( i = 0; i < HEAP_TAGS; i++ )
+  {
+    const c_heap_tagstats *t = &c_heap.tag[i];
+    lua_createtable( L, 0, 4 );
+    lua_pushinteger( L, t->bytes );
+    lua_setfield( L, -2, "bytes" );
+    lua_pushinteger( L, t->peak );
+    lua_setfield( L, -2, "peak" );
+    lua_pushinteger( L, t->blocks );
+    lua_setfield( L, -2, "blocks" );
+    lua_pushinteger( L, t->allocs );
+    lua_setfield( L, -2, "allocs" );
+    lua_setfield( L, -2, c_heap_tagnames[i] );
+  }
+  lua_setfield( L, -2, "tags" );
+  lua_createtable( L, HEAP_CLASSES, 1 );
+  lua_createtable( L, HEAP_CLASSES, 1 );
+  for ( i = 0; i < HEAP_CLASSES; i++ )
+  {
+    // keyed by the largest size of the class, the last by "larger"
+    if ( i < HEAP_CLASSES - 1 )
+      lua_pushinteger( L, HEAP_CLASS_MIN << i );
+    else
+      lua_pushliteral( L, "larger" );
+    lua_pushvalue( L, -1 );
+    lua_pushinteger( L, c_heap.live[i] );
+    lua_rawset( L, -5 );
+    lua_pushinteger( L, c_heap.allocs[i] );
+    lua_rawset( L, -3 );
+  }
+  lua_setfield( L, -3, "allocs" );
+  lua_setfield( L, -2, "sizes" );
+#endif
+  return 1;
+}
+
+// Lua: egc_setmode(mode[, limit]) -- mode EGC_NOT_ACTIVE, EGC_ON_ALLOC_FAILURE,
+//        EGC_ON_MEM_LIMIT, EGC_ALWAYS or EGC_ADAPTIVE, or a sum of them; limit
+//        is the memory limit of EGC_ON_MEM_LIMIT, or the free heap
+//        EGC_ADAPTIVE keeps (4096 by default)
+static int node_egc_setmode( lua_State* L )
+{
+  unsigned mode = luaL_checkinteger( L, 1 );
+  unsigned limit = luaL_optinteger( L, 2, 0 );
+  luaL_argcheck( L, mode <= ( EGC_ON_ALLOC_FAILURE | EGC_ON_MEM_LIMIT |
+                              EGC_ALWAYS | EGC_ADAPTIVE ), 1, "invalid mode" );
+  legc_set_mode( L, mode, limit );
+  return 0;
+}
+
+// Lua: t = egc_stats() -- t.mode; t.target, the free heap EGC_ADAPTIVE
+//        keeps; t.compact, the allocations it still runs a full collection
+//        before; t.rate, the bytes allocated while a GC cycle runs; t.allocated,
+//        t.cycles, t.steps run ahead of the collector, t.fullgcs run by the
+//        EGC, t.failures of allocation and of those t.fragmented, with
+//        enough heap free
+static int node_egc_stats( lua_State* L )
+{
+  return legc_pushstats( L );
+}
+
 // Lua: setcpufreq(mhz)
 // mhz is either CPU80MHZ od CPU160MHZ
 static int node_setcpufreq(lua_State* L)
@@ -433,6 +634,9 @@ const LUA_REG_TYPE node_map[] =
   { LSTRKEY( "flashid" ), LFUNCVAL( node_flashid ) },
   { LSTRKEY( "flashsize" ), LFUNCVAL( node_flashsize) },
   { LSTRKEY( "heap" ), LFUNCVAL( node_heap ) },
+  { LSTRKEY( "memstat" ), LFUNCVAL( node_memstat ) },
+  { LSTRKEY( "egc_setmode" ), LFUNCVAL( node_egc_setmode ) },
+  { LSTRKEY( "egc_stats" ), LFUNCVAL( node_egc_stats ) },
 #ifdef DEVKIT_VERSION_0_9
   { LSTRKEY( "key" ), LFUNCVAL( node_key ) },
   { LSTRKEY( "led" ), LFUNCVAL( node_led ) },
@@ -442,8 +646,18 @@ const LUA_REG_TYPE node_map[] =
 // Moved to adc module, use adc.readvdd33()  
 // { LSTRKEY( "readvdd33" ), LFUNCVAL( node_readvdd33) },
   { LSTRKEY( "compile" ), LFUNCVAL( node_compile) },
+  { LSTRKEY( "flashreload" ), LFUNCVAL( node_flashreload) },
+  { LSTRKEY( "flashindex" ), LFUNCVAL( node_flashindex) },
+#ifdef LUA_PROFILE
+  { LSTRKEY( "profile" ), LFUNCVAL( node_profile ) },
+#endif
   { LSTRKEY( "CPU80MHZ" ), LNUMVAL( CPU80MHZ ) },
   { LSTRKEY( "CPU160MHZ" ), LNUMVAL( CPU160MHZ ) },
+  { LSTRKEY( "EGC_NOT_ACTIVE" ), LNUMVAL( EGC_NOT_ACTIVE ) },
+  { LSTRKEY( "EGC_ON_ALLOC_FAILURE" ), LNUMVAL( EGC_ON_ALLOC_FAILURE ) },
+  { LSTRKEY( "EGC_ON_MEM_LIMIT" ), LNUMVAL( EGC_ON_MEM_LIMIT ) },
+  { LSTRKEY( "EGC_ALWAYS" ), LNUMVAL( EGC_ALWAYS ) },
+  { LSTRKEY( "EGC_ADAPTIVE" ), LNUMVAL( EGC_ADAPTIVE ) },
   { LSTRKEY( "setcpufreq" ), LFUNCVAL( node_setcpufreq) },
   { LSTRKEY( "bootreason" ), LFUNCVAL( node_bootreason) },
 // Combined to dsleep(us, option)
@@ -121,7 +121,8 @@ static mqtt_message_t* fini_message(mqtt_connection_t* connection, int type, int
 
 void mqtt_msg_init(mqtt_connection_t* connection, uint8_t* buffer, uint16_t buffer_length)
 {
-  c_memset(connection, 0, sizeof(connection));
+  // message_id goes on from one message to the next
+  c_memset(&connection->message, 0, sizeof(connection->message));
   connection->buffer = buffer;
   connection->buffer_length = buffer_length;
 }
@@ -145,6 +146,22 @@ int mqtt_get_total_length(uint8_t* buffer, uint16_t length)
   return totlen;
 }
 
+int mqtt_get_frame_length(uint8_t* buffer, uint16_t length)
+{
+  int i;
+
+  // the remaining length field is at most 4 bytes long
+  for(i = 1; i < length && i <= 4; ++i)
+  {
+    if((buffer[i] & 0x80) == 0)
+      return mqtt_get_total_length(buffer, i + 1);
+  }
+  if(i > 4)
+    return -1;
+
+  return 0;
+}
+
 const char* mqtt_get_publish_topic(uint8_t* buffer, uint16_t* length)
 {
   int i;
@@ -43,7 +43,7 @@ extern "C" {
 *
 */
 /* 7			6			5			4			3			2			1			0*/
-/*|      --- Message Type----			|  DUP Flag	|	   QoS Level		|	Retain	|
+/*|      --- Message Type----			|  DUP Flag	|	   QoS Level		|	Retain	|*/
 /*										Remaining Length								 */
 
 
@@ -104,6 +104,9 @@ static inline int mqtt_get_retain(uint8_t* buffer) { return (buffer[0] & 0x01);
 
 void mqtt_msg_init(mqtt_connection_t* connection, uint8_t* buffer, uint16_t buffer_length);
 int mqtt_get_total_length(uint8_t* buffer, uint16_t length);
+// Length of the complete packet starting at buffer, 0 while the fixed
+// header is still incomplete, -1 if the remaining length is malformed.
+int mqtt_get_frame_length(uint8_t* buffer, uint16_t length);
 const char* mqtt_get_publish_topic(uint8_t* buffer, uint16_t* length);
 const char* mqtt_get_publish_data(uint8_t* buffer, uint16_t* length);
 uint16_t mqtt_get_id(uint8_t* buffer, uint16_t length);
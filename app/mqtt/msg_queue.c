@@ -1,82 +1,379 @@
+#define HEAP_TRACE_TAG HEAP_TAG_MQTT
+
 #include "c_string.h"
 #include "c_stdlib.h"
 #include "c_stdio.h"
 #include "msg_queue.h"
 
-msg_queue_t *msg_enqueue(msg_queue_t **head, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
-  if(!head){
+// node header plus message, rounded up so the next node stays aligned
+#define MSG_NODE_SIZE(len)  ((sizeof(msg_node_t) + (len) + 3) & ~3)
+
+int msg_queue_init(msg_queue_t *q, uint16_t size){
+  c_memset(q, 0, sizeof(msg_queue_t));
+  q->arena = (uint8_t *)c_zalloc(size);
+  if(!q->arena){
+    NODE_DBG("not enough memory\n");
+    return 0;
+  }
+  q->size = size;
+  q->end = size;
+  return 1;
+}
+
+void msg_queue_free(msg_queue_t *q){
+  msg_spill_close(q);
+  if(q->arena){
+    c_free(q->arena);
+    q->arena = NULL;
+  }
+  q->size = 0;
+  q->head = q->tail = q->end = 0;
+  q->count = q->done = q->sent = q->used = 0;
+  q->busy = NULL;
+}
+
+// offset a node of need bytes can be stored at, -1 if the arena is full
+static int msg_fit(msg_queue_t *q, uint16_t need){
+  if(!q->arena)
+    return -1;
+  if(q->count == 0){
+    q->head = q->tail = 0;
+    q->end = q->size;
+  }
+  if(q->count == 0 || q->tail > q->head){
+    if(q->size - q->tail >= need)
+      return q->tail;
+    if(q->head >= need)     // wrap to the start of the arena
+      return 0;
+    return -1;
+  }
+  if(q->head - q->tail >= need)
+    return q->tail;
+  return -1;
+}
+
+static msg_node_t *msg_push(msg_queue_t *q, int at, uint16_t length, uint16_t msg_id, int msg_type, int publish_qos){
+  uint16_t need = MSG_NODE_SIZE(length);
+  msg_node_t *node = (msg_node_t *)(q->arena + at);
+
+  if(at != q->tail){
+    q->end = q->tail;
+  }
+  q->tail = at + need;
+  q->count++;
+  q->used += need;
+
+  node->msg.data = (uint8_t *)(node + 1);
+  node->msg.length = length;
+  node->msg_id = msg_id;
+  node->size = need;
+  node->msg_type = msg_type;
+  node->publish_qos = publish_qos;
+  node->state = MSG_QUEUED;
+  return node;
+}
+
+msg_node_t *msg_enqueue(msg_queue_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
+  if(!q){
     return NULL;
   }
   if (!msg || !msg->data || msg->length == 0){
     NODE_DBG("empty message\n");
     return NULL;
   }
-  msg_queue_t *node = (msg_queue_t *)c_zalloc(sizeof(msg_queue_t));
-  if(!node){
-    NODE_DBG("not enough memory\n");
+  int at = msg_fit(q, MSG_NODE_SIZE(msg->length));
+  if(at < 0){
+    NODE_DBG("queue full\n");
     return NULL;
   }
-  
-  node->msg.data = (uint8_t *)c_zalloc(msg->length);
-  if(!node->msg.data){
-    NODE_DBG("not enough memory\n");
-    c_free(node);
+  msg_node_t *node = msg_push(q, at, msg->length, msg_id, msg_type, publish_qos);
+  c_memcpy(node->msg.data, msg->data, msg->length);
+  return node;
+}
+
+static void msg_unspill(msg_queue_t *q);
+
+// the node stored after node, NULL past the newest
+static msg_node_t *msg_after(msg_queue_t *q, msg_node_t *node){
+  uint16_t at = (uint8_t *)node - q->arena + node->size;
+  if(at == q->tail)
     return NULL;
+  if(at == q->end)
+    at = 0;
+  return (msg_node_t *)(q->arena + at);
+}
+
+// free the done nodes at the head, then move spilled messages into the room
+static void msg_reclaim(msg_queue_t *q){
+  msg_node_t *node;
+  int freed = 0;
+  while(q->count > 0){
+    node = (msg_node_t *)(q->arena + q->head);
+    if(node->state != MSG_DONE || node == q->busy)
+      break;
+    q->head += node->size;
+    q->used -= node->size;
+    q->count--;
+    q->done--;
+    freed = 1;
+    if(q->count == 0){
+      q->head = q->tail = 0;
+      q->end = q->size;
+    } else if(q->head == q->end){
+      q->head = 0;
+      q->end = q->size;
+    }
   }
-  c_memcpy(node->msg.data, msg->data, msg->length);
-  node->msg.length = msg->length;
-  node->next = NULL;
-  node->msg_id = msg_id;
-  node->msg_type = msg_type;
-  node->publish_qos = publish_qos;
+  if(freed && q->spill_count > 0){
+    msg_unspill(q);
+  }
+}
 
-  msg_queue_t *tail = *head;
-  if(tail){
-    while(tail->next!=NULL) tail = tail->next;
-    tail->next = node;
-  } else {
-    *head = node;
+// The message after node, oldest first, NULL for the oldest. Done ones are
+// skipped.
+msg_node_t * msg_next(msg_queue_t *q, msg_node_t *node){
+  if(!q || q->count == 0){
+    return NULL;
+  }
+  node = node ? msg_after(q, node) : (msg_node_t *)(q->arena + q->head);
+  while(node && node->state == MSG_DONE){
+    node = msg_after(q, node);
   }
   return node;
 }
 
-void msg_destroy(msg_queue_t *node){
-  if(!node) return;
-  if(node->msg.data){
-    c_free(node->msg.data);
-    node->msg.data = NULL;
+msg_node_t * msg_peek(msg_queue_t *q){
+  return msg_next(q, NULL);
+}
+
+// the message of msg_type and msg_id waiting for its answer
+msg_node_t * msg_find(msg_queue_t *q, uint16_t msg_id, int msg_type){
+  msg_node_t *node = NULL;
+  while((node = msg_next(q, node)) != NULL){
+    if(node->state == MSG_SENT && node->msg_id == msg_id && node->msg_type == msg_type)
+      return node;
   }
-  c_free(node);
+  return NULL;
 }
 
-msg_queue_t * msg_dequeue(msg_queue_t **head){
-  if(!head || !*head){
-    return NULL;
+// A done node is not to be used any more, its space may be reused at once.
+void msg_set_state(msg_queue_t *q, msg_node_t *node, int state){
+  if(!q || !node || node->state == state || node->state == MSG_DONE){
+    return;
+  }
+  if(node->state == MSG_SENT)
+    q->sent--;
+  if(state == MSG_SENT)
+    q->sent++;
+  else if(state == MSG_DONE)
+    q->done++;
+  node->state = state;
+  if(state == MSG_DONE){
+    msg_reclaim(q);
   }
-  msg_queue_t *node = *head;  // fetch head.
-  *head = node->next; // update head.
-  node->next = NULL;
-  return node;
 }
 
-msg_queue_t * msg_peek(msg_queue_t **head){
-  if(!head || !*head){
-    return NULL;
+// node (NULL for none) is being sent, its data has to stay where it is even
+// if it is done before the connection is
+void msg_busy(msg_queue_t *q, msg_node_t *node){
+  if(!q){
+    return;
+  }
+  q->busy = node;
+  if(!node){
+    msg_reclaim(q);
   }
-  return *head;  // fetch head.
 }
 
-int msg_size(msg_queue_t **head){
-  if(!head || !*head){
+int msg_size(msg_queue_t *q){
+  if(!q){
     return 0;
   }
-  int i = 1;
-  msg_queue_t *tail = *head;
-  if(tail){
-    while(tail->next!=NULL){
-      tail = tail->next;
-      i++;
+  return q->count - q->done;
+}
+
+int msg_inflight(msg_queue_t *q){
+  if(!q){
+    return 0;
+  }
+  return q->sent;
+}
+
+#if defined(BUILD_SPIFFS)
+#include "flash_fs.h"
+
+// The spill file starts with the offset of the oldest record not yet moved
+// back to the arena, followed by the records: length, msg_id (both little
+// endian), type, qos, message.
+#define MSG_SPILL_START 4
+#define MSG_SPILL_HDR 6
+
+static int msg_spill_setpos(int fd, uint32_t pos){
+  uint8_t b[MSG_SPILL_START];
+  b[0] = pos & 0xff;
+  b[1] = (pos >> 8) & 0xff;
+  b[2] = (pos >> 16) & 0xff;
+  b[3] = pos >> 24;
+  return fs_seek(fd, 0, FS_SEEK_SET) >= 0 &&
+         fs_write(fd, b, MSG_SPILL_START) == MSG_SPILL_START;
+}
+
+// move spilled messages back into the arena, oldest first, while they fit
+static void msg_unspill(msg_queue_t *q){
+  uint8_t hdr[MSG_SPILL_HDR];
+  uint32_t pos = q->spill_pos;
+  int fd = fs_open(q->spill_name, FS_RDWR);
+  if(fd < FS_OPEN_OK){
+    q->spill_count = 0;
+  }
+  while(q->spill_count > 0){
+    if(fs_seek(fd, q->spill_pos, FS_SEEK_SET) < 0 ||
+       fs_read(fd, hdr, MSG_SPILL_HDR) != MSG_SPILL_HDR){
+      q->spill_count = 0;
+      break;
+    }
+    uint16_t length = hdr[0] | (hdr[1] << 8);
+    int at = msg_fit(q, MSG_NODE_SIZE(length));
+    if(at < 0)
+      break;
+    if(fs_read(fd, q->arena + at + sizeof(msg_node_t), length) != length){
+      q->spill_count = 0;
+      break;
+    }
+    msg_push(q, at, length, hdr[2] | (hdr[3] << 8), hdr[4], hdr[5]);
+    q->spill_pos += MSG_SPILL_HDR + length;
+    q->spill_count--;
+  }
+  if(q->spill_count > 0 && q->spill_pos != pos)
+    msg_spill_setpos(fd, q->spill_pos);
+  if(fd >= FS_OPEN_OK)
+    fs_close(fd);
+  if(q->spill_count == 0){
+    fs_remove(q->spill_name);
+    q->spill_pos = 0;
+  }
+}
+
+// Spill QoS>0 publishes that don't fit the arena to name. Messages still
+// in the file from before a restart are queued again.
+int msg_spill_open(msg_queue_t *q, const char *name){
+  uint8_t hdr[MSG_SPILL_HDR];
+  size_t l = c_strlen(name);
+  if(l == 0 || l > FS_NAME_MAX_LENGTH)
+    return 0;
+  msg_spill_close(q);
+  q->spill_name = (char *)c_zalloc(l + 1);
+  if(!q->spill_name)
+    return 0;
+  c_memcpy(q->spill_name, name, l);
+
+  int fd = fs_open(q->spill_name, FS_RDONLY);
+  if(fd < FS_OPEN_OK)
+    return 1;
+  uint32_t size = fs_size(fd);
+  uint32_t pos = 0;
+  uint16_t msg_id;
+  if(fs_read(fd, hdr, MSG_SPILL_START) == MSG_SPILL_START)
+    pos = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+  if(pos >= MSG_SPILL_START)
+    q->spill_pos = pos;
+  while(pos >= MSG_SPILL_START && pos + MSG_SPILL_HDR <= size){
+    if(fs_seek(fd, pos, FS_SEEK_SET) < 0 ||
+       fs_read(fd, hdr, MSG_SPILL_HDR) != MSG_SPILL_HDR)
+      break;
+    pos += MSG_SPILL_HDR + (hdr[0] | (hdr[1] << 8));
+    if(pos > size)
+      break;
+    // the ids given out after a restart have to start past these
+    msg_id = hdr[2] | (hdr[3] << 8);
+    if(msg_id > q->spill_max_id)
+      q->spill_max_id = msg_id;
+    q->spill_count++;
+  }
+  fs_close(fd);
+  NODE_DBG("%d spilled messages in %s\n", q->spill_count, q->spill_name);
+  if(q->spill_count > 0)
+    msg_unspill(q);
+  else
+    fs_remove(q->spill_name);
+  return 1;
+}
+
+void msg_spill_close(msg_queue_t *q){
+  if(q->spill_name){
+    c_free(q->spill_name);
+    q->spill_name = NULL;
+  }
+  q->spill_pos = 0;
+  q->spill_count = 0;
+  q->spill_max_id = 0;
+}
+
+int msg_spill(msg_queue_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
+  uint8_t hdr[MSG_SPILL_HDR];
+  int fd, ok;
+  if(!q || !q->spill_name || !msg || !msg->data || msg->length == 0)
+    return 0;
+  if(MSG_NODE_SIZE(msg->length) > q->size)   // would never fit back
+    return 0;
+  if(q->spill_count == 0){
+    fd = fs_open(q->spill_name, FS_RDWR | FS_TRUNC | FS_CREAT);
+    if(fd >= FS_OPEN_OK && !msg_spill_setpos(fd, MSG_SPILL_START)){
+      fs_close(fd);
+      fd = -1;
     }
+    q->spill_pos = MSG_SPILL_START;
+  } else {
+    fd = fs_open(q->spill_name, FS_RDWR | FS_APPEND);
+  }
+  if(fd < FS_OPEN_OK){
+    NODE_DBG("can not open %s\n", q->spill_name);
+    return 0;
+  }
+  hdr[0] = msg->length & 0xff;
+  hdr[1] = msg->length >> 8;
+  hdr[2] = msg_id & 0xff;
+  hdr[3] = msg_id >> 8;
+  hdr[4] = msg_type;
+  hdr[5] = publish_qos;
+  fs_seek(fd, 0, FS_SEEK_END);
+  ok = fs_write(fd, hdr, MSG_SPILL_HDR) == MSG_SPILL_HDR &&
+       fs_write(fd, msg->data, msg->length) == msg->length;
+  fs_close(fd);
+  if(ok)
+    q->spill_count++;
+  return ok;
+}
+
+#else
+
+static void msg_unspill(msg_queue_t *q){
+  q->spill_count = 0;
+}
+
+int msg_spill_open(msg_queue_t *q, const char *name){
+  return 0;
+}
+
+void msg_spill_close(msg_queue_t *q){
+}
+
+int msg_spill(msg_queue_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
+  return 0;
+}
+
+#endif
+
+uint16_t msg_spill_max_id(msg_queue_t *q){
+  if(!q){
+    return 0;
+  }
+  return q->spill_max_id;
+}
+
+int msg_spilled(msg_queue_t *q){
+  if(!q){
+    return 0;
   }
-  return i;
+  return q->spill_count;
 }
@@ -5,21 +5,57 @@
 extern "C" {
 #endif
 
-struct msg_queue_t;
+// what is left to do with a queued message
+#define MSG_QUEUED  0   // send it
+#define MSG_SENT    1   // wait for the answer to it
+#define MSG_DONE    2   // nothing, its space is free once the older ones are done
 
-typedef struct msg_queue_t {
-  struct msg_queue_t *next;
+// One queued message. Nodes live inside the queue arena, msg.data points
+// right behind the node and stays valid until the node is done.
+typedef struct msg_node_t {
   mqtt_message_t msg;
   uint16_t msg_id;
-  int msg_type;
-  int publish_qos;
+  uint16_t size;      // arena bytes of the node, msg.length may shrink
+  uint8_t msg_type;
+  uint8_t publish_qos;
+  uint8_t state;
+} msg_node_t;
+
+// Bounded fifo of messages in one fixed arena, nodes are stored back to
+// back and wrap to the start of the arena when they don't fit at the end.
+typedef struct msg_queue_t {
+  uint8_t *arena;
+  uint16_t size;      // arena bytes
+  uint16_t head;      // offset of the oldest node
+  uint16_t tail;      // offset of the next free byte
+  uint16_t end;       // end of the used part of the arena once tail wrapped
+  uint16_t count;     // nodes in the arena, done ones too
+  uint16_t done;      // nodes done behind one that is not
+  uint16_t sent;      // nodes waiting for an answer
+  uint16_t used;      // arena bytes taken by nodes
+  msg_node_t *busy;   // node the connection is sending, kept until it is done with it
+  char *spill_name;   // file QoS>0 publishes overflow to, NULL if disabled
+  uint32_t spill_pos; // read offset of the oldest spilled message
+  uint16_t spill_count;
+  uint16_t spill_max_id; // highest msg_id found in the spill file
 } msg_queue_t;
 
-msg_queue_t * msg_enqueue(msg_queue_t **head, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
-void msg_destroy(msg_queue_t *node);
-msg_queue_t * msg_dequeue(msg_queue_t **head);
-msg_queue_t * msg_peek(msg_queue_t **head);
-int msg_size(msg_queue_t **head);
+int msg_queue_init(msg_queue_t *q, uint16_t size);
+void msg_queue_free(msg_queue_t *q);
+msg_node_t * msg_enqueue(msg_queue_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
+msg_node_t * msg_peek(msg_queue_t *q);
+msg_node_t * msg_next(msg_queue_t *q, msg_node_t *node);
+msg_node_t * msg_find(msg_queue_t *q, uint16_t msg_id, int msg_type);
+void msg_set_state(msg_queue_t *q, msg_node_t *node, int state);
+void msg_busy(msg_queue_t *q, msg_node_t *node);
+int msg_size(msg_queue_t *q);
+int msg_inflight(msg_queue_t *q);
+
+int msg_spill_open(msg_queue_t *q, const char *name);
+void msg_spill_close(msg_queue_t *q);
+int msg_spill(msg_queue_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
+int msg_spilled(msg_queue_t *q);
+uint16_t msg_spill_max_id(msg_queue_t *q);
 
 #ifdef __cplusplus
 }
@@ -45,6 +45,9 @@ The small 4KB sectors allow for greater flexibility in applications th
 void myspiffs_mount() {
   spiffs_config cfg;
   cfg.phys_addr = ( u32_t )platform_flash_get_first_free_block_address( NULL ); 
+#ifdef LUA_FLASH_IMAGE_SIZE
+  cfg.phys_addr += LUA_FLASH_IMAGE_SIZE;  // Lua image partition, see lflash.c
+#endif
   cfg.phys_addr += 0x3000;
   cfg.phys_addr &= 0xFFFFC000;  // align to 4 sector.
   cfg.phys_size = INTERNAL_FLASH_SIZE - ( ( u32_t )cfg.phys_addr - INTERNAL_FLASH_START_ADDRESS );
@@ -80,6 +83,9 @@ int myspiffs_format( void )
   SPIFFS_unmount(&fs);
   u32_t sect_first, sect_last;
   sect_first = ( u32_t )platform_flash_get_first_free_block_address( NULL ); 
+#ifdef LUA_FLASH_IMAGE_SIZE
+  sect_first += LUA_FLASH_IMAGE_SIZE;
+#endif
   sect_first += 0x3000;
   sect_first &= 0xFFFFC000;  // align to 4 sector.
   sect_first = platform_flash_get_sector_of_address(sect_first);
@@ -99,6 +105,7 @@ int myspiffs_check( void )
   // int res = (int)SPIFFS_check(&fs);
   // ets_wdt_enable();
   // return res;
+  return 0;
 }
 
 int myspiffs_open(const char *name, int flags){
@@ -166,6 +173,9 @@ int myspiffs_error( int fd ){
 void myspiffs_clearerr( int fd ){
   SPIFFS_clearerr(&fs);
 }
+int myspiffs_remove( const char *name ){
+  return SPIFFS_remove(&fs, (char *)name);
+}
 int myspiffs_rename( const char *old, const char *newname ){
   return SPIFFS_rename(&fs, (char *)old, (char *)newname);
 }
@@ -491,8 +491,10 @@ int myspiffs_ungetc( int c, int fd );
 int myspiffs_flush( int fd );
 int myspiffs_error( int fd );
 void myspiffs_clearerr( int fd );
+int myspiffs_format( void );
 int myspiffs_check( void );
 int myspiffs_rename( const char *old, const char *newname );
+int myspiffs_remove( const char *name );
 size_t myspiffs_size( int fd );
 
 #if defined(__cplusplus)
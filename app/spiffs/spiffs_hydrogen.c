@@ -421,7 +421,8 @@ s32_t SPIFFS_lseek(spiffs *fs, spiffs_file fh, s32_t offs, int whence) {
     break;
   }
 
-  if (offs > (s32_t)fd->size) {
+  // a file not written yet has no size, only offset 0
+  if (fd->size == SPIFFS_UNDEFINED_LEN ? offs > 0 : offs > (s32_t)fd->size) {
     res = SPIFFS_ERR_END_OF_OBJECT;
   }
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
@@ -910,7 +911,7 @@ s32_t SPIFFS_vis(spiffs *fs) {
   spiffs_printf("free_blocks: %i\n", fs->free_blocks);
   spiffs_printf("page_alloc:  %i\n", fs->stats_p_allocated);
   spiffs_printf("page_delet:  %i\n", fs->stats_p_deleted);
-  u32_t total, used;
+  u32_t total = 0, used = 0;
   SPIFFS_info(fs, &total, &used);
   spiffs_printf("used:        %i of %i\n", used, total);
 
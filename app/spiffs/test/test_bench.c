@@ -0,0 +1,247 @@
+/*
+ * test_bench.c
+ *
+ * Workload benchmarks on top of the emulated flash. Each test replays a
+ * typical device access pattern and reports throughput, flash traffic per
+ * logical byte, erases, gc runs and per operation latency percentiles.
+ * Only built into the runner when SPIFFS_TEST_BENCH is defined.
+ */
+
+#include "testrunner.h"
+#include "test_spiffs.h"
+#include "spiffs_nucleus.h"
+#include "spiffs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_SAMPLES     (64*1024)
+
+typedef struct {
+  const char *name;
+  u32_t ops;
+  u32_t logical_bytes;
+  u32_t *lat_us;
+  u32_t samples;
+  struct timespec t_start;
+  struct timespec t_op;
+#if SPIFFS_GC_STATS
+  u32_t gc_runs_start;
+#endif
+} bench;
+
+static u32_t elapsed_us(struct timespec *from) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - from->tv_sec) * 1000000 + (now.tv_nsec - from->tv_nsec) / 1000;
+}
+
+static void bench_start(bench *b, const char *name) {
+  memset(b, 0, sizeof(bench));
+  b->name = name;
+  b->lat_us = malloc(sizeof(u32_t) * BENCH_MAX_SAMPLES);
+  clear_flash_ops_log();
+#if SPIFFS_GC_STATS
+  b->gc_runs_start = (FS)->stats_gc_runs;
+#endif
+  clock_gettime(CLOCK_MONOTONIC, &b->t_start);
+}
+
+static void bench_op_begin(bench *b) {
+  clock_gettime(CLOCK_MONOTONIC, &b->t_op);
+}
+
+static void bench_op_end(bench *b, u32_t logical_bytes) {
+  u32_t us = elapsed_us(&b->t_op);
+  if (b->samples < BENCH_MAX_SAMPLES) {
+    b->lat_us[b->samples++] = us;
+  }
+  b->ops++;
+  b->logical_bytes += logical_bytes;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  u32_t x = *(const u32_t *)a;
+  u32_t y = *(const u32_t *)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static u32_t percentile(bench *b, int p) {
+  if (b->samples == 0) return 0;
+  return b->lat_us[(b->samples - 1) * p / 100];
+}
+
+static void bench_report(bench *b) {
+  u32_t us = elapsed_us(&b->t_start);
+  u32_t rd = get_flash_ops_log_read_bytes();
+  u32_t wr = get_flash_ops_log_write_bytes();
+  u32_t er = get_flash_ops_log_erases();
+  float lb = b->logical_bytes == 0 ? 1.0f : (float)b->logical_bytes;
+
+  qsort(b->lat_us, b->samples, sizeof(u32_t), cmp_u32);
+
+  printf("  BENCH %s\n", b->name);
+  printf("    ops             : %i, %i logical bytes in %i us\n", b->ops, b->logical_bytes, us);
+  printf("    throughput      : %.1f kB/s, %.1f ops/s\n",
+      us == 0 ? 0.0f : (float)b->logical_bytes * 1000000.0f / 1024.0f / us,
+      us == 0 ? 0.0f : (float)b->ops * 1000000.0f / us);
+  printf("    flash rd/byte   : %.2f\n", (float)rd / lb);
+  printf("    flash wr/byte   : %.2f\n", (float)wr / lb);
+  printf("    erases          : %i (%.3f per logical kB)\n", er, (float)er * 1024.0f / lb);
+#if SPIFFS_GC_STATS
+  printf("    gc runs         : %i\n", (FS)->stats_gc_runs - b->gc_runs_start);
+#endif
+  printf("    latency us      : p50 %i  p90 %i  p99 %i  max %i\n",
+      percentile(b, 50), percentile(b, 90), percentile(b, 99), percentile(b, 100));
+
+  free(b->lat_us);
+}
+
+
+SUITE(bench_tests)
+void setup() {
+  _setup();
+}
+void teardown() {
+  _teardown();
+}
+
+TEST(bench_log_append) {
+  const u32_t rec_len = 80;
+  const u32_t rotate_at = 64*1024;
+  const int records = 20000;
+  u8_t rec[80];
+  bench b;
+  int i;
+  u32_t log_size = 0;
+
+  spiffs_file fd = SPIFFS_open(FS, "log", SPIFFS_APPEND | SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  TEST_CHECK(fd > 0);
+
+  bench_start(&b, "log append, 80 byte records, rotate at 64k");
+  for (i = 0; i < records; i++) {
+    memrand(rec, rec_len);
+    if (log_size + rec_len > rotate_at) {
+      SPIFFS_close(FS, fd);
+      SPIFFS_remove(FS, "log.1");
+      TEST_CHECK(SPIFFS_rename(FS, "log", "log.1") >= 0);
+      fd = SPIFFS_open(FS, "log", SPIFFS_APPEND | SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+      TEST_CHECK(fd > 0);
+      log_size = 0;
+    }
+    bench_op_begin(&b);
+    TEST_CHECK(SPIFFS_write(FS, fd, rec, rec_len) >= 0);
+    TEST_CHECK(SPIFFS_fflush(FS, fd) >= 0);
+    bench_op_end(&b, rec_len);
+    log_size += rec_len;
+  }
+  SPIFFS_close(FS, fd);
+  bench_report(&b);
+  return TEST_RES_OK;
+} TEST_END(bench_log_append)
+
+TEST(bench_config_rewrite) {
+  const u32_t cfg_len = 512;
+  const int rewrites = 5000;
+  u8_t cfg[512];
+  bench b;
+  int i;
+
+  bench_start(&b, "config rewrite, 512 bytes, open/trunc/write/close");
+  for (i = 0; i < rewrites; i++) {
+    memrand(cfg, cfg_len);
+    bench_op_begin(&b);
+    spiffs_file fd = SPIFFS_open(FS, "config", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+    TEST_CHECK(fd > 0);
+    TEST_CHECK(SPIFFS_write(FS, fd, cfg, cfg_len) >= 0);
+    SPIFFS_close(FS, fd);
+    bench_op_end(&b, cfg_len);
+  }
+  bench_report(&b);
+  return TEST_RES_OK;
+} TEST_END(bench_config_rewrite)
+
+TEST(bench_many_small_files) {
+  const int files = 200;
+  const int rounds = 10;
+  u8_t buf[300];
+  char name[32];
+  bench b;
+  int r, i;
+
+  bench_start(&b, "many small files, 200 x 100..300 bytes, write/read/remove");
+  for (r = 0; r < rounds; r++) {
+    for (i = 0; i < files; i++) {
+      u32_t len = 100 + (i * 7) % 201;
+      sprintf(name, "small%i", i);
+      memrand(buf, len);
+      bench_op_begin(&b);
+      spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+      TEST_CHECK(fd > 0);
+      TEST_CHECK(SPIFFS_write(FS, fd, buf, len) >= 0);
+      SPIFFS_close(FS, fd);
+      bench_op_end(&b, len);
+    }
+    for (i = 0; i < files; i++) {
+      u32_t len = 100 + (i * 7) % 201;
+      sprintf(name, "small%i", i);
+      bench_op_begin(&b);
+      spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_RDONLY, 0);
+      TEST_CHECK(fd > 0);
+      TEST_CHECK(SPIFFS_read(FS, fd, buf, len) == (s32_t)len);
+      SPIFFS_close(FS, fd);
+      bench_op_end(&b, len);
+    }
+    for (i = 0; i < files; i++) {
+      sprintf(name, "small%i", i);
+      bench_op_begin(&b);
+      TEST_CHECK(SPIFFS_remove(FS, name) >= 0);
+      bench_op_end(&b, 0);
+    }
+  }
+  bench_report(&b);
+  return TEST_RES_OK;
+} TEST_END(bench_many_small_files)
+
+TEST(bench_fill_to_95) {
+  const u32_t chunk = 4096;
+  const u32_t file_len = 32*1024;
+  u8_t *buf = malloc(chunk);
+  char name[32];
+  u32_t total, used;
+  bench b;
+  int files = 0;
+  int pass, i;
+
+  bench_start(&b, "fill to 95%, 32k files in 4k chunks, free half, refill");
+  for (pass = 0; pass < 3; pass++) {
+    while (1) {
+      TEST_CHECK(SPIFFS_info(FS, &total, &used) >= 0);
+      if (used + file_len > total / 100 * 95) break;
+      sprintf(name, "fill%i", files);
+      spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+      TEST_CHECK(fd > 0);
+      u32_t written;
+      for (written = 0; written < file_len; written += chunk) {
+        memrand(buf, chunk);
+        bench_op_begin(&b);
+        TEST_CHECK(SPIFFS_write(FS, fd, buf, chunk) >= 0);
+        bench_op_end(&b, chunk);
+      }
+      SPIFFS_close(FS, fd);
+      files++;
+    }
+    printf("    pass %i: %i files, %i of %i bytes used\n", pass, files, used, total);
+    // free every other file so gc has to pick up fragmented blocks
+    for (i = pass & 1; i < files; i += 2) {
+      sprintf(name, "fill%i", i);
+      SPIFFS_remove(FS, name);
+    }
+  }
+  free(buf);
+  bench_report(&b);
+  return TEST_RES_OK;
+} TEST_END(bench_fill_to_95)
+
+SUITE_END(bench_tests)
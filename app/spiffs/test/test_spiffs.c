@@ -32,6 +32,7 @@ static u32_t bytes_rd = 0;
 static u32_t bytes_wr = 0;
 static u32_t reads = 0;
 static u32_t writes = 0;
+static u32_t erase_ops = 0;
 static u32_t error_after_bytes_written = 0;
 static u32_t error_after_bytes_read = 0;
 static char error_after_bytes_written_once_only = 0;
@@ -139,6 +140,9 @@ static s32_t _erase(u32_t addr, u32_t size) {
     return -1;
   }
   erases[(addr-__fs.cfg.phys_addr)/__fs.cfg.phys_erase_block]++;
+  if (log_flash_ops) {
+    erase_ops++;
+  }
   memset(&area[addr], 0xff, size);
   return 0;
 }
@@ -352,6 +356,7 @@ void clear_flash_ops_log() {
   bytes_wr = 0;
   reads = 0;
   writes = 0;
+  erase_ops = 0;
   error_after_bytes_read = 0;
   error_after_bytes_written = 0;
 }
@@ -364,6 +369,10 @@ u32_t get_flash_ops_log_write_bytes() {
   return bytes_wr;
 }
 
+u32_t get_flash_ops_log_erases() {
+  return erase_ops;
+}
+
 void invoke_error_after_read_bytes(u32_t b, char once_only) {
   error_after_bytes_read = b;
   error_after_bytes_read_once_only = once_only;
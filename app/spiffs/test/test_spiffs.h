@@ -74,6 +74,7 @@ void set_flash_ops_log(int enable);
 void clear_flash_ops_log();
 u32_t get_flash_ops_log_read_bytes();
 u32_t get_flash_ops_log_write_bytes();
+u32_t get_flash_ops_log_erases();
 void invoke_error_after_read_bytes(u32_t b, char once_only);
 void invoke_error_after_write_bytes(u32_t b, char once_only);
 
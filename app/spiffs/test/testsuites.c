@@ -12,4 +12,7 @@ void add_suites() {
   ADD_SUITE(check_tests);
   ADD_SUITE(hydrogen_tests)
   ADD_SUITE(bug_tests)
+#ifdef SPIFFS_TEST_BENCH
+  ADD_SUITE(bench_tests)
+#endif
 }
@@ -94,4 +94,15 @@ espconn_secure_accept(struct espconn *espconn)
 	return espconn_ssl_server(espconn);
 }
 
-
+/******************************************************************************
+ * FunctionName : espconn_secure_set_size
+ * Description  : Set the maximum fragment length (RFC 6066) that client
+ *                connections ask the server for, which sizes their buffers
+ * Parameters   : size -- 512, 1024, 2048 or 4096, or 0 not to ask
+ * Returns      : ESPCONN_OK, or ESPCONN_ARG for any other size
+*******************************************************************************/
+sint8 ICACHE_FLASH_ATTR
+espconn_secure_set_size(uint16 size)
+{
+	return espconn_ssl_set_size(size) ? ESPCONN_OK : ESPCONN_ARG;
+}
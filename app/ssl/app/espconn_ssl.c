@@ -24,6 +24,9 @@
 //#include "os.h"
 #include "lwip/app/espconn.h"
 
+#include "user_interface.h"
+#include "user_config.h"
+
 struct pbuf *psslpbuf = NULL;
 extern espconn_msg *plink_active;
 
@@ -33,7 +36,90 @@ static err_t espconn_ssl_srecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, e
 static void espconn_ssl_sclose(void *arg, struct tcp_pcb *pcb);
 static void espconn_ssl_cclose(void *arg, struct tcp_pcb *pcb);
 
+/* the fragment length client connections ask for, 0 for the default */
+static uint16 ssl_max_fragment = 0;
+
 /////////////////////////////common function///////////////////////////////////
+#ifdef CLIENT_SSL_SESSION_RTC
+/* in the RTC memory for the user, after node.flashreload()'s request */
+#ifndef SSL_SESSION_RTC_ADDR
+#define SSL_SESSION_RTC_ADDR	80
+#endif
+#define SSL_SESSION_MAGIC		0x53534c53
+
+/* the session of the last client connection, which deep sleep keeps */
+typedef struct _rtc_session {
+    uint32 magic;
+    uint8 remote_ip[4];
+    int remote_port;
+    SSL_CLIENT_SESSION sess;
+    uint32 check;
+} rtc_session;
+
+static uint32 ICACHE_FLASH_ATTR rtc_session_check(const rtc_session *r)
+{
+    const uint8 *p = (const uint8 *)r, *end = (const uint8 *)&r->check;
+    uint32 check = 0;
+
+    while (p < end)
+        check = (check << 1 | check >> 31) ^ *p++;
+
+    return check;
+}
+
+/******************************************************************************
+ * FunctionName : espconn_ssl_session_load
+ * Description  : Get the session kept for the server of a connection, unless
+ *                the RTC memory has another server's or garbage after a cold
+ *                start.
+ * Parameters   : espconn -- the espconn to connect
+ *                sess -- where the session goes
+ * Returns      : true if there is one to offer
+*******************************************************************************/
+static bool ICACHE_FLASH_ATTR
+espconn_ssl_session_load(struct espconn *espconn, SSL_CLIENT_SESSION *sess)
+{
+    rtc_session r;
+
+    if (!system_rtc_mem_read(SSL_SESSION_RTC_ADDR, &r, sizeof(r)) ||
+            r.magic != SSL_SESSION_MAGIC || r.check != rtc_session_check(&r))
+        return false;
+
+    if (os_memcmp(r.remote_ip, espconn->proto.tcp->remote_ip, 4) != 0 ||
+            r.remote_port != espconn->proto.tcp->remote_port)
+        return false;
+
+    os_memcpy(sess, &r.sess, sizeof(*sess));
+    return true;
+}
+
+/******************************************************************************
+ * FunctionName : espconn_ssl_session_save
+ * Description  : Keep the session of a connection after its handshake, or
+ *                forget the kept one if there is none
+ * Parameters   : espconn -- the espconn connected
+ *                ssl -- the ssl object of the connection, NULL to forget
+ * Returns      : none
+*******************************************************************************/
+static void ICACHE_FLASH_ATTR
+espconn_ssl_session_save(struct espconn *espconn, SSL *ssl)
+{
+    rtc_session r;
+
+    os_memset(&r, 0, sizeof(r));
+
+    if (ssl != NULL && ssl_get_client_session(ssl, &r.sess) == SSL_OK) {
+        r.magic = SSL_SESSION_MAGIC;
+        os_memcpy(r.remote_ip, espconn->proto.tcp->remote_ip, 4);
+        r.remote_port = espconn->proto.tcp->remote_port;
+        r.check = rtc_session_check(&r);
+        system_rtc_mem_write(SSL_SESSION_RTC_ADDR, &r, sizeof(r));
+    } else {
+        system_rtc_mem_write(SSL_SESSION_RTC_ADDR, &r, sizeof(r.magic));
+    }
+}
+#endif
+
 /******************************************************************************
  * FunctionName : display_session_id
  * Description  : Display what session id we have.
@@ -232,14 +318,15 @@ espconn_ssl_sent(void *arg, uint8 *psent, uint16 length)
 
     pcb = pssl_sent->pcommon.pcb;
 	pssl = pssl_sent->pssl;
-    if (RT_MAX_PLAIN_LENGTH < length) {
-        len = RT_MAX_PLAIN_LENGTH;
-    } else {
-        len = length;
-    }
-
     if (pssl != NULL) {
         if (pssl->ssl != NULL) {
+            /* a record at a time, of the fragment length negotiated */
+            if (pssl->ssl->max_plain_length < length) {
+                len = pssl->ssl->max_plain_length;
+            } else {
+                len = length;
+            }
+
             pssl->ssl->SslClient_pcb = pcb;
             res = ssl_write(pssl->ssl, psent, len);
             pssl_sent->pcommon.ptrbuf = psent + len;
@@ -421,6 +508,9 @@ espconn_ssl_crecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
                 pbuf_free(p);
                 if (ret != SSL_OK){
                     os_printf("client handshake failed\n");
+#ifdef CLIENT_SSL_SESSION_RTC
+                    espconn_ssl_session_save(precv->pespconn, NULL);
+#endif
                     espconn_ssl_cclose(arg, pcb);
                 }
             }
@@ -437,6 +527,9 @@ espconn_ssl_crecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
 
                     display_session_id(pssl->ssl);
                     display_cipher(pssl->ssl);
+#ifdef CLIENT_SSL_SESSION_RTC
+                    espconn_ssl_session_save(precv->pespconn, pssl->ssl);
+#endif
                     pssl->quiet = true;
                     os_printf("client handshake ok!\n");
                     REG_CLR_BIT(0x3ff00014, BIT(0));
@@ -449,17 +542,21 @@ espconn_ssl_crecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
                     	precv->pespconn->proto.tcp->connect_callback(precv->pespconn);
                     }
                 } else {
-                    uint8_t *read_buf = NULL;
-                    ret = ssl_read(pssl->ssl, &read_buf);
-                    precv->pespconn->state = ESPCONN_READ;
-                    precv->pcommon.pcb = pcb;
+                    /* one record at a time: with a small fragment length
+                     * there can be several in the pbuf */
+                    do {
+                        uint8_t *read_buf = NULL;
+                        ret = ssl_read(pssl->ssl, &read_buf);
+                        precv->pespconn->state = ESPCONN_READ;
+                        precv->pcommon.pcb = pcb;
+
+                        if (precv->pespconn->recv_callback != NULL && read_buf != NULL) {
+                        	precv->pespconn->recv_callback(precv->pespconn, read_buf, ret);
+                        }
+
+                        precv->pespconn->state = ESPCONN_CONNECT;
+                    } while (pssl->ssl->pbuf_offset != 0);
                     pbuf_free(p);
-
-                    if (precv->pespconn->recv_callback != NULL && read_buf != NULL) {
-                    	precv->pespconn->recv_callback(precv->pespconn, read_buf, ret);
-                    }
-
-                    precv->pespconn->state = ESPCONN_CONNECT;
                 }
             }
         }
@@ -604,6 +701,10 @@ espconn_ssl_connect(void *arg, struct tcp_pcb *tpcb, err_t err)
     //    return ERR_ISCONN;
     //}
 
+#ifdef CLIENT_SSL_SESSION_RTC
+    SSL_CLIENT_SESSION sess;
+#endif
+
     pconnect->pcommon.pcb = tpcb;
     pssl = (ssl_msg *)os_zalloc(sizeof(ssl_msg));
     pconnect->pssl = pssl;
@@ -623,6 +724,13 @@ espconn_ssl_connect(void *arg, struct tcp_pcb *tpcb, err_t err)
     }
 
     ssl_printf("espconn_ssl_client ssl_ctx %p\n", pssl->ssl_ctx);
+    ssl_ctx_set_max_fragment(pssl->ssl_ctx, ssl_max_fragment);
+#ifdef CLIENT_SSL_SESSION_RTC
+    /* offer the session kept from the last connection to this server */
+    if (espconn_ssl_session_load(pconnect->pespconn, &sess))
+        pssl->ssl = SSLClient_resume(pssl->ssl_ctx, tpcb, &sess);
+    else
+#endif
     pssl->ssl = SSLClient_new(pssl->ssl_ctx, tpcb, NULL, 0);
 
     if (pssl->ssl == NULL) {
@@ -636,6 +744,23 @@ espconn_ssl_connect(void *arg, struct tcp_pcb *tpcb, err_t err)
     return ERR_OK;
 }
 
+/******************************************************************************
+ * FunctionName : espconn_ssl_set_size
+ * Description  : Set the maximum fragment length the client connections made
+ *                from now on ask the server for.
+ * Parameters   : size -- 512, 1024, 2048 or 4096, or 0 not to ask
+ * Returns      : true if it is one of those
+*******************************************************************************/
+bool ICACHE_FLASH_ATTR
+espconn_ssl_set_size(uint16 size)
+{
+    if (size != 0 && size != 512 && size != 1024 && size != 2048 && size != 4096)
+        return false;
+
+    ssl_max_fragment = size;
+    return true;
+}
+
 /******************************************************************************
  * FunctionName : espconn_ssl_disconnect
  * Description  : A new incoming connection has been disconnected.
@@ -863,17 +988,19 @@ espconn_ssl_srecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
                 	espconn_ssl_sclose(arg, pcb);
                 }
             } else {
-                    uint8_t *read_buf = NULL;
-                    ret = ssl_read(pssl->ssl, &read_buf);
-                    precv->pespconn->state = ESPCONN_READ;
-                    precv->pcommon.pcb = pcb;
+                    do {
+                        uint8_t *read_buf = NULL;
+                        ret = ssl_read(pssl->ssl, &read_buf);
+                        precv->pespconn->state = ESPCONN_READ;
+                        precv->pcommon.pcb = pcb;
+
+                        if (precv->pespconn->recv_callback != NULL && read_buf != NULL) {
+                        	precv->pespconn->recv_callback(precv->pespconn, read_buf, ret);
+                        }
+
+                        precv->pespconn->state = ESPCONN_CONNECT;
+                    } while (pssl->ssl->pbuf_offset != 0);
                     pbuf_free(p);
-
-                    if (precv->pespconn->recv_callback != NULL && read_buf != NULL) {
-                    	precv->pespconn->recv_callback(precv->pespconn, read_buf, ret);
-                    }
-
-                    precv->pespconn->state = ESPCONN_CONNECT;
                 }
 
         }
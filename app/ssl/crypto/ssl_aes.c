@@ -31,7 +31,8 @@
 /**
  * AES implementation - this is a small code version. There are much faster
  * versions around but they are much larger in size (i.e. they use large 
- * submix tables).
+ * submix tables). With CONFIG_AES_TTABLE it is one of those, if a modest
+ * one: a table of 256 words each way, rotated for the 4 rows.
  */
 
 //#include <string.h>
@@ -40,6 +41,7 @@
 #include "lwip/def.h"
 #include "ssl/ssl_os_port.h"
 #include "ssl/ssl_crypto.h"
+#include "flash_api.h"
 
 /* all commented out in skeleton mode */
 #ifndef CONFIG_SSL_SKELETON_MODE
@@ -164,6 +166,182 @@ static const unsigned char Rcon[30]=
 	0xb3,0x7d,0xfa,0xef,0xc5,0x91,
 };
 
+#ifdef CONFIG_AES_TTABLE
+/* the T-tables are in flash, where a word is read at a time through the
+ * cache of the SPI flash, or with CONFIG_AES_TTABLE_RAM in RAM, where no
+ * miss of that cache holds up a lookup */
+#ifdef CONFIG_AES_TTABLE_RAM
+#define AES_TTABLE_ATTR
+#else
+#define AES_TTABLE_ATTR ICACHE_STORE_ATTR ICACHE_RODATA_ATTR
+#endif
+
+/*
+ * AES T-table: S(x) times the column (2,1,1,3) of MixColumns, whose
+ * other columns are rotations of it
+ */
+static const uint32_t aes_te[256] AES_TTABLE_ATTR =
+{
+	0xC66363A5,0xF87C7C84,0xEE777799,0xF67B7B8D,
+	0xFFF2F20D,0xD66B6BBD,0xDE6F6FB1,0x91C5C554,
+	0x60303050,0x02010103,0xCE6767A9,0x562B2B7D,
+	0xE7FEFE19,0xB5D7D762,0x4DABABE6,0xEC76769A,
+	0x8FCACA45,0x1F82829D,0x89C9C940,0xFA7D7D87,
+	0xEFFAFA15,0xB25959EB,0x8E4747C9,0xFBF0F00B,
+	0x41ADADEC,0xB3D4D467,0x5FA2A2FD,0x45AFAFEA,
+	0x239C9CBF,0x53A4A4F7,0xE4727296,0x9BC0C05B,
+	0x75B7B7C2,0xE1FDFD1C,0x3D9393AE,0x4C26266A,
+	0x6C36365A,0x7E3F3F41,0xF5F7F702,0x83CCCC4F,
+	0x6834345C,0x51A5A5F4,0xD1E5E534,0xF9F1F108,
+	0xE2717193,0xABD8D873,0x62313153,0x2A15153F,
+	0x0804040C,0x95C7C752,0x46232365,0x9DC3C35E,
+	0x30181828,0x379696A1,0x0A05050F,0x2F9A9AB5,
+	0x0E070709,0x24121236,0x1B80809B,0xDFE2E23D,
+	0xCDEBEB26,0x4E272769,0x7FB2B2CD,0xEA75759F,
+	0x1209091B,0x1D83839E,0x582C2C74,0x341A1A2E,
+	0x361B1B2D,0xDC6E6EB2,0xB45A5AEE,0x5BA0A0FB,
+	0xA45252F6,0x763B3B4D,0xB7D6D661,0x7DB3B3CE,
+	0x5229297B,0xDDE3E33E,0x5E2F2F71,0x13848497,
+	0xA65353F5,0xB9D1D168,0x00000000,0xC1EDED2C,
+	0x40202060,0xE3FCFC1F,0x79B1B1C8,0xB65B5BED,
+	0xD46A6ABE,0x8DCBCB46,0x67BEBED9,0x7239394B,
+	0x944A4ADE,0x984C4CD4,0xB05858E8,0x85CFCF4A,
+	0xBBD0D06B,0xC5EFEF2A,0x4FAAAAE5,0xEDFBFB16,
+	0x864343C5,0x9A4D4DD7,0x66333355,0x11858594,
+	0x8A4545CF,0xE9F9F910,0x04020206,0xFE7F7F81,
+	0xA05050F0,0x783C3C44,0x259F9FBA,0x4BA8A8E3,
+	0xA25151F3,0x5DA3A3FE,0x804040C0,0x058F8F8A,
+	0x3F9292AD,0x219D9DBC,0x70383848,0xF1F5F504,
+	0x63BCBCDF,0x77B6B6C1,0xAFDADA75,0x42212163,
+	0x20101030,0xE5FFFF1A,0xFDF3F30E,0xBFD2D26D,
+	0x81CDCD4C,0x180C0C14,0x26131335,0xC3ECEC2F,
+	0xBE5F5FE1,0x359797A2,0x884444CC,0x2E171739,
+	0x93C4C457,0x55A7A7F2,0xFC7E7E82,0x7A3D3D47,
+	0xC86464AC,0xBA5D5DE7,0x3219192B,0xE6737395,
+	0xC06060A0,0x19818198,0x9E4F4FD1,0xA3DCDC7F,
+	0x44222266,0x542A2A7E,0x3B9090AB,0x0B888883,
+	0x8C4646CA,0xC7EEEE29,0x6BB8B8D3,0x2814143C,
+	0xA7DEDE79,0xBC5E5EE2,0x160B0B1D,0xADDBDB76,
+	0xDBE0E03B,0x64323256,0x743A3A4E,0x140A0A1E,
+	0x924949DB,0x0C06060A,0x4824246C,0xB85C5CE4,
+	0x9FC2C25D,0xBDD3D36E,0x43ACACEF,0xC46262A6,
+	0x399191A8,0x319595A4,0xD3E4E437,0xF279798B,
+	0xD5E7E732,0x8BC8C843,0x6E373759,0xDA6D6DB7,
+	0x018D8D8C,0xB1D5D564,0x9C4E4ED2,0x49A9A9E0,
+	0xD86C6CB4,0xAC5656FA,0xF3F4F407,0xCFEAEA25,
+	0xCA6565AF,0xF47A7A8E,0x47AEAEE9,0x10080818,
+	0x6FBABAD5,0xF0787888,0x4A25256F,0x5C2E2E72,
+	0x381C1C24,0x57A6A6F1,0x73B4B4C7,0x97C6C651,
+	0xCBE8E823,0xA1DDDD7C,0xE874749C,0x3E1F1F21,
+	0x964B4BDD,0x61BDBDDC,0x0D8B8B86,0x0F8A8A85,
+	0xE0707090,0x7C3E3E42,0x71B5B5C4,0xCC6666AA,
+	0x904848D8,0x06030305,0xF7F6F601,0x1C0E0E12,
+	0xC26161A3,0x6A35355F,0xAE5757F9,0x69B9B9D0,
+	0x17868691,0x99C1C158,0x3A1D1D27,0x279E9EB9,
+	0xD9E1E138,0xEBF8F813,0x2B9898B3,0x22111133,
+	0xD26969BB,0xA9D9D970,0x078E8E89,0x339494A7,
+	0x2D9B9BB6,0x3C1E1E22,0x15878792,0xC9E9E920,
+	0x87CECE49,0xAA5555FF,0x50282878,0xA5DFDF7A,
+	0x038C8C8F,0x59A1A1F8,0x09898980,0x1A0D0D17,
+	0x65BFBFDA,0xD7E6E631,0x844242C6,0xD06868B8,
+	0x824141C3,0x299999B0,0x5A2D2D77,0x1E0F0F11,
+	0x7BB0B0CB,0xA85454FC,0x6DBBBBD6,0x2C16163A,
+};
+
+/*
+ * AES inverse T-table: S^-1(x) times the column (14,9,13,11) of
+ * InvMixColumns
+ */
+static const uint32_t aes_td[256] AES_TTABLE_ATTR =
+{
+	0x51F4A750,0x7E416553,0x1A17A4C3,0x3A275E96,
+	0x3BAB6BCB,0x1F9D45F1,0xACFA58AB,0x4BE30393,
+	0x2030FA55,0xAD766DF6,0x88CC7691,0xF5024C25,
+	0x4FE5D7FC,0xC52ACBD7,0x26354480,0xB562A38F,
+	0xDEB15A49,0x25BA1B67,0x45EA0E98,0x5DFEC0E1,
+	0xC32F7502,0x814CF012,0x8D4697A3,0x6BD3F9C6,
+	0x038F5FE7,0x15929C95,0xBF6D7AEB,0x955259DA,
+	0xD4BE832D,0x587421D3,0x49E06929,0x8EC9C844,
+	0x75C2896A,0xF48E7978,0x99583E6B,0x27B971DD,
+	0xBEE14FB6,0xF088AD17,0xC920AC66,0x7DCE3AB4,
+	0x63DF4A18,0xE51A3182,0x97513360,0x62537F45,
+	0xB16477E0,0xBB6BAE84,0xFE81A01C,0xF9082B94,
+	0x70486858,0x8F45FD19,0x94DE6C87,0x527BF8B7,
+	0xAB73D323,0x724B02E2,0xE31F8F57,0x6655AB2A,
+	0xB2EB2807,0x2FB5C203,0x86C57B9A,0xD33708A5,
+	0x302887F2,0x23BFA5B2,0x02036ABA,0xED16825C,
+	0x8ACF1C2B,0xA779B492,0xF307F2F0,0x4E69E2A1,
+	0x65DAF4CD,0x0605BED5,0xD134621F,0xC4A6FE8A,
+	0x342E539D,0xA2F355A0,0x058AE132,0xA4F6EB75,
+	0x0B83EC39,0x4060EFAA,0x5E719F06,0xBD6E1051,
+	0x3E218AF9,0x96DD063D,0xDD3E05AE,0x4DE6BD46,
+	0x91548DB5,0x71C45D05,0x0406D46F,0x605015FF,
+	0x1998FB24,0xD6BDE997,0x894043CC,0x67D99E77,
+	0xB0E842BD,0x07898B88,0xE7195B38,0x79C8EEDB,
+	0xA17C0A47,0x7C420FE9,0xF8841EC9,0x00000000,
+	0x09808683,0x322BED48,0x1E1170AC,0x6C5A724E,
+	0xFD0EFFFB,0x0F853856,0x3DAED51E,0x362D3927,
+	0x0A0FD964,0x685CA621,0x9B5B54D1,0x24362E3A,
+	0x0C0A67B1,0x9357E70F,0xB4EE96D2,0x1B9B919E,
+	0x80C0C54F,0x61DC20A2,0x5A774B69,0x1C121A16,
+	0xE293BA0A,0xC0A02AE5,0x3C22E043,0x121B171D,
+	0x0E090D0B,0xF28BC7AD,0x2DB6A8B9,0x141EA9C8,
+	0x57F11985,0xAF75074C,0xEE99DDBB,0xA37F60FD,
+	0xF701269F,0x5C72F5BC,0x44663BC5,0x5BFB7E34,
+	0x8B432976,0xCB23C6DC,0xB6EDFC68,0xB8E4F163,
+	0xD731DCCA,0x42638510,0x13972240,0x84C61120,
+	0x854A247D,0xD2BB3DF8,0xAEF93211,0xC729A16D,
+	0x1D9E2F4B,0xDCB230F3,0x0D8652EC,0x77C1E3D0,
+	0x2BB3166C,0xA970B999,0x119448FA,0x47E96422,
+	0xA8FC8CC4,0xA0F03F1A,0x567D2CD8,0x223390EF,
+	0x87494EC7,0xD938D1C1,0x8CCAA2FE,0x98D40B36,
+	0xA6F581CF,0xA57ADE28,0xDAB78E26,0x3FADBFA4,
+	0x2C3A9DE4,0x5078920D,0x6A5FCC9B,0x547E4662,
+	0xF68D13C2,0x90D8B8E8,0x2E39F75E,0x82C3AFF5,
+	0x9F5D80BE,0x69D0937C,0x6FD52DA9,0xCF2512B3,
+	0xC8AC993B,0x10187DA7,0xE89C636E,0xDB3BBB7B,
+	0xCD267809,0x6E5918F4,0xEC9AB701,0x834F9AA8,
+	0xE6956E65,0xAAFFE67E,0x21BCCF08,0xEF15E8E6,
+	0xBAE79BD9,0x4A6F36CE,0xEA9F09D4,0x29B07CD6,
+	0x31A4B2AF,0x2A3F2331,0xC6A59430,0x35A266C0,
+	0x744EBC37,0xFC82CAA6,0xE090D0B0,0x33A7D815,
+	0xF104984A,0x41ECDAF7,0x7FCD500E,0x1791F62F,
+	0x764DD68D,0x43EFB04D,0xCCAA4D54,0xE49604DF,
+	0x9ED1B5E3,0x4C6A881B,0xC12C1FB8,0x4665517F,
+	0x9D5EEA04,0x018C355D,0xFA877473,0xFB0B412E,
+	0xB3671D5A,0x92DBD252,0xE9105633,0x6DD64713,
+	0x9AD7618C,0x37A10C7A,0x59F8148E,0xEB133C89,
+	0xCEA927EE,0xB761C935,0xE11CE5ED,0x7A47B13C,
+	0x9CD2DF59,0x55F2733F,0x1814CE79,0x73C737BF,
+	0x53F7CDEA,0x5FFDAA5B,0xDF3D6F14,0x7844DB86,
+	0xCAAFF381,0xB968C43E,0x3824342C,0xC2A3405F,
+	0x161DC372,0xBCE2250C,0x283C498B,0xFF0D9541,
+	0x39A80171,0x080CB3DE,0xD8B4E49C,0x6456C190,
+	0x7BCB8461,0xD532B670,0x486C5C74,0xD0B85742,
+};
+
+/* a round on the columns a, b, c, d of the state: SubBytes, ShiftRows and
+ * MixColumns in 4 lookups */
+#define TE_ROUND(a, b, c, d) (aes_te[(a) >> 24] ^ \
+            rot1(aes_te[((b) >> 16) & 0xff]) ^ \
+            rot2(aes_te[((c) >> 8) & 0xff]) ^ rot3(aes_te[(d) & 0xff]))
+#define TD_ROUND(a, b, c, d) (aes_td[(a) >> 24] ^ \
+            rot1(aes_td[((b) >> 16) & 0xff]) ^ \
+            rot2(aes_td[((c) >> 8) & 0xff]) ^ rot3(aes_td[(d) & 0xff]))
+
+/* the last round, with no MixColumns: the S-box bytes of aes_te, which has
+ * S(x) in its middle two */
+#define TE_LAST(a, b, c, d) (((aes_te[(a) >> 24] << 8) & 0xff000000) ^ \
+            (aes_te[((b) >> 16) & 0xff] & 0x00ff0000) ^ \
+            (aes_te[((c) >> 8) & 0xff] & 0x0000ff00) ^ \
+            ((aes_te[(d) & 0xff] >> 8) & 0x000000ff))
+#define TD_LAST(a, b, c, d) \
+            (((uint32_t)byte_of_aligned_array(aes_isbox, (a) >> 24) << 24) ^ \
+            ((uint32_t)byte_of_aligned_array(aes_isbox, ((b) >> 16) & 0xff) << 16) ^ \
+            ((uint32_t)byte_of_aligned_array(aes_isbox, ((c) >> 8) & 0xff) << 8) ^ \
+            ((uint32_t)byte_of_aligned_array(aes_isbox, (d) & 0xff)))
+#endif
+
 /* ----- static functions ----- */
 static void AES_encrypt(const AES_CTX *ctx, uint32_t *data);
 static void AES_decrypt(const AES_CTX *ctx, uint32_t *data);
@@ -359,6 +537,316 @@ void ICACHE_FLASH_ATTR AES_cbc_decrypt(AES_CTX *ctx, const uint8_t *msg, uint8_t
     os_memcpy(ctx->iv, iv, AES_IV_SIZE);
 }
 
+/**
+ * Encrypt or decrypt a byte sequence of any length with AES in counter mode
+ * (NIST SP 800-38A). The iv is the first counter block, counted up as a 128
+ * bit big endian number, and is left at the one after the last block used,
+ * for the next call to go on from a whole block.
+ */
+void ICACHE_FLASH_ATTR AES_ctr_crypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length)
+{
+    int i, len;
+    uint32_t ctr[4], ks[4], blk[4];
+
+    os_memcpy(ctr, ctx->iv, AES_IV_SIZE);
+    for (i = 0; i < 4; i++)
+        ctr[i] = ntohl(ctr[i]);
+
+    for (; length > 0; length -= len)
+    {
+        len = length < AES_BLOCKSIZE ? length : AES_BLOCKSIZE;
+        os_memcpy(ks, ctr, AES_BLOCKSIZE);
+        AES_encrypt(ctx, ks);
+
+        for (i = 3; i >= 0 && ++ctr[i] == 0; i--)
+            ;
+
+        os_memcpy(blk, msg, len);
+        for (i = 0; i < 4; i++)
+            blk[i] ^= htonl(ks[i]);
+        os_memcpy(out, blk, len);
+
+        msg += len;
+        out += len;
+    }
+
+    for (i = 0; i < 4; i++)
+        ctr[i] = htonl(ctr[i]);
+    os_memcpy(ctx->iv, ctr, AES_IV_SIZE);
+}
+
+/*
+ * What the 4 bits shifted out of the bottom of a GHASH value by gf_mul put
+ * back into its top word, in the bit order of GCM: a word table, for flash.
+ */
+static const uint32_t ghash_last4[16] ICACHE_STORE_ATTR ICACHE_RODATA_ATTR =
+{
+    0x00000000, 0x1c200000, 0x38400000, 0x24600000,
+    0x70800000, 0x6ca00000, 0x48c00000, 0x54e00000,
+    0xe1000000, 0xfd200000, 0xd9400000, 0xc5600000,
+    0x91800000, 0x8da00000, 0xa9c00000, 0xb5e00000
+};
+
+/*
+ * x = x*H in GF(2^128), 4 bits of x at a time from its last up: shift the
+ * product 4 bits, reduce what falls off, add the multiple of H for the next
+ * 4 bits. The words are those of the block read big endian, so the 4 bits
+ * come from the bottom of the last word up.
+ */
+static void ICACHE_FLASH_ATTR gf_mul(const AES_GCM_CTX *ctx, uint32_t *x)
+{
+    uint32_t z0 = 0, z1 = 0, z2 = 0, z3 = 0, rem, w;
+    int i, j;
+
+    for (i = 3; i >= 0; i--)
+    {
+        for (w = x[i], j = 0; j < 8; j++, w >>= 4)
+        {
+            const uint32_t *h = ctx->hh[w & 0x0f];
+
+            rem = z3 & 0x0f;
+            z3 = (z2 << 28) | (z3 >> 4);
+            z2 = (z1 << 28) | (z2 >> 4);
+            z1 = (z0 << 28) | (z1 >> 4);
+            z0 = (z0 >> 4) ^ ghash_last4[rem];
+
+            z0 ^= h[0];
+            z1 ^= h[1];
+            z2 ^= h[2];
+            z3 ^= h[3];
+        }
+    }
+
+    x[0] = z0;
+    x[1] = z1;
+    x[2] = z2;
+    x[3] = z3;
+}
+
+/*
+ * Fold up to a block of bytes into the GHASH value, the rest of the block
+ * taken as zeroes.
+ */
+static void ICACHE_FLASH_ATTR ghash_update(const AES_GCM_CTX *ctx, uint32_t *y,
+        const uint8_t *data, int length)
+{
+    uint32_t blk[4];
+    int i;
+
+    os_memset(blk, 0, AES_BLOCKSIZE);
+    os_memcpy(blk, data, length);
+
+    for (i = 0; i < 4; i++)
+        y[i] ^= ntohl(blk[i]);
+
+    gf_mul(ctx, y);
+}
+
+/**
+ * Set up AES-GCM with the key: the key schedule and the multiples of the
+ * hash key H, the encryption of a block of zeroes.
+ */
+void ICACHE_FLASH_ATTR AES_gcm_set_key(AES_GCM_CTX *ctx, const uint8_t *key, 
+        AES_MODE mode)
+{
+    static const uint8_t zero_iv[AES_IV_SIZE];
+    uint32_t v[4];
+    int i, j, k;
+
+    AES_set_key(&ctx->aes, key, zero_iv, mode);
+    os_memset(v, 0, sizeof(v));
+    AES_encrypt(&ctx->aes, v);
+
+    /* H is 8 in the bit order of GCM, where halving is a multiplication by
+     * x; the other multiples are the sums of those */
+    os_memset(ctx->hh[0], 0, sizeof(ctx->hh[0]));
+    os_memcpy(ctx->hh[8], v, sizeof(v));
+
+    for (i = 4; i > 0; i >>= 1)
+    {
+        uint32_t t = (v[3] & 1) ? 0xe1000000 : 0;
+        v[3] = (v[2] << 31) | (v[3] >> 1);
+        v[2] = (v[1] << 31) | (v[2] >> 1);
+        v[1] = (v[0] << 31) | (v[1] >> 1);
+        v[0] = (v[0] >> 1) ^ t;
+        os_memcpy(ctx->hh[i], v, sizeof(v));
+    }
+
+    for (i = 2; i <= 8; i *= 2)
+    {
+        for (j = 1; j < i; j++)
+        {
+            for (k = 0; k < 4; k++)
+                ctx->hh[i+j][k] = ctx->hh[i][k] ^ ctx->hh[j][k];
+        }
+    }
+}
+
+/*
+ * The one pass of AES-GCM both ways: each block is put through the counter
+ * mode and GHASH while it is at hand, GHASH taking the ciphertext, which is
+ * the input when decrypting. The tag is left in the words of tag_32.
+ */
+static void ICACHE_FLASH_ATTR gcm_crypt(const AES_GCM_CTX *ctx, const uint8_t *iv,
+        const uint8_t *aad, int aad_len, const uint8_t *msg, uint8_t *out,
+        int length, int is_decrypt, uint32_t *tag_32)
+{
+    uint32_t ctr[4], j0[4], y[4], blk[4], ks[4];
+    int i, n;
+
+    os_memcpy(ctr, iv, AES_GCM_IV_SIZE);
+    for (i = 0; i < 3; i++)
+        ctr[i] = ntohl(ctr[i]);
+    ctr[3] = 1;                 /* J0 = IV || 0^31 || 1 */
+    os_memcpy(j0, ctr, sizeof(j0));
+    AES_encrypt(&ctx->aes, j0);
+    os_memset(y, 0, sizeof(y));
+
+    for (i = 0; i < aad_len; i += AES_BLOCKSIZE)
+        ghash_update(ctx, y, &aad[i],
+                aad_len - i < AES_BLOCKSIZE ? aad_len - i : AES_BLOCKSIZE);
+
+    for (n = length; n > 0; n -= AES_BLOCKSIZE)
+    {
+        int len = n < AES_BLOCKSIZE ? n : AES_BLOCKSIZE;
+
+        ctr[3]++;
+        os_memcpy(ks, ctr, sizeof(ks));
+        AES_encrypt(&ctx->aes, ks);
+
+        if (is_decrypt)
+            ghash_update(ctx, y, msg, len);
+
+        os_memcpy(blk, msg, len);
+        for (i = 0; i < 4; i++)
+            blk[i] ^= htonl(ks[i]);
+        os_memcpy(out, blk, len);
+
+        if (!is_decrypt)
+            ghash_update(ctx, y, out, len);
+
+        msg += len;
+        out += len;
+    }
+
+    /* the lengths in bits */
+    y[0] ^= (uint32_t)aad_len >> 29;
+    y[1] ^= (uint32_t)aad_len << 3;
+    y[2] ^= (uint32_t)length >> 29;
+    y[3] ^= (uint32_t)length << 3;
+    gf_mul(ctx, y);
+
+    for (i = 0; i < 4; i++)
+        tag_32[i] = htonl(y[i] ^ j0[i]);
+}
+
+/**
+ * Encrypt and authenticate a byte sequence with AES-GCM, the tag to tag.
+ */
+void ICACHE_FLASH_ATTR AES_gcm_encrypt(const AES_GCM_CTX *ctx, const uint8_t *iv,
+        const uint8_t *aad, int aad_len, const uint8_t *msg, uint8_t *out,
+        int length, uint8_t *tag)
+{
+    uint32_t tag_32[4];
+
+    gcm_crypt(ctx, iv, aad, aad_len, msg, out, length, 0, tag_32);
+    os_memcpy(tag, tag_32, AES_GCM_TAG_SIZE);
+}
+
+/**
+ * Decrypt a byte sequence with AES-GCM and check its tag, in a time that
+ * does not tell how much of it is right: 0 if it is, -1 if not.
+ */
+int ICACHE_FLASH_ATTR AES_gcm_decrypt(const AES_GCM_CTX *ctx, const uint8_t *iv,
+        const uint8_t *aad, int aad_len, const uint8_t *msg, uint8_t *out,
+        int length, const uint8_t *tag)
+{
+    uint32_t tag_32[4];
+    const uint8_t *t = (const uint8_t *)tag_32;
+    uint8_t diff = 0;
+    int i;
+
+    gcm_crypt(ctx, iv, aad, aad_len, msg, out, length, 1, tag_32);
+
+    for (i = 0; i < AES_GCM_TAG_SIZE; i++)
+        diff |= t[i] ^ tag[i];
+
+    return diff ? -1 : 0;
+}
+
+#ifdef CONFIG_AES_TTABLE
+/**
+ * Encrypt a single block (16 bytes) of data
+ */
+static void ICACHE_FLASH_ATTR AES_encrypt(const AES_CTX *ctx, uint32_t *data)
+{
+    const uint32_t *k = ctx->ks;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    int curr_rnd;
+
+    /* Pre-round key addition */
+    s0 = data[0] ^ k[0];
+    s1 = data[1] ^ k[1];
+    s2 = data[2] ^ k[2];
+    s3 = data[3] ^ k[3];
+
+    for (curr_rnd = 1; curr_rnd < ctx->rounds; curr_rnd++)
+    {
+        k += 4;
+        t0 = TE_ROUND(s0, s1, s2, s3) ^ k[0];
+        t1 = TE_ROUND(s1, s2, s3, s0) ^ k[1];
+        t2 = TE_ROUND(s2, s3, s0, s1) ^ k[2];
+        t3 = TE_ROUND(s3, s0, s1, s2) ^ k[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    k += 4;
+    data[0] = TE_LAST(s0, s1, s2, s3) ^ k[0];
+    data[1] = TE_LAST(s1, s2, s3, s0) ^ k[1];
+    data[2] = TE_LAST(s2, s3, s0, s1) ^ k[2];
+    data[3] = TE_LAST(s3, s0, s1, s2) ^ k[3];
+}
+
+/**
+ * Decrypt a single block (16 bytes) of data, with the round keys of
+ * AES_convert_key
+ */
+static void ICACHE_FLASH_ATTR AES_decrypt(const AES_CTX *ctx, uint32_t *data)
+{
+    const uint32_t *k = ctx->ks + ctx->rounds*4;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    int curr_rnd;
+
+    /* pre-round key addition */
+    s0 = data[0] ^ k[0];
+    s1 = data[1] ^ k[1];
+    s2 = data[2] ^ k[2];
+    s3 = data[3] ^ k[3];
+
+    for (curr_rnd = 1; curr_rnd < ctx->rounds; curr_rnd++)
+    {
+        k -= 4;
+        t0 = TD_ROUND(s0, s3, s2, s1) ^ k[0];
+        t1 = TD_ROUND(s1, s0, s3, s2) ^ k[1];
+        t2 = TD_ROUND(s2, s1, s0, s3) ^ k[2];
+        t3 = TD_ROUND(s3, s2, s1, s0) ^ k[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    k -= 4;
+    data[0] = TD_LAST(s0, s3, s2, s1) ^ k[0];
+    data[1] = TD_LAST(s1, s0, s3, s2) ^ k[1];
+    data[2] = TD_LAST(s2, s1, s0, s3) ^ k[2];
+    data[3] = TD_LAST(s3, s2, s1, s0) ^ k[3];
+}
+
+#else
 /**
  * Encrypt a single block (16 bytes) of data
  */
@@ -475,4 +963,6 @@ static void ICACHE_FLASH_ATTR AES_decrypt(const AES_CTX *ctx, uint32_t *data)
     }
 }
 
+#endif /* CONFIG_AES_TTABLE */
+
 #endif
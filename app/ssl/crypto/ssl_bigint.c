@@ -46,6 +46,8 @@
  * - Karatsuba multiplication
  * - Squaring
  * - Sliding window exponentiation
+ * - Montgomery exponentiation on the components, with Barrett or Classical
+ *   reduction elsewhere
  * - Chinese Remainder Theorem (implemented in rsa.c).
  *
  * All the algorithms used are pretty standard, and designed for different
@@ -81,7 +83,7 @@ static bigint *alloc(BI_CTX *ctx, int size);
 static bigint *trim(bigint *bi);
 static void more_comps(bigint *bi, int n);
 #if defined(CONFIG_BIGINT_KARATSUBA) || defined(CONFIG_BIGINT_BARRETT) || \
-    defined(CONFIG_BIGINT_MONTGOMERY)
+    defined(CONFIG_BIGINT_MONTGOMERY) || defined(CONFIG_BIGINT_MONT_POWER)
 static bigint *comp_right_shift(bigint *biR, int num_shifts);
 static bigint *comp_left_shift(bigint *biR, int num_shifts);
 #endif
@@ -525,7 +527,7 @@ static bigint * ICACHE_FLASH_ATTR bi_int_divide(BI_CTX *ctx, bigint *biR, comp d
     return trim(biR);
 }
 
-#ifdef CONFIG_BIGINT_MONTGOMERY
+#if defined(CONFIG_BIGINT_MONTGOMERY) || defined(CONFIG_BIGINT_MONT_POWER)
 /**
  * There is a need for the value of integer N' such that B^-1(B-1)-N^-1N'=1, 
  * where B^-1(B-1) mod N=1. Actually, only the least significant part of 
@@ -556,7 +558,7 @@ static comp ICACHE_FLASH_ATTR modular_inverse(bigint *bim)
 #endif
 
 #if defined(CONFIG_BIGINT_KARATSUBA) || defined(CONFIG_BIGINT_BARRETT) || \
-    defined(CONFIG_BIGINT_MONTGOMERY)
+    defined(CONFIG_BIGINT_MONTGOMERY) || defined(CONFIG_BIGINT_MONT_POWER)
 /**
  * Take each component and shift down (in terms of components) 
  */
@@ -778,6 +780,12 @@ void ICACHE_FLASH_ATTR bi_set_mod(BI_CTX *ctx, bigint *bim, int mod_offset)
             bi_clone(ctx, ctx->bi_radix), k*2-1), ctx->bi_mod[mod_offset], 0);
     bi_permanent(ctx->bi_mu[mod_offset]);
 #endif
+
+#ifdef CONFIG_BIGINT_MONT_POWER
+    /* bi_mod_power() works in Montgomery form when the modulus is odd, as
+     * those of RSA are */
+    ctx->N0_dash[mod_offset] = (bim->comps[0] & 1) ? modular_inverse(bim) : 0;
+#endif
 }
 
 /**
@@ -1102,7 +1110,7 @@ static bigint * ICACHE_FLASH_ATTR alloc(BI_CTX *ctx, int size)
 #ifdef CONFIG_SSL_FULL_MODE
             ssl_printf("alloc: refs was not 0\n");
 #endif
-            return;     /* wujg : org ----> abort(); */
+            return NULL;     /* wujg : org ----> abort(); */
         }
 
         more_comps(biR, size);
@@ -1153,19 +1161,8 @@ static int ICACHE_FLASH_ATTR find_max_exp_index(bigint *biexp)
  */
 static int ICACHE_FLASH_ATTR exp_bit_is_one(bigint *biexp, int offset)
 {
-    comp test = biexp->comps[offset / COMP_BIT_SIZE];
-    int num_shifts = offset % COMP_BIT_SIZE;
-    comp shift = 1;
-    int i;
-
     check(biexp);
-
-    for (i = 0; i < num_shifts; i++)
-    {
-        shift <<= 1;
-    }
-
-    return (test & shift) != 0;
+    return (biexp->comps[offset / COMP_BIT_SIZE] >> (offset % COMP_BIT_SIZE)) & 1;
 }
 
 #ifdef CONFIG_BIGINT_CHECK_ON
@@ -1303,6 +1300,256 @@ bigint * ICACHE_FLASH_ATTR bi_barrett(BI_CTX *ctx, bigint *bi)
 }
 #endif /* CONFIG_BIGINT_BARRETT */
 
+#ifdef CONFIG_BIGINT_MONT_POWER
+/*
+ * Multiply a and b, of k components each, into t, which has 2k+1. When a is b
+ * the cross products are worked out once and doubled.
+ */
+static void ICACHE_FLASH_ATTR mont_product(comp *t, const comp *a, const comp *b, int k)
+{
+    int i, j;
+    long_comp carry;
+    comp top = 0;
+
+    os_memset(t, 0, (2*k+1)*COMP_BYTE_SIZE);
+
+    if (a != b)
+    {
+        for (i = 0; i < k; i++)
+        {
+            carry = 0;
+
+            for (j = 0; j < k; j++)
+            {
+                carry += (long_comp)a[i]*b[j] + t[i+j];
+                t[i+j] = (comp)carry;
+                carry >>= COMP_BIT_SIZE;
+            }
+
+            t[i+k] = (comp)carry;
+        }
+
+        return;
+    }
+
+    for (i = 0; i < k-1; i++)
+    {
+        carry = 0;
+
+        for (j = i+1; j < k; j++)
+        {
+            carry += (long_comp)a[i]*a[j] + t[i+j];
+            t[i+j] = (comp)carry;
+            carry >>= COMP_BIT_SIZE;
+        }
+
+        t[i+k] = (comp)carry;
+    }
+
+    for (i = 0; i < 2*k; i++)
+    {
+        comp w = t[i];
+        t[i] = (comp)(w << 1) | top;
+        top = w >> (COMP_BIT_SIZE-1);
+    }
+
+    carry = 0;
+
+    for (i = 0; i < k; i++)
+    {
+        long_comp sq = (long_comp)a[i]*a[i];
+
+        carry += (comp)sq + (long_comp)t[2*i];
+        t[2*i] = (comp)carry;
+        carry >>= COMP_BIT_SIZE;
+        carry += (sq >> COMP_BIT_SIZE) + t[2*i+1];
+        t[2*i+1] = (comp)carry;
+        carry >>= COMP_BIT_SIZE;
+    }
+}
+
+/*
+ * Montgomery reduction of the product in t into r: t/R mod m, for R the radix
+ * to the power k. r may be one of the factors of t.
+ */
+static void ICACHE_FLASH_ATTR mont_reduce(comp *r, comp *t, const comp *m, comp n0, int k)
+{
+    comp *s = t + k;
+    int i, j;
+
+    for (i = 0; i < k; i++)
+    {
+        comp u = (comp)((long_comp)t[i]*n0);
+        long_comp carry = 0;
+
+        for (j = 0; j < k; j++)
+        {
+            carry += (long_comp)u*m[j] + t[i+j];
+            t[i+j] = (comp)carry;
+            carry >>= COMP_BIT_SIZE;
+        }
+
+        for (j = i+k; carry; j++)
+        {
+            carry += t[j];
+            t[j] = (comp)carry;
+            carry >>= COMP_BIT_SIZE;
+        }
+    }
+
+    /* what is left is below 2m, so one subtraction at most */
+    for (j = k-1; j > 0 && s[j] == m[j]; j--)
+        ;
+
+    if (s[k] || s[j] >= m[j])
+    {
+        comp borrow = 0;
+
+        for (j = 0; j < k; j++)
+        {
+            long_comp d = (long_comp)s[j] - m[j] - borrow;
+            r[j] = (comp)d;
+            borrow = (comp)(d >> COMP_BIT_SIZE) & 1;
+        }
+    }
+    else
+    {
+        os_memcpy(r, s, k*COMP_BYTE_SIZE);
+    }
+}
+
+/*
+ * The number of bits in the sliding window for an exponent of so many bits:
+ * the one with the fewest multiplications, the table's and the exponent's.
+ */
+static int ICACHE_FLASH_ATTR slide_window_size(int bits)
+{
+#ifdef CONFIG_BIGINT_SLIDING_WINDOW
+    int window = bits > 671 ? 6 : bits > 239 ? 5 : bits > 79 ? 4 :
+                 bits > 23 ? 3 : 1;
+    return min(window, CONFIG_BIGINT_MAX_WINDOW);
+#else
+    return 1;
+#endif
+}
+
+/*
+ * bi_mod_power() for a modulus with Montgomery constants. The residues are
+ * arrays of k components in one allocation, with the table of odd powers of
+ * bi, and every multiplication is reduced in place. The allocation is about
+ * 5 KB for a 2048-bit modulus: short of heap the window is made smaller, and
+ * without room for even one power NULL is returned, bi and biexp untouched.
+ */
+static bigint * ICACHE_FLASH_ATTR mont_power(BI_CTX *ctx, bigint *bi, bigint *biexp)
+{
+    uint8_t mod_offset = ctx->mod_offset;
+    bigint *bim = ctx->bi_mod[mod_offset];
+    comp n0 = ctx->N0_dash[mod_offset];
+    comp *m = bim->comps;
+    int k = bim->size;
+    int i = find_max_exp_index(biexp), j, started = 0;
+    int window_size = slide_window_size(i+1);
+    int num_g = 1 << (window_size-1);
+    comp *t, *acc, *g;
+    bigint *biR;
+
+    check(bi);
+    check(biexp);
+
+    while ((t = (comp *)os_malloc((2*k+1 + k + k*num_g)*COMP_BYTE_SIZE)) == NULL)
+    {
+        if (window_size == 1)
+            return NULL;
+
+        window_size--;
+        num_g >>= 1;
+    }
+
+    acc = t + 2*k+1;
+    g = acc + k;
+
+    /* g^1 in Montgomery form, bi*R mod m, on a copy: bi_divide() may work in
+     * place, and bi_crt() shares bi. Then g^3, g^5... by g^2 in acc */
+    biR = bi_divide(ctx, comp_left_shift(bi_clone(ctx, bi), k), bim, 1);
+    os_memset(g, 0, k*COMP_BYTE_SIZE);
+    os_memcpy(g, biR->comps, biR->size*COMP_BYTE_SIZE);
+    bi_free(ctx, biR);
+
+    if (num_g > 1)
+    {
+        mont_product(t, g, g, k);
+        mont_reduce(acc, t, m, n0, k);
+
+        for (j = 1; j < num_g; j++)
+        {
+            mont_product(t, g + (j-1)*k, acc, k);
+            mont_reduce(g + j*k, t, m, n0, k);
+        }
+    }
+
+    /* as bi_mod_power(), but the first window is a copy, not a multiply */
+    do
+    {
+        if (exp_bit_is_one(biexp, i))
+        {
+            int l = i-window_size+1;
+            int part_exp = 0;
+
+            if (l < 0)  /* LSB of exponent will always be 1 */
+                l = 0;
+            else
+            {
+                while (exp_bit_is_one(biexp, l) == 0)
+                    l++;    /* go back up */
+            }
+
+            for (j = i; j >= l; j--)
+            {
+                if (started)
+                {
+                    mont_product(t, acc, acc, k);
+                    mont_reduce(acc, t, m, n0, k);
+                }
+
+                part_exp = (part_exp << 1) | exp_bit_is_one(biexp, j);
+            }
+
+            part_exp = (part_exp-1)/2;  /* adjust for array */
+
+            if (started)
+            {
+                mont_product(t, acc, g + part_exp*k, k);
+                mont_reduce(acc, t, m, n0, k);
+            }
+            else
+            {
+                os_memcpy(acc, g + part_exp*k, k*COMP_BYTE_SIZE);
+                started = 1;
+            }
+
+            i = l-1;
+        }
+        else    /* square it */
+        {
+            mont_product(t, acc, acc, k);
+            mont_reduce(acc, t, m, n0, k);
+            i--;
+        }
+    } while (i >= 0);
+
+    /* out of Montgomery form: acc/R */
+    os_memset(t, 0, (2*k+1)*COMP_BYTE_SIZE);
+    os_memcpy(t, acc, k*COMP_BYTE_SIZE);
+    biR = alloc(ctx, k);
+    mont_reduce(biR->comps, t, m, n0, k);
+
+    os_free(t);
+    bi_free(ctx, bi);
+    bi_free(ctx, biexp);
+    return trim(biR);
+}
+#endif
+
 #ifdef CONFIG_BIGINT_SLIDING_WINDOW
 /*
  * Work out g1, g3, g5, g7... etc for the sliding-window algorithm 
@@ -1346,8 +1593,19 @@ static void ICACHE_FLASH_ATTR precompute_slide_window(BI_CTX *ctx, int window, b
  */
 bigint * ICACHE_FLASH_ATTR bi_mod_power(BI_CTX *ctx, bigint *bi, bigint *biexp)
 {
-    int i = find_max_exp_index(biexp), j, window_size = 1;
-    bigint *biR = int_to_bi(ctx, 1);
+    int i, j, window_size = 1;
+    bigint *biR;
+
+#ifdef CONFIG_BIGINT_MONT_POWER
+    if (ctx->N0_dash[ctx->mod_offset] &&
+            (biR = mont_power(ctx, bi, biexp)) != NULL)
+    {
+        return biR;
+    }
+#endif
+
+    i = find_max_exp_index(biexp);
+    biR = int_to_bi(ctx, 1);
 
 #if defined(CONFIG_BIGINT_MONTGOMERY)
     uint8_t mod_offset = ctx->mod_offset;
@@ -1368,6 +1626,8 @@ bigint * ICACHE_FLASH_ATTR bi_mod_power(BI_CTX *ctx, bigint *bi, bigint *biexp)
     for (j = i; j > 32; j /= 5) /* work out an optimum size */
         window_size++;
 
+    window_size = min(window_size, CONFIG_BIGINT_MAX_WINDOW);
+
     /* work out the slide constants */
     precompute_slide_window(ctx, window_size, bi);
 #else   /* just one constant */
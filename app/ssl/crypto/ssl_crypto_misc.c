@@ -39,6 +39,7 @@
 
 #include "ssl/ssl_os_port.h"
 #include "ssl/ssl_crypto_misc.h"
+#include "user_interface.h"
 #ifdef CONFIG_WIN32_USE_CRYPTO_LIB
 #include "wincrypt.h"
 #endif
@@ -52,7 +53,7 @@ static HCRYPTPROV gCryptProv;
 #if (!defined(CONFIG_USE_DEV_URANDOM) && !defined(CONFIG_WIN32_USE_CRYPTO_LIB))
 /* change to processor registers as appropriate */
 #define ENTROPY_POOL_SIZE 32
-#define ENTROPY_COUNTER1 ((((uint64_t)tv.tv_sec)<<32) | tv.tv_usec)
+#define ENTROPY_COUNTER1 ((uint64_t)system_get_time())
 #define ENTROPY_COUNTER2 rand()
 static uint8_t entropy_pool[ENTROPY_POOL_SIZE];
 #endif
@@ -126,10 +127,10 @@ EXP_FUNC void STDCALL ICACHE_FLASH_ATTR RNG_initialize()
         }
     }
 #else
-    /* start of with a stack to copy across */
-    int i;
-    os_memcpy(entropy_pool, &i, ENTROPY_POOL_SIZE);
-    srand((unsigned int)&i); 
+    /* start off with the time and a stack address */
+    uint32_t t = system_get_time();
+    os_memcpy(entropy_pool, &t, sizeof(t));
+    srand(t ^ (unsigned int)&t); 
 #endif
 }
 
@@ -173,14 +174,12 @@ EXP_FUNC void STDCALL ICACHE_FLASH_ATTR get_random(int num_rand_bytes, uint8_t *
     /* The method we use when we've got nothing better. Use RC4, time 
        and a couple of random seeds to generate a random sequence */
     RC4_CTX rng_ctx;
-    struct timeval tv;
     MD5_CTX rng_digest_ctx;
     uint8_t digest[MD5_SIZE];
     uint64_t *ep;
     int i;
 
     /* A proper implementation would use counters etc for entropy */
-//    gettimeofday(&tv, NULL);    
     ep = (uint64_t *)entropy_pool;
     ep[0] ^= ENTROPY_COUNTER1;
     ep[1] ^= ENTROPY_COUNTER2; 
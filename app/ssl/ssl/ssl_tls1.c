@@ -51,6 +51,8 @@ static const char * server_finished = "server finished";
 static const char * client_finished = "client finished";
 
 static int do_handshake(SSL *ssl, uint8_t *buf, int read_len);
+static int handshake_record(SSL *ssl, int offset, int read_len);
+static int bm_resize(SSL *ssl, int size);
 static int set_key_block(SSL *ssl, int is_write);
 static int verify_digest(SSL *ssl, int mode, const uint8_t *buf, int read_len);
 static void *crypt_new(SSL *ssl, uint8_t *key, uint8_t *iv, int is_decrypt);
@@ -68,11 +70,14 @@ static void session_free(SSL_SESSION *ssl_sessions[], int sess_index);
 
 const uint8_t ssl_prot_prefs[NUM_PROTOCOLS] = 
 #ifdef CONFIG_SSL_PROT_LOW                  /* low security, fast speed */
-{ SSL_RC4_128_SHA, SSL_AES128_SHA, SSL_AES256_SHA, SSL_RC4_128_MD5 };
+{ SSL_RC4_128_SHA, SSL_AES128_GCM_SHA256, SSL_AES128_SHA, SSL_AES256_SHA,
+  SSL_RC4_128_MD5 };
 #elif CONFIG_SSL_PROT_MEDIUM                /* medium security, medium speed */
-{ SSL_AES128_SHA, SSL_AES256_SHA, SSL_RC4_128_SHA, SSL_RC4_128_MD5 };    
+{ SSL_AES128_GCM_SHA256, SSL_AES128_SHA, SSL_AES256_SHA, SSL_RC4_128_SHA,
+  SSL_RC4_128_MD5 };    
 #else /* CONFIG_SSL_PROT_HIGH */            /* high security, low speed */
-{ SSL_AES256_SHA, SSL_AES128_SHA, SSL_RC4_128_SHA, SSL_RC4_128_MD5 };
+{ SSL_AES128_GCM_SHA256, SSL_AES256_SHA, SSL_AES128_SHA, SSL_RC4_128_SHA,
+  SSL_RC4_128_MD5 };
 #endif
 #endif /* CONFIG_SSL_SKELETON_MODE */
 
@@ -97,6 +102,22 @@ static const cipher_info_t cipher_info[NUM_PROTOCOLS] =
 #else
 static const cipher_info_t cipher_info[NUM_PROTOCOLS] = 
 {
+    /*
+     * An AEAD suite has no MAC: its digest is the tag, and its records are
+     * sealed and opened by aead_encrypt and aead_decrypt. The IV of the key
+     * block is the implicit part of the nonce.
+     */
+    {   /* AES128-GCM-SHA256 */
+        SSL_AES128_GCM_SHA256,          /* AES128-GCM-SHA256 */
+        16,                             /* key size */
+        4,                              /* iv size */ 
+        2*(16+4),                       /* key block size */
+        0,                              /* no padding */
+        AES_GCM_TAG_SIZE,               /* digest size */
+        NULL,                           /* no hmac */
+        NULL,                           /* encrypt */
+        NULL                            /* decrypt */
+    },
     {   /* AES128-SHA */
         SSL_AES128_SHA,                 /* AES128-SHA */
         16,                             /* key size */
@@ -148,8 +169,21 @@ static const cipher_info_t cipher_info[NUM_PROTOCOLS] =
 };
 #endif
 
-static void prf(const uint8_t *sec, int sec_len, uint8_t *seed, int seed_len,
-        uint8_t *out, int olen);
+#ifndef CONFIG_SSL_SKELETON_MODE
+/* the part of the nonce of an AEAD suite sent with each record */
+#define AEAD_EXPLICIT_IV_SIZE       8
+
+/* the cipher context of an AEAD suite: its key, and the implicit part of the
+ * nonce from the key block */
+typedef struct
+{
+    AES_GCM_CTX gcm;
+    uint8_t salt[4];
+} AEAD_CTX;
+#endif
+
+static void prf(SSL *ssl, const uint8_t *sec, int sec_len,
+        uint8_t *seed, int seed_len, uint8_t *out, int olen);
 static const cipher_info_t *get_cipher_info(uint8_t cipher);
 static void increment_read_sequence(SSL *ssl);
 static void increment_write_sequence(SSL *ssl);
@@ -242,6 +276,19 @@ EXP_FUNC void STDCALL ICACHE_FLASH_ATTR ssl_ctx_free(SSL_CTX *ssl_ctx)
     os_free(ssl_ctx);
 }
 
+/*
+ * Ask for a smaller fragment on the connections of a client context.
+ */
+EXP_FUNC int STDCALL ICACHE_FLASH_ATTR ssl_ctx_set_max_fragment(SSL_CTX *ssl_ctx, int length)
+{
+    if (length != 0 && length != 512 && length != 1024 &&
+            length != 2048 && length != RT_MAX_PLAIN_LENGTH)
+        return SSL_NOT_OK;
+
+    ssl_ctx->max_plain_length = length;
+    return SSL_OK;
+}
+
 /*
  * Free any used resources used by this connection.
  */
@@ -283,6 +330,7 @@ EXP_FUNC void STDCALL ICACHE_FLASH_ATTR ssl_free(SSL *ssl)
     x509_free(ssl->x509_ctx);
 #endif
 
+    os_free(ssl->bm_all_data);
     os_free(ssl);
 }
 
@@ -321,8 +369,8 @@ EXP_FUNC int STDCALL ICACHE_FLASH_ATTR ssl_write(SSL *ssl, const uint8_t *out_da
     {
         nw = n;
 
-        if (nw > RT_MAX_PLAIN_LENGTH)    /* fragment if necessary */
-            nw = RT_MAX_PLAIN_LENGTH;
+        if (nw > ssl->max_plain_length)  /* fragment if necessary */
+            nw = ssl->max_plain_length;
 
         if ((i = send_packet(ssl, PT_APP_PROTOCOL_DATA, 
                                             &out_data[tot], nw)) <= 0)
@@ -602,19 +650,59 @@ SSL *ICACHE_FLASH_ATTR ssl_new(SSL_CTX *ssl_ctx, int client_fd)
 }
 #endif
 
+/*
+ * Give the record buffer another size. This moves it, so it is only done
+ * between records, when nothing points into it.
+ */
+static int ICACHE_FLASH_ATTR bm_resize(SSL *ssl, int size)
+{
+    uint8_t *bm_all_data = (uint8_t *)os_realloc(ssl->bm_all_data, size);
+
+    if (bm_all_data == NULL)
+        return SSL_NOT_OK;
+
+    ssl->bm_all_data = bm_all_data;
+    ssl->bm_data = bm_all_data + BM_RECORD_OFFSET; /* space at the start */
+    ssl->bm_size = size;
+    return SSL_OK;
+}
+
 /*
  * Get a new ssl context for a new connection.(raw api)add by ives 12.12.2013
  */
 SSL *ICACHE_FLASH_ATTR ssl_new_context(SSL_CTX *ssl_ctx, struct tcp_pcb *SslClient_pcb)
 {
 	SSL *ssl = (SSL *)os_zalloc(sizeof(SSL));
+    int i, size, cert_size = 7;
+
+    if (ssl == NULL)
+        return NULL;
+
+    /* the record buffer, for the fragment length the client will ask for,
+     * and for our certificate chain in as many records as that takes */
+    ssl->max_plain_length = ssl_ctx->max_plain_length ?
+                        ssl_ctx->max_plain_length : RT_MAX_PLAIN_LENGTH;
+    size = BM_BUFFER_SIZE(ssl->max_plain_length);
+
+    for (i = 0; i < ssl_ctx->chain_length; i++)
+        cert_size += 3 + ssl_ctx->certs[i].size;
+
+    cert_size += (cert_size / ssl->max_plain_length + 1) * SSL_RECORD_SIZE;
+    if (ssl_ctx->chain_length && size < cert_size)
+        size = cert_size;
+
+    if (bm_resize(ssl, size) != SSL_OK)
+    {
+        os_free(ssl);
+        return NULL;
+    }
+
     ssl->ssl_ctx = ssl_ctx;
     ssl->need_bytes = SSL_RECORD_SIZE;      /* need a record */
     //ssl->client_fd = client_fd;annotation by ives 12.12.2013
     ssl->SslClient_pcb = SslClient_pcb;
 	ssl->ssl_pbuf = NULL;
     ssl->flag = SSL_NEED_RECORD;
-    ssl->bm_data = ssl->bm_all_data + BM_RECORD_OFFSET; /* space at the start */
     ssl->hs_status = SSL_NOT_OK;            /* not connected */
 #ifdef CONFIG_ENABLE_VERIFICATION
     ssl->ca_cert_ctx = ssl_ctx->ca_cert_ctx;
@@ -790,6 +878,7 @@ void ICACHE_FLASH_ATTR add_packet(SSL *ssl, const uint8_t *pkt, int len)
 {
     MD5_Update(&ssl->dc->md5_ctx, pkt, len);
     SHA1_Update(&ssl->dc->sha1_ctx, pkt, len);
+    SHA256_Update(&ssl->dc->sha256_ctx, pkt, len);
 }
 
 /**
@@ -849,16 +938,53 @@ static void ICACHE_FLASH_ATTR p_hash_sha1(const uint8_t *sec, int sec_len,
 }
 
 /**
- * Work out the PRF.
+ * Work out the SHA256 PRF.
  */
-static void ICACHE_FLASH_ATTR prf(const uint8_t *sec, int sec_len, uint8_t *seed, int seed_len,
-        uint8_t *out, int olen)
+static void ICACHE_FLASH_ATTR p_hash_sha256(const uint8_t *sec, int sec_len, 
+        uint8_t *seed, int seed_len, uint8_t *out, int olen)
+{
+    uint8_t a1[128];
+
+    /* A(1) */
+    ssl_hmac_sha256(seed, seed_len, sec, sec_len, a1);
+    os_memcpy(&a1[SHA256_SIZE], seed, seed_len);
+    ssl_hmac_sha256(a1, SHA256_SIZE+seed_len, sec, sec_len, out);
+
+    while (olen > SHA256_SIZE)
+    {
+        uint8_t a2[SHA256_SIZE];
+        out += SHA256_SIZE;
+        olen -= SHA256_SIZE;
+
+        /* A(N) */
+        ssl_hmac_sha256(a1, SHA256_SIZE, sec, sec_len, a2);
+        os_memcpy(a1, a2, SHA256_SIZE);
+
+        /* work out the actual hash */
+        ssl_hmac_sha256(a1, SHA256_SIZE+seed_len, sec, sec_len, out);
+    }
+}
+
+/**
+ * Work out the PRF: that of TLS 1.2 is P_SHA256 alone, that of the versions
+ * before it P_MD5 and P_SHA1 over the two halves of the secret.
+ */
+static void ICACHE_FLASH_ATTR prf(SSL *ssl, const uint8_t *sec, int sec_len,
+        uint8_t *seed, int seed_len, uint8_t *out, int olen)
 {
     int len, i;
     const uint8_t *S1, *S2;
     uint8_t xbuf[256]; /* needs to be > the amount of key data */
     uint8_t ybuf[256]; /* needs to be > the amount of key data */
 
+    if (ssl->version >= SSL_PROTOCOL_VERSION1_2)
+    {
+        /* the hash is written a whole block at a time */
+        p_hash_sha256(sec, sec_len, seed, seed_len, xbuf, olen);
+        os_memcpy(out, xbuf, olen);
+        return;
+    }
+
     len = sec_len/2;
     S1 = sec;
     S2 = &sec[len];
@@ -881,33 +1007,34 @@ void ICACHE_FLASH_ATTR generate_master_secret(SSL *ssl, const uint8_t *premaster
     os_strcpy((char *)buf, "master secret");
     os_memcpy(&buf[13], ssl->dc->client_random, SSL_RANDOM_SIZE);
     os_memcpy(&buf[45], ssl->dc->server_random, SSL_RANDOM_SIZE);
-    prf(premaster_secret, SSL_SECRET_SIZE, buf, 77, ssl->dc->master_secret,
-            SSL_SECRET_SIZE);
+    prf(ssl, premaster_secret, SSL_SECRET_SIZE, buf, 77,
+            ssl->dc->master_secret, SSL_SECRET_SIZE);
 }
 
 /**
  * Generate a 'random' blob of data used for the generation of keys.
  */
-static void ICACHE_FLASH_ATTR generate_key_block(uint8_t *client_random, uint8_t *server_random,
-        uint8_t *master_secret, uint8_t *key_block, int key_block_size)
+static void ICACHE_FLASH_ATTR generate_key_block(SSL *ssl, uint8_t *client_random,
+        uint8_t *server_random, uint8_t *master_secret, uint8_t *key_block,
+        int key_block_size)
 {
     uint8_t buf[128];
     os_strcpy((char *)buf, "key expansion");
     os_memcpy(&buf[13], server_random, SSL_RANDOM_SIZE);
     os_memcpy(&buf[45], client_random, SSL_RANDOM_SIZE);
-    prf(master_secret, SSL_SECRET_SIZE, buf, 77, key_block, key_block_size);
+    prf(ssl, master_secret, SSL_SECRET_SIZE, buf, 77, key_block,
+            key_block_size);
 }
 
 /** 
  * Calculate the digest used in the finished message. This function also
- * doubles up as a certificate verify function.
+ * doubles up as a certificate verify function, where the digest is the
+ * MD5 and SHA1 of the handshake, or from TLS 1.2 its SHA256.
  */
 void ICACHE_FLASH_ATTR finished_digest(SSL *ssl, const char *label, uint8_t *digest)
 {
     uint8_t mac_buf[128]; 
     uint8_t *q = mac_buf;
-    MD5_CTX md5_ctx = ssl->dc->md5_ctx;
-    SHA1_CTX sha1_ctx = ssl->dc->sha1_ctx;
 
     if (label)
     {
@@ -915,20 +1042,32 @@ void ICACHE_FLASH_ATTR finished_digest(SSL *ssl, const char *label, uint8_t *dig
         q += os_strlen(label);
     }
 
-    MD5_Final(q, &md5_ctx);
-    q += MD5_SIZE;
+    if (ssl->version >= SSL_PROTOCOL_VERSION1_2)
+    {
+        SHA256_CTX sha256_ctx = ssl->dc->sha256_ctx;
+        SHA256_Final(q, &sha256_ctx);
+        q += SHA256_SIZE;
+    }
+    else
+    {
+        MD5_CTX md5_ctx = ssl->dc->md5_ctx;
+        SHA1_CTX sha1_ctx = ssl->dc->sha1_ctx;
+
+        MD5_Final(q, &md5_ctx);
+        q += MD5_SIZE;
     
-    SHA1_Final(q, &sha1_ctx);
-    q += SHA1_SIZE;
+        SHA1_Final(q, &sha1_ctx);
+        q += SHA1_SIZE;
+    }
 
     if (label)
     {
-        prf(ssl->dc->master_secret, SSL_SECRET_SIZE, mac_buf, (int)(q-mac_buf),
-            digest, SSL_FINISHED_HASH_SIZE);
+        prf(ssl, ssl->dc->master_secret, SSL_SECRET_SIZE, mac_buf,
+            (int)(q-mac_buf), digest, SSL_FINISHED_HASH_SIZE);
     }
     else    /* for use in a certificate verify */
     {
-        os_memcpy(digest, mac_buf, MD5_SIZE + SHA1_SIZE);
+        os_memcpy(digest, mac_buf, q-mac_buf);
     }
 
 #if 0
@@ -973,6 +1112,14 @@ static void *ICACHE_FLASH_ATTR crypt_new(SSL *ssl, uint8_t *key, uint8_t *iv, in
                 return (void *)aes_ctx;
             }
 
+        case SSL_AES128_GCM_SHA256:
+            {
+                AEAD_CTX *aead_ctx = (AEAD_CTX *)os_malloc(sizeof(AEAD_CTX));
+                AES_gcm_set_key(&aead_ctx->gcm, key, AES_MODE_128);
+                os_memcpy(aead_ctx->salt, iv, sizeof(aead_ctx->salt));
+                return (void *)aead_ctx;
+            }
+
         case SSL_RC4_128_MD5:
 #endif
         case SSL_RC4_128_SHA:
@@ -986,6 +1133,64 @@ static void *ICACHE_FLASH_ATTR crypt_new(SSL *ssl, uint8_t *key, uint8_t *iv, in
     return NULL;    /* its all gone wrong */
 }
 
+#ifndef CONFIG_SSL_SKELETON_MODE
+/**
+ * Seal the length bytes of a record of an AEAD suite in place (RFC 5288):
+ * the sequence number goes in front of them as the explicit part of the
+ * nonce, and the tag after them. The additional data is the sequence number
+ * and the record header, with the length of the plaintext.
+ */
+static int ICACHE_FLASH_ATTR aead_encrypt(SSL *ssl, const uint8_t *hmac_header,
+        int length)
+{
+    AEAD_CTX *aead_ctx = (AEAD_CTX *)ssl->encrypt_ctx;
+    uint8_t *buf = ssl->bm_data;
+    uint8_t aad[8+SSL_RECORD_SIZE], nonce[AES_GCM_IV_SIZE];
+
+    os_memcpy(aad, ssl->write_sequence, 8);
+    os_memcpy(&aad[8], hmac_header, SSL_RECORD_SIZE);
+    os_memcpy(nonce, aead_ctx->salt, sizeof(aead_ctx->salt));
+    os_memcpy(&nonce[sizeof(aead_ctx->salt)], ssl->write_sequence,
+            AEAD_EXPLICIT_IV_SIZE);
+
+    os_memmove(&buf[AEAD_EXPLICIT_IV_SIZE], buf, length);
+    os_memcpy(buf, ssl->write_sequence, AEAD_EXPLICIT_IV_SIZE);
+    buf += AEAD_EXPLICIT_IV_SIZE;
+    AES_gcm_encrypt(&aead_ctx->gcm, nonce, aad, sizeof(aad), buf, buf,
+            length, &buf[length]);
+    return AEAD_EXPLICIT_IV_SIZE + length + ssl->cipher_info->digest_size;
+}
+
+/**
+ * Open a record of an AEAD suite in place: the plaintext is left after the
+ * explicit nonce, and its length returned, if the tag is right.
+ */
+static int ICACHE_FLASH_ATTR aead_decrypt(SSL *ssl, uint8_t *buf, int read_len)
+{
+    AEAD_CTX *aead_ctx = (AEAD_CTX *)ssl->decrypt_ctx;
+    uint8_t aad[8+SSL_RECORD_SIZE], nonce[AES_GCM_IV_SIZE];
+    int length = read_len - AEAD_EXPLICIT_IV_SIZE - 
+                            ssl->cipher_info->digest_size;
+
+    if (length < 0)
+        return SSL_ERROR_INVALID_HMAC;
+
+    os_memcpy(aad, ssl->read_sequence, 8);
+    os_memcpy(&aad[8], ssl->hmac_header, 3);
+    aad[11] = length >> 8;
+    aad[12] = length & 0xff;
+    os_memcpy(nonce, aead_ctx->salt, sizeof(aead_ctx->salt));
+    os_memcpy(&nonce[sizeof(aead_ctx->salt)], buf, AEAD_EXPLICIT_IV_SIZE);
+
+    buf += AEAD_EXPLICIT_IV_SIZE;
+    if (AES_gcm_decrypt(&aead_ctx->gcm, nonce, aad, sizeof(aad), buf, buf,
+                length, &buf[length]))
+        return SSL_ERROR_INVALID_HMAC;
+
+    return length;
+}
+#endif
+
 /**
  * Send a packet over the socket.
  */
@@ -993,14 +1198,37 @@ static err_t ICACHE_FLASH_ATTR send_raw_packet(SSL *ssl, uint8_t protocol)
 {
     uint8_t *rec_buf = ssl->bm_all_data;
     int pkt_size = SSL_RECORD_SIZE + ssl->bm_index;
+    int frag = ssl->bm_index, records = 1;
     int Length = 0;
+    int i;
     //int ret = SSL_OK;
     err_t Err = ERR_OK;
-    rec_buf[0] = protocol;
-    rec_buf[1] = 0x03;      /* version = 3.1 or higher */
-    rec_buf[2] = ssl->version & 0x0f;
-    rec_buf[3] = ssl->bm_index >> 8;
-    rec_buf[4] = ssl->bm_index & 0xff;
+
+    /* a handshake message longer than the fragment (an RSA key exchange or a
+     * certificate) goes as several records, laid out back to front in place
+     * so that each one has its header in front of it */
+    if (protocol == PT_HANDSHAKE_PROTOCOL && !IS_SET_SSL_FLAG(SSL_TX_ENCRYPTED) &&
+            ssl->bm_index > ssl->max_plain_length)
+    {
+        frag = ssl->max_plain_length;
+        records = (ssl->bm_index + frag - 1) / frag;
+        pkt_size = ssl->bm_index + records * SSL_RECORD_SIZE;
+    }
+
+    for (i = records - 1; i >= 0; i--)
+    {
+        int size = i < records - 1 ? frag : ssl->bm_index - i * frag;
+
+        rec_buf = &ssl->bm_all_data[i * (frag + SSL_RECORD_SIZE)];
+        if (i > 0)
+            os_memmove(&rec_buf[SSL_RECORD_SIZE], &ssl->bm_data[i * frag], size);
+
+        rec_buf[0] = protocol;
+        rec_buf[1] = 0x03;      /* version = 3.1 or higher */
+        rec_buf[2] = ssl->version & 0x0f;
+        rec_buf[3] = size >> 8;
+        rec_buf[4] = size & 0xff;
+    }
     //DISPLAY_BYTES(ssl, "sending %d bytes", ssl->bm_all_data,
     //              pkt_size, pkt_size);
 
@@ -1074,44 +1302,55 @@ int ICACHE_FLASH_ATTR send_packet(SSL *ssl, uint8_t protocol, const uint8_t *in,
             }
         }
 
-        /* add the packet digest */
-        add_hmac_digest(ssl, mode, hmac_header, ssl->bm_data, msg_length, 
-                                                &ssl->bm_data[msg_length]);
-        msg_length += ssl->cipher_info->digest_size;
-
-        /* add padding? */
-        if (ssl->cipher_info->padding_size)
+#ifndef CONFIG_SSL_SKELETON_MODE
+        /* encrypt and authenticate in one pass */
+        if (IS_AEAD_CIPHER(ssl->cipher_info->cipher))
+        {
+            msg_length = aead_encrypt(ssl, hmac_header, msg_length);
+            increment_write_sequence(ssl);
+        }
+        else
+#endif
         {
-            int last_blk_size = msg_length%ssl->cipher_info->padding_size;
-            int pad_bytes = ssl->cipher_info->padding_size - last_blk_size;
+            /* add the packet digest */
+            add_hmac_digest(ssl, mode, hmac_header, ssl->bm_data, msg_length, 
+                                                    &ssl->bm_data[msg_length]);
+            msg_length += ssl->cipher_info->digest_size;
 
-            /* ensure we always have at least 1 padding byte */
-            if (pad_bytes == 0)
-                pad_bytes += ssl->cipher_info->padding_size;
+            /* add padding? */
+            if (ssl->cipher_info->padding_size)
+            {
+                int last_blk_size = msg_length%ssl->cipher_info->padding_size;
+                int pad_bytes = ssl->cipher_info->padding_size - last_blk_size;
 
-            os_memset(&ssl->bm_data[msg_length], pad_bytes-1, pad_bytes);
-            msg_length += pad_bytes;
-        }
+                /* ensure we always have at least 1 padding byte */
+                if (pad_bytes == 0)
+                    pad_bytes += ssl->cipher_info->padding_size;
 
-        //DISPLAY_BYTES(ssl, "unencrypted write", ssl->bm_data, msg_length);
-        increment_write_sequence(ssl);
+                os_memset(&ssl->bm_data[msg_length], pad_bytes-1, pad_bytes);
+                msg_length += pad_bytes;
+            }
 
-        /* add the explicit IV for TLS1.1 */
-        if (ssl->version >= SSL_PROTOCOL_VERSION1_1 &&
-                        ssl->cipher_info->iv_size)
-        {
-            uint8_t iv_size = ssl->cipher_info->iv_size;
-            uint8_t *t_buf = (uint8_t *)os_malloc(msg_length + iv_size);
-            os_memcpy(t_buf + iv_size, ssl->bm_data, msg_length);
-            get_random(iv_size, t_buf);
-            msg_length += iv_size;
-            os_memcpy(ssl->bm_data, t_buf, msg_length);
-            os_free(t_buf); /* add by wujg */
-        }
+            //DISPLAY_BYTES(ssl, "unencrypted write", ssl->bm_data, msg_length);
+            increment_write_sequence(ssl);
 
-        /* now encrypt the packet */
-        ssl->cipher_info->encrypt(ssl->encrypt_ctx, ssl->bm_data, 
-                                            ssl->bm_data, msg_length);
+            /* add the explicit IV for TLS1.1 */
+            if (ssl->version >= SSL_PROTOCOL_VERSION1_1 &&
+                            ssl->cipher_info->iv_size)
+            {
+                uint8_t iv_size = ssl->cipher_info->iv_size;
+                uint8_t *t_buf = (uint8_t *)os_malloc(msg_length + iv_size);
+                os_memcpy(t_buf + iv_size, ssl->bm_data, msg_length);
+                get_random(iv_size, t_buf);
+                msg_length += iv_size;
+                os_memcpy(ssl->bm_data, t_buf, msg_length);
+                os_free(t_buf); /* add by wujg */
+            }
+
+            /* now encrypt the packet */
+            ssl->cipher_info->encrypt(ssl->encrypt_ctx, ssl->bm_data, 
+                                                ssl->bm_data, msg_length);
+        }
     }
     else if (protocol == PT_HANDSHAKE_PROTOCOL)
     {
@@ -1137,6 +1376,7 @@ int ICACHE_FLASH_ATTR send_packet(SSL *ssl, uint8_t protocol, const uint8_t *in,
 static int ICACHE_FLASH_ATTR set_key_block(SSL *ssl, int is_write)
 {
     const cipher_info_t *ciph_info = get_cipher_info(ssl->cipher);
+    int mac_size;                           /* none for an AEAD suite */
     uint8_t *q;
     uint8_t client_key[32], server_key[32]; /* big enough for AES256 */
     uint8_t client_iv[16], server_iv[16];   /* big enough for AES128/256 */
@@ -1145,6 +1385,8 @@ static int ICACHE_FLASH_ATTR set_key_block(SSL *ssl, int is_write)
     if (ciph_info == NULL)
         return -1;
 
+    mac_size = ciph_info->hmac ? ciph_info->digest_size : 0;
+
     /* only do once in a handshake */
     if (ssl->dc->key_block == NULL)
     {
@@ -1155,7 +1397,7 @@ static int ICACHE_FLASH_ATTR set_key_block(SSL *ssl, int is_write)
         print_blob("server", ssl->dc->server_random, 32);
         print_blob("master", ssl->dc->master_secret, SSL_SECRET_SIZE);
 #endif
-        generate_key_block(ssl->dc->client_random, ssl->dc->server_random,
+        generate_key_block(ssl, ssl->dc->client_random, ssl->dc->server_random,
             ssl->dc->master_secret, ssl->dc->key_block, 
             ciph_info->key_block_size);
 #if 0
@@ -1167,17 +1409,17 @@ static int ICACHE_FLASH_ATTR set_key_block(SSL *ssl, int is_write)
 
     if ((is_client && is_write) || (!is_client && !is_write))
     {
-        os_memcpy(ssl->client_mac, q, ciph_info->digest_size);
+        os_memcpy(ssl->client_mac, q, mac_size);
     }
 
-    q += ciph_info->digest_size;
+    q += mac_size;
 
     if ((!is_client && is_write) || (is_client && !is_write))
     {
-        os_memcpy(ssl->server_mac, q, ciph_info->digest_size);
+        os_memcpy(ssl->server_mac, q, mac_size);
     }
 
-    q += ciph_info->digest_size;
+    q += mac_size;
     os_memcpy(client_key, q, ciph_info->key_size);
     q += ciph_info->key_size;
     os_memcpy(server_key, q, ciph_info->key_size);
@@ -1231,13 +1473,16 @@ int ret = SSL_OK;
 	uint8_t *read_buf = NULL;
 	uint8_t *pread_buf = NULL;
 	u16_t recvlength = 0;
-	read_buf =(uint8_t*)os_zalloc(ssl->ssl_pbuf->len + 1);
+	u16_t offset = ssl->pbuf_offset;	/* past the records already read */
+	ssl->pbuf_offset = 0;
+	read_buf =(uint8_t*)os_zalloc(ssl->ssl_pbuf->len - offset + 1);
 	pread_buf = read_buf;
 	if (pread_buf != NULL){
-		recvlength = pbuf_copy_partial(ssl->ssl_pbuf, read_buf,ssl->ssl_pbuf->len,0);
+		recvlength = pbuf_copy_partial(ssl->ssl_pbuf, read_buf,ssl->ssl_pbuf->len - offset,offset);
 	}
 	if (recvlength != 0){
 		do{	
+			buf = ssl->bm_data;		/* it moves when it is resized */
 //			ssl_printf("basic_read ssl->bm_read_index %d\n", ssl->bm_read_index);
 //			ssl_printf("basic_read ssl->need_bytes %d\n", ssl->need_bytes);
 //			ssl_printf("basic_read ssl->got_bytes %d\n", ssl->got_bytes);
@@ -1293,10 +1538,10 @@ int ret = SSL_OK;
             /* should be v3.1 (TLSv1) or better  */
             ssl->version = ssl->client_version = version;
 
-            if (version > SSL_PROTOCOL_VERSION_MAX)
+            if (version > SSL_PROTOCOL_SVR_VERSION_MAX)
             {
                 /* use client's version */
-                ssl->version = SSL_PROTOCOL_VERSION_MAX;
+                ssl->version = SSL_PROTOCOL_SVR_VERSION_MAX;
             }
             else if (version < SSL_PROTOCOL_MIN_VERSION)  
             {
@@ -1317,12 +1562,19 @@ int ret = SSL_OK;
         ssl->need_bytes = (buf[3] << 8) + buf[4];
 
         /* do we violate the spec with the message size?  */
-        if (ssl->need_bytes > RT_MAX_PLAIN_LENGTH+RT_EXTRA-BM_RECORD_OFFSET)
+        if (ssl->need_bytes > ssl->bm_size-BM_RECORD_OFFSET)
         {
-            ret = SSL_ERROR_INVALID_PROT_MSG;
-            recvlength = 0;
-            os_printf("we violate the spec with the message size\n");
-            goto error;
+            /* the records up to the server hello, which says whether the
+             * server takes a smaller fragment, can be of the default size */
+            if (ssl->next_state != HS_SERVER_HELLO ||
+                ssl->need_bytes > BM_BUFFER_SIZE(RT_MAX_PLAIN_LENGTH)-BM_RECORD_OFFSET ||
+                bm_resize(ssl, BM_BUFFER_SIZE(RT_MAX_PLAIN_LENGTH)) != SSL_OK)
+            {
+                ret = SSL_ERROR_INVALID_PROT_MSG;
+                recvlength = 0;
+                os_printf("we violate the spec with the message size\n");
+                goto error;
+            }
         }
 
         CLR_SSL_FLAG(SSL_NEED_RECORD);
@@ -1338,17 +1590,27 @@ int ret = SSL_OK;
     /* decrypt if we need to */
     if (IS_SET_SSL_FLAG(SSL_RX_ENCRYPTED))
     {
-        ssl->cipher_info->decrypt(ssl->decrypt_ctx, buf, buf, read_len);
-
-        if (ssl->version >= SSL_PROTOCOL_VERSION1_1 &&
-                        ssl->cipher_info->iv_size)
+#ifndef CONFIG_SSL_SKELETON_MODE
+        if (IS_AEAD_CIPHER(ssl->cipher_info->cipher))
         {
-            buf += ssl->cipher_info->iv_size;
-            read_len -= ssl->cipher_info->iv_size;
+            read_len = aead_decrypt(ssl, buf, read_len);
+            buf += AEAD_EXPLICIT_IV_SIZE;
         }
+        else
+#endif
+        {
+            ssl->cipher_info->decrypt(ssl->decrypt_ctx, buf, buf, read_len);
 
-        read_len = verify_digest(ssl, 
-                is_client ? SSL_CLIENT_READ : SSL_SERVER_READ, buf, read_len);
+            if (ssl->version >= SSL_PROTOCOL_VERSION1_1 &&
+                            ssl->cipher_info->iv_size)
+            {
+                buf += ssl->cipher_info->iv_size;
+                read_len -= ssl->cipher_info->iv_size;
+            }
+
+            read_len = verify_digest(ssl, 
+                    is_client ? SSL_CLIENT_READ : SSL_SERVER_READ, buf, read_len);
+        }
 
         /* does the hmac work? */
         if (read_len < 0)
@@ -1368,8 +1630,7 @@ int ret = SSL_OK;
         case PT_HANDSHAKE_PROTOCOL:
             if (ssl->dc != NULL)
             {
-                ssl->dc->bm_proc_index = 0;
-                ret = do_handshake(ssl, buf, read_len);
+                ret = handshake_record(ssl, buf - ssl->bm_data, read_len);
             }
             else /* no client renegotiation allowed */
             {
@@ -1404,6 +1665,10 @@ int ret = SSL_OK;
             }
 
             ret = read_len;
+            /* a pbuf has several records of small fragments: the rest is
+             * for the next call */
+            if (recvlength != 0 && in_data)
+                ssl->pbuf_offset = ssl->ssl_pbuf->len - recvlength;
 			recvlength = 0;
             break;
 
@@ -1443,6 +1708,101 @@ error:
 	return ret;
 }
 
+/**
+ * Hand the messages of a handshake record to do_handshake one at a time. On
+ * the client, a message that runs on past the end of the record, as a
+ * certificate chain cut into small fragments does, is gathered in the
+ * disposable context until the records after it have brought the rest.
+ */
+static int ICACHE_FLASH_ATTR handshake_record(SSL *ssl, int offset, int read_len)
+{
+    int ret = SSL_OK;
+
+    while (read_len > 0 && ret == SSL_OK && ssl->dc)
+    {
+        DISPOSABLE_CTX *dc = ssl->dc;
+        uint8_t *buf = &ssl->bm_data[offset];
+        int n, hs_len = 0;
+
+        if (read_len >= SSL_HS_HDR_SIZE)
+            hs_len = SSL_HS_HDR_SIZE + (buf[2] << 8) + buf[3];
+
+        if (dc->hs_got == 0 && hs_len && hs_len <= read_len && buf[1] == 0)
+        {
+            /* a whole message, where it is */
+            dc->bm_proc_index = offset;
+            ret = do_handshake(ssl, buf, hs_len);
+            offset += hs_len;
+            read_len -= hs_len;
+        }
+        else if (!IS_SET_SSL_FLAG(SSL_IS_CLIENT))
+        {
+            ret = SSL_ERROR_INVALID_HANDSHAKE;
+        }
+        else
+        {
+            if (dc->hs_got < SSL_HS_HDR_SIZE)
+            {
+                n = SSL_HS_HDR_SIZE - dc->hs_got;
+                if (n > read_len)
+                    n = read_len;
+
+                os_memcpy(&dc->hs_hdr[dc->hs_got], buf, n);
+                dc->hs_got += n;
+                offset += n;
+                read_len -= n;
+                buf += n;
+
+                if (dc->hs_got < SSL_HS_HDR_SIZE)
+                    break;
+
+                if (dc->hs_hdr[1] != 0)  /* no messages of 64kB and more */
+                {
+                    ret = SSL_ERROR_INVALID_HANDSHAKE;
+                    break;
+                }
+
+                dc->hs_buf = (uint8_t *)os_malloc(SSL_HS_HDR_SIZE +
+                                (dc->hs_hdr[2] << 8) + dc->hs_hdr[3]);
+                if (dc->hs_buf == NULL)
+                {
+                    ret = SSL_NOT_OK;
+                    break;
+                }
+
+                os_memcpy(dc->hs_buf, dc->hs_hdr, SSL_HS_HDR_SIZE);
+            }
+
+            hs_len = SSL_HS_HDR_SIZE + (dc->hs_hdr[2] << 8) + dc->hs_hdr[3];
+            n = hs_len - dc->hs_got;
+            if (n > read_len)
+                n = read_len;
+
+            os_memcpy(&dc->hs_buf[dc->hs_got], buf, n);
+            dc->hs_got += n;
+            offset += n;
+            read_len -= n;
+
+            if (dc->hs_got == hs_len)
+            {
+                /* the finished message frees the context */
+                uint8_t *msg = dc->hs_buf;
+                dc->hs_buf = NULL;
+                dc->hs_got = 0;
+                ret = do_handshake(ssl, msg, hs_len);
+                os_free(msg);
+            }
+        }
+
+        /* the server hello may have turned the smaller fragment down */
+        if (ret == SSL_OK &&
+                ssl->bm_size < BM_BUFFER_SIZE(ssl->max_plain_length))
+            ret = bm_resize(ssl, BM_BUFFER_SIZE(ssl->max_plain_length));
+    }
+
+    return ret;
+}
+
 /**
  * Do some basic checking of data and then perform the appropriate handshaking.
  */
@@ -1682,6 +2042,7 @@ void ICACHE_FLASH_ATTR disposable_new(SSL *ssl)
         ssl->dc = (DISPOSABLE_CTX *)os_zalloc(sizeof(DISPOSABLE_CTX));
         MD5_Init(&ssl->dc->md5_ctx);
         SHA1_Init(&ssl->dc->sha1_ctx);
+        SHA256_Init(&ssl->dc->sha256_ctx);
     }
 }
 
@@ -1693,6 +2054,7 @@ void ICACHE_FLASH_ATTR disposable_free(SSL *ssl)
     if (ssl->dc)
     {
         os_free(ssl->dc->key_block);
+        os_free(ssl->dc->hs_buf);
         os_memset(ssl->dc, 0, sizeof(DISPOSABLE_CTX));
         os_free(ssl->dc);
         ssl->dc = NULL;
@@ -1898,11 +2260,9 @@ EXP_FUNC int STDCALL ICACHE_FLASH_ATTR ssl_verify_cert(const SSL *ssl)
 /**
  * Process a certificate message.
  */
-int ICACHE_FLASH_ATTR process_certificate(SSL *ssl, X509_CTX **x509_ctx)
+int ICACHE_FLASH_ATTR process_certificate(SSL *ssl, X509_CTX **x509_ctx, uint8_t *buf, int pkt_size)
 {
     int ret = SSL_OK;
-    uint8_t *buf = &ssl->bm_data[ssl->dc->bm_proc_index];
-    int pkt_size = ssl->bm_index;
     int cert_size, offset = 5;
     int total_cert_size = (buf[offset]<<8) + buf[offset+1];
     int is_client = IS_SET_SSL_FLAG(SSL_IS_CLIENT);
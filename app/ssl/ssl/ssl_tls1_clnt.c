@@ -40,11 +40,12 @@
 #ifdef CONFIG_SSL_ENABLE_CLIENT        /* all commented out if no client */
 
 static int send_client_hello(SSL *ssl);
-static int process_server_hello(SSL *ssl);
+static int process_server_hello(SSL *ssl, uint8_t *buf, int pkt_size);
 static int process_server_hello_done(SSL *ssl);
 static int send_client_key_xchg(SSL *ssl);
-static int process_cert_req(SSL *ssl);
+static int process_cert_req(SSL *ssl, uint8_t *buf, int pkt_size);
 static int send_cert_verify(SSL *ssl);
+static uint8_t max_fragment_code(int length);
 
 #if 0
 /*
@@ -82,6 +83,9 @@ EXP_FUNC SSL *STDCALL ICACHE_FLASH_ATTR SSLClient_new(SSL_CTX *ssl_ctx, struct t
         uint8_t *session_id, uint8_t sess_id_size)
 {	
     SSL *ssl = ssl_new_context(ssl_ctx, SslClient_pcb);
+    if (ssl == NULL)
+        return NULL;
+
     ssl->version = SSL_PROTOCOL_VERSION_MAX;
     if (session_id && ssl_ctx->num_sessions) {
         if (sess_id_size > SSL_SESSION_ID_SIZE) {
@@ -96,6 +100,48 @@ EXP_FUNC SSL *STDCALL ICACHE_FLASH_ATTR SSLClient_new(SSL_CTX *ssl_ctx, struct t
     do_client_connect(ssl);
     return ssl;
 }
+
+/*
+ * Establish a new SSL connection that offers a kept session. The session goes
+ * in the cache of the context, where the server hello looks for its id.
+ */
+EXP_FUNC SSL *STDCALL ICACHE_FLASH_ATTR SSLClient_resume(SSL_CTX *ssl_ctx, struct tcp_pcb *SslClient_pcb,
+        const SSL_CLIENT_SESSION *sess)
+{
+    SSL_SESSION *session;
+
+    if (sess == NULL || sess->sess_id_size == 0 ||
+            sess->sess_id_size > SSL_SESSION_ID_SIZE || ssl_ctx->num_sessions == 0)
+        return SSLClient_new(ssl_ctx, SslClient_pcb, NULL, 0);
+
+    if (ssl_ctx->ssl_sessions[0] == NULL)
+        ssl_ctx->ssl_sessions[0] = (SSL_SESSION *)os_zalloc(sizeof(SSL_SESSION));
+
+    if ((session = ssl_ctx->ssl_sessions[0]) == NULL)
+        return SSLClient_new(ssl_ctx, SslClient_pcb, NULL, 0);
+
+    os_memset(session, 0, sizeof(SSL_SESSION));
+    os_memcpy(session->session_id, sess->session_id, sess->sess_id_size);
+    os_memcpy(session->master_secret, sess->master_secret, SSL_SECRET_SIZE);
+    return SSLClient_new(ssl_ctx, SslClient_pcb,
+            sess->session_id, sess->sess_id_size);
+}
+
+/*
+ * Get the session of a connection, to offer it on a later one.
+ */
+EXP_FUNC int STDCALL ICACHE_FLASH_ATTR ssl_get_client_session(const SSL *ssl, SSL_CLIENT_SESSION *sess)
+{
+    if (ssl->hs_status != SSL_OK || ssl->session == NULL ||
+            ssl->sess_id_size == 0)
+        return SSL_ERROR_INVALID_SESSION;
+
+    sess->sess_id_size = ssl->sess_id_size;
+    os_memcpy(sess->session_id, ssl->session_id, SSL_SESSION_ID_SIZE);
+    os_memcpy(sess->master_secret, ssl->session->master_secret, SSL_SECRET_SIZE);
+    return SSL_OK;
+}
+
 /*
  * Process the handshake record.
  */
@@ -108,11 +154,11 @@ int ICACHE_FLASH_ATTR do_clnt_handshake(SSL *ssl, int handshake_type, uint8_t *b
     switch (handshake_type)
     {
         case HS_SERVER_HELLO:
-            ret = process_server_hello(ssl);
+            ret = process_server_hello(ssl, buf, hs_len);
             break;
 
         case HS_CERTIFICATE:
-            ret = process_certificate(ssl, &ssl->x509_ctx);
+            ret = process_certificate(ssl, &ssl->x509_ctx, buf, hs_len);
             break;
 
         case HS_SERVER_HELLO_DONE:
@@ -140,7 +186,7 @@ int ICACHE_FLASH_ATTR do_clnt_handshake(SSL *ssl, int handshake_type, uint8_t *b
             break;
 
         case HS_CERT_REQ:
-            ret = process_cert_req(ssl);
+            ret = process_cert_req(ssl, buf, hs_len);
             break;
 
         case HS_FINISHED:
@@ -191,6 +237,19 @@ int ICACHE_FLASH_ATTR do_client_connect(SSL *ssl)
     return ret;
 }
 
+/*
+ * The RFC 6066 code of a fragment length: 1 for 512 bytes up to 4 for 4096.
+ */
+static uint8_t ICACHE_FLASH_ATTR max_fragment_code(int length)
+{
+    uint8_t code = 1;
+
+    while ((RT_MIN_PLAIN_LENGTH << (code - 1)) < length)
+        code++;
+
+    return code;
+}
+
 /*
  * Send the initial client hello.
  */
@@ -207,6 +266,7 @@ static int ICACHE_FLASH_ATTR send_client_hello(SSL *ssl)
     /* byte 3 is calculated later */
     buf[4] = 0x03;
     buf[5] = ssl->version & 0x0f;
+    ssl->client_version = ssl->version;     /* for the premaster secret */
 
     /* client random value - spec says that 1st 4 bytes are big endian time */
     *tm_ptr++ = (uint8_t)(((long)tm & 0xff000000) >> 24);
@@ -243,6 +303,19 @@ static int ICACHE_FLASH_ATTR send_client_hello(SSL *ssl)
 
     buf[offset++] = 1;              /* no compression */
     buf[offset++] = 0;
+
+    if (ssl->ssl_ctx->max_plain_length)
+    {
+        /* ask for a smaller fragment (RFC 6066) */
+        buf[offset++] = 0;          /* extensions length */
+        buf[offset++] = 5;
+        buf[offset++] = 0;
+        buf[offset++] = SSL_EXT_MAX_FRAGMENT_LENGTH;
+        buf[offset++] = 0;          /* extension length */
+        buf[offset++] = 1;
+        buf[offset++] = max_fragment_code(ssl->ssl_ctx->max_plain_length);
+    }
+
     buf[3] = offset - 4;            /* handshake size */
 
     return send_packet(ssl, PT_HANDSHAKE_PROTOCOL, NULL, offset);
@@ -251,10 +324,8 @@ static int ICACHE_FLASH_ATTR send_client_hello(SSL *ssl)
 /*
  * Process the server hello.
  */
-static int ICACHE_FLASH_ATTR process_server_hello(SSL *ssl)
+static int ICACHE_FLASH_ATTR process_server_hello(SSL *ssl, uint8_t *buf, int pkt_size)
 {
-    uint8_t *buf = ssl->bm_data;
-    int pkt_size = ssl->bm_index;
     int num_sessions = ssl->ssl_ctx->num_sessions;
     uint8_t sess_id_size;
     int offset, ret = SSL_OK;
@@ -287,16 +358,14 @@ static int ICACHE_FLASH_ATTR process_server_hello(SSL *ssl)
 
     if (num_sessions)
     {
-        ssl->session = ssl_session_update(num_sessions,
-                ssl->ssl_ctx->ssl_sessions, ssl, &buf[offset]);
-        os_memcpy(ssl->session->session_id, &buf[offset], sess_id_size);
+        /* the cache has the ids padded with 0's */
+        uint8_t session_id[SSL_SESSION_ID_SIZE];
+        os_memset(session_id, 0, SSL_SESSION_ID_SIZE);
+        os_memcpy(session_id, &buf[offset], sess_id_size);
 
-        /* pad the rest with 0's */
-        if (sess_id_size < SSL_SESSION_ID_SIZE)
-        {
-            os_memset(&ssl->session->session_id[sess_id_size], 0,
-                SSL_SESSION_ID_SIZE-sess_id_size);
-        }
+        ssl->session = ssl_session_update(num_sessions,
+                ssl->ssl_ctx->ssl_sessions, ssl, session_id);
+        os_memcpy(ssl->session->session_id, session_id, SSL_SESSION_ID_SIZE);
     }
 
     os_memcpy(ssl->session_id, &buf[offset], sess_id_size);
@@ -305,12 +374,54 @@ static int ICACHE_FLASH_ATTR process_server_hello(SSL *ssl)
 
     /* get the real cipher we are using */
     ssl->cipher = buf[++offset];
+
+    /* the AEAD suites come with TLS 1.2 */
+    if (IS_AEAD_CIPHER(ssl->cipher) && ssl->version < SSL_PROTOCOL_VERSION1_2)
+    {
+        ret = SSL_ERROR_NO_CIPHER;
+        goto error;
+    }
+
     ssl->next_state = IS_SET_SSL_FLAG(SSL_SESSION_RESUME) ? 
                                         HS_FINISHED : HS_CERTIFICATE;
 
     offset++;   // skip the compr
     PARANOIA_CHECK(pkt_size, offset);
-    ssl->dc->bm_proc_index = offset+1; 
+    offset++;
+
+    /* a fragment length asked for holds only if the server says it back */
+    ssl->max_plain_length = RT_MAX_PLAIN_LENGTH;
+    if (ssl->ssl_ctx->max_plain_length && pkt_size >= offset + 2)
+    {
+        int ext_end = offset + 2 + (buf[offset] << 8) + buf[offset+1];
+        offset += 2;
+        PARANOIA_CHECK(pkt_size, ext_end);
+
+        while (offset + 4 <= ext_end)
+        {
+            int ext_type = (buf[offset] << 8) + buf[offset+1];
+            int ext_len = (buf[offset+2] << 8) + buf[offset+3];
+            offset += 4;
+            PARANOIA_CHECK(ext_end, offset + ext_len);
+
+            if (ext_type == SSL_EXT_MAX_FRAGMENT_LENGTH)
+            {
+                /* anything but what we asked for is an error */
+                if (ext_len != 1 || buf[offset] !=
+                        max_fragment_code(ssl->ssl_ctx->max_plain_length))
+                {
+                    ret = SSL_ERROR_INVALID_HANDSHAKE;
+                    goto error;
+                }
+
+                ssl->max_plain_length = ssl->ssl_ctx->max_plain_length;
+            }
+
+            offset += ext_len;
+        }
+    }
+
+    ssl->dc->bm_proc_index += pkt_size;
 
 error:
     return ret;
@@ -338,7 +449,7 @@ static int ICACHE_FLASH_ATTR send_client_key_xchg(SSL *ssl)
     buf[1] = 0;
 
     premaster_secret[0] = 0x03; /* encode the version number */
-    premaster_secret[1] = SSL_PROTOCOL_MINOR_VERSION; /* must be TLS 1.1 */
+    premaster_secret[1] = ssl->client_version & 0x0f; /* the one offered */
     get_random(SSL_SECRET_SIZE-2, &premaster_secret[2]);
     //DISPLAY_RSA(ssl, ssl->x509_ctx->rsa_ctx);
 
@@ -360,12 +471,10 @@ static int ICACHE_FLASH_ATTR send_client_key_xchg(SSL *ssl)
 /*
  * Process the certificate request.
  */
-static int ICACHE_FLASH_ATTR process_cert_req(SSL *ssl)
+static int ICACHE_FLASH_ATTR process_cert_req(SSL *ssl, uint8_t *buf, int pkt_size)
 {
-    uint8_t *buf = &ssl->bm_data[ssl->dc->bm_proc_index];
     int ret = SSL_OK;
     int offset = (buf[2] << 4) + buf[3];
-    int pkt_size = ssl->bm_index;
 
     /* don't do any processing - we will send back an RSA certificate anyway */
     ssl->next_state = HS_SERVER_HELLO_DONE;
@@ -376,28 +485,50 @@ error:
     return ret;
 }
 
+/*
+ * The DER of a DigestInfo of SHA256, up to the digest itself: what a TLS 1.2
+ * signature signs (RFC 5246, 4.7).
+ */
+static const uint8_t sha256_digest_info[] =
+{
+    0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+    0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+};
+
 /*
  * Send a certificate verify message.
  */
 static int ICACHE_FLASH_ATTR send_cert_verify(SSL *ssl)
 {
     uint8_t *buf = ssl->bm_data;
-    uint8_t dgst[MD5_SIZE+SHA1_SIZE];
+    uint8_t dgst[sizeof(sha256_digest_info)+SHA256_SIZE];
     RSA_CTX *rsa_ctx = ssl->ssl_ctx->rsa_ctx;
-    int n = 0, ret;
+    int n = 0, ret, offset = 4, dgst_len = MD5_SIZE+SHA1_SIZE;
 
     //DISPLAY_RSA(ssl, rsa_ctx);
 
     buf[0] = HS_CERT_VERIFY;
     buf[1] = 0;
 
-    finished_digest(ssl, NULL, dgst);   /* calculate the digest */
+    if (ssl->version >= SSL_PROTOCOL_VERSION1_2)
+    {
+        /* the SHA256 of the handshake, signed with RSA */
+        buf[offset++] = 4;
+        buf[offset++] = 1;
+        os_memcpy(dgst, sha256_digest_info, sizeof(sha256_digest_info));
+        finished_digest(ssl, NULL, &dgst[sizeof(sha256_digest_info)]);
+        dgst_len = sizeof(dgst);
+    }
+    else
+    {
+        finished_digest(ssl, NULL, dgst);   /* calculate the digest */
+    }
 
     /* rsa_ctx->bi_ctx is not thread-safe */
     if (rsa_ctx)
     {
         SSL_CTX_LOCK(ssl->ssl_ctx->mutex);
-        n = RSA_encrypt(rsa_ctx, dgst, sizeof(dgst), &buf[6], 1);
+        n = RSA_encrypt(rsa_ctx, dgst, dgst_len, &buf[offset+2], 1);
         SSL_CTX_UNLOCK(ssl->ssl_ctx->mutex);
 
         if (n == 0)
@@ -407,9 +538,9 @@ static int ICACHE_FLASH_ATTR send_cert_verify(SSL *ssl)
         }
     }
     
-    buf[4] = n >> 8;        /* add the RSA size (not officially documented) */
-    buf[5] = n & 0xff;
-    n += 2;
+    buf[offset] = n >> 8;   /* add the RSA size (not officially documented) */
+    buf[offset+1] = n & 0xff;
+    n += offset + 2 - 4;
     buf[2] = n >> 8;
     buf[3] = n & 0xff;
     ret = send_packet(ssl, PT_HANDSHAKE_PROTOCOL, NULL, n+4);
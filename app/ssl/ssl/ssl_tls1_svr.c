@@ -75,6 +75,9 @@ EXP_FUNC SSL *STDCALL ICACHE_FLASH_ATTR sslserver_new(SSL_CTX *ssl_ctx, struct t
 {
     SSL *ssl;
     ssl = ssl_new_context(ssl_ctx, client_pcb);
+    if (ssl == NULL)
+        return NULL;
+
     ssl->next_state = HS_CLIENT_HELLO;
 #ifdef CONFIG_SSL_FULL_MODE
     if (ssl_ctx->chain_length == 0)
@@ -102,7 +105,7 @@ int ICACHE_FLASH_ATTR do_svr_handshake(SSL *ssl, int handshake_type, uint8_t *bu
 
 #ifdef CONFIG_SSL_CERT_VERIFICATION
         case HS_CERTIFICATE:/* the client sends its cert */
-            ret = process_certificate(ssl, &ssl->x509_ctx);
+            ret = process_certificate(ssl, &ssl->x509_ctx, buf, hs_len);
 
             if (ret == SSL_OK)    /* verify the cert */
             { 
@@ -145,10 +148,10 @@ static int ICACHE_FLASH_ATTR process_client_hello(SSL *ssl)
     uint8_t version = (buf[4] << 4) + buf[5];
     ssl->version = ssl->client_version = version;
 
-    if (version > SSL_PROTOCOL_VERSION_MAX)
+    if (version > SSL_PROTOCOL_SVR_VERSION_MAX)
     {
         /* use client's version instead */
-        ssl->version = SSL_PROTOCOL_VERSION_MAX; 
+        ssl->version = SSL_PROTOCOL_SVR_VERSION_MAX; 
     }
     else if (version < SSL_PROTOCOL_MIN_VERSION)  /* old version supported? */
     {
@@ -183,7 +186,8 @@ static int ICACHE_FLASH_ATTR process_client_hello(SSL *ssl)
     {
         for (j = 0; j < NUM_PROTOCOLS; j++)
         {
-            if (ssl_prot_prefs[j] == ((buf[offset+i]<<8) + buf[offset+i+1]))   /* got a match? */
+            if (ssl_prot_prefs[j] == ((buf[offset+i]<<8) + buf[offset+i+1]) &&
+                    !IS_AEAD_CIPHER(ssl_prot_prefs[j]))   /* got a match? */
             {
                 ssl->cipher = ssl_prot_prefs[j];
                 goto do_state;
@@ -233,7 +237,8 @@ int process_sslv23_client_hello(SSL *ssl)
     {
         for (i = 0; i < cs_len; i += 3)
         {
-            if (ssl_prot_prefs[j] == buf[offset+i])
+            if (ssl_prot_prefs[j] == buf[offset+i] &&
+                    !IS_AEAD_CIPHER(ssl_prot_prefs[j]))
             {
                 ssl->cipher = ssl_prot_prefs[j];
                 goto server_hello;
@@ -266,10 +266,12 @@ void ICACHE_FLASH_ATTR x509_free(X509_CTX *x509_ctx)
 
 #ifdef CONFIG_SSL_CERT_VERIFICATION
 /**
- * Take a signature and decrypt it.
+ * Take a signature and decrypt it, in the context of the issuer's key: its
+ * modulus was set, and the constants of the reduction worked out, when the
+ * certificate was loaded, rather than for every signature it checks.
  */
 static bigint *ICACHE_FLASH_ATTR sig_verify(BI_CTX *ctx, const uint8_t *sig, int sig_len,
-        bigint *modulus, bigint *pub_exp)
+        bigint *pub_exp)
 {
     int i, size;
     bigint *decrypted_bi, *dat_bi;
@@ -281,7 +283,7 @@ static bigint *ICACHE_FLASH_ATTR sig_verify(BI_CTX *ctx, const uint8_t *sig, int
     ctx->mod_offset = BIGINT_M_OFFSET;
 
     /* convert to a normal block */
-    decrypted_bi = bi_mod_power2(ctx, dat_bi, modulus, pub_exp);
+    decrypted_bi = bi_mod_power(ctx, dat_bi, pub_exp);
 
     bi_export(ctx, decrypted_bi, block, sig_len);
     ctx->mod_offset = BIGINT_M_OFFSET;
@@ -326,7 +328,7 @@ int ICACHE_FLASH_ATTR x509_verify(const CA_CERT_CTX *ca_cert_ctx, const X509_CTX
     bigint *cert_sig;
     X509_CTX *next_cert = NULL;
     BI_CTX *ctx = NULL;
-    bigint *mod = NULL, *expn = NULL;
+    bigint *expn = NULL;
     int match_ca_cert = 0;
     struct timeval tv;
     uint8_t is_self_signed = 0;
@@ -343,21 +345,22 @@ int ICACHE_FLASH_ATTR x509_verify(const CA_CERT_CTX *ca_cert_ctx, const X509_CTX
     {
         is_self_signed = 1;
         ctx = cert->rsa_ctx->bi_ctx;
-        mod = cert->rsa_ctx->m;
         expn = cert->rsa_ctx->e;
     }
 
 //    gettimeofday(&tv, NULL);
+    /* no clock to check the dates against: tv_sec 0 leaves them unchecked */
+    tv.tv_sec = 0;
 
     /* check the not before date */
-    if (tv.tv_sec < cert->not_before)
+    if (tv.tv_sec && tv.tv_sec < cert->not_before)
     {
         ret = X509_VFY_ERROR_NOT_YET_VALID;
         goto end_verify;
     }
 
     /* check the not after date */
-    if (tv.tv_sec > cert->not_after)
+    if (tv.tv_sec && tv.tv_sec > cert->not_after)
     {
         ret = X509_VFY_ERROR_EXPIRED;
         goto end_verify;
@@ -379,7 +382,6 @@ int ICACHE_FLASH_ATTR x509_verify(const CA_CERT_CTX *ca_cert_ctx, const X509_CTX
                     /* use this CA certificate for signature verification */
                     match_ca_cert = 1;
                     ctx = ca_cert_ctx->cert[i]->rsa_ctx->bi_ctx;
-                    mod = ca_cert_ctx->cert[i]->rsa_ctx->m;
                     expn = ca_cert_ctx->cert[i]->rsa_ctx->e;
                     break;
                 }
@@ -405,7 +407,6 @@ int ICACHE_FLASH_ATTR x509_verify(const CA_CERT_CTX *ca_cert_ctx, const X509_CTX
     else /* use the next certificate in the chain for signature verify */
     {
         ctx = next_cert->rsa_ctx->bi_ctx;
-        mod = next_cert->rsa_ctx->m;
         expn = next_cert->rsa_ctx->e;
     }
 
@@ -418,7 +419,7 @@ int ICACHE_FLASH_ATTR x509_verify(const CA_CERT_CTX *ca_cert_ctx, const X509_CTX
 
     /* check the signature */
     cert_sig = sig_verify(ctx, cert->signature, cert->sig_len, 
-                        bi_clone(ctx, mod), bi_clone(ctx, expn));
+                        bi_clone(ctx, expn));
 
     if (cert_sig && cert->digest)
     {